@@ -1,6 +1,12 @@
 #ifndef LOGGING_H_
 #define LOGGING_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
 void writelog(const char *format, ...);
+#ifdef __cplusplus
+}
+#endif
 
 #ifdef ENABLE_PNGLOG
 #define PNG_LOG writelog
@@ -0,0 +1,280 @@
+#include "stdafx.h"
+#include "png_chunk_reader.h"
+
+#include <string.h>
+
+#include "logging.h"
+#include "third_party/libpng/png.h"
+#include "third_party/zlib/zlib.h"
+
+namespace {
+
+const unsigned char kPngSignature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+// Same limits libpng applies to every image we hand it (see pnglibconf.h).
+const uint32_t kMaxDimension = PNG_USER_WIDTH_MAX;
+
+uint32_t ReadUint32(const unsigned char* p) {
+  return (static_cast<uint32_t>(p[0]) << 24) |
+    (static_cast<uint32_t>(p[1]) << 16) |
+    (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+uint32_t ChunkType(char a, char b, char c, char d) {
+  return (static_cast<uint32_t>(a) << 24) | (static_cast<uint32_t>(b) << 16) |
+    (static_cast<uint32_t>(c) << 8) | static_cast<uint32_t>(d);
+}
+
+const uint32_t kIHDR = ChunkType('I', 'H', 'D', 'R');
+const uint32_t kPLTE = ChunkType('P', 'L', 'T', 'E');
+const uint32_t kIDAT = ChunkType('I', 'D', 'A', 'T');
+const uint32_t kIEND = ChunkType('I', 'E', 'N', 'D');
+const uint32_t kTRNS = ChunkType('t', 'R', 'N', 'S');
+const uint32_t kGAMA = ChunkType('g', 'A', 'M', 'A');
+const uint32_t kSRGB = ChunkType('s', 'R', 'G', 'B');
+
+// |type_and_data| points at the chunk type, which the CRC covers along with
+// the payload.
+bool CrcMatches(const unsigned char* type_and_data, uint32_t length) {
+  uLong crc = crc32(0L, Z_NULL, 0);
+  crc = crc32(crc, type_and_data, length + 4);
+  return crc == ReadUint32(type_and_data + 4 + length);
+}
+
+}  // namespace
+
+PngChunkReader::PngChunkReader()
+  : idat_size_(0),
+  has_gamma_(false),
+  gamma_(0.0),
+  complete_(false) {
+}
+
+PngChunkReader::~PngChunkReader() {
+}
+
+bool PngChunkReader::Parse(const unsigned char* input, size_t input_size) {
+  if (input_size < sizeof(kPngSignature) ||
+    memcmp(input, kPngSignature, sizeof(kPngSignature)) != 0)
+    return false;
+
+  bool seen_ihdr = false;
+  bool idat_finished = false;
+  size_t pos = sizeof(kPngSignature);
+  while (input_size - pos >= 8) {
+    const uint32_t length = ReadUint32(input + pos);
+    const uint32_t type = ReadUint32(input + pos + 4);
+    if (length > PNG_UINT_31_MAX)
+      return false;
+    if (input_size - pos - 8 < static_cast<size_t>(length) + 4)
+      break;  // Truncated chunk; the rest of the file is missing.
+
+    const unsigned char* type_and_data = input + pos + 4;
+    const unsigned char* data = type_and_data + 4;
+    pos += 12 + static_cast<size_t>(length);
+    chunks_.push_back({ type, { data, length } });
+
+    if (!seen_ihdr) {
+      if (type != kIHDR || !CrcMatches(type_and_data, length) ||
+        !HandleIHDR(data, length))
+        return false;
+      seen_ihdr = true;
+      continue;
+    }
+
+    if (type == kIDAT) {
+      if (idat_finished || !CrcMatches(type_and_data, length))
+        return false;
+      if (header_.color_type == PNG_COLOR_TYPE_PALETTE && palette_.empty())
+        return false;
+      idat_.push_back({ data, length });
+      idat_size_ += length;
+      continue;
+    }
+    if (!idat_.empty())
+      idat_finished = true;
+
+    if (type == kIEND) {
+      complete_ = !idat_.empty();
+      break;
+    }
+
+    if (type == kPLTE) {
+      if (!CrcMatches(type_and_data, length) || !idat_.empty() ||
+        !palette_.empty() || length == 0 || length % 3 != 0 ||
+        length / 3 > PNG_MAX_PALETTE_LENGTH)
+        return false;
+      if (header_.color_type == PNG_COLOR_TYPE_PALETTE &&
+        length / 3 > (1u << header_.bit_depth))
+        return false;
+      palette_.assign(data, data + length);
+    }
+    else if (type == kTRNS) {
+      if (!CrcMatches(type_and_data, length) || !idat_.empty())
+        return false;
+      switch (header_.color_type) {
+      case PNG_COLOR_TYPE_PALETTE:
+        if (palette_.empty() || length == 0 || length > palette_.size() / 3)
+          return false;
+        break;
+      case PNG_COLOR_TYPE_GRAY:
+        if (length != 2)
+          return false;
+        break;
+      case PNG_COLOR_TYPE_RGB:
+        if (length != 6)
+          return false;
+        break;
+      default:
+        // libpng ignores tRNS on images that already carry alpha, with a
+        // warning; leave such oddities to it.
+        return false;
+      }
+      trns_.assign(data, data + length);
+    }
+    else if (type == kGAMA) {
+      if (!CrcMatches(type_and_data, length) || length != 4)
+        return false;
+      has_gamma_ = true;
+      gamma_ = ReadUint32(data) / 100000.0;
+    }
+    else if (type == kSRGB) {
+      if (!CrcMatches(type_and_data, length) || length != 1)
+        return false;
+      if (!has_gamma_) {
+        has_gamma_ = true;
+        gamma_ = 45455 / 100000.0;
+      }
+    }
+    else if (type == kRestartPointsType) {
+      if (!idat_.empty() || !CrcMatches(type_and_data, length))
+        continue;
+      HandleRestartPoints(data, length);
+    }
+    else if ((type & 0x20000000) == 0) {
+      // Unknown critical chunk.
+      PNG_LOG("PngChunkReader: unknown critical chunk %08x\n", type);
+      return false;
+    }
+  }
+
+  return seen_ihdr;
+}
+
+// static
+bool PngChunkReader::PeekHeader(const unsigned char* input, size_t input_size,
+  Header* header) {
+  const size_t kIHDREnd = sizeof(kPngSignature) + 8 + 13;
+  if (input_size < kIHDREnd ||
+    memcmp(input, kPngSignature, sizeof(kPngSignature)) != 0)
+    return false;
+  const unsigned char* chunk = input + sizeof(kPngSignature);
+  if (ReadUint32(chunk + 4) != kIHDR)
+    return false;
+
+  PngChunkReader reader;
+  if (!reader.HandleIHDR(chunk + 8, ReadUint32(chunk)))
+    return false;
+  *header = reader.header_;
+  return true;
+}
+
+// static
+bool PngChunkReader::HasChunkBeforeIDAT(const unsigned char* input,
+  size_t input_size, uint32_t type) {
+  if (input_size < sizeof(kPngSignature) ||
+    memcmp(input, kPngSignature, sizeof(kPngSignature)) != 0)
+    return false;
+  size_t pos = sizeof(kPngSignature);
+  while (input_size - pos >= 12) {
+    const uint32_t length = ReadUint32(input + pos);
+    const uint32_t chunk_type = ReadUint32(input + pos + 4);
+    if (chunk_type == type)
+      return true;
+    if (chunk_type == kIDAT || length > PNG_UINT_31_MAX ||
+      input_size - pos - 12 < length)
+      return false;
+    pos += 12 + static_cast<size_t>(length);
+  }
+  return false;
+}
+
+bool PngChunkReader::HandleIHDR(const unsigned char* data, uint32_t length) {
+  if (length != 13)
+    return false;
+
+  header_.width = ReadUint32(data);
+  header_.height = ReadUint32(data + 4);
+  header_.bit_depth = data[8];
+  header_.color_type = data[9];
+  header_.interlace_type = data[12];
+  if (header_.width == 0 || header_.height == 0 ||
+    header_.width > kMaxDimension || header_.height > kMaxDimension)
+    return false;
+  // Compression and filter method must both be 0.
+  if (data[10] != 0 || data[11] != 0 ||
+    header_.interlace_type > PNG_INTERLACE_ADAM7)
+    return false;
+
+  const int depth = header_.bit_depth;
+  switch (header_.color_type) {
+  case PNG_COLOR_TYPE_GRAY:
+    return depth == 1 || depth == 2 || depth == 4 || depth == 8 ||
+      depth == 16;
+  case PNG_COLOR_TYPE_PALETTE:
+    return depth == 1 || depth == 2 || depth == 4 || depth == 8;
+  case PNG_COLOR_TYPE_RGB:
+  case PNG_COLOR_TYPE_GRAY_ALPHA:
+  case PNG_COLOR_TYPE_RGB_ALPHA:
+    return depth == 8 || depth == 16;
+  default:
+    return false;
+  }
+}
+
+void PngChunkReader::HandleRestartPoints(const unsigned char* data,
+  uint32_t length) {
+  // The chunk is only a hint, so a bad one is ignored rather than failing
+  // the whole file.
+  if (length < 4 || !restart_points_.empty())
+    return;
+  const uint32_t count = ReadUint32(data);
+  if (count == 0 || (length - 4) / 8 != count || (length - 4) % 8 != 0)
+    return;
+
+  std::vector<RestartPoint> points(count);
+  for (uint32_t i = 0; i < count; ++i) {
+    points[i].first_row = ReadUint32(data + 4 + 8 * i);
+    points[i].stream_offset = ReadUint32(data + 8 + 8 * i);
+    if (i == 0 ? points[i].first_row != 0 || points[i].stream_offset != 0 :
+      points[i].first_row <= points[i - 1].first_row ||
+      points[i].stream_offset <= points[i - 1].stream_offset ||
+      points[i].first_row >= header_.height)
+      return;
+  }
+  restart_points_.swap(points);
+}
+
+int PngChunkReader::channels() const {
+  switch (header_.color_type) {
+  case PNG_COLOR_TYPE_GRAY_ALPHA:
+    return 2;
+  case PNG_COLOR_TYPE_RGB:
+    return 3;
+  case PNG_COLOR_TYPE_RGB_ALPHA:
+    return 4;
+  default:
+    return 1;
+  }
+}
+
+size_t PngChunkReader::RowBytes(uint32_t pixels) const {
+  const size_t bits = static_cast<size_t>(pixels) * channels() *
+    header_.bit_depth;
+  return (bits + 7) / 8;
+}
+
+int PngChunkReader::FilterBpp() const {
+  const int bits = channels() * header_.bit_depth;
+  return bits < 8 ? 1 : bits / 8;
+}
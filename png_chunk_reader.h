@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// Walks the chunks of a PNG file that is entirely in memory. Nothing is
+// copied: IDAT payloads are exposed as spans into the caller's buffer so the
+// decode paths that bypass libpng's progressive reader can inflate straight
+// from the file data.
+class PngChunkReader {
+public:
+  struct Header {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    int bit_depth = 0;
+    int color_type = 0;
+    int interlace_type = 0;
+  };
+
+  struct Span {
+    const unsigned char* data;
+    size_t size;
+  };
+
+  struct Chunk {
+    uint32_t type;
+    Span data;
+  };
+
+  // Start of an independently inflatable piece of the IDAT stream, as
+  // recorded in the rsPT chunk. |stream_offset| counts bytes of concatenated
+  // IDAT payload; the first restart point is always row 0 at offset 0, the
+  // start of the zlib stream. Every later one is a byte-aligned deflate block
+  // boundary after a full flush, so the window is empty.
+  struct RestartPoint {
+    uint32_t first_row;
+    uint32_t stream_offset;
+  };
+
+  // Private, ancillary, unsafe-to-copy chunk listing the restart points of
+  // the IDAT stream. It must come before the first IDAT. Payload: a 4-byte
+  // count followed by that many (first_row, stream_offset) pairs, all
+  // big-endian.
+  static const uint32_t kRestartPointsType = 0x72735054;  // "rsPT"
+
+  PngChunkReader();
+  ~PngChunkReader();
+
+  // Parses the signature and every chunk up to and including IEND. Returns
+  // false if the structure is malformed, a chunk we rely on fails its CRC,
+  // or the file uses a critical chunk we do not understand. Truncated files
+  // parse successfully as long as IHDR is intact; check complete().
+  bool Parse(const unsigned char* input, size_t input_size);
+
+  // Reads only the signature and IHDR, for deciding how to decode a file
+  // before paying for a full walk of its chunks.
+  static bool PeekHeader(const unsigned char* input, size_t input_size,
+    Header* header);
+
+  // Scans chunk headers up to the first IDAT for one of |type|, without
+  // checking CRCs.
+  static bool HasChunkBeforeIDAT(const unsigned char* input,
+    size_t input_size, uint32_t type);
+
+  const Header& header() const { return header_; }
+
+  // IDAT payloads in file order. Concatenated they form one zlib stream.
+  const std::vector<Span>& idat() const { return idat_; }
+  size_t idat_size() const { return idat_size_; }
+
+  // Every chunk up to and including IEND, in file order.
+  const std::vector<Chunk>& chunks() const { return chunks_; }
+
+  // Restart points from a valid rsPT chunk, or empty.
+  const std::vector<RestartPoint>& restart_points() const {
+    return restart_points_;
+  }
+
+  // PLTE entries as RGB triplets, and tRNS contents exactly as stored.
+  const std::vector<unsigned char>& palette() const { return palette_; }
+  const std::vector<unsigned char>& trns() const { return trns_; }
+
+  // File gamma from gAMA, or from sRGB which implies 1/2.2.
+  bool has_gamma() const { return has_gamma_; }
+  double gamma() const { return gamma_; }
+
+  // True once IEND has been seen.
+  bool complete() const { return complete_; }
+
+  // Samples per pixel for the colour type in the header.
+  int channels() const;
+
+  // Bytes of filtered data per row of |pixels| pixels, without the filter
+  // type byte.
+  size_t RowBytes(uint32_t pixels) const;
+
+  // Distance in bytes between corresponding bytes of adjacent pixels, as used
+  // by the Sub, Avg and Paeth filters.
+  int FilterBpp() const;
+
+private:
+  bool HandleIHDR(const unsigned char* data, uint32_t length);
+  void HandleRestartPoints(const unsigned char* data, uint32_t length);
+
+  Header header_;
+  std::vector<Chunk> chunks_;
+  std::vector<Span> idat_;
+  std::vector<RestartPoint> restart_points_;
+  size_t idat_size_;
+  std::vector<unsigned char> palette_;
+  std::vector<unsigned char> trns_;
+  bool has_gamma_;
+  double gamma_;
+  bool complete_;
+};
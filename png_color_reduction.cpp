@@ -0,0 +1,362 @@
+#include "stdafx.h"
+#include "png_color_reduction.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "third_party/libpng/png.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define PNG_COLOR_REDUCTION_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Alpha is the top byte of the pixel word in every format, and the other
+// three bytes are the colour channels in some order.
+const uint32_t kAlphaMask = 0xff000000;
+const uint32_t kGrayMask = 0x0000ffff;
+
+inline uint32_t LoadPixel(const unsigned char* p) {
+  uint32_t pixel;
+  memcpy(&pixel, p, 4);
+  return pixel;
+}
+
+// Zero in the low 16 bits exactly when the three colour channels are equal.
+inline uint32_t GrayDifference(uint32_t pixel) {
+  return (pixel ^ (pixel >> 8)) & kGrayMask;
+}
+
+// Appends |bit_depth|-bit samples to a row, most significant bits first.
+class BitPacker {
+public:
+  BitPacker(int bit_depth, unsigned char* dst)
+    : bit_depth_(bit_depth), dst_(dst), bits_(0), pending_(0) {
+  }
+
+  void Put(unsigned value) {
+    pending_ = (pending_ << bit_depth_) | value;
+    bits_ += bit_depth_;
+    if (bits_ == 8) {
+      *dst_++ = static_cast<unsigned char>(pending_);
+      bits_ = 0;
+      pending_ = 0;
+    }
+  }
+
+  void Finish() {
+    if (bits_)
+      *dst_ = static_cast<unsigned char>(pending_ << (8 - bits_));
+  }
+
+private:
+  const int bit_depth_;
+  unsigned char* dst_;
+  int bits_;
+  unsigned pending_;
+};
+
+}  // namespace
+
+int PngPaletteBitDepth(size_t colors) {
+  if (colors <= 2)
+    return 1;
+  if (colors <= 4)
+    return 2;
+  if (colors <= 16)
+    return 4;
+  return 8;
+}
+
+void PackPngSamples(const unsigned char* samples, int count, int bit_depth,
+  unsigned char* dst) {
+  if (bit_depth == 8) {
+    memcpy(dst, samples, count);
+    return;
+  }
+  BitPacker packer(bit_depth, dst);
+  for (int i = 0; i < count; ++i)
+    packer.Put(samples[i]);
+  packer.Finish();
+}
+
+PngColorReducer::PixelSet::PixelSet() : size_(0) {
+  memset(counts_, 0, sizeof(counts_));
+}
+
+bool PngColorReducer::PixelSet::Insert(uint32_t pixel) {
+  if (Find(pixel) >= 0)
+    return true;
+  if (size_ == kMaxSize)
+    return false;
+  int bucket = Bucket(pixel);
+  while (counts_[bucket] == 4)
+    bucket = (bucket + 1) % kBuckets;
+  const int slot = bucket * 4 + counts_[bucket]++;
+  pixels_[slot] = pixel;
+  slots_.push_back(slot);
+  ++size_;
+  return true;
+}
+
+int PngColorReducer::PixelSet::Find(uint32_t pixel) const {
+  // With at most 256 pixels in 1024 slots the probe rarely leaves the first
+  // bucket.
+  for (int bucket = Bucket(pixel);; bucket = (bucket + 1) % kBuckets) {
+    const int count = counts_[bucket];
+#if defined(PNG_COLOR_REDUCTION_SSE2)
+    const __m128i keys = _mm_loadu_si128(
+      reinterpret_cast<const __m128i*>(&pixels_[bucket * 4]));
+    const int match = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(keys,
+      _mm_set1_epi32(static_cast<int>(pixel))))) & ((1 << count) - 1);
+    if (match) {
+      int lane = 0;
+      while (!(match & (1 << lane)))
+        ++lane;
+      return bucket * 4 + lane;
+    }
+#else
+    for (int lane = 0; lane < count; ++lane) {
+      if (pixels_[bucket * 4 + lane] == pixel)
+        return bucket * 4 + lane;
+    }
+#endif
+    if (count < 4)
+      return -1;
+  }
+}
+
+PngColorReducer::PngColorReducer(PngDecoder::ColorFormat format,
+  bool discard_transparency)
+  : format_(format),
+  discard_transparency_(discard_transparency),
+  color_type_(discard_transparency ? PNG_COLOR_TYPE_RGB :
+    PNG_COLOR_TYPE_RGB_ALPHA),
+  bit_depth_(8),
+  counted_(false) {
+}
+
+PngColorReducer::~PngColorReducer() {
+}
+
+void PngColorReducer::Analyze(const unsigned char* pixels, size_t stride,
+  int w, int h) {
+  bool opaque = true;
+  bool gray = true;
+  bool counting = true;
+  uint32_t alpha_and = kAlphaMask;
+  uint32_t gray_or = 0;
+  // Stop once the image is known to need RGBA.
+  for (int y = 0; y < h && (counting || gray || opaque); ++y) {
+    const unsigned char* row = pixels + y * stride;
+    // Colours repeat in runs; only pixels that differ from the last one
+    // inserted reach the hash set.
+    uint32_t last = LoadPixel(row);
+    if (counting)
+      counting = colors_.Insert(last);
+    int x = 0;
+#if defined(PNG_COLOR_REDUCTION_SSE2)
+    __m128i alpha_and_v = _mm_set1_epi32(-1);
+    __m128i gray_or_v = _mm_setzero_si128();
+    for (; x + 4 <= w; x += 4) {
+      const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x * 4));
+      alpha_and_v = _mm_and_si128(alpha_and_v, v);
+      gray_or_v = _mm_or_si128(gray_or_v,
+        _mm_xor_si128(v, _mm_srli_epi32(v, 8)));
+      if (!counting)
+        continue;
+      const __m128i same = _mm_cmpeq_epi32(v,
+        _mm_set1_epi32(static_cast<int>(last)));
+      if (_mm_movemask_epi8(same) == 0xffff)
+        continue;
+      for (int i = 0; i < 4 && counting; ++i) {
+        const uint32_t pixel = LoadPixel(row + (x + i) * 4);
+        if (pixel != last) {
+          counting = colors_.Insert(pixel);
+          last = pixel;
+        }
+      }
+    }
+    unsigned char lanes[16];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), alpha_and_v);
+    for (int i = 0; i < 4; ++i)
+      alpha_and &= LoadPixel(lanes + i * 4);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), gray_or_v);
+    for (int i = 0; i < 4; ++i)
+      gray_or |= LoadPixel(lanes + i * 4) & kGrayMask;
+#endif
+    for (; x < w; ++x) {
+      const uint32_t pixel = LoadPixel(row + x * 4);
+      alpha_and &= pixel;
+      gray_or |= GrayDifference(pixel);
+      if (counting && pixel != last) {
+        counting = colors_.Insert(pixel);
+        last = pixel;
+      }
+    }
+    gray = gray_or == 0;
+    opaque = discard_transparency_ || alpha_and == kAlphaMask;
+  }
+
+  counted_ = counting;
+  const int palette_bit_depth =
+    counting ? PngPaletteBitDepth(colors_.size()) : 0;
+  if (gray && opaque) {
+    const int gray_bit_depth = counting ? GrayBitDepth() : 8;
+    if (counting && palette_bit_depth < gray_bit_depth) {
+      BuildPalette();
+      color_type_ = PNG_COLOR_TYPE_PALETTE;
+      bit_depth_ = palette_bit_depth;
+    }
+    else {
+      color_type_ = PNG_COLOR_TYPE_GRAY;
+      bit_depth_ = gray_bit_depth;
+    }
+  }
+  else if (counting) {
+    BuildPalette();
+    color_type_ = PNG_COLOR_TYPE_PALETTE;
+    bit_depth_ = palette_bit_depth;
+  }
+  else {
+    color_type_ = gray ? PNG_COLOR_TYPE_GRAY_ALPHA :
+      opaque ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_RGB_ALPHA;
+    bit_depth_ = 8;
+  }
+}
+
+int PngColorReducer::channels() const {
+  switch (color_type_) {
+  case PNG_COLOR_TYPE_GRAY_ALPHA:
+    return 2;
+  case PNG_COLOR_TYPE_RGB:
+    return 3;
+  case PNG_COLOR_TYPE_RGB_ALPHA:
+    return 4;
+  default:
+    return 1;
+  }
+}
+
+size_t PngColorReducer::RowBytes(int w) const {
+  return (static_cast<size_t>(w) * channels() * bit_depth_ + 7) / 8;
+}
+
+int PngColorReducer::FilterBpp() const {
+  const int bits = channels() * bit_depth_;
+  return bits < 8 ? 1 : bits / 8;
+}
+
+void PngColorReducer::PackRow(const unsigned char* src, int w,
+  unsigned char* dst) const {
+  switch (color_type_) {
+  case PNG_COLOR_TYPE_RGB_ALPHA:
+  case PNG_COLOR_TYPE_RGB: {
+    const bool alpha = color_type_ == PNG_COLOR_TYPE_RGB_ALPHA;
+    if (format_ == PngDecoder::FORMAT_RGBA) {
+      for (int x = 0; x < w; ++x, src += 4) {
+        memcpy(dst, src, 3);
+        dst += 3;
+        if (alpha)
+          *dst++ = src[3];
+      }
+      break;
+    }
+    for (int x = 0; x < w; ++x, src += 4) {
+      uint32_t pixel = LoadPixel(src);
+      if (format_ == PngDecoder::FORMAT_SkBitmap)
+        pixel = UnpremultiplyPixel(pixel);
+      *dst++ = static_cast<unsigned char>(pixel >> 16);
+      *dst++ = static_cast<unsigned char>(pixel >> 8);
+      *dst++ = static_cast<unsigned char>(pixel);
+      if (alpha)
+        *dst++ = static_cast<unsigned char>(pixel >> 24);
+    }
+    break;
+  }
+  case PNG_COLOR_TYPE_GRAY_ALPHA:
+    for (int x = 0; x < w; ++x, src += 4) {
+      const uint32_t rgba = ToRgba(LoadPixel(src));
+      *dst++ = static_cast<unsigned char>(rgba);
+      *dst++ = static_cast<unsigned char>(rgba >> 24);
+    }
+    break;
+  case PNG_COLOR_TYPE_GRAY: {
+    // Exact gray levels at lower depths are multiples of
+    // 255 / (2^depth - 1), which the top bits give.
+    BitPacker packer(bit_depth_, dst);
+    for (int x = 0; x < w; ++x, src += 4)
+      packer.Put((ToRgba(LoadPixel(src)) & 0xff) >> (8 - bit_depth_));
+    packer.Finish();
+    break;
+  }
+  case PNG_COLOR_TYPE_PALETTE: {
+    BitPacker packer(bit_depth_, dst);
+    uint32_t last = LoadPixel(src);
+    unsigned index = colors_.index(colors_.Find(last));
+    for (int x = 0; x < w; ++x, src += 4) {
+      const uint32_t pixel = LoadPixel(src);
+      if (pixel != last) {
+        last = pixel;
+        index = colors_.index(colors_.Find(pixel));
+      }
+      packer.Put(index);
+    }
+    packer.Finish();
+    break;
+  }
+  }
+}
+
+uint32_t PngColorReducer::ToRgba(uint32_t pixel) const {
+  uint32_t rgba;
+  if (format_ == PngDecoder::FORMAT_RGBA) {
+    rgba = pixel;
+  }
+  else {
+    // Native ARGB words, BGRA in memory.
+    if (format_ == PngDecoder::FORMAT_SkBitmap)
+      pixel = UnpremultiplyPixel(pixel);
+    rgba = ((pixel >> 16) & 0xff) | (pixel & 0xff00) |
+      ((pixel & 0xff) << 16) | (pixel & kAlphaMask);
+  }
+  return discard_transparency_ ? rgba | kAlphaMask : rgba;
+}
+
+int PngColorReducer::GrayBitDepth() const {
+  int bit_depth = 1;
+  for (int slot : colors_.slots()) {
+    const unsigned level = ToRgba(colors_.pixel(slot)) & 0xff;
+    while (bit_depth < 8 && level % (255 / ((1 << bit_depth) - 1)) != 0)
+      bit_depth *= 2;
+  }
+  return bit_depth;
+}
+
+void PngColorReducer::BuildPalette() {
+  // Translucent entries first, so that tRNS can stop after the last of them,
+  // then by colour for a stable order.
+  std::vector<std::pair<uint64_t, int>> entries;
+  for (int slot : colors_.slots()) {
+    const uint32_t rgba = ToRgba(colors_.pixel(slot));
+    const uint64_t opaque = (rgba & kAlphaMask) == kAlphaMask ? 1 : 0;
+    entries.push_back(std::make_pair((opaque << 32) | rgba, slot));
+  }
+  std::sort(entries.begin(), entries.end());
+
+  palette_.clear();
+  trns_.clear();
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const uint32_t rgba = static_cast<uint32_t>(entries[i].first);
+    colors_.set_index(entries[i].second, static_cast<unsigned char>(i));
+    palette_.push_back(static_cast<unsigned char>(rgba));
+    palette_.push_back(static_cast<unsigned char>(rgba >> 8));
+    palette_.push_back(static_cast<unsigned char>(rgba >> 16));
+    if ((rgba & kAlphaMask) != kAlphaMask)
+      trns_.push_back(static_cast<unsigned char>(rgba >> 24));
+  }
+}
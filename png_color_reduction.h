@@ -0,0 +1,128 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "png_decoder.h"
+
+// Undoes premultiplication of a native ARGB word, rounding to nearest.
+inline uint32_t UnpremultiplyPixel(uint32_t argb) {
+  const unsigned a = argb >> 24;
+  if (a == 255)
+    return argb;
+  if (a == 0)
+    return 0;
+  const unsigned r = (((argb >> 16) & 0xff) * 255 + a / 2) / a;
+  const unsigned g = (((argb >> 8) & 0xff) * 255 + a / 2) / a;
+  const unsigned b = ((argb & 0xff) * 255 + a / 2) / a;
+  const unsigned max = 255;
+  return (a << 24) | ((r < max ? r : max) << 16) | ((g < max ? g : max) << 8) |
+    (b < max ? b : max);
+}
+
+// Bits per index of a palette with |colors| entries: 1, 2, 4 or 8.
+int PngPaletteBitDepth(size_t colors);
+
+// Packs |count| samples of |bit_depth| bits, one per byte of |samples|, into
+// (count * bit_depth + 7) / 8 bytes at |dst|, most significant bits first.
+void PackPngSamples(const unsigned char* samples, int count, int bit_depth,
+  unsigned char* dst);
+
+// Turns 4-byte pixels in one of PngDecoder's formats into PNG rows. Until
+// Analyze() is called the rows are 8-bit RGBA, or RGB when transparency is
+// discarded. Analyze() scans the image and switches to the narrowest PNG
+// pixel format that holds it exactly: grayscale at 1 to 8 bits when every
+// pixel is opaque gray, a 1 to 8-bit palette with tRNS when there are at
+// most 256 colours, gray with alpha, or RGB when every pixel is opaque.
+class PngColorReducer {
+public:
+  // |discard_transparency| treats every pixel as opaque.
+  PngColorReducer(PngDecoder::ColorFormat format, bool discard_transparency);
+  ~PngColorReducer();
+
+  // Scans the |w| x |h| image whose rows start |stride| bytes apart at
+  // |pixels|. The opacity and gray checks and the run skipping of the colour
+  // count use SSE2 where the CPU has it; colours go into a small hash set
+  // probed four entries at a time, and counting stops past 256.
+  void Analyze(const unsigned char* pixels, size_t stride, int w, int h);
+
+  // PNG_COLOR_TYPE_* and bit depth of the rows PackRow() writes.
+  int color_type() const { return color_type_; }
+  int bit_depth() const { return bit_depth_; }
+
+  // Bytes per row of |w| pixels, and the filter distance in bytes.
+  size_t RowBytes(int w) const;
+  int FilterBpp() const;
+
+  // PLTE entries as RGB triplets, and the tRNS alpha values, which cover the
+  // translucent entries, all placed first. Empty unless the rows are
+  // palette indices.
+  const std::vector<unsigned char>& palette() const { return palette_; }
+  const std::vector<unsigned char>& trns() const { return trns_; }
+
+  // Distinct pixels seen by Analyze(), or 0 if there were more than 256.
+  size_t color_count() const { return counted_ ? colors_.size() : 0; }
+
+  // Writes |w| pixels from |src| to |dst| as RowBytes(w) bytes. May be called
+  // from several threads at once.
+  void PackRow(const unsigned char* src, int w, unsigned char* dst) const;
+
+private:
+  // Open-addressing set of pixel words in buckets of four, each with the
+  // palette index assigned to it.
+  class PixelSet {
+  public:
+    static const int kMaxSize = 256;
+
+    PixelSet();
+
+    // Returns false once the set would hold more than kMaxSize pixels.
+    bool Insert(uint32_t pixel);
+
+    // Slot of |pixel|, or -1.
+    int Find(uint32_t pixel) const;
+
+    size_t size() const { return size_; }
+    uint32_t pixel(int slot) const { return pixels_[slot]; }
+    unsigned char index(int slot) const { return indices_[slot]; }
+    void set_index(int slot, unsigned char index) { indices_[slot] = index; }
+    // Slots in use, in insertion order.
+    const std::vector<int>& slots() const { return slots_; }
+
+  private:
+    static const int kBuckets = 256;
+
+    static int Bucket(uint32_t pixel) {
+      return static_cast<int>((pixel * 2654435761u) >> 24);
+    }
+
+    uint32_t pixels_[kBuckets * 4];
+    unsigned char counts_[kBuckets];
+    unsigned char indices_[kBuckets * 4];
+    std::vector<int> slots_;
+    size_t size_;
+  };
+
+  // Samples per pixel of the rows PackRow() writes.
+  int channels() const;
+
+  // The pixel word as RGBA bytes, in memory order, with alpha unmultiplied.
+  uint32_t ToRgba(uint32_t pixel) const;
+
+  // Lowest gray bit depth, 1 to 8, that holds every pixel in |colors_|
+  // exactly.
+  int GrayBitDepth() const;
+
+  void BuildPalette();
+
+  const PngDecoder::ColorFormat format_;
+  const bool discard_transparency_;
+  int color_type_;
+  int bit_depth_;
+  bool counted_;
+  PixelSet colors_;
+  std::vector<unsigned char> palette_;
+  std::vector<unsigned char> trns_;
+};
@@ -0,0 +1,120 @@
+// Benchmark for PngDecoder. Decodes each PNG file given on the command line
+// with every decode mode and prints the median and maximum decode rates, in
+// MB/s of output pixels. Every mode's output is checked against
+// DECODE_MODE_PROGRESSIVE.
+//
+//   png_decode_bench [--threads=N] file.png...
+
+#include "stdafx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include "png_decoder.h"
+
+CAppModule _Module;
+
+namespace {
+
+struct BenchMode {
+  PngDecoder::DecodeMode mode;
+  const char* name;
+};
+
+const BenchMode kBenchModes[] = {
+  { PngDecoder::DECODE_MODE_PROGRESSIVE, "progressive" },
+  { PngDecoder::DECODE_MODE_SEQUENTIAL, "sequential" },
+  { PngDecoder::DECODE_MODE_PIPELINED, "pipelined" },
+  { PngDecoder::DECODE_MODE_SEGMENTED, "segmented" },
+  { PngDecoder::DECODE_MODE_BANDED, "banded" },
+  { PngDecoder::DECODE_MODE_AUTO, "auto" },
+};
+
+bool ReadFile(const char* name, std::vector<unsigned char>* data) {
+  std::ifstream file(name, std::ios::in | std::ios::binary);
+  if (!file)
+    return false;
+  data->assign(std::istreambuf_iterator<char>(file),
+    std::istreambuf_iterator<char>());
+  return !data->empty();
+}
+
+// Returns false if the file does not decode.
+bool BenchFile(const char* name, int threads) {
+  std::vector<unsigned char> data;
+  if (!ReadFile(name, &data)) {
+    fprintf(stderr, "%s: cannot read\n", name);
+    return false;
+  }
+
+  PngDecoder::DecodeOptions options;
+  options.mode = PngDecoder::DECODE_MODE_PROGRESSIVE;
+  options.error_dialogs = false;
+  options.max_threads = threads;
+  std::vector<unsigned char> reference;
+  int w, h;
+  if (!PngDecoder::Decode(data.data(), data.size(), PngDecoder::FORMAT_RGBA,
+    options, &reference, &w, &h)) {
+    fprintf(stderr, "%s: does not decode\n", name);
+    return false;
+  }
+  printf("%-40s : %dx%d, %u bytes\n", name, w, h,
+    static_cast<unsigned>(data.size()));
+
+  // Decode about 100 MB of pixels per run, or the image once if bigger.
+  const double mega_byte = 1024 * 1024;
+  const int repeats = std::max(1,
+    static_cast<int>(100 * mega_byte / reference.size()));
+  const int runs = 5;
+
+  std::vector<unsigned char> output;
+  bool ok = true;
+  for (const BenchMode& bench_mode : kBenchModes) {
+    options.mode = bench_mode.mode;
+    double rates[runs];
+    for (int run = 0; run < runs; ++run) {
+      const auto start = std::chrono::steady_clock::now();
+      for (int r = 0; r < repeats; ++r) {
+        PngDecoder::Decode(data.data(), data.size(), PngDecoder::FORMAT_RGBA,
+          options, &output, &w, &h);
+      }
+      const double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+      rates[run] = reference.size() * repeats / mega_byte / seconds;
+    }
+    std::sort(rates, rates + runs);
+
+    const bool same = output == reference;
+    ok &= same;
+    printf("  %-12s : %8.1f MB/s median %8.1f MB/s max%s\n", bench_mode.name,
+      rates[runs / 2], rates[runs - 1], same ? "" : "  OUTPUT MISMATCH");
+  }
+  return ok;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int threads = 0;
+  int first_file = 1;
+  if (argc > 1 && strncmp(argv[1], "--threads=", 10) == 0) {
+    threads = atoi(argv[1] + 10);
+    first_file = 2;
+  }
+  if (first_file >= argc) {
+    fprintf(stderr, "usage: %s [--threads=N] file.png...\n", argv[0]);
+    return 1;
+  }
+
+  bool ok = true;
+  for (int i = first_file; i < argc; ++i)
+    ok &= BenchFile(argv[i], threads);
+  return ok ? 0 : 3;
+}
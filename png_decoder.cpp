@@ -3,6 +3,14 @@
 #include "logging.h"
 #include "png_decoder.h"
 #include <atlstr.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+
+#include "png_chunk_reader.h"
+#include "png_deinterlace.h"
+#include "png_idat_decoder.h"
+#include "png_zlib_pool.h"
 
 #include "third_party/libpng/png.h"
 #include "third_party/zlib/zlib.h"
@@ -73,6 +81,11 @@ namespace {
       output(o),
       width(0),
       height(0),
+      rows_decoded(0),
+      interlaced(false),
+      pass(-1),
+      pass_callback(nullptr),
+      header_accepted(false),
       done(false) {
     }
 
@@ -84,6 +97,11 @@ namespace {
       output(NULL),
       width(0),
       height(0),
+      rows_decoded(0),
+      interlaced(false),
+      pass(-1),
+      pass_callback(nullptr),
+      header_accepted(false),
       done(false) {
     }
 
@@ -104,6 +122,19 @@ namespace {
     int width;
     int height;
 
+    // Rows from the top that hold their final pixels.
+    int rows_decoded;
+
+    // Interlaced images only: the Adam7 pass being decoded, and who to tell
+    // when one is finished.
+    bool interlaced;
+    int pass;
+    const PngDecoder::PassCallback* pass_callback;
+
+    // Set once the header has been read and the output sized. An error before
+    // then leaves no pixels to salvage, whatever |output| held.
+    bool header_accepted;
+
     // Set to true when we've found the end of the data.
     bool done;
 
@@ -159,8 +190,8 @@ public:
       return false;
     }
 
-    png_ptr_ = png_create_read_struct(
-      PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_ptr_ = png_create_read_struct_2(PNG_LIBPNG_VER_STRING, NULL, NULL,
+      NULL, NULL, PngPoolMalloc, PngPoolFree);
     if (!png_ptr_) {
       PNG_LOG("_________Build 3 %d\n", (int)input);
       return false;
@@ -185,16 +216,23 @@ void LogLibPNGDecodeError(png_structp png_ptr, png_const_charp error_msg) {
   longjmp(png_jmpbuf(png_ptr), 1);
 }
 
+// Same, without the message box, for decodes that are retried or that run
+// unattended.
+void LogLibPNGDecodeErrorQuietly(png_structp png_ptr,
+  png_const_charp error_msg) {
+  PNG_LOG("libpng decode error:: %s\n", error_msg);
+  longjmp(png_jmpbuf(png_ptr), 1);
+}
+
 void LogLibPNGDecodeWarning(png_structp png_ptr, png_const_charp warning_msg) {
   PNG_LOG("libpng decode warning:: %s\n", warning_msg);
 }
 
-// Called when the png header has been read. This code is based on the WebKit
+// Sets up the transforms for |state->output_format| once the png header has
+// been read, and sizes the output. This code is based on the WebKit
 // PNGImageDecoder
-void DecodeInfoCallback(png_struct* png_ptr, png_info* info_ptr) {
-  PngDecoderState* state = static_cast<PngDecoderState*>(
-    png_get_progressive_ptr(png_ptr));
-
+void SetUpDecodeTransforms(png_struct* png_ptr, png_info* info_ptr,
+  PngDecoderState* state) {
   int bit_depth, color_type, interlace_type, compression_type;
   int filter_type;
   png_uint_32 w, h;
@@ -296,8 +334,10 @@ void DecodeInfoCallback(png_struct* png_ptr, png_info* info_ptr) {
   }
 
   // Tell libpng to send us rows for interlaced pngs.
-  if (interlace_type == PNG_INTERLACE_ADAM7)
+  if (interlace_type == PNG_INTERLACE_ADAM7) {
     png_set_interlace_handling(png_ptr);
+    state->interlaced = true;
+  }
 
   png_read_update_info(png_ptr, info_ptr);
 
@@ -305,16 +345,44 @@ void DecodeInfoCallback(png_struct* png_ptr, png_info* info_ptr) {
     state->output->resize(
       state->width * state->output_channels * state->height);
   }
+  state->header_accepted = true;
+}
+
+// Called when the png header has been read.
+void DecodeInfoCallback(png_struct* png_ptr, png_info* info_ptr) {
+  PngDecoderState* state = static_cast<PngDecoderState*>(
+    png_get_progressive_ptr(png_ptr));
+  SetUpDecodeTransforms(png_ptr, info_ptr, state);
+}
+
+// Hands the image to the pass callback for every pass before |pass|, which
+// is 7 once the image is done. libpng skips passes that are empty for small
+// images, but callers get all seven.
+void AdvancePass(PngDecoderState* state, int pass) {
+  for (; state->pass < pass; ++state->pass) {
+    if (state->pass < 0 || !state->pass_callback || !*state->pass_callback ||
+      !state->output)
+      continue;
+    if (state->pass < 6) {
+      ReplicateAdam7Pass(state->pass, state->width, state->height,
+        reinterpret_cast<uint32_t*>(&state->output->front()));
+    }
+    (*state->pass_callback)(state->pass, &state->output->front(),
+      state->width, state->height);
+  }
 }
 
 void DecodeRowCallback(png_struct* png_ptr, png_byte* new_row,
   png_uint_32 row_num, int pass) {
-  if (!new_row)
-    return;  // Interlaced image; row didn't change this pass.
-
   PngDecoderState* state = static_cast<PngDecoderState*>(
     png_get_progressive_ptr(png_ptr));
 
+  if (state->interlaced)
+    AdvancePass(state, pass);
+
+  if (!new_row)
+    return;  // Interlaced image; row didn't change this pass.
+
   if (static_cast<int>(row_num) > state->height) {
 
     PNG_LOG( "DecodeRowCallback 4 \n");
@@ -327,61 +395,375 @@ void DecodeRowCallback(png_struct* png_ptr, png_byte* new_row,
 
   unsigned char* dest = &base[state->width * state->output_channels * row_num];
   png_progressive_combine_row(png_ptr, dest, new_row);
+
+  // Rows arrive in order within a pass. In the last pass, which has the odd
+  // rows, the even row below is already final too.
+  if (!state->interlaced)
+    state->rows_decoded = static_cast<int>(row_num) + 1;
+  else if (pass == 6)
+    state->rows_decoded = std::min(static_cast<int>(row_num) + 2, state->height);
 }
 
 void DecodeEndCallback(png_struct* png_ptr, png_info* info) {
   PngDecoderState* state = static_cast<PngDecoderState*>(
     png_get_progressive_ptr(png_ptr));
 
+  if (state->interlaced)
+    AdvancePass(state, 7);
+
   // Mark the image as complete, this will tell the Decode function that we
   // have successfully found the end of the data.
   state->done = true;
 }
 
+int ResolveThreadCount(const PngDecoder::DecodeOptions& options) {
+  if (options.max_threads > 0)
+    return options.max_threads;
+  const unsigned cores = std::thread::hardware_concurrency();
+  return cores > 0 ? static_cast<int>(cores) : 1;
 }
 
-PngDecoder::PngDecoder()
-{
+bool DecodeProgressive(const unsigned char* input, size_t input_size,
+  PngDecoder::ColorFormat format, const PngDecoder::DecodeOptions& options,
+  std::vector<unsigned char>* output, int* w, int* h,
+  PngDecoder::DecodeResult* result) {
+  PngStreamDecoder decoder(format, options, output);
+  decoder.Feed(input, input_size);
+  return decoder.Finish(w, h, result);
 }
 
 
-PngDecoder::~PngDecoder()
-{
+// Copies the bytes libpng asks for from the caller's buffer into libpng's
+// own. Unlike png_process_data, nothing is staged in a save buffer first.
+struct MemoryReader {
+  const unsigned char* data;
+  size_t size;
+  size_t offset;
+  bool truncated;
+};
+
+void ReadFromMemory(png_struct* png_ptr, png_byte* out, png_size_t length) {
+  MemoryReader* reader = static_cast<MemoryReader*>(png_get_io_ptr(png_ptr));
+  if (length > reader->size - reader->offset) {
+    // Not an error worth reporting through LogLibPNGDecodeError; the caller
+    // tells truncation apart by the flag.
+    reader->truncated = true;
+    longjmp(png_jmpbuf(png_ptr), 1);
+  }
+  memcpy(out, reader->data + reader->offset, length);
+  reader->offset += length;
 }
 
-bool PngDecoder::Decode(const unsigned char* input, size_t input_size,
-  ColorFormat format, std::vector<unsigned char>* output,
-  int* w, int* h) {
+// Same output as DecodeProgressive, through libpng's sequential reader, for
+// images it accepts. Errors are only logged: Decode retries the image with
+// DecodeProgressive, which reports them.
+bool DecodeSequential(const unsigned char* input, size_t input_size,
+  PngDecoder::ColorFormat format, const PngDecoder::DecodeOptions& options,
+  std::vector<unsigned char>* output, int* w, int* h,
+  PngDecoder::DecodeResult* result) {
+  result->error = PngDecoder::DECODE_ERROR_INVALID;
   PngReadStructInfo si;
   if (!si.Build(input, input_size))
     return false;
 
+  // Declared ahead of setjmp so that they can be inspected after an error.
+  PngDecoderState state(format, output);
+  state.pass_callback = &options.pass_callback;
+  MemoryReader reader = { input, input_size, 0, false };
+
   if (setjmp(png_jmpbuf(si.png_ptr_))) {
-    // The destroyer will ensure that the structures are cleaned up in this
-    // case, even though we may get here as a jump from random parts of the
-    // PNG library called below.
-    return false;
+    if (!state.header_accepted) {
+      output->clear();
+      return false;
+    }
+    result->error = reader.truncated ? PngDecoder::DECODE_ERROR_TRUNCATED :
+      PngDecoder::DECODE_ERROR_CORRUPT;
+    if (!options.allow_partial) {
+      output->clear();
+      return false;
+    }
+    result->rows_decoded = state.rows_decoded;
+    *w = state.width;
+    *h = state.height;
+    return true;
   }
 
-  PngDecoderState state(format, output);
-
   png_set_error_fn(si.png_ptr_, NULL,
-    LogLibPNGDecodeError, LogLibPNGDecodeWarning);
-  png_set_progressive_read_fn(si.png_ptr_, &state, &DecodeInfoCallback,
-    &DecodeRowCallback, &DecodeEndCallback);
-  png_process_data(si.png_ptr_,
-    si.info_ptr_,
-    const_cast<unsigned char*>(input),
-    input_size);
-
-  if (!state.done) {
-    // Fed it all the data but the library didn't think we got all the data, so
-    // this file must be truncated.
-    output->clear();
-    return false;
+    LogLibPNGDecodeErrorQuietly, LogLibPNGDecodeWarning);
+  png_set_read_fn(si.png_ptr_, &reader, &ReadFromMemory);
+  png_read_info(si.png_ptr_, si.info_ptr_);
+  SetUpDecodeTransforms(si.png_ptr_, si.info_ptr_, &state);
+
+  const size_t stride = static_cast<size_t>(state.width) * state.output_channels;
+  // With interlace handling on, libpng visits every row in every pass and
+  // only writes the pixels of the current one.
+  const int passes = state.interlaced ? 7 : 1;
+  for (int pass = 0; pass < passes; ++pass) {
+    if (state.interlaced)
+      AdvancePass(&state, pass);
+    for (int y = 0; y < state.height; ++y) {
+      png_read_row(si.png_ptr_, &(*output)[y * stride], NULL);
+      if (pass == passes - 1)
+        state.rows_decoded = y + 1;
+    }
   }
+  png_read_end(si.png_ptr_, NULL);
+  if (state.interlaced)
+    AdvancePass(&state, 7);
 
+  result->error = PngDecoder::DECODE_ERROR_NONE;
+  result->rows_decoded = state.rows_decoded;
   *w = state.width;
   *h = state.height;
   return true;
 }
+
+// True if |input| ends with an IEND chunk, i.e. is not obviously truncated.
+bool EndsWithIEND(const unsigned char* input, size_t input_size) {
+  static const unsigned char kIEND[12] = {
+    0, 0, 0, 0, 'I', 'E', 'N', 'D', 0xae, 0x42, 0x60, 0x82 };
+  return input_size >= sizeof(kIEND) &&
+    memcmp(input + input_size - sizeof(kIEND), kIEND, sizeof(kIEND)) == 0;
+}
+}
+
+// libpng's progressive reader and what it decodes into. Lives on the heap so
+// that libpng's callbacks can keep pointing at |state| between calls.
+class PngStreamDecoder::Reader {
+public:
+  Reader(PngDecoder::ColorFormat format,
+    const PngDecoder::DecodeOptions& options,
+    std::vector<unsigned char>* output)
+    : options(options),
+    state(format, output),
+    signature_size(0),
+    failed(false) {
+    state.pass_callback = &this->options.pass_callback;
+  }
+
+  // Hands |data| to libpng. False, and |failed| set, if libpng gave up.
+  bool Process(const unsigned char* data, size_t size) {
+    if (!size || state.done)
+      return true;
+    if (setjmp(png_jmpbuf(si.png_ptr_))) {
+      // The structures stay valid; Finish() reads what |state| got to.
+      failed = true;
+      return false;
+    }
+    png_process_data(si.png_ptr_, si.info_ptr_,
+      const_cast<unsigned char*>(data), size);
+    return true;
+  }
+
+  const PngDecoder::DecodeOptions options;
+  PngReadStructInfo si;
+  PngDecoderState state;
+
+  // The first bytes, gathered until there are enough to check the signature
+  // before anything is allocated.
+  unsigned char signature[8];
+  size_t signature_size;
+
+  bool failed;
+};
+
+PngStreamDecoder::PngStreamDecoder(PngDecoder::ColorFormat format,
+  const PngDecoder::DecodeOptions& options,
+  std::vector<unsigned char>* output)
+  : reader_(new Reader(format, options, output)) {
+  // Nothing of an earlier image may be mistaken for a partial result.
+  output->clear();
+}
+
+PngStreamDecoder::~PngStreamDecoder() {
+}
+
+bool PngStreamDecoder::Feed(const unsigned char* data, size_t size) {
+  Reader* reader = reader_.get();
+  if (reader->failed)
+    return false;
+
+  if (!reader->si.png_ptr_) {
+    const size_t wanted = sizeof(reader->signature) - reader->signature_size;
+    const size_t taken = std::min(size, wanted);
+    memcpy(reader->signature + reader->signature_size, data, taken);
+    reader->signature_size += taken;
+    data += taken;
+    size -= taken;
+    if (reader->signature_size < sizeof(reader->signature))
+      return true;
+
+    if (!reader->si.Build(reader->signature, sizeof(reader->signature))) {
+      reader->failed = true;
+      return false;
+    }
+    png_set_error_fn(reader->si.png_ptr_, NULL,
+      reader->options.error_dialogs ? LogLibPNGDecodeError :
+      LogLibPNGDecodeErrorQuietly, LogLibPNGDecodeWarning);
+    png_set_progressive_read_fn(reader->si.png_ptr_, &reader->state,
+      &DecodeInfoCallback, &DecodeRowCallback, &DecodeEndCallback);
+    if (!reader->Process(reader->signature, sizeof(reader->signature)))
+      return false;
+  }
+  return reader->Process(data, size);
+}
+
+bool PngStreamDecoder::done() const {
+  return reader_->state.done;
+}
+
+bool PngStreamDecoder::Finish(int* w, int* h,
+  PngDecoder::DecodeResult* result) {
+  PngDecoder::DecodeResult local_result;
+  if (!result)
+    result = &local_result;
+  const Reader* reader = reader_.get();
+  std::vector<unsigned char>* output = reader->state.output;
+
+  result->error = PngDecoder::DECODE_ERROR_INVALID;
+  if (!reader->state.header_accepted)
+    return false;
+
+  if (reader->failed || !reader->state.done) {
+    // Either libpng hit an error, or it was fed all the data but did not
+    // think it got all of it, so the file must be truncated.
+    result->error = reader->failed ? PngDecoder::DECODE_ERROR_CORRUPT :
+      PngDecoder::DECODE_ERROR_TRUNCATED;
+    if (!reader->options.allow_partial) {
+      output->clear();
+      return false;
+    }
+    result->rows_decoded = reader->state.rows_decoded;
+    *w = reader->state.width;
+    *h = reader->state.height;
+    return true;
+  }
+
+  result->error = PngDecoder::DECODE_ERROR_NONE;
+  result->rows_decoded = reader->state.height;
+  *w = reader->state.width;
+  *h = reader->state.height;
+  return true;
+}
+
+PngDecoder::DecodeOptions::DecodeOptions()
+  : mode(DECODE_MODE_AUTO),
+  max_threads(0),
+  allow_partial(false),
+  error_dialogs(true) {
+}
+
+PngDecoder::DecodeResult::DecodeResult()
+  : error(DECODE_ERROR_NONE),
+  rows_decoded(0) {
+}
+
+PngDecoder::PngDecoder()
+{
+}
+
+
+PngDecoder::~PngDecoder()
+{
+}
+
+bool PngDecoder::Decode(const unsigned char* input, size_t input_size,
+  ColorFormat format, std::vector<unsigned char>* output,
+  int* w, int* h) {
+  return Decode(input, input_size, format, DecodeOptions(), output, w, h);
+}
+
+bool PngDecoder::Decode(const unsigned char* input, size_t input_size,
+  ColorFormat format, const DecodeOptions& options,
+  std::vector<unsigned char>* output, int* w, int* h, DecodeResult* result) {
+  DecodeResult local_result;
+  if (!result)
+    result = &local_result;
+  const int threads = ResolveThreadCount(options);
+
+  // Which libpng reader handles what the IDAT modes cannot. The sequential
+  // reader can only read whole pieces of a chunk, so for a cut-off file it
+  // stops short of rows the progressive reader still gets.
+  DecodeMode libpng_mode = DECODE_MODE_SEQUENTIAL;
+  if (options.mode == DECODE_MODE_PROGRESSIVE ||
+    (options.allow_partial && !EndsWithIEND(input, input_size)))
+    libpng_mode = DECODE_MODE_PROGRESSIVE;
+
+  DecodeMode mode = options.mode;
+  bool interlaced = false;
+  if (mode == DECODE_MODE_AUTO) {
+    mode = libpng_mode;
+    PngChunkReader::Header header;
+    if (PngChunkReader::PeekHeader(input, input_size, &header)) {
+      if (header.interlace_type != 0)
+        interlaced = true;
+      else if (threads > 1 && PngChunkReader::HasChunkBeforeIDAT(input,
+        input_size, PngChunkReader::kRestartPointsType))
+        mode = DECODE_MODE_SEGMENTED;
+      else if (threads > 2 &&
+        static_cast<unsigned long long>(header.width) * header.height >=
+        kPipelinedDecodeMinPixels)
+        mode = DECODE_MODE_PIPELINED;
+      else if (libpng_mode == DECODE_MODE_SEQUENTIAL)
+        mode = DECODE_MODE_BANDED;
+    }
+  }
+
+  // Every IDAT mode hands interlaced images to DecodePngInterlaced.
+  if (interlaced || mode == DECODE_MODE_PIPELINED ||
+    mode == DECODE_MODE_SEGMENTED || mode == DECODE_MODE_BANDED) {
+    PngChunkReader reader;
+    if (reader.Parse(input, input_size) && reader.complete()) {
+      PngIdatDecodeResult idat_result;
+      if (reader.header().interlace_type != 0)
+        idat_result = DecodePngInterlaced(reader, format, options.pass_callback,
+          output);
+      else if (mode == DECODE_MODE_SEGMENTED) {
+        idat_result = DecodePngSegmented(reader, format, threads, output);
+        // Restart points are only a hint from whoever wrote the file; a bad
+        // one must not fail an image the whole stream still decodes.
+        if (idat_result == PNG_IDAT_DECODE_FAILED)
+          idat_result = DecodePngPipelined(reader, format, threads, output);
+      } else if (mode == DECODE_MODE_BANDED)
+        idat_result = DecodePngBanded(reader, format, output);
+      else
+        idat_result = DecodePngPipelined(reader, format, threads, output);
+      if (idat_result == PNG_IDAT_DECODE_OK) {
+        *w = static_cast<int>(reader.header().width);
+        *h = static_cast<int>(reader.header().height);
+        result->error = DECODE_ERROR_NONE;
+        result->rows_decoded = *h;
+        return true;
+      }
+      // The fast paths do not track how far they got; let libpng find out
+      // what can be salvaged. DECODE_MODE_AUTO also leaves the verdict to
+      // libpng, which lets some damage, like a bad Adler-32, pass.
+      if (idat_result == PNG_IDAT_DECODE_FAILED && !options.allow_partial &&
+        options.mode != DECODE_MODE_AUTO) {
+        output->clear();
+        result->error = DECODE_ERROR_CORRUPT;
+        return false;
+      }
+      // The sequential reader would only fail too and hand over to the
+      // progressive one.
+      if (idat_result == PNG_IDAT_DECODE_FAILED)
+        libpng_mode = DECODE_MODE_PROGRESSIVE;
+    }
+  }
+
+  if (libpng_mode == DECODE_MODE_PROGRESSIVE) {
+    return DecodeProgressive(input, input_size, format, options, output, w, h,
+      result);
+  }
+  const bool decoded = DecodeSequential(input, input_size, format, options,
+    output, w, h, result);
+  // The sequential reader fails on some damage the progressive reader only
+  // warns about, such as an IDAT stream with a bad Adler-32. Rejected images
+  // are rare enough to decode twice so that both readers agree, and so that
+  // errors are reported once, by the progressive reader.
+  if (result->error == DECODE_ERROR_NONE ||
+    result->error == DECODE_ERROR_TRUNCATED)
+    return decoded;
+  return DecodeProgressive(input, input_size, format, options, output, w, h,
+    result);
+}
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <stddef.h>
+
+#include <functional>
+#include <memory>
 #include <vector>
 
 class PngDecoder
@@ -25,9 +29,170 @@ public:
     FORMAT_SkBitmap
   };
 
+  enum DecodeMode {
+    // Picks the fastest mode that supports the image. The IDAT modes below
+    // fail on damage libpng only warns about, such as a bad Adler-32, so
+    // images they reject go to libpng, and AUTO accepts what
+    // DECODE_MODE_PROGRESSIVE accepts.
+    DECODE_MODE_AUTO,
+
+    // libpng's progressive reader. Handles every image.
+    DECODE_MODE_PROGRESSIVE,
+
+    // Inflates on the calling thread while worker threads unfilter and
+    // convert batches of rows. Meant for very large images. Images that need
+    // gamma correction are decoded with DECODE_MODE_SEQUENTIAL instead, and
+    // with |max_threads| below three, which leaves no room for the pipeline,
+    // images are decoded as with DECODE_MODE_BANDED.
+    DECODE_MODE_PIPELINED,
+
+    // For images written with restart points (see png_restart_points.h):
+    // inflates, unfilters and converts each IDAT segment on its own thread.
+    // Images without restart points are decoded with
+    // DECODE_MODE_SEQUENTIAL instead, and images whose restart points turn
+    // out to be wrong with DECODE_MODE_PIPELINED.
+    DECODE_MODE_SEGMENTED,
+
+    // libpng's sequential reader, fed from the input buffer. Handles every
+    // image, with the same output as DECODE_MODE_PROGRESSIVE but without the
+    // progressive reader's save buffer: libpng's read callback still copies
+    // each piece once into libpng's own buffer, which only the IDAT modes
+    // avoid. The progressive reader only pays off when data arrives in
+    // pieces, which Decode never sees, so DECODE_MODE_AUTO uses this for
+    // images the IDAT modes leave alone. The sequential reader fails on some
+    // damage the progressive one lets pass, such as a bad Adler-32, so images
+    // it rejects are decoded again, and their errors reported, with
+    // DECODE_MODE_PROGRESSIVE.
+    DECODE_MODE_SEQUENTIAL,
+
+    // Inflates IDAT data about 512 KB of filtered rows at a time into a band
+    // buffer, then unfilters and converts each band while it is in cache.
+    // Single-threaded, and avoids libpng's row-at-a-time inflate. Beyond the
+    // band, needs a copy of the compressed data when it spans several IDAT
+    // chunks. Images that need gamma correction are decoded with
+    // DECODE_MODE_SEQUENTIAL instead.
+    DECODE_MODE_BANDED,
+  };
+
+  // Called after each Adam7 pass of an interlaced image with the whole output
+  // image so far. Pixels that later passes will provide are filled in from the
+  // decoded pixel at the top left of their block, giving a coarse preview.
+  // Called for all seven passes, 0 to 6, even those that are empty for small
+  // images; the last call has the complete image.
+  typedef std::function<void(int pass, const unsigned char* pixels,
+    int width, int height)> PassCallback;
+
+  struct DecodeOptions {
+    DecodeOptions();
+
+    DecodeMode mode;
+
+    // Upper bound on the threads used by the multi-threaded modes. 0 means
+    // one per logical processor.
+    int max_threads;
+
+    // Optional; only called for interlaced images.
+    PassCallback pass_callback;
+
+    // When the data ends early or turns out to be corrupt partway through
+    // the image, keep the pixels decoded so far instead of failing. See
+    // DecodeResult. Input that does not end in IEND is then always read with
+    // DECODE_MODE_PROGRESSIVE, which salvages the most rows.
+    bool allow_partial;
+
+    // Shows libpng's errors in a message box, as the viewer always has.
+    // Batch tools turn this off; errors are then only logged.
+    bool error_dialogs;
+  };
+
+  enum DecodeError {
+    DECODE_ERROR_NONE,
+
+    // Not a PNG, or the header was rejected. There are no pixels.
+    DECODE_ERROR_INVALID,
+
+    // The data ended before the image did.
+    DECODE_ERROR_TRUNCATED,
+
+    // libpng hit an error partway through the image, e.g. a bad chunk CRC or
+    // invalid deflate data.
+    DECODE_ERROR_CORRUPT,
+  };
+
+  struct DecodeResult {
+    DecodeResult();
+
+    DecodeError error;
+
+    // Number of rows, from the top, that hold their final pixels. For an
+    // interlaced image, rows fill in only during the last pass; the rest of
+    // the image holds whatever earlier passes provided.
+    int rows_decoded;
+  };
+
+  // DECODE_MODE_PIPELINED, DECODE_MODE_SEGMENTED and DECODE_MODE_BANDED all
+  // decode interlaced images with the same dedicated single-threaded
+  // deinterlacer, and DECODE_MODE_AUTO always does.
+  // Otherwise, in DECODE_MODE_AUTO, images with restart points use
+  // DECODE_MODE_SEGMENTED when more than one core is available, and images
+  // with at least this many pixels DECODE_MODE_PIPELINED when three are.
+  // All other images use DECODE_MODE_BANDED.
+  static constexpr unsigned long long kPipelinedDecodeMinPixels =
+    16 * 1024 * 1024;
+
 
   static bool Decode(const unsigned char* input, size_t input_size,
     ColorFormat format, std::vector<unsigned char>* output,
     int* w, int* h);
 
+  // With |options.allow_partial|, also returns true for a truncated or
+  // corrupt image once its header has been read: |output|, |w| and |h|
+  // describe the full image, with rows past |result->rows_decoded| left
+  // transparent black or partly filled. |result| is optional.
+  static bool Decode(const unsigned char* input, size_t input_size,
+    ColorFormat format, const DecodeOptions& options,
+    std::vector<unsigned char>* output, int* w, int* h,
+    DecodeResult* result = nullptr);
+
+};
+
+// Decodes a PNG whose bytes arrive a piece at a time, e.g. as they are
+// inflated from a zip entry or read from a socket, so the file never has to
+// be held whole. Uses libpng's progressive reader, with the same output as
+// PngDecoder::Decode() in DECODE_MODE_PROGRESSIVE.
+//
+//   PngStreamDecoder decoder(PngDecoder::FORMAT_RGBA, options, &pixels);
+//   while (!decoder.done() && ReadSome(buffer, &size)) {
+//     if (!decoder.Feed(buffer, size))
+//       break;
+//   }
+//   if (!decoder.Finish(&w, &h))
+//     ...
+class PngStreamDecoder {
+public:
+  // Decodes into |output|, which must outlive the decoder. |options.mode| and
+  // |options.max_threads| are ignored.
+  PngStreamDecoder(PngDecoder::ColorFormat format,
+    const PngDecoder::DecodeOptions& options,
+    std::vector<unsigned char>* output);
+  ~PngStreamDecoder();
+
+  // Decodes the next |size| bytes. Returns false once the data is known to
+  // be bad, after which further calls do nothing; Finish() tells what was
+  // salvaged. Bytes after the IEND chunk are ignored.
+  bool Feed(const unsigned char* data, size_t size);
+
+  // True once the IEND chunk has been read.
+  bool done() const;
+
+  // Call once the data has all been fed. Same results as PngDecoder::Decode(),
+  // including truncated and corrupt images with |options.allow_partial|,
+  // except that how much of a corrupt image is salvaged can depend on how
+  // its data was split.
+  bool Finish(int* w, int* h, PngDecoder::DecodeResult* result = nullptr);
+
+private:
+  class Reader;
+
+  std::unique_ptr<Reader> reader_;
 };
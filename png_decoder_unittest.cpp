@@ -0,0 +1,221 @@
+#include "stdafx.h"
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "png_chunk_reader.h"
+#include "png_decoder.h"
+#include "png_encoder.h"
+#include "png_restart_points.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/zlib/zlib.h"
+
+CAppModule _Module;
+
+namespace {
+
+const PngDecoder::DecodeMode kIdatModes[] = {
+  PngDecoder::DECODE_MODE_PIPELINED,
+  PngDecoder::DECODE_MODE_SEGMENTED,
+  PngDecoder::DECODE_MODE_BANDED,
+};
+
+// Adam7 pass origins and steps: x0, y0, dx, dy.
+const int kAdam7[7][4] = {
+  { 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 },
+  { 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 },
+};
+
+void AppendUint32(uint32_t value, std::vector<unsigned char>* out) {
+  for (int shift = 24; shift >= 0; shift -= 8)
+    out->push_back(static_cast<unsigned char>(value >> shift));
+}
+
+void AppendChunk(const char* type, const std::vector<unsigned char>& data,
+  std::vector<unsigned char>* png) {
+  AppendUint32(static_cast<uint32_t>(data.size()), png);
+  const size_t start = png->size();
+  png->insert(png->end(), type, type + 4);
+  png->insert(png->end(), data.begin(), data.end());
+  AppendUint32(static_cast<uint32_t>(crc32(0, &(*png)[start],
+    static_cast<uInt>(png->size() - start))), png);
+}
+
+// An RGBA image whose neighbouring pixels all differ.
+std::vector<unsigned char> MakePixels(int w, int h) {
+  std::vector<unsigned char> pixels(static_cast<size_t>(w) * h * 4);
+  for (int y = 0; y < h; ++y) {
+    for (int x = 0; x < w; ++x) {
+      unsigned char* p = &pixels[(static_cast<size_t>(y) * w + x) * 4];
+      p[0] = static_cast<unsigned char>(x * 7 + y * 3);
+      p[1] = static_cast<unsigned char>(x * y);
+      p[2] = static_cast<unsigned char>(255 - x * 5);
+      p[3] = static_cast<unsigned char>(128 + y);
+    }
+  }
+  return pixels;
+}
+
+// Writes |pixels| as an 8-bit RGBA PNG with unfiltered rows, by hand, since
+// PngEncoder has no interlaced output. Drops the last |cut| bytes of the
+// zlib stream.
+std::vector<unsigned char> MakePng(int w, int h, bool interlaced,
+  const std::vector<unsigned char>& pixels, size_t cut) {
+  std::vector<unsigned char> raw;
+  for (int pass = interlaced ? 0 : 6; pass < 7; ++pass) {
+    const int x0 = interlaced ? kAdam7[pass][0] : 0;
+    const int y0 = interlaced ? kAdam7[pass][1] : 0;
+    const int dx = interlaced ? kAdam7[pass][2] : 1;
+    const int dy = interlaced ? kAdam7[pass][3] : 1;
+    if (x0 >= w)
+      continue;
+    for (int y = y0; y < h; y += dy) {
+      raw.push_back(0);
+      for (int x = x0; x < w; x += dx) {
+        const unsigned char* p =
+          &pixels[(static_cast<size_t>(y) * w + x) * 4];
+        raw.insert(raw.end(), p, p + 4);
+      }
+    }
+  }
+
+  uLongf size = compressBound(static_cast<uLong>(raw.size()));
+  std::vector<unsigned char> idat(size);
+  EXPECT_EQ(Z_OK, compress2(idat.data(), &size, raw.data(),
+    static_cast<uLong>(raw.size()), 6));
+  idat.resize(size - cut);
+
+  static const unsigned char kSignature[8] = {
+    0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n',
+  };
+  std::vector<unsigned char> png(kSignature, kSignature + 8);
+  std::vector<unsigned char> ihdr;
+  AppendUint32(w, &ihdr);
+  AppendUint32(h, &ihdr);
+  const unsigned char fields[] = { 8, 6, 0, 0, interlaced ? 1 : 0 };
+  ihdr.insert(ihdr.end(), fields, fields + sizeof(fields));
+  AppendChunk("IHDR", ihdr, &png);
+  AppendChunk("IDAT", idat, &png);
+  AppendChunk("IEND", std::vector<unsigned char>(), &png);
+  return png;
+}
+
+bool Decode(const std::vector<unsigned char>& png,
+  PngDecoder::DecodeMode mode, std::vector<unsigned char>* pixels,
+  PngDecoder::DecodeResult* result, int threads = 4) {
+  PngDecoder::DecodeOptions options;
+  options.mode = mode;
+  options.max_threads = threads;
+  int w = 0;
+  int h = 0;
+  return PngDecoder::Decode(png.data(), png.size(), PngDecoder::FORMAT_RGBA,
+    options, pixels, &w, &h, result);
+}
+
+}  // namespace
+
+TEST(PngDecoderTest, Interlaced) {
+  const std::vector<unsigned char> pixels = MakePixels(37, 23);
+  const std::vector<unsigned char> png = MakePng(37, 23, true, pixels, 0);
+  for (PngDecoder::DecodeMode mode : kIdatModes) {
+    std::vector<unsigned char> decoded;
+    PngDecoder::DecodeResult result;
+    EXPECT_TRUE(Decode(png, mode, &decoded, &result)) << mode;
+    EXPECT_EQ(pixels, decoded) << mode;
+  }
+}
+
+// Every row is there, but the zlib stream stops before its Adler-32.
+TEST(PngDecoderTest, InterlacedTruncatedIdat) {
+  const std::vector<unsigned char> png =
+    MakePng(37, 23, true, MakePixels(37, 23), 4);
+  for (PngDecoder::DecodeMode mode : kIdatModes) {
+    std::vector<unsigned char> decoded;
+    PngDecoder::DecodeResult result;
+    EXPECT_FALSE(Decode(png, mode, &decoded, &result)) << mode;
+    EXPECT_EQ(PngDecoder::DECODE_ERROR_CORRUPT, result.error) << mode;
+    EXPECT_TRUE(decoded.empty()) << mode;
+  }
+
+  // DECODE_MODE_AUTO leaves the verdict to libpng.
+  std::vector<unsigned char> progressive;
+  PngDecoder::DecodeResult progressive_result;
+  const bool progressive_ok = Decode(png, PngDecoder::DECODE_MODE_PROGRESSIVE,
+    &progressive, &progressive_result);
+  std::vector<unsigned char> decoded;
+  PngDecoder::DecodeResult result;
+  EXPECT_EQ(progressive_ok,
+    Decode(png, PngDecoder::DECODE_MODE_AUTO, &decoded, &result));
+  EXPECT_EQ(progressive_result.error, result.error);
+  EXPECT_EQ(progressive, decoded);
+}
+
+// Below three threads the pipeline has no room and decodes single-threaded.
+TEST(PngDecoderTest, PipelinedFewThreads) {
+  const std::vector<unsigned char> pixels = MakePixels(301, 157);
+  const std::vector<unsigned char> png = MakePng(301, 157, false, pixels, 0);
+  for (int threads = 1; threads <= 3; ++threads) {
+    std::vector<unsigned char> decoded;
+    PngDecoder::DecodeResult result;
+    EXPECT_TRUE(Decode(png, PngDecoder::DECODE_MODE_PIPELINED, &decoded,
+      &result, threads)) << threads;
+    EXPECT_EQ(pixels, decoded) << threads;
+  }
+}
+
+// Tall enough for several of DECODE_MODE_BANDED's bands.
+TEST(PngDecoderTest, BandedMatchesProgressive) {
+  const std::vector<unsigned char> pixels = MakePixels(700, 900);
+  const std::vector<unsigned char> png = MakePng(700, 900, false, pixels, 0);
+  std::vector<unsigned char> progressive;
+  PngDecoder::DecodeResult progressive_result;
+  ASSERT_TRUE(Decode(png, PngDecoder::DECODE_MODE_PROGRESSIVE, &progressive,
+    &progressive_result));
+  EXPECT_EQ(pixels, progressive);
+
+  std::vector<unsigned char> banded;
+  PngDecoder::DecodeResult result;
+  EXPECT_TRUE(Decode(png, PngDecoder::DECODE_MODE_BANDED, &banded, &result));
+  EXPECT_EQ(progressive, banded);
+  EXPECT_EQ(900, result.rows_decoded);
+}
+
+TEST(PngDecoderTest, EncodedRestartPoints) {
+  const std::vector<unsigned char> pixels = MakePixels(301, 157);
+  PngEncoder::EncodeOptions options;
+  options.restart_rows = 16;
+  std::vector<unsigned char> png;
+  ASSERT_TRUE(PngEncoder::Encode(pixels.data(), 301 * 4,
+    PngDecoder::FORMAT_RGBA, 301, 157, options, &png));
+
+  PngChunkReader reader;
+  ASSERT_TRUE(reader.Parse(png.data(), png.size()));
+  EXPECT_EQ(10u, reader.restart_points().size());
+
+  std::vector<unsigned char> decoded;
+  PngDecoder::DecodeResult result;
+  EXPECT_TRUE(Decode(png, PngDecoder::DECODE_MODE_SEGMENTED, &decoded,
+    &result));
+  EXPECT_EQ(pixels, decoded);
+}
+
+// The rows are all there, but the stream has no Adler-32.
+TEST(PngDecoderTest, AddRestartPointsTruncatedIdat) {
+  const std::vector<unsigned char> png =
+    MakePng(301, 157, false, MakePixels(301, 157), 4);
+  std::vector<unsigned char> output;
+  EXPECT_FALSE(AddPngRestartPoints(png.data(), png.size(), 16, 6, &output));
+  EXPECT_TRUE(output.empty());
+
+  const std::vector<unsigned char> whole =
+    MakePng(301, 157, false, MakePixels(301, 157), 0);
+  ASSERT_TRUE(AddPngRestartPoints(whole.data(), whole.size(), 16, 6,
+    &output));
+  std::vector<unsigned char> decoded;
+  PngDecoder::DecodeResult result;
+  EXPECT_TRUE(Decode(output, PngDecoder::DECODE_MODE_SEGMENTED, &decoded,
+    &result));
+  EXPECT_EQ(MakePixels(301, 157), decoded);
+}
@@ -0,0 +1,100 @@
+#include "stdafx.h"
+#include "png_deinterlace.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define PNG_DEINTERLACE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+struct Adam7Pass {
+  uint32_t x0, y0, dx, dy;
+  // Size of the block each decoded pixel stands for once this pass is done.
+  uint32_t block_width, block_height;
+};
+
+const Adam7Pass kAdam7Passes[7] = {
+  { 0, 0, 8, 8, 8, 8 },
+  { 4, 0, 8, 8, 4, 8 },
+  { 0, 4, 4, 8, 4, 4 },
+  { 2, 0, 4, 4, 2, 4 },
+  { 0, 2, 2, 4, 2, 2 },
+  { 1, 0, 2, 2, 1, 2 },
+  { 0, 1, 1, 2, 1, 1 },
+};
+
+}  // namespace
+
+uint32_t Adam7PassWidth(int pass, uint32_t width) {
+  const Adam7Pass& p = kAdam7Passes[pass];
+  return width > p.x0 ? (width - p.x0 + p.dx - 1) / p.dx : 0;
+}
+
+uint32_t Adam7PassHeight(int pass, uint32_t height) {
+  const Adam7Pass& p = kAdam7Passes[pass];
+  return height > p.y0 ? (height - p.y0 + p.dy - 1) / p.dy : 0;
+}
+
+uint32_t Adam7PassRowToImageRow(int pass, uint32_t pass_row) {
+  return kAdam7Passes[pass].y0 + pass_row * kAdam7Passes[pass].dy;
+}
+
+void ScatterAdam7Row(int pass, const uint32_t* src, uint32_t count,
+  uint32_t width, uint32_t* dst_row) {
+  const Adam7Pass& p = kAdam7Passes[pass];
+  if (p.dx == 1) {
+    memcpy(dst_row, src, count * sizeof(uint32_t));
+    return;
+  }
+
+  uint32_t i = 0;
+#if defined(PNG_DEINTERLACE_SSE2)
+  if (p.dx == 2) {
+    // Two source pixels cover four destination pixels. Pass 4 owns the even
+    // columns and may clobber the odd ones, which pass 5 writes later; pass 5
+    // must blend around the even columns.
+    const __m128i keep_even = _mm_set_epi32(0, -1, 0, -1);
+    for (; i + 2 <= count && 2 * i + 4 <= width; i += 2) {
+      const __m128i pair =
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i));
+      const __m128i doubled = _mm_unpacklo_epi32(pair, pair);
+      __m128i* dst = reinterpret_cast<__m128i*>(dst_row + 2 * i);
+      if (p.x0 == 0) {
+        _mm_storeu_si128(dst, doubled);
+      }
+      else {
+        const __m128i existing = _mm_loadu_si128(dst);
+        _mm_storeu_si128(dst, _mm_or_si128(_mm_and_si128(keep_even, existing),
+          _mm_andnot_si128(keep_even, doubled)));
+      }
+    }
+  }
+#endif
+  for (; i < count; ++i)
+    dst_row[p.x0 + i * p.dx] = src[i];
+}
+
+void ReplicateAdam7Pass(int pass, uint32_t width, uint32_t height,
+  uint32_t* pixels) {
+  const uint32_t block_width = kAdam7Passes[pass].block_width;
+  const uint32_t block_height = kAdam7Passes[pass].block_height;
+  for (uint32_t y = 0; y < height; y += block_height) {
+    uint32_t* row = pixels + static_cast<size_t>(y) * width;
+    if (block_width > 1) {
+      for (uint32_t x = 0; x < width; x += block_width) {
+        const uint32_t end = std::min(x + block_width, width);
+        std::fill(row + x + 1, row + end, row[x]);
+      }
+    }
+    const uint32_t end_y = std::min(y + block_height, height);
+    for (uint32_t fill_y = y + 1; fill_y < end_y; ++fill_y) {
+      memcpy(pixels + static_cast<size_t>(fill_y) * width, row,
+        width * sizeof(uint32_t));
+    }
+  }
+}
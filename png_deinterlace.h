@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+// Adam7 helpers for 4-byte output pixels. Passes are numbered 0 to 6, as in
+// libpng.
+
+// Number of pixels per row, and rows, that |pass| contributes to an image of
+// the given size. Either is 0 when the pass is empty.
+uint32_t Adam7PassWidth(int pass, uint32_t width);
+uint32_t Adam7PassHeight(int pass, uint32_t height);
+
+// Output row that row |pass_row| of |pass| belongs to.
+uint32_t Adam7PassRowToImageRow(int pass, uint32_t pass_row);
+
+// Stores the |count| pixels of one row of |pass| at their columns in
+// |dst_row|, which is |width| pixels wide. Pixels owned by earlier passes are
+// preserved; pixels owned by later passes may be overwritten. The two-column
+// passes, which together with the full-width last pass carry most of the
+// image, use SSE2.
+void ScatterAdam7Row(int pass, const uint32_t* src, uint32_t count,
+  uint32_t width, uint32_t* dst_row);
+
+// Once |pass| has been decoded into |pixels|, fills every pixel that a later
+// pass owns with the decoded pixel at the top left of its Adam7 block, so the
+// image can be shown as a coarse preview. Later passes overwrite the
+// placeholders with the real values.
+void ReplicateAdam7Pass(int pass, uint32_t width, uint32_t height,
+  uint32_t* pixels);
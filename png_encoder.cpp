@@ -0,0 +1,286 @@
+#include "stdafx.h"
+#include "png_encoder.h"
+
+#include <setjmp.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "logging.h"
+#include "png_color_reduction.h"
+#include "png_idat_encoder.h"
+#include "png_quantizer.h"
+#include "png_restart_points.h"
+#include "png_zlib_pool.h"
+
+#include "third_party/libpng/png.h"
+#include "third_party/zlib/zlib.h"
+
+namespace {
+
+// Same bound as the decoder: w * h * 4 must fit a signed int.
+const unsigned long long kMaxPixels = (1 << 29) - 1;
+
+// Holds png write struct and info ensuring the proper destruction.
+class PngWriteStructInfo {
+public:
+  PngWriteStructInfo() : png_ptr_(nullptr), info_ptr_(nullptr) {
+  }
+  ~PngWriteStructInfo() {
+    png_destroy_write_struct(&png_ptr_, &info_ptr_);
+  }
+
+  bool Build() {
+    png_ptr_ = png_create_write_struct_2(PNG_LIBPNG_VER_STRING, NULL, NULL,
+      NULL, NULL, PngPoolMalloc, PngPoolFree);
+    if (!png_ptr_)
+      return false;
+    info_ptr_ = png_create_info_struct(png_ptr_);
+    return info_ptr_ != nullptr;
+  }
+
+  png_struct* png_ptr_;
+  png_info* info_ptr_;
+};
+
+void LogLibPNGEncodeError(png_structp png_ptr, png_const_charp error_msg) {
+  PNG_LOG("libpng encode error: %s\n", error_msg);
+  longjmp(png_jmpbuf(png_ptr), 1);
+}
+
+void LogLibPNGEncodeWarning(png_structp png_ptr, png_const_charp warning_msg) {
+  PNG_LOG("libpng encode warning: %s\n", warning_msg);
+}
+
+void WriteToVector(png_structp png_ptr, png_bytep data, png_size_t size) {
+  std::vector<unsigned char>* output =
+    static_cast<std::vector<unsigned char>*>(png_get_io_ptr(png_ptr));
+  output->insert(output->end(), data, data + size);
+}
+
+void FlushVector(png_structp png_ptr) {
+}
+
+const uint32_t kIDAT = 0x49444154;
+const uint32_t kIEND = 0x49454e44;
+
+// libpng's IDAT size when none is set.
+const size_t kDefaultIdatChunkSize = 8192;
+
+// libpng shrinks the deflate window for images with up to this many bytes of
+// filtered data; those are left to it so that the output stays the same.
+const size_t kLibpngSmallImageBytes = 16384;
+
+int ResolveThreadCount(const PngEncoder::EncodeOptions& options) {
+  if (options.max_threads > 0)
+    return options.max_threads;
+  const unsigned cores = std::thread::hardware_concurrency();
+  return cores > 0 ? static_cast<int>(cores) : 1;
+}
+
+}  // namespace
+
+int ToLibPNGFilters(int filters) {
+  int png_filters = 0;
+  if (filters & PngEncoder::FILTER_NONE)
+    png_filters |= PNG_FILTER_NONE;
+  if (filters & PngEncoder::FILTER_SUB)
+    png_filters |= PNG_FILTER_SUB;
+  if (filters & PngEncoder::FILTER_UP)
+    png_filters |= PNG_FILTER_UP;
+  if (filters & PngEncoder::FILTER_AVG)
+    png_filters |= PNG_FILTER_AVG;
+  if (filters & PngEncoder::FILTER_PAETH)
+    png_filters |= PNG_FILTER_PAETH;
+  return png_filters;
+}
+
+PngEncoder::Comment::Comment(const std::string& key, const std::string& text)
+  : key(key),
+  text(text) {
+}
+
+PngEncoder::Comment::~Comment() {
+}
+
+PngEncoder::EncodeOptions::EncodeOptions()
+  : zlib_level(PngDecoder::DEFAULT_ZLIB_COMPRESSION),
+  zlib_strategy(Z_DEFAULT_STRATEGY),
+  filters(FILTER_ALL),
+  discard_transparency(false),
+  idat_chunk_size(0),
+  write_srgb(false),
+  max_threads(1),
+  restart_rows(0),
+  fast_deflate(false),
+  auto_tune(false),
+  reduce_colors(false),
+  max_colors(0),
+  dither(false) {
+}
+
+PngEncoder::EncodeOptions::~EncodeOptions() {
+}
+
+bool PngEncoder::Encode(const unsigned char* pixels, size_t stride,
+  ColorFormat format, int w, int h, const EncodeOptions& options,
+  std::vector<unsigned char>* output) {
+  if (w <= 0 || h <= 0 || stride < static_cast<size_t>(w) * 4 ||
+    static_cast<unsigned long long>(w) * h > kMaxPixels)
+    return false;
+  if (options.zlib_level < 0 || options.zlib_level > 9 ||
+    ToLibPNGFilters(options.filters) == 0 || options.restart_rows < 0)
+    return false;
+  if (options.max_colors < 0 || options.max_colors == 1 ||
+    options.max_colors > 256)
+    return false;
+
+  PngColorReducer reducer(format, options.discard_transparency);
+  if (options.reduce_colors || options.max_colors)
+    reducer.Analyze(pixels, stride, w, h);
+  // Quantize only when the exact colours do not fit.
+  PngQuantizer quantizer;
+  const bool quantize = options.max_colors &&
+    (reducer.color_count() == 0 ||
+      reducer.color_count() > static_cast<size_t>(options.max_colors));
+  if (quantize) {
+    quantizer.Quantize(pixels, stride, format, options.discard_transparency,
+      w, h, options.max_colors, options.dither, ResolveThreadCount(options));
+  }
+  const int color_type = quantize ? PNG_COLOR_TYPE_PALETTE :
+    reducer.color_type();
+  const int bit_depth = quantize ? quantizer.bit_depth() : reducer.bit_depth();
+  const std::vector<unsigned char>& plte = quantize ? quantizer.palette() :
+    reducer.palette();
+  const std::vector<unsigned char>& trns = quantize ? quantizer.trns() :
+    reducer.trns();
+  const size_t row_bytes = quantize ? quantizer.RowBytes() :
+    reducer.RowBytes(w);
+  const int bpp = quantize ? 1 : reducer.FilterBpp();
+  const PngRowSource source = quantize ?
+    PngRowSource([&](uint32_t y, unsigned char* row) {
+      quantizer.PackRow(y, row);
+    }) :
+    PngRowSource([&](uint32_t y, unsigned char* row) {
+      reducer.PackRow(pixels + y * stride, w, row);
+    });
+
+  PngDeflateSettings settings = {
+    options.filters, options.zlib_level, options.zlib_strategy };
+  if (options.fast_deflate) {
+    settings.zlib_level = Z_BEST_SPEED;
+    settings.zlib_strategy = Z_QUICK;
+  }
+  else if (options.auto_tune) {
+    settings = ChooseDeflateSettings(source, row_bytes, bpp, h,
+      options.zlib_level);
+  }
+
+  PngWriteStructInfo si;
+  if (!si.Build())
+    return false;
+
+  std::vector<png_text> text(options.comments.size());
+  for (size_t i = 0; i < text.size(); ++i) {
+    memset(&text[i], 0, sizeof(png_text));
+    text[i].compression = PNG_TEXT_COMPRESSION_NONE;
+    text[i].key = const_cast<png_charp>(options.comments[i].key.c_str());
+    text[i].text = const_cast<png_charp>(options.comments[i].text.c_str());
+    text[i].text_length = options.comments[i].text.size();
+  }
+
+  std::vector<png_color> palette(plte.size() / 3);
+  for (size_t i = 0; i < palette.size(); ++i) {
+    palette[i].red = plte[i * 3];
+    palette[i].green = plte[i * 3 + 1];
+    palette[i].blue = plte[i * 3 + 2];
+  }
+
+  // Declared ahead of setjmp: a longjmp out of libpng skips destructors.
+  std::vector<unsigned char> packed_row;
+
+  const size_t original_size = output->size();
+  if (setjmp(png_jmpbuf(si.png_ptr_))) {
+    output->resize(original_size);
+    return false;
+  }
+
+  png_set_error_fn(si.png_ptr_, NULL,
+    LogLibPNGEncodeError, LogLibPNGEncodeWarning);
+  png_set_write_fn(si.png_ptr_, output, WriteToVector, FlushVector);
+
+  png_set_compression_level(si.png_ptr_, settings.zlib_level);
+  png_set_compression_strategy(si.png_ptr_, settings.zlib_strategy);
+  png_set_filter(si.png_ptr_, PNG_FILTER_TYPE_BASE,
+    ToLibPNGFilters(settings.filter_mask));
+  if (options.idat_chunk_size)
+    png_set_compression_buffer_size(si.png_ptr_, options.idat_chunk_size);
+
+  png_set_IHDR(si.png_ptr_, si.info_ptr_, w, h, bit_depth,
+    color_type, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+    PNG_FILTER_TYPE_DEFAULT);
+  if (!palette.empty()) {
+    png_set_PLTE(si.png_ptr_, si.info_ptr_, palette.data(),
+      static_cast<int>(palette.size()));
+  }
+  if (!trns.empty()) {
+    png_set_tRNS(si.png_ptr_, si.info_ptr_,
+      const_cast<png_bytep>(trns.data()), static_cast<int>(trns.size()),
+      nullptr);
+  }
+  if (options.write_srgb)
+    png_set_sRGB_gAMA_and_cHRM(si.png_ptr_, si.info_ptr_,
+      PNG_sRGB_INTENT_PERCEPTUAL);
+
+  if (!text.empty())
+    png_set_text(si.png_ptr_, si.info_ptr_, text.data(),
+      static_cast<int>(text.size()));
+
+  png_write_info(si.png_ptr_, si.info_ptr_);
+
+  const size_t filtered_bytes = (row_bytes + 1) * h;
+  if (filtered_bytes > kLibpngSmallImageBytes || options.restart_rows) {
+    // libpng has written everything up to the first IDAT; take over from
+    // there, with the SIMD row filters.
+    std::vector<unsigned char> stream;
+    std::vector<PngChunkReader::RestartPoint> points;
+    const int threads = ResolveThreadCount(options);
+    const bool deflated = options.restart_rows ?
+      DeflateRowsWithRestartPoints(source, row_bytes, bpp, h,
+        options.restart_rows, settings, &stream, &points) :
+      threads > 1 && filtered_bytes >= 2 * kParallelDeflateMinBlockBytes ?
+      DeflateRowsParallel(source, row_bytes, bpp, h,
+        settings.filter_mask, settings.zlib_level, settings.zlib_strategy,
+        threads, &stream) :
+      DeflateRows(source, row_bytes, bpp, h, settings.filter_mask,
+        settings.zlib_level, settings.zlib_strategy, &stream);
+    if (!deflated) {
+      output->resize(original_size);
+      return false;
+    }
+    if (!points.empty())
+      AppendRestartPointsChunk(points, output);
+    const size_t chunk_size = options.idat_chunk_size ?
+      options.idat_chunk_size : kDefaultIdatChunkSize;
+    for (size_t pos = 0; pos < stream.size(); pos += chunk_size) {
+      AppendPngChunk(kIDAT, &stream[pos],
+        std::min(chunk_size, stream.size() - pos), output);
+    }
+    AppendPngChunk(kIEND, nullptr, 0, output);
+    return true;
+  }
+
+  // Most images shrink to well under their raw size; saves the first few
+  // reallocations.
+  output->reserve(original_size + row_bytes * h / 2);
+
+  packed_row.resize(row_bytes);
+  for (int y = 0; y < h; ++y) {
+    source(y, packed_row.data());
+    png_write_row(si.png_ptr_, packed_row.data());
+  }
+  png_write_end(si.png_ptr_, si.info_ptr_);
+  return true;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+#include "png_decoder.h"
+
+class PngEncoder
+{
+public:
+  // Same pixel layouts the decoder produces: 4 bytes per pixel, RGBA, BGRA
+  // or premultiplied native-endian ARGB (SkBitmap).
+  typedef PngDecoder::ColorFormat ColorFormat;
+
+  // Row filters libpng may choose from, per row. More choices cost encode
+  // time and usually buy a smaller file.
+  enum FilterMask {
+    FILTER_NONE = 1 << 0,
+    FILTER_SUB = 1 << 1,
+    FILTER_UP = 1 << 2,
+    FILTER_AVG = 1 << 3,
+    FILTER_PAETH = 1 << 4,
+    FILTER_ALL = FILTER_NONE | FILTER_SUB | FILTER_UP | FILTER_AVG |
+      FILTER_PAETH,
+  };
+
+  // A tEXt chunk.
+  struct Comment {
+    Comment(const std::string& key, const std::string& text);
+    ~Comment();
+
+    std::string key;
+    std::string text;
+  };
+
+  struct EncodeOptions {
+    EncodeOptions();
+    ~EncodeOptions();
+
+    // zlib compression level, 0 to 9.
+    int zlib_level;
+
+    // zlib strategy: Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE or
+    // Z_FIXED.
+    int zlib_strategy;
+
+    // FilterMask bits. libpng picks among them per row; a single bit forces
+    // that filter.
+    int filters;
+
+    // Write RGB instead of RGBA, dropping the alpha channel. Only meant for
+    // images known to be opaque.
+    bool discard_transparency;
+
+    // Largest IDAT chunk written; 0 keeps libpng's 8 KB. Bigger chunks save
+    // a little size and per-chunk overhead when decoding.
+    size_t idat_chunk_size;
+
+    // Adds an sRGB chunk.
+    bool write_srgb;
+
+    // Threads to deflate with; 0 means one per logical processor. With more
+    // than one, images of a few megabytes and up are filtered and deflated
+    // in row blocks in parallel (see DeflateRowsParallel), at a cost of
+    // usually well under 1% in file size.
+    int max_threads;
+
+    // Rows per restart point segment (see png_restart_points.h); 0 writes
+    // none. Files with restart points decode their IDAT in parallel with
+    // PngDecoder, at some cost in size for short segments. The image is
+    // then deflated as a single stream, whatever |max_threads|.
+    int restart_rows;
+
+    // Deflate with zlib's Z_QUICK strategy at level 1 instead of
+    // |zlib_level| and |zlib_strategy|: a single hash probe per position,
+    // for real-time captures. Faster than level 1, for bigger files.
+    bool fast_deflate;
+
+    // Picks the filters, zlib strategy and level from a sample of the rows
+    // (see ChooseDeflateSettings), overriding |filters| and |zlib_strategy|;
+    // |zlib_level| becomes the highest level used. Costs a fraction of an
+    // encode. Ignored with |fast_deflate|.
+    bool auto_tune;
+
+    // Writes the narrowest colour type that holds the image exactly: gray,
+    // gray with alpha, RGB, or a palette with tRNS for up to 256 colours,
+    // at the lowest bit depth that fits (see PngColorReducer). Costs one
+    // extra pass over the pixels.
+    bool reduce_colors;
+
+    // Lossy: quantizes images with more than |max_colors| colours, 2 to 256,
+    // to a palette of that size (see PngQuantizer), with alpha through tRNS;
+    // images with fewer are written exactly as with |reduce_colors|. 0 keeps
+    // every colour. Meant for thumbnails and previews, where it typically
+    // halves the file for a comparable encode time.
+    int max_colors;
+
+    // Floyd-Steinberg dithers quantized images, trading smooth gradients for
+    // noise that deflates less well. Single-threaded.
+    bool dither;
+
+    std::vector<Comment> comments;
+  };
+
+  // Encodes a |w| x |h| image whose rows start |stride| bytes apart at
+  // |pixels|, appending the PNG to |output|. libpng writes the chunks before
+  // the IDAT. Past 16 KB of image data, or with |restart_rows|, the rows
+  // are then filtered with the SIMD filters of png_row_filter.h and deflated
+  // here, giving the same file libpng would have written when
+  // single-threaded and without restart points; smaller images go through
+  // png_write_row. Either way PngColorReducer, or PngQuantizer with
+  // |max_colors|, packs the rows.
+  // Returns false, leaving |output| as it was, on bad arguments or an encode
+  // error.
+  static bool Encode(const unsigned char* pixels, size_t stride,
+    ColorFormat format, int w, int h, const EncodeOptions& options,
+    std::vector<unsigned char>* output);
+};
+
+// libpng's PNG_FILTER_* bits for PngEncoder::FilterMask bits |filters|, for
+// png_set_filter(). 0 if none are set.
+int ToLibPNGFilters(int filters);
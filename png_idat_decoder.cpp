@@ -0,0 +1,600 @@
+#include "stdafx.h"
+#include "png_idat_decoder.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <thread>
+
+#include "logging.h"
+#include "png_deinterlace.h"
+#include "png_parallel.h"
+#include "png_row_converter.h"
+#include "png_row_filter.h"
+#include "png_zlib_pool.h"
+
+namespace {
+
+// Same bound as DecodeInfoCallback: w * h * 4 must fit in a signed int.
+const uint64_t kMaxPixels = (1 << 29) - 1;
+
+// Rows handed between pipeline stages at a time. Big enough to amortize the
+// hand-off, small enough that a slot stays in L2 for wide images.
+const uint32_t kPipelineRowsPerBatch = 16;
+
+// Filtered bytes DecodePngBanded inflates per call: enough to keep inflate
+// in its fast loop, small enough to stay in L2 until unfiltered.
+const size_t kBandBytes = 512 * 1024;
+
+// One batch of filtered rows moving through the pipeline. |stamp| says which
+// stage owns it: for batch b living in this slot, 3b means free for the
+// inflater, 3b + 1 inflated, 3b + 2 unfiltered. The converter that finishes
+// batch b hands the slot on to batch b + slot count.
+struct PipelineSlot {
+  std::atomic<uint64_t> stamp;
+  std::unique_ptr<unsigned char[]> rows;
+};
+
+bool WaitForStamp(const std::atomic<uint64_t>& stamp, uint64_t expected,
+  const std::atomic<bool>& failed) {
+  int spins = 0;
+  while (stamp.load(std::memory_order_acquire) != expected) {
+    if (failed.load(std::memory_order_relaxed))
+      return false;
+    if (++spins > 64)
+      std::this_thread::yield();
+  }
+  return true;
+}
+
+bool WaitForFlag(const std::atomic<bool>& flag,
+  const std::atomic<bool>& failed) {
+  int spins = 0;
+  while (!flag.load(std::memory_order_acquire)) {
+    if (failed.load(std::memory_order_relaxed))
+      return false;
+    if (++spins > 64)
+      std::this_thread::yield();
+  }
+  return true;
+}
+
+// Reads the big-endian Adler-32 that follows the deflate data.
+bool ReadStreamAdler(const std::vector<PngChunkReader::Span>& spans,
+  size_t offset, uLong* adler) {
+  unsigned char bytes[4];
+  if (!CopyIdatBytes(spans, offset, 4, bytes))
+    return false;
+  *adler = (static_cast<uLong>(bytes[0]) << 24) |
+    (static_cast<uLong>(bytes[1]) << 16) |
+    (static_cast<uLong>(bytes[2]) << 8) | bytes[3];
+  return true;
+}
+
+// The zlib header must announce deflate without a preset dictionary.
+bool ZlibHeaderIsValid(const std::vector<PngChunkReader::Span>& spans) {
+  unsigned char header[2];
+  if (!CopyIdatBytes(spans, 0, 2, header))
+    return false;
+  return (header[0] & 0x0f) == Z_DEFLATED && (header[0] >> 4) <= 7 &&
+    (header[1] & 0x20) == 0 && ((header[0] << 8) | header[1]) % 31 == 0;
+}
+
+}  // namespace
+
+IdatInflater::IdatInflater(const std::vector<PngChunkReader::Span>& spans)
+  : spans_(spans),
+  next_span_(0),
+  start_offset_(0),
+  initialized_(false) {
+  memset(&stream_, 0, sizeof(stream_));
+  UsePngZlibPool(&stream_);
+}
+
+IdatInflater::~IdatInflater() {
+  if (initialized_)
+    inflateEnd(&stream_);
+}
+
+bool IdatInflater::Init() {
+  initialized_ = inflateInit(&stream_) == Z_OK;
+  return initialized_;
+}
+
+bool IdatInflater::InitAtRestartPoint(size_t stream_offset) {
+  // Restart point 0 is the start of the zlib stream; skip its header.
+  if (stream_offset == 0)
+    stream_offset = 2;
+  start_offset_ = stream_offset;
+  if (!Seek(stream_offset))
+    return false;
+  initialized_ = inflateInit2(&stream_, -MAX_WBITS) == Z_OK;
+  return initialized_;
+}
+
+bool IdatInflater::Seek(size_t stream_offset) {
+  for (next_span_ = 0; next_span_ < spans_.size(); ++next_span_) {
+    const PngChunkReader::Span& span = spans_[next_span_];
+    if (stream_offset < span.size) {
+      stream_.next_in = const_cast<unsigned char*>(span.data) + stream_offset;
+      stream_.avail_in = static_cast<uInt>(span.size - stream_offset);
+      ++next_span_;
+      return true;
+    }
+    stream_offset -= span.size;
+  }
+  return false;
+}
+
+bool IdatInflater::NextSpan() {
+  while (next_span_ < spans_.size() && spans_[next_span_].size == 0)
+    ++next_span_;
+  if (next_span_ == spans_.size())
+    return false;
+  stream_.next_in = const_cast<unsigned char*>(spans_[next_span_].data);
+  stream_.avail_in = static_cast<uInt>(spans_[next_span_].size);
+  ++next_span_;
+  return true;
+}
+
+bool IdatInflater::Read(unsigned char* out, size_t size) {
+  while (size > 0) {
+    const uInt chunk = static_cast<uInt>(std::min<size_t>(size, 1u << 30));
+    stream_.next_out = out;
+    stream_.avail_out = chunk;
+    while (stream_.avail_out > 0) {
+      if (stream_.avail_in == 0 && !NextSpan())
+        return false;
+      const int ret = inflate(&stream_, Z_NO_FLUSH);
+      if (ret == Z_STREAM_END && stream_.avail_out > 0)
+        return false;
+      if (ret != Z_OK && ret != Z_STREAM_END) {
+        PNG_LOG("IdatInflater: inflate error %d\n", ret);
+        return false;
+      }
+    }
+    out += chunk;
+    size -= chunk;
+  }
+  return true;
+}
+
+bool IdatInflater::Finish(uLong* adler, size_t* end_offset) {
+  // libpng only warns about surplus data after the last row, so accept it,
+  // but it is still covered by the checksum.
+  // Read() may already have reached the end, in which case inflate() just
+  // says so again.
+  unsigned char scratch[256];
+  for (;;) {
+    stream_.next_out = scratch;
+    stream_.avail_out = sizeof(scratch);
+    const int ret = inflate(&stream_, Z_NO_FLUSH);
+    *adler = adler32(*adler, scratch, sizeof(scratch) - stream_.avail_out);
+    if (ret == Z_STREAM_END)
+      break;
+    if (ret == Z_BUF_ERROR && stream_.avail_in == 0) {
+      if (!NextSpan())
+        return false;
+      continue;
+    }
+    if (ret != Z_OK) {
+      PNG_LOG("IdatInflater: inflate error %d\n", ret);
+      return false;
+    }
+  }
+  *end_offset = start_offset_ + stream_.total_in;
+  return true;
+}
+
+bool CopyIdatBytes(const std::vector<PngChunkReader::Span>& spans,
+  size_t stream_offset, size_t size, unsigned char* out) {
+  for (const PngChunkReader::Span& span : spans) {
+    if (size == 0)
+      break;
+    if (stream_offset >= span.size) {
+      stream_offset -= span.size;
+      continue;
+    }
+    const size_t n = std::min(size, span.size - stream_offset);
+    memcpy(out, span.data + stream_offset, n);
+    out += n;
+    size -= n;
+    stream_offset = 0;
+  }
+  return size == 0;
+}
+
+PngIdatDecodeResult DecodePngPipelined(const PngChunkReader& reader,
+  PngDecoder::ColorFormat format, int threads,
+  std::vector<unsigned char>* output) {
+  // The pipeline needs the calling thread, the unfilter thread and at least
+  // one converter.
+  if (threads < 3)
+    return DecodePngBanded(reader, format, output);
+
+  const PngChunkReader::Header& header = reader.header();
+  if (header.interlace_type != 0)
+    return PNG_IDAT_DECODE_UNSUPPORTED;
+  if (static_cast<uint64_t>(header.width) * header.height > kMaxPixels)
+    return PNG_IDAT_DECODE_FAILED;
+
+  PngRowConverter converter;
+  if (!converter.Init(reader, format))
+    return PNG_IDAT_DECODE_UNSUPPORTED;
+
+  IdatInflater inflater(reader.idat());
+  if (!inflater.Init())
+    return PNG_IDAT_DECODE_FAILED;
+
+  const uint32_t width = header.width;
+  const uint32_t height = header.height;
+  const size_t row_bytes = reader.RowBytes(width);
+  const size_t stride = row_bytes + 1;
+  const int bpp = reader.FilterBpp();
+  const size_t out_stride = static_cast<size_t>(width) * 4;
+  const uint64_t batch_count =
+    (height + kPipelineRowsPerBatch - 1) / kPipelineRowsPerBatch;
+
+  const int convert_threads = threads - 2;
+  const size_t slot_count = 2 * convert_threads + 2;
+  std::unique_ptr<PipelineSlot[]> slots(new PipelineSlot[slot_count]);
+  for (size_t i = 0; i < slot_count; ++i) {
+    slots[i].stamp.store(3 * i, std::memory_order_relaxed);
+    slots[i].rows.reset(new unsigned char[kPipelineRowsPerBatch * stride]);
+  }
+
+  output->resize(out_stride * height);
+  unsigned char* const out = output->data();
+
+  std::atomic<bool> failed(false);
+  std::atomic<uint64_t> next_convert(0);
+
+  auto rows_in_batch = [height](uint64_t batch) {
+    return std::min<uint32_t>(kPipelineRowsPerBatch,
+      height - static_cast<uint32_t>(batch) * kPipelineRowsPerBatch);
+  };
+
+  // Unfiltering is inherently sequential: each row depends on the one above.
+  std::thread unfilter_thread([&]() {
+    std::unique_ptr<unsigned char[]> prev_copy(new unsigned char[row_bytes]);
+    const unsigned char* prev = nullptr;
+    for (uint64_t b = 0; b < batch_count; ++b) {
+      PipelineSlot& slot = slots[b % slot_count];
+      if (!WaitForStamp(slot.stamp, 3 * b + 1, failed))
+        return;
+      const uint32_t rows = rows_in_batch(b);
+      for (uint32_t r = 0; r < rows; ++r) {
+        unsigned char* row = &slot.rows[r * stride];
+        if (!UnfilterPngRow(row[0], bpp, row_bytes, prev, row + 1)) {
+          failed.store(true);
+          return;
+        }
+        prev = row + 1;
+      }
+      // The slot may be recycled before the next batch is unfiltered.
+      memcpy(prev_copy.get(), prev, row_bytes);
+      prev = prev_copy.get();
+      slot.stamp.store(3 * b + 2, std::memory_order_release);
+    }
+  });
+
+  std::vector<std::thread> convert_pool;
+  for (int i = 0; i < convert_threads; ++i) {
+    convert_pool.emplace_back([&]() {
+      for (;;) {
+        const uint64_t b = next_convert.fetch_add(1);
+        if (b >= batch_count)
+          return;
+        PipelineSlot& slot = slots[b % slot_count];
+        if (!WaitForStamp(slot.stamp, 3 * b + 2, failed))
+          return;
+        const uint32_t rows = rows_in_batch(b);
+        unsigned char* dest = out + b * kPipelineRowsPerBatch * out_stride;
+        for (uint32_t r = 0; r < rows; ++r)
+          converter.ConvertRow(&slot.rows[r * stride + 1], width,
+            dest + r * out_stride);
+        slot.stamp.store(3 * (b + slot_count), std::memory_order_release);
+      }
+    });
+  }
+
+  for (uint64_t b = 0; b < batch_count; ++b) {
+    PipelineSlot& slot = slots[b % slot_count];
+    if (!WaitForStamp(slot.stamp, 3 * b, failed))
+      break;
+    if (!inflater.Read(slot.rows.get(), rows_in_batch(b) * stride)) {
+      failed.store(true);
+      break;
+    }
+    slot.stamp.store(3 * b + 1, std::memory_order_release);
+  }
+
+  unfilter_thread.join();
+  for (std::thread& thread : convert_pool)
+    thread.join();
+
+  if (failed.load())
+    return PNG_IDAT_DECODE_FAILED;
+  // The stream must still end after the last row, with a matching Adler-32.
+  uLong adler = adler32(0L, Z_NULL, 0);
+  size_t stream_end;
+  if (!inflater.Finish(&adler, &stream_end))
+    return PNG_IDAT_DECODE_FAILED;
+  return PNG_IDAT_DECODE_OK;
+}
+
+PngIdatDecodeResult DecodePngBanded(const PngChunkReader& reader,
+  PngDecoder::ColorFormat format, std::vector<unsigned char>* output) {
+  const PngChunkReader::Header& header = reader.header();
+  if (header.interlace_type != 0)
+    return PNG_IDAT_DECODE_UNSUPPORTED;
+  if (static_cast<uint64_t>(header.width) * header.height > kMaxPixels)
+    return PNG_IDAT_DECODE_FAILED;
+
+  PngRowConverter converter;
+  if (!converter.Init(reader, format))
+    return PNG_IDAT_DECODE_UNSUPPORTED;
+
+  // inflate() leaves its fast loop whenever less than a few hundred bytes of
+  // input or output remain, which happens at every IDAT boundary. Files
+  // written with small IDAT chunks get one contiguous copy of their stream so
+  // that inflate only slows down at the end of each band.
+  std::vector<unsigned char> joined;
+  std::vector<PngChunkReader::Span> contiguous;
+  const std::vector<PngChunkReader::Span>* spans = &reader.idat();
+  if (spans->size() > 1) {
+    joined.resize(reader.idat_size());
+    if (!CopyIdatBytes(*spans, 0, joined.size(), joined.data()))
+      return PNG_IDAT_DECODE_FAILED;
+    contiguous.push_back({ joined.data(), joined.size() });
+    spans = &contiguous;
+  }
+
+  IdatInflater inflater(*spans);
+  if (!inflater.Init())
+    return PNG_IDAT_DECODE_FAILED;
+
+  const uint32_t width = header.width;
+  const uint32_t height = header.height;
+  const size_t row_bytes = reader.RowBytes(width);
+  const size_t stride = row_bytes + 1;
+  const int bpp = reader.FilterBpp();
+  const size_t out_stride = static_cast<size_t>(width) * 4;
+  const uint32_t band_rows = static_cast<uint32_t>(std::min<size_t>(height,
+    std::max<size_t>(1, kBandBytes / stride)));
+
+  // Row 0 of the band buffer holds the last row of the previous band.
+  std::unique_ptr<unsigned char[]> band(
+    new (std::nothrow) unsigned char[(band_rows + 1) * stride]);
+  if (!band)
+    return PNG_IDAT_DECODE_FAILED;
+
+  output->resize(out_stride * height);
+  unsigned char* const out = output->data();
+  for (uint32_t y = 0; y < height; y += band_rows) {
+    const uint32_t rows = std::min(band_rows, height - y);
+    if (!inflater.Read(&band[stride], rows * stride))
+      return PNG_IDAT_DECODE_FAILED;
+    const unsigned char* prev = y == 0 ? nullptr : &band[1];
+    for (uint32_t r = 1; r <= rows; ++r) {
+      unsigned char* row = &band[r * stride];
+      if (!UnfilterPngRow(row[0], bpp, row_bytes, prev, row + 1))
+        return PNG_IDAT_DECODE_FAILED;
+      converter.ConvertRow(row + 1, width, out + (y + r - 1) * out_stride);
+      prev = row + 1;
+    }
+    if (rows < height - y)
+      memcpy(&band[0], &band[rows * stride], stride);
+  }
+
+  // Every row is there, but the stream must still end, with a matching
+  // Adler-32, as DecodePngSegmented checks.
+  uLong adler = adler32(0L, Z_NULL, 0);
+  size_t stream_end;
+  if (!inflater.Finish(&adler, &stream_end))
+    return PNG_IDAT_DECODE_FAILED;
+  return PNG_IDAT_DECODE_OK;
+}
+
+PngIdatDecodeResult DecodePngSegmented(const PngChunkReader& reader,
+  PngDecoder::ColorFormat format, int threads,
+  std::vector<unsigned char>* output) {
+  const PngChunkReader::Header& header = reader.header();
+  const std::vector<PngChunkReader::RestartPoint>& points =
+    reader.restart_points();
+  if (points.empty() || header.interlace_type != 0)
+    return PNG_IDAT_DECODE_UNSUPPORTED;
+  if (static_cast<uint64_t>(header.width) * header.height > kMaxPixels)
+    return PNG_IDAT_DECODE_FAILED;
+
+  PngRowConverter converter;
+  if (!converter.Init(reader, format))
+    return PNG_IDAT_DECODE_UNSUPPORTED;
+  if (!ZlibHeaderIsValid(reader.idat()))
+    return PNG_IDAT_DECODE_FAILED;
+
+  const uint32_t width = header.width;
+  const uint32_t height = header.height;
+  const size_t row_bytes = reader.RowBytes(width);
+  const size_t stride = row_bytes + 1;
+  const int bpp = reader.FilterBpp();
+  const size_t out_stride = static_cast<size_t>(width) * 4;
+  const size_t segment_count = points.size();
+
+  output->resize(out_stride * height);
+  unsigned char* const out = output->data();
+
+  std::atomic<bool> failed(false);
+  std::vector<uLong> segment_adler(segment_count);
+  std::vector<size_t> segment_length(segment_count);
+  // Last unfiltered row of each segment, for a following segment whose first
+  // row was filtered against it. Valid once |segment_done| is set.
+  std::vector<std::vector<unsigned char>> last_rows(segment_count);
+  std::unique_ptr<std::atomic<bool>[]> segment_done(
+    new std::atomic<bool>[segment_count]);
+  for (size_t i = 0; i < segment_count; ++i)
+    segment_done[i].store(false);
+  size_t stream_end = 0;
+
+  PngParallelFor(segment_count, threads, [&](size_t k) {
+    if (failed.load())
+      return;
+    const uint32_t first_row = points[k].first_row;
+    const uint32_t end_row =
+      k + 1 < segment_count ? points[k + 1].first_row : height;
+
+    IdatInflater inflater(reader.idat());
+    if (!inflater.InitAtRestartPoint(points[k].stream_offset)) {
+      failed.store(true);
+      return;
+    }
+
+    std::unique_ptr<unsigned char[]> batch(
+      new unsigned char[kPipelineRowsPerBatch * stride]);
+    std::vector<unsigned char>& prev_copy = last_rows[k];
+    prev_copy.resize(row_bytes);
+    const unsigned char* prev = nullptr;
+    uLong adler = adler32(0L, Z_NULL, 0);
+
+    for (uint32_t y = first_row; y < end_row; y += kPipelineRowsPerBatch) {
+      const uint32_t rows = std::min(kPipelineRowsPerBatch, end_row - y);
+      if (!inflater.Read(batch.get(), rows * stride)) {
+        failed.store(true);
+        return;
+      }
+      adler = adler32(adler, batch.get(), static_cast<uInt>(rows * stride));
+
+      for (uint32_t r = 0; r < rows; ++r) {
+        unsigned char* row = &batch[r * stride];
+        if (y + r == first_row && first_row > 0 &&
+          row[0] != PNG_ROW_FILTER_NONE && row[0] != PNG_ROW_FILTER_SUB) {
+          // The producer filtered across the restart point. Still correct,
+          // just serialized: wait for the segment above to finish.
+          if (!WaitForFlag(segment_done[k - 1], failed))
+            return;
+          prev = last_rows[k - 1].data();
+        }
+        if (!UnfilterPngRow(row[0], bpp, row_bytes, prev, row + 1)) {
+          failed.store(true);
+          return;
+        }
+        converter.ConvertRow(row + 1, width, out + (y + r) * out_stride);
+        prev = row + 1;
+      }
+      memcpy(prev_copy.data(), prev, row_bytes);
+      prev = prev_copy.data();
+    }
+
+    if (k + 1 == segment_count && !inflater.Finish(&adler, &stream_end)) {
+      failed.store(true);
+      return;
+    }
+    segment_adler[k] = adler;
+    segment_length[k] = inflater.total_out();
+    segment_done[k].store(true, std::memory_order_release);
+  });
+
+  if (failed.load())
+    return PNG_IDAT_DECODE_FAILED;
+
+  uLong adler = segment_adler[0];
+  for (size_t k = 1; k < segment_count; ++k) {
+    adler = adler32_combine(adler, segment_adler[k],
+      static_cast<z_off_t>(segment_length[k]));
+  }
+  uLong expected;
+  if (!ReadStreamAdler(reader.idat(), stream_end, &expected) ||
+    expected != adler) {
+    PNG_LOG("DecodePngSegmented: Adler-32 mismatch\n");
+    return PNG_IDAT_DECODE_FAILED;
+  }
+  return PNG_IDAT_DECODE_OK;
+}
+
+PngIdatDecodeResult DecodePngInterlaced(const PngChunkReader& reader,
+  PngDecoder::ColorFormat format,
+  const PngDecoder::PassCallback& pass_callback,
+  std::vector<unsigned char>* output) {
+  const PngChunkReader::Header& header = reader.header();
+  if (header.interlace_type == 0)
+    return PNG_IDAT_DECODE_UNSUPPORTED;
+  if (static_cast<uint64_t>(header.width) * header.height > kMaxPixels)
+    return PNG_IDAT_DECODE_FAILED;
+
+  PngRowConverter converter;
+  if (!converter.Init(reader, format))
+    return PNG_IDAT_DECODE_UNSUPPORTED;
+
+  IdatInflater inflater(reader.idat());
+  if (!inflater.Init())
+    return PNG_IDAT_DECODE_FAILED;
+
+  const uint32_t width = header.width;
+  const uint32_t height = header.height;
+  const int bpp = reader.FilterBpp();
+  const size_t max_stride = reader.RowBytes(width) + 1;
+
+  output->resize(static_cast<size_t>(width) * 4 * height);
+  uint32_t* const out = reinterpret_cast<uint32_t*>(output->data());
+
+  std::unique_ptr<unsigned char[]> batch(
+    new unsigned char[kPipelineRowsPerBatch * max_stride]);
+  std::unique_ptr<unsigned char[]> prev_copy(new unsigned char[max_stride]);
+  std::unique_ptr<uint32_t[]> converted(new uint32_t[width]);
+
+  for (int pass = 0; pass < 7; ++pass) {
+    // Empty passes have no data at all, not even filter bytes.
+    const uint32_t pass_width = Adam7PassWidth(pass, width);
+    const uint32_t pass_height = pass_width ? Adam7PassHeight(pass, height) : 0;
+    const size_t row_bytes = reader.RowBytes(pass_width);
+    const size_t stride = row_bytes + 1;
+    const unsigned char* prev = nullptr;
+    for (uint32_t y = 0; y < pass_height; y += kPipelineRowsPerBatch) {
+      const uint32_t rows = std::min(kPipelineRowsPerBatch, pass_height - y);
+      if (!inflater.Read(batch.get(), rows * stride))
+        return PNG_IDAT_DECODE_FAILED;
+      for (uint32_t r = 0; r < rows; ++r) {
+        unsigned char* row = &batch[r * stride];
+        if (!UnfilterPngRow(row[0], bpp, row_bytes, prev, row + 1))
+          return PNG_IDAT_DECODE_FAILED;
+        prev = row + 1;
+
+        uint32_t* dest =
+          out + static_cast<size_t>(Adam7PassRowToImageRow(pass, y + r)) * width;
+        if (pass_width == width) {
+          // Only the last pass covers whole rows; convert in place.
+          converter.ConvertRow(row + 1, width,
+            reinterpret_cast<unsigned char*>(dest));
+        }
+        else {
+          converter.ConvertRow(row + 1, pass_width,
+            reinterpret_cast<unsigned char*>(converted.get()));
+          ScatterAdam7Row(pass, converted.get(), pass_width, width, dest);
+        }
+      }
+      memcpy(prev_copy.get(), prev, row_bytes);
+      prev = prev_copy.get();
+    }
+
+    // The stream must end after the last pass, with a matching Adler-32,
+    // before the image is handed out as complete.
+    if (pass == 6) {
+      uLong adler = adler32(0L, Z_NULL, 0);
+      size_t stream_end;
+      if (!inflater.Finish(&adler, &stream_end))
+        return PNG_IDAT_DECODE_FAILED;
+    }
+
+    if (pass_callback) {
+      if (pass < 6)
+        ReplicateAdam7Pass(pass, width, height, out);
+      pass_callback(pass, output->data(), static_cast<int>(width),
+        static_cast<int>(height));
+    }
+  }
+  return PNG_IDAT_DECODE_OK;
+}
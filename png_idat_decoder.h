@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "png_chunk_reader.h"
+#include "png_decoder.h"
+#include "third_party/zlib/zlib.h"
+
+// Inflates the concatenated IDAT payloads of a PngChunkReader on demand,
+// either as the whole zlib stream or as raw deflate data from a restart point.
+class IdatInflater {
+public:
+  explicit IdatInflater(const std::vector<PngChunkReader::Span>& spans);
+  ~IdatInflater();
+
+  // Starts at the beginning of the zlib stream.
+  bool Init();
+
+  // Starts raw deflate decoding at |stream_offset| bytes into the stream,
+  // which must be a restart point. Offset 0 skips the zlib header.
+  bool InitAtRestartPoint(size_t stream_offset);
+
+  // Inflates exactly |size| bytes into |out|. Returns false if the stream is
+  // corrupt or ends early.
+  bool Read(unsigned char* out, size_t size);
+
+  // Runs the stream to its end, folding any surplus data into |adler|, and
+  // returns the stream offset just past the deflate data in |end_offset|.
+  // After Init(), zlib itself checks the Adler-32 that follows, fails on a
+  // mismatch, and |end_offset| is past it instead.
+  bool Finish(uLong* adler, size_t* end_offset);
+
+  // Bytes inflated so far.
+  size_t total_out() const { return stream_.total_out; }
+
+private:
+  bool Seek(size_t stream_offset);
+  bool NextSpan();
+
+  const std::vector<PngChunkReader::Span>& spans_;
+  size_t next_span_;
+  size_t start_offset_;
+  bool initialized_;
+  z_stream stream_;
+};
+
+// Copies |size| bytes starting |stream_offset| bytes into the concatenated
+// |spans|. Returns false if they run out first.
+bool CopyIdatBytes(const std::vector<PngChunkReader::Span>& spans,
+  size_t stream_offset, size_t size, unsigned char* out);
+
+// Decode paths that inflate IDAT data and unfilter rows themselves instead of
+// going through libpng's progressive reader. They only handle images whose
+// output needs no transform beyond what PngRowConverter implements, and tell
+// the caller to fall back to libpng otherwise.
+enum PngIdatDecodeResult {
+  // The image needs something only libpng handles; nothing was written.
+  PNG_IDAT_DECODE_UNSUPPORTED,
+  // The image data is corrupt or truncated.
+  PNG_IDAT_DECODE_FAILED,
+  PNG_IDAT_DECODE_OK,
+};
+
+// Runs inflate on the calling thread and hands batches of filtered rows
+// through a ring of slots to one thread that unfilters them in row order and
+// to |threads| - 2 threads that convert them into |output|, so no more than
+// |threads| run at once. Wall-clock time approaches the slowest of the three
+// stages rather than their sum. With fewer than three threads there is no
+// room for a pipeline, and the image is decoded with DecodePngBanded().
+PngIdatDecodeResult DecodePngPipelined(const PngChunkReader& reader,
+  PngDecoder::ColorFormat format, int threads,
+  std::vector<unsigned char>* output);
+
+// Single-threaded: inflates the IDAT stream in bands of about 512 KB of
+// filtered rows, each with one large inflate() call that keeps zlib in its
+// chunked SIMD fast path (inffast_chunk.c), then unfilters and converts the
+// band while it is still in cache. Needs one band buffer, plus a contiguous
+// copy of the IDAT data when it is split over several chunks.
+PngIdatDecodeResult DecodePngBanded(const PngChunkReader& reader,
+  PngDecoder::ColorFormat format, std::vector<unsigned char>* output);
+
+// Decodes an image with restart points (see PngChunkReader::RestartPoint) by
+// inflating, unfiltering and converting each segment on its own thread, up to
+// |threads| at once. The Adler-32 of the stream is still verified, by
+// combining per-segment checksums. Returns PNG_IDAT_DECODE_UNSUPPORTED for
+// images without restart points.
+PngIdatDecodeResult DecodePngSegmented(const PngChunkReader& reader,
+  PngDecoder::ColorFormat format, int threads,
+  std::vector<unsigned char>* output);
+
+// Decodes an Adam7 interlaced image pass by pass, scattering each converted
+// pass row straight into |output| instead of expanding rows the way libpng
+// does. Calls |pass_callback|, if set, after each pass with a filled-in
+// preview.
+PngIdatDecodeResult DecodePngInterlaced(const PngChunkReader& reader,
+  PngDecoder::ColorFormat format,
+  const PngDecoder::PassCallback& pass_callback,
+  std::vector<unsigned char>* output);
@@ -0,0 +1,390 @@
+#include "stdafx.h"
+#include "png_idat_encoder.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <new>
+
+#include "logging.h"
+#include "png_parallel.h"
+#include "png_row_filter.h"
+#include "png_zlib_pool.h"
+#include "third_party/zlib/zlib.h"
+
+namespace {
+
+// Deflate's window, and so the most history a block can use.
+const size_t kDictionaryBytes = 32 * 1024;
+
+// libpng's default; see png_set_compression_mem_level.
+const int kMemLevel = 8;
+
+// Blocks per thread, so that a slow block does not leave the others idle.
+const int kBlocksPerThread = 4;
+
+// ChooseDeflateSettings samples an eighth of the filtered data, within these
+// bounds, in kSampleBands bands.
+const size_t kMinSampleBytes = 32 * 1024;
+const size_t kMaxSampleBytes = 256 * 1024;
+const uint32_t kSampleBands = 4;
+
+// Images with fewer of their pixels equal to the left or upper neighbour are
+// treated as photographic.
+const double kPhotoRepeatRatio = 0.1;
+
+// A candidate deflate settings listed after another must give output this
+// much smaller to be picked over it.
+const double kLaterCandidateGain = 0.01;
+
+struct DeflatedBlock {
+  std::vector<unsigned char> data;
+  uLong adler;
+  size_t length;
+};
+
+// The two header bytes deflate() would write for |level| and |strategy|.
+void AppendZlibHeader(int level, int strategy,
+  std::vector<unsigned char>* stream) {
+  if (level == Z_DEFAULT_COMPRESSION)
+    level = 6;
+  int level_flags;
+  if (strategy >= Z_HUFFMAN_ONLY || level < 2)
+    level_flags = 0;
+  else if (level < 6)
+    level_flags = 1;
+  else if (level == 6)
+    level_flags = 2;
+  else
+    level_flags = 3;
+  unsigned header = (Z_DEFLATED + ((MAX_WBITS - 8) << 4)) << 8;
+  header |= level_flags << 6;
+  header += 31 - (header % 31);
+  stream->push_back(static_cast<unsigned char>(header >> 8));
+  stream->push_back(static_cast<unsigned char>(header));
+}
+
+// Filters rows [first_row, end_row) into |filtered|, fetching the row above
+// |first_row| from |source| unless it is the first row of the image.
+void FilterRows(const PngRowSource& source, size_t row_bytes, int bpp,
+  uint32_t first_row, uint32_t end_row, int filter_mask,
+  unsigned char* filtered) {
+  std::unique_ptr<unsigned char[]> prev(new unsigned char[row_bytes]);
+  std::unique_ptr<unsigned char[]> cur(new unsigned char[row_bytes]);
+  std::unique_ptr<unsigned char[]> scratch(new unsigned char[row_bytes + 1]);
+  if (first_row == 0)
+    memset(prev.get(), 0, row_bytes);
+  else
+    source(first_row - 1, prev.get());
+  for (uint32_t y = first_row; y < end_row; ++y) {
+    source(y, cur.get());
+    FilterPngRow(filter_mask, bpp, row_bytes, prev.get(), cur.get(), filtered,
+      scratch.get());
+    filtered += row_bytes + 1;
+    prev.swap(cur);
+  }
+}
+
+// Drops the filters that libpng never uses for a |height| row image with
+// |row_bytes| bytes per row.
+int AdjustFilterMask(int filter_mask, size_t row_bytes, int bpp,
+  uint32_t height) {
+  // libpng never uses the row above in a one-row image, nor the pixel to the
+  // left in a one-pixel-wide one.
+  if (height == 1) {
+    filter_mask &= ~(PngFilterBit(PNG_ROW_FILTER_UP) |
+      PngFilterBit(PNG_ROW_FILTER_AVG) | PngFilterBit(PNG_ROW_FILTER_PAETH));
+  }
+  if (row_bytes == static_cast<size_t>(bpp)) {
+    filter_mask &= ~(PngFilterBit(PNG_ROW_FILTER_SUB) |
+      PngFilterBit(PNG_ROW_FILTER_AVG) | PngFilterBit(PNG_ROW_FILTER_PAETH));
+  }
+  return filter_mask;
+}
+
+// First rows of kSampleBands bands of |rows_per_band| rows spread evenly
+// over an image of |height| rows.
+std::vector<uint32_t> SampleBands(uint32_t height, uint32_t rows_per_band) {
+  std::vector<uint32_t> bands;
+  for (uint32_t b = 0; b < kSampleBands; ++b) {
+    bands.push_back(static_cast<uint32_t>(
+      static_cast<uint64_t>(height - rows_per_band) * b / (kSampleBands - 1)));
+  }
+  return bands;
+}
+
+// Filters the sampled bands with |filter_mask| into |sample|.
+void FilterSample(const PngRowSource& source, size_t row_bytes, int bpp,
+  uint32_t height, const std::vector<uint32_t>& bands, uint32_t rows_per_band,
+  int filter_mask, std::vector<unsigned char>* sample) {
+  const size_t stride = row_bytes + 1;
+  sample->clear();
+  for (uint32_t first_row : bands) {
+    const uint32_t end_row = std::min(height, first_row + rows_per_band);
+    const size_t offset = sample->size();
+    sample->resize(offset + (end_row - first_row) * stride);
+    FilterRows(source, row_bytes, bpp, first_row, end_row, filter_mask,
+      sample->data() + offset);
+  }
+}
+
+// Share of the pixels in |sample|, unfiltered rows of |stride| bytes in bands
+// of |rows_per_band|, that equal the pixel to their left or the one above.
+double RepeatRatio(const std::vector<unsigned char>& sample, size_t stride,
+  int bpp, uint32_t rows_per_band) {
+  const size_t rows = sample.size() / stride;
+  uint64_t pixels = 0;
+  uint64_t repeats = 0;
+  for (size_t y = 0; y < rows; ++y) {
+    const unsigned char* row = &sample[y * stride + 1];
+    const unsigned char* above = y % rows_per_band ? row - stride : nullptr;
+    for (size_t x = 0; x + bpp <= stride - 1; x += bpp) {
+      ++pixels;
+      if ((x > 0 && memcmp(row + x, row + x - bpp, bpp) == 0) ||
+        (above && memcmp(row + x, above + x, bpp) == 0))
+        ++repeats;
+    }
+  }
+  return pixels ? static_cast<double>(repeats) / pixels : 0;
+}
+
+// Size of |data| deflated with |level| and |strategy|, or 0 on error.
+size_t DeflatedSize(const std::vector<unsigned char>& data, int level,
+  int strategy) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  UsePngZlibPool(&zs);
+  if (deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, kMemLevel,
+    strategy) != Z_OK)
+    return 0;
+  std::vector<unsigned char> out(
+    deflateBound(&zs, static_cast<uLong>(data.size())));
+  zs.next_in = const_cast<unsigned char*>(data.data());
+  zs.avail_in = static_cast<uInt>(data.size());
+  zs.next_out = out.data();
+  zs.avail_out = static_cast<uInt>(out.size());
+  const int ret = deflate(&zs, Z_FINISH);
+  const size_t size = ret == Z_STREAM_END ? zs.total_out : 0;
+  deflateEnd(&zs);
+  return size;
+}
+
+}  // namespace
+
+bool DeflateRows(const PngRowSource& source, size_t row_bytes, int bpp,
+  uint32_t height, int filter_mask, int zlib_level, int zlib_strategy,
+  std::vector<unsigned char>* stream) {
+  const PngDeflateSettings settings = {
+    filter_mask, zlib_level, zlib_strategy };
+  return DeflateRowsWithLimit(source, row_bytes, bpp, height, settings,
+    MAX_WBITS, kMemLevel, nullptr, stream);
+}
+
+bool DeflateRowsWithLimit(const PngRowSource& source, size_t row_bytes,
+  int bpp, uint32_t height, const PngDeflateSettings& settings,
+  int window_bits, int mem_level, const std::atomic<size_t>* size_limit,
+  std::vector<unsigned char>* stream) {
+  const int filter_mask =
+    AdjustFilterMask(settings.filter_mask, row_bytes, bpp, height);
+
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  UsePngZlibPool(&zs);
+  if (deflateInit2(&zs, settings.zlib_level, Z_DEFLATED, window_bits,
+    mem_level, settings.zlib_strategy) != Z_OK)
+    return false;
+
+  std::unique_ptr<unsigned char[]> prev(new unsigned char[row_bytes]);
+  std::unique_ptr<unsigned char[]> cur(new unsigned char[row_bytes]);
+  std::unique_ptr<unsigned char[]> filtered(new unsigned char[row_bytes + 1]);
+  std::unique_ptr<unsigned char[]> scratch(new unsigned char[row_bytes + 1]);
+  memset(prev.get(), 0, row_bytes);
+  unsigned char out[kDictionaryBytes];
+
+  stream->clear();
+  int ret = Z_OK;
+  for (uint32_t y = 0; y < height && ret == Z_OK; ++y) {
+    source(y, cur.get());
+    FilterPngRow(filter_mask, bpp, row_bytes, prev.get(), cur.get(),
+      filtered.get(), scratch.get());
+    prev.swap(cur);
+
+    const int flush = y + 1 == height ? Z_FINISH : Z_NO_FLUSH;
+    zs.next_in = filtered.get();
+    zs.avail_in = static_cast<uInt>(row_bytes + 1);
+    do {
+      zs.next_out = out;
+      zs.avail_out = sizeof(out);
+      ret = deflate(&zs, flush);
+      stream->insert(stream->end(), out, zs.next_out);
+    } while (ret == Z_OK && (zs.avail_in != 0 || zs.avail_out == 0 ||
+      (flush == Z_FINISH)));
+    if (size_limit && stream->size() > size_limit->load()) {
+      deflateEnd(&zs);
+      return false;
+    }
+  }
+  deflateEnd(&zs);
+  if (ret != Z_STREAM_END) {
+    PNG_LOG("DeflateRows: deflate %d\n", ret);
+    return false;
+  }
+  return true;
+}
+
+bool DeflateRowsParallel(const PngRowSource& source, size_t row_bytes,
+  int bpp, uint32_t height, int filter_mask, int zlib_level,
+  int zlib_strategy, int threads, std::vector<unsigned char>* stream) {
+  const size_t stride = row_bytes + 1;
+  threads = std::max(threads, 1);
+  const uint32_t rows_per_block = static_cast<uint32_t>(std::max<uint64_t>(
+    (kParallelDeflateMinBlockBytes + stride - 1) / stride,
+    (height + threads * kBlocksPerThread - 1) / (threads * kBlocksPerThread)));
+  const size_t block_count = (height + rows_per_block - 1) / rows_per_block;
+  const uint32_t dictionary_rows =
+    static_cast<uint32_t>((kDictionaryBytes + stride - 1) / stride);
+
+  filter_mask = AdjustFilterMask(filter_mask, row_bytes, bpp, height);
+
+  std::vector<DeflatedBlock> blocks(block_count);
+  std::atomic<bool> failed(false);
+  PngParallelFor(block_count, threads, [&](size_t b) {
+    if (failed.load())
+      return;
+    const uint32_t first_row = static_cast<uint32_t>(b * rows_per_block);
+    const uint32_t end_row = std::min(height, first_row + rows_per_block);
+    // Refilter enough rows before the block to rebuild the dictionary; the
+    // filter choices only depend on the two rows involved, so they come out
+    // the same as in the block that owns them.
+    const uint32_t history_rows = std::min(first_row, dictionary_rows);
+    const size_t history_bytes = history_rows * stride;
+    const size_t block_bytes = (end_row - first_row) * stride;
+    std::unique_ptr<unsigned char[]> filtered(
+      new (std::nothrow) unsigned char[history_bytes + block_bytes]);
+    if (!filtered) {
+      failed.store(true);
+      return;
+    }
+    FilterRows(source, row_bytes, bpp, first_row - history_rows, end_row,
+      filter_mask, filtered.get());
+    const unsigned char* data = filtered.get() + history_bytes;
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    UsePngZlibPool(&zs);
+    if (deflateInit2(&zs, zlib_level, Z_DEFLATED, -MAX_WBITS, kMemLevel,
+      zlib_strategy) != Z_OK) {
+      failed.store(true);
+      return;
+    }
+    const size_t dictionary_bytes = std::min(history_bytes, kDictionaryBytes);
+    if (dictionary_bytes > 0) {
+      deflateSetDictionary(&zs, data - dictionary_bytes,
+        static_cast<uInt>(dictionary_bytes));
+    }
+
+    const bool last = b + 1 == block_count;
+    DeflatedBlock& block = blocks[b];
+    // A sync flush adds an empty stored block on top of what deflateBound
+    // allows for.
+    block.data.resize(deflateBound(&zs, static_cast<uLong>(block_bytes)) + 16);
+    zs.next_in = const_cast<unsigned char*>(data);
+    zs.avail_in = static_cast<uInt>(block_bytes);
+    zs.next_out = block.data.data();
+    zs.avail_out = static_cast<uInt>(block.data.size());
+    const int ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+    if ((last && ret != Z_STREAM_END) || (!last && ret != Z_OK) ||
+      zs.avail_in != 0) {
+      PNG_LOG("DeflateRowsParallel: block %u deflate %d\n",
+        static_cast<unsigned>(b), ret);
+      failed.store(true);
+    }
+    block.data.resize(zs.total_out);
+    deflateEnd(&zs);
+
+    block.adler = adler32(adler32(0L, Z_NULL, 0), data,
+      static_cast<uInt>(block_bytes));
+    block.length = block_bytes;
+  });
+  if (failed.load())
+    return false;
+
+  stream->clear();
+  AppendZlibHeader(zlib_level, zlib_strategy, stream);
+  uLong adler = adler32(0L, Z_NULL, 0);
+  for (const DeflatedBlock& block : blocks) {
+    stream->insert(stream->end(), block.data.begin(), block.data.end());
+    adler = adler32_combine(adler, block.adler,
+      static_cast<z_off_t>(block.length));
+  }
+  for (int shift = 24; shift >= 0; shift -= 8)
+    stream->push_back(static_cast<unsigned char>(adler >> shift));
+  return true;
+}
+
+PngDeflateSettings ChooseDeflateSettings(const PngRowSource& source,
+  size_t row_bytes, int bpp, uint32_t height, int zlib_level) {
+  const int all_filters = PngFilterBit(PNG_ROW_FILTER_NONE) |
+    PngFilterBit(PNG_ROW_FILTER_SUB) | PngFilterBit(PNG_ROW_FILTER_UP) |
+    PngFilterBit(PNG_ROW_FILTER_AVG) | PngFilterBit(PNG_ROW_FILTER_PAETH);
+  // Stored blocks: filtering would only cost time.
+  if (zlib_level == 0)
+    return { PngFilterBit(PNG_ROW_FILTER_NONE), 0, Z_DEFAULT_STRATEGY };
+
+  const size_t stride = row_bytes + 1;
+  const size_t sample_bytes = std::min(kMaxSampleBytes,
+    std::max(kMinSampleBytes, stride * height / 8));
+  uint32_t rows_per_band = static_cast<uint32_t>(std::max<size_t>(2,
+    sample_bytes / kSampleBands / stride));
+  std::vector<uint32_t> bands(1, 0);
+  if (static_cast<uint64_t>(rows_per_band) * kSampleBands < height)
+    bands = SampleBands(height, rows_per_band);
+  else
+    rows_per_band = height;
+
+  std::vector<unsigned char> sample;
+  int sample_filters = PngFilterBit(PNG_ROW_FILTER_NONE);
+  FilterSample(source, row_bytes, bpp, height, bands, rows_per_band,
+    sample_filters, &sample);
+  const double repeat_ratio = RepeatRatio(sample, stride, bpp, rows_per_band);
+
+  // Cheapest to deflate first. Z_RLE only finds runs, which suits filtered
+  // photos and flat areas alike; Z_FILTERED favours literals over the short
+  // matches that filtered photos are full of.
+  std::vector<PngDeflateSettings> candidates;
+  if (repeat_ratio < kPhotoRepeatRatio) {
+    candidates.push_back({ all_filters, Z_BEST_SPEED, Z_HUFFMAN_ONLY });
+    candidates.push_back({ all_filters, zlib_level, Z_RLE });
+    candidates.push_back({ all_filters, zlib_level, Z_FILTERED });
+    candidates.push_back({ all_filters, zlib_level, Z_DEFAULT_STRATEGY });
+  }
+  else {
+    candidates.push_back({ PngFilterBit(PNG_ROW_FILTER_UP), zlib_level,
+      Z_RLE });
+    candidates.push_back({ PngFilterBit(PNG_ROW_FILTER_NONE), zlib_level,
+      Z_DEFAULT_STRATEGY });
+    candidates.push_back({ PngFilterBit(PNG_ROW_FILTER_UP), zlib_level,
+      Z_DEFAULT_STRATEGY });
+    candidates.push_back({ all_filters, zlib_level, Z_FILTERED });
+    candidates.push_back({ all_filters, zlib_level, Z_DEFAULT_STRATEGY });
+  }
+
+  PngDeflateSettings best = candidates.back();
+  size_t best_size = 0;
+  for (const PngDeflateSettings& candidate : candidates) {
+    if (candidate.filter_mask != sample_filters) {
+      sample_filters = candidate.filter_mask;
+      FilterSample(source, row_bytes, bpp, height, bands, rows_per_band,
+        AdjustFilterMask(sample_filters, row_bytes, bpp, height), &sample);
+    }
+    const size_t size = DeflatedSize(sample, candidate.zlib_level,
+      candidate.zlib_strategy);
+    if (size && (!best_size || size < best_size * (1 - kLaterCandidateGain))) {
+      best = candidate;
+      best_size = size;
+    }
+  }
+  return best;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+// Writes unfiltered row |y| of the image, in PNG sample order, to |row|. May
+// be called from several threads at once, and more than once for some rows.
+typedef std::function<void(uint32_t y, unsigned char* row)> PngRowSource;
+
+// DeflateRowsParallel makes blocks of at least this many filtered bytes, to
+// keep the size cost of block boundaries small. Images with fewer than two
+// blocks' worth of data gain nothing from it.
+const size_t kParallelDeflateMinBlockBytes = 1024 * 1024;
+
+// Filter mask, zlib level and zlib strategy for DeflateRows() or
+// DeflateRowsParallel().
+struct PngDeflateSettings {
+  int filter_mask;
+  int zlib_level;
+  int zlib_strategy;
+};
+
+// Builds the zlib stream for an IDAT from |height| rows of |row_bytes| bytes
+// each, one row at a time, filtering with FilterPngRow() and |filter_mask|
+// and deflating with the settings libpng uses. For images whose filtered data
+// is over 16 KB (below that libpng shrinks the deflate window) the stream is
+// byte for byte the one libpng's writer produces, only faster.
+bool DeflateRows(const PngRowSource& source, size_t row_bytes, int bpp,
+  uint32_t height, int filter_mask, int zlib_level, int zlib_strategy,
+  std::vector<unsigned char>* stream);
+
+// DeflateRows() with the whole configuration given: |window_bits| and
+// |mem_level| as for deflateInit2(). Gives up, returning false, as soon as
+// the stream grows past |*size_limit| bytes, a bound other threads may lower
+// meanwhile; nullptr means no bound.
+bool DeflateRowsWithLimit(const PngRowSource& source, size_t row_bytes,
+  int bpp, uint32_t height, const PngDeflateSettings& settings,
+  int window_bits, int mem_level, const std::atomic<size_t>* size_limit,
+  std::vector<unsigned char>* stream);
+
+// Builds the zlib stream for an IDAT from |height| rows of |row_bytes| bytes
+// each, filtering rows with FilterPngRow() and |filter_mask|. The rows are
+// split into blocks that are filtered and deflated on up to |threads|
+// threads. Every block but the last ends with Z_SYNC_FLUSH so the pieces
+// concatenate into one raw deflate stream, and each block starts with the
+// previous 32 KB of filtered data as its dictionary so matches still reach
+// back across the boundary. The Adler-32 trailer is joined from per-block
+// checksums with adler32_combine. The result is a single ordinary zlib
+// stream, slightly bigger than a serial deflate of the same data.
+bool DeflateRowsParallel(const PngRowSource& source, size_t row_bytes,
+  int bpp, uint32_t height, int filter_mask, int zlib_level,
+  int zlib_strategy, int threads, std::vector<unsigned char>* stream);
+
+// Picks deflate settings for an image from a few bands of rows spread over
+// it, at a fraction of the cost of one encode. How often pixels repeat their
+// left or upper neighbour separates photographic images, where deflate finds
+// few matches and Huffman-only, RLE or Z_FILTERED coding of the adaptively
+// filtered rows is about as small and much faster, from synthetic ones, where
+// unfiltered rows (text, UI) or the Up filter (flat areas) often beat
+// adaptive filtering. The four or five candidates that leaves, across
+// Z_DEFAULT_STRATEGY, Z_FILTERED, Z_RLE and Z_HUFFMAN_ONLY, are deflated on
+// the sample and the smallest wins. |zlib_level| caps the effort spent.
+PngDeflateSettings ChooseDeflateSettings(const PngRowSource& source,
+  size_t row_bytes, int bpp, uint32_t height, int zlib_level);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Runs |task(i)| for every i in [0, count) on up to |threads| threads, the
+// calling thread included. Items are claimed in increasing order, so a task
+// may wait for the result of an earlier item without deadlocking.
+template <typename Task>
+void PngParallelFor(size_t count, int threads, const Task& task) {
+  const size_t workers =
+    std::min<size_t>(count, static_cast<size_t>(std::max(threads, 1)));
+  std::atomic<size_t> next(0);
+  auto run = [&]() {
+    for (size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1))
+      task(i);
+  };
+
+  std::vector<std::thread> pool;
+  for (size_t i = 1; i < workers; ++i)
+    pool.emplace_back(run);
+  run();
+  for (std::thread& thread : pool)
+    thread.join();
+}
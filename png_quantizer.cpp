@@ -0,0 +1,735 @@
+#include "stdafx.h"
+#include "png_quantizer.h"
+
+#include <limits.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+
+#include "png_color_reduction.h"
+#include "png_parallel.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define PNG_QUANTIZER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Histogram bins: 5 bits of each colour channel and 3 of alpha.
+const int kHistogramBins = 1 << 18;
+
+// Rows per histogram or mapping work item.
+const int kRowsPerTask = 64;
+
+// k-means passes after median cut, and roughly how many pixels each samples.
+const int kKMeansPasses = 2;
+const size_t kKMeansSamplePixels = 16 * 1024;
+
+// Direct-mapped cache of nearest entries for repeated colours, per thread.
+const int kCacheBits = 12;
+
+struct Color {
+  int c[4];
+};
+
+int Distance(const Color& a, const Color& b) {
+  int distance = 0;
+  for (int i = 0; i < 4; ++i)
+    distance += (a.c[i] - b.c[i]) * (a.c[i] - b.c[i]);
+  return distance;
+}
+
+inline Color LoadColor(const unsigned char* rgba) {
+  const Color color = { { rgba[0], rgba[1], rgba[2], rgba[3] } };
+  return color;
+}
+
+inline uint32_t HistogramBin(const unsigned char* rgba) {
+  return (rgba[0] >> 3) << 13 | (rgba[1] >> 3) << 8 | (rgba[2] >> 3) << 3 |
+    rgba[3] >> 5;
+}
+
+// Middle of |bin|, except that the top alpha bin stands for fully opaque,
+// by far its most common value.
+Color BinColor(uint32_t bin) {
+  const int alpha = bin & 7;
+  const Color color = { {
+    static_cast<int>((bin >> 13) & 31) << 3 | 4,
+    static_cast<int>((bin >> 8) & 31) << 3 | 4,
+    static_cast<int>((bin >> 3) & 31) << 3 | 4,
+    alpha == 7 ? 255 : alpha << 5 | 16 } };
+  return color;
+}
+
+// Converts rows of the caller's pixels to RGBA, with alpha forced to 255
+// when transparency is discarded.
+class RowReader {
+public:
+  RowReader(const unsigned char* pixels, size_t stride,
+    PngDecoder::ColorFormat format, bool discard_transparency, int w)
+    : pixels_(pixels), stride_(stride), converter_(format, false),
+    discard_transparency_(discard_transparency), w_(w) {
+  }
+
+  void Read(int y, unsigned char* rgba) const {
+    converter_.PackRow(pixels_ + y * stride_, w_, rgba);
+    if (discard_transparency_) {
+      for (int x = 0; x < w_; ++x)
+        rgba[x * 4 + 3] = 255;
+    }
+  }
+
+private:
+  const unsigned char* pixels_;
+  const size_t stride_;
+  const PngColorReducer converter_;
+  const bool discard_transparency_;
+  const int w_;
+};
+
+struct HistogramEntry {
+  Color color;
+  uint32_t count;
+};
+
+// Splits the histogram into at most |colors| boxes, each time splitting the
+// box with the largest squared error at the weighted median of its widest
+// channel, and returns the weighted mean of each box.
+std::vector<Color> MedianCut(std::vector<HistogramEntry>* entries,
+  int colors) {
+  struct Box {
+    size_t begin;
+    size_t end;
+    double error;
+    int channel;
+  };
+  auto measure = [&](Box* box) {
+    double sum[4] = { 0 }, sum_squares[4] = { 0 }, count = 0;
+    for (size_t i = box->begin; i < box->end; ++i) {
+      const HistogramEntry& entry = (*entries)[i];
+      for (int c = 0; c < 4; ++c) {
+        sum[c] += static_cast<double>(entry.color.c[c]) * entry.count;
+        sum_squares[c] += static_cast<double>(entry.color.c[c]) *
+          entry.color.c[c] * entry.count;
+      }
+      count += entry.count;
+    }
+    box->error = 0;
+    box->channel = 0;
+    double widest = -1;
+    for (int c = 0; c < 4; ++c) {
+      const double error = sum_squares[c] - sum[c] * sum[c] / count;
+      box->error += error;
+      if (error > widest) {
+        widest = error;
+        box->channel = c;
+      }
+    }
+    if (box->end - box->begin < 2)
+      box->error = 0;
+  };
+
+  std::vector<Box> boxes(1);
+  boxes[0].begin = 0;
+  boxes[0].end = entries->size();
+  measure(&boxes[0]);
+  while (static_cast<int>(boxes.size()) < colors) {
+    Box* box = &*std::max_element(boxes.begin(), boxes.end(),
+      [](const Box& a, const Box& b) { return a.error < b.error; });
+    if (box->error <= 0)
+      break;
+    const int channel = box->channel;
+    std::sort(entries->begin() + box->begin, entries->begin() + box->end,
+      [channel](const HistogramEntry& a, const HistogramEntry& b) {
+        return a.color.c[channel] < b.color.c[channel];
+      });
+    uint64_t total = 0;
+    for (size_t i = box->begin; i < box->end; ++i)
+      total += (*entries)[i].count;
+    uint64_t below = 0;
+    size_t split = box->begin;
+    while (split + 1 < box->end && below + (*entries)[split].count <= total / 2)
+      below += (*entries)[split++].count;
+    split = std::max(split, box->begin + 1);
+    Box upper = { split, box->end, 0, 0 };
+    box->end = split;
+    measure(box);
+    measure(&upper);
+    boxes.push_back(upper);
+  }
+
+  std::vector<Color> palette;
+  for (const Box& box : boxes) {
+    double sum[4] = { 0 }, count = 0;
+    for (size_t i = box.begin; i < box.end; ++i) {
+      for (int c = 0; c < 4; ++c)
+        sum[c] += static_cast<double>((*entries)[i].color.c[c]) *
+        (*entries)[i].count;
+      count += (*entries)[i].count;
+    }
+    Color color;
+    for (int c = 0; c < 4; ++c)
+      color.c[c] = static_cast<int>(sum[c] / count + 0.5);
+    palette.push_back(color);
+  }
+  return palette;
+}
+
+// Nearest-colour search over a palette of up to 256 entries, in RGBA space.
+class KdTree {
+public:
+  explicit KdTree(const std::vector<Color>& colors) {
+    std::vector<int> ids(colors.size());
+    for (size_t i = 0; i < ids.size(); ++i)
+      ids[i] = static_cast<int>(i);
+    nodes_.reserve(colors.size());
+    Build(colors, &ids, 0, ids.size());
+  }
+
+  // Entry with the smallest Distance() to |color|. |hint|, an entry likely
+  // to be close such as the previous pixel's, bounds the search from the
+  // start.
+  int Nearest(const Color& color, int hint) const {
+    int best = hint;
+    int best_distance = Distance(color, nodes_[entry_nodes_[hint]].color);
+    Search(0, color, &best, &best_distance);
+    return best;
+  }
+
+private:
+  // The tree is laid out in preorder: a node's left subtree follows it
+  // directly, and its right one starts at |right|.
+  struct Node {
+    Color color;
+    int entry;
+    int axis;
+    int right;
+    int end;
+  };
+
+  void Build(const std::vector<Color>& colors, std::vector<int>* ids,
+    size_t begin, size_t end) {
+    if (begin == end)
+      return;
+    // Split on the channel with the widest range, at the median.
+    int axis = 0, widest = -1;
+    for (int c = 0; c < 4; ++c) {
+      int low = 255, high = 0;
+      for (size_t i = begin; i < end; ++i) {
+        low = std::min(low, colors[(*ids)[i]].c[c]);
+        high = std::max(high, colors[(*ids)[i]].c[c]);
+      }
+      if (high - low > widest) {
+        widest = high - low;
+        axis = c;
+      }
+    }
+    const size_t middle = (begin + end) / 2;
+    std::nth_element(ids->begin() + begin, ids->begin() + middle,
+      ids->begin() + end, [&](int a, int b) {
+        return colors[a].c[axis] < colors[b].c[axis];
+      });
+    const int entry = (*ids)[middle];
+    const int node = static_cast<int>(nodes_.size());
+    nodes_.push_back({ colors[entry], entry, axis, 0, 0 });
+    if (entry_nodes_.size() <= static_cast<size_t>(entry))
+      entry_nodes_.resize(entry + 1);
+    entry_nodes_[entry] = node;
+    Build(colors, ids, begin, middle);
+    nodes_[node].right = static_cast<int>(nodes_.size());
+    Build(colors, ids, middle + 1, end);
+    nodes_[node].end = static_cast<int>(nodes_.size());
+  }
+
+  // Searches the subtree at |index|; ties go to the lower entry.
+  void Search(int index, const Color& color, int* best,
+    int* best_distance) const {
+    const Node& node = nodes_[index];
+    const int distance = Distance(color, node.color);
+    if (distance < *best_distance ||
+      (distance == *best_distance && node.entry < *best)) {
+      *best = node.entry;
+      *best_distance = distance;
+    }
+    const int left = index + 1;
+    const int right = node.right;
+    const int delta = color.c[node.axis] - node.color.c[node.axis];
+    const int near_side = delta < 0 ? left : right;
+    const int far_side = delta < 0 ? right : left;
+    const int near_end = delta < 0 ? right : node.end;
+    const int far_end = delta < 0 ? node.end : right;
+    if (near_side < near_end)
+      Search(near_side, color, best, best_distance);
+    if (far_side < far_end && delta * delta <= *best_distance)
+      Search(far_side, color, best, best_distance);
+  }
+
+  std::vector<Node> nodes_;
+  // Node of each palette entry.
+  std::vector<int> entry_nodes_;
+};
+
+// Remembers the nearest entry of recently seen colours.
+class NearestCache {
+public:
+  explicit NearestCache(const KdTree& tree)
+    : tree_(tree), keys_(1 << kCacheBits), entries_(1 << kCacheBits, -1),
+    last_(0) {
+  }
+
+  int Nearest(const unsigned char* rgba) {
+    uint32_t key;
+    memcpy(&key, rgba, 4);
+    const uint32_t slot = (key * 2654435761u) >> (32 - kCacheBits);
+    if (entries_[slot] < 0 || keys_[slot] != key) {
+      keys_[slot] = key;
+      entries_[slot] = tree_.Nearest(LoadColor(rgba), last_);
+    }
+    last_ = entries_[slot];
+    return last_;
+  }
+
+private:
+  const KdTree& tree_;
+  std::vector<uint32_t> keys_;
+  std::vector<int> entries_;
+  int last_;
+};
+
+// Exact nearest-entry search by bin: kBinBits bits of each colour channel,
+// and alpha in eighths with fully opaque apart, since opaque images only
+// ever want alpha 255. The first time a bin is used, the entries that can be
+// nearest to some colour in it are listed, closest to the bin's box first:
+// those no farther from the box than the smallest distance within which some
+// entry covers all of it. Bins take their entries from a coarser bin's list
+// rather than from the whole palette. A lookup walks the list until the next
+// entry's distance to the box exceeds the best distance found, usually after
+// a few. Ties go to the lower entry, as with KdTree.
+class BinNearest {
+public:
+  explicit BinNearest(const std::vector<Color>& colors)
+    : colors_(colors), offsets_(1 << (3 * kBinBits + 4), -1),
+      coarse_offsets_(1 << (3 * kCoarseBinBits + 4), -1) {
+    for (size_t i = 0; i < colors_.size(); ++i)
+      palette_.push_back(MakeCandidate(0, static_cast<int>(i)));
+    palette_.push_back(End());
+  }
+
+  // Entry with the smallest Distance() to |color|, whose channels must be in
+  // 0 to 255.
+  int Nearest(const Color& color) {
+    const uint32_t bin = Bin(color, kBinBits);
+    if (offsets_[bin] < 0) {
+      const uint32_t coarse = Bin(color, kCoarseBinBits);
+      if (coarse_offsets_[coarse] < 0) {
+        coarse_offsets_[coarse] = List(coarse, kCoarseBinBits,
+          palette_.data(), &coarse_candidates_);
+      }
+      offsets_[bin] = List(bin, kBinBits,
+        &coarse_candidates_[coarse_offsets_[coarse]], &candidates_);
+    }
+    // Lists have at least two entries before their end, so the first two
+    // are always tried; that settles most lookups without a branch.
+    const Candidate* candidate = &candidates_[offsets_[bin]];
+#if defined(PNG_QUANTIZER_SSE2)
+    const __m128i wanted = _mm_loadu_si128(
+      reinterpret_cast<const __m128i*>(color.c));
+    const __m128i target = _mm_packs_epi32(wanted, wanted);
+#else
+    const Color& target = color;
+#endif
+    int best = std::min(Key(target, candidate[0]), Key(target, candidate[1]));
+    for (candidate += 2; candidate->box_distance <= best >> 8; ++candidate)
+      best = std::min(best, Key(target, *candidate));
+    return best & 255;
+  }
+
+private:
+  static const int kBinBits = 5;
+  static const int kCoarseBinBits = 3;
+
+  struct Candidate {
+    // The entry's colour, kept here to save a lookup.
+    int16_t color[4];
+    // Smallest Distance() from the bin's box to the entry.
+    int box_distance;
+    int entry;
+  };
+
+  Candidate MakeCandidate(int box_distance, int entry) const {
+    Candidate candidate;
+    for (int c = 0; c < 4; ++c)
+      candidate.color[c] = static_cast<int16_t>(colors_[entry].c[c]);
+    candidate.box_distance = box_distance;
+    candidate.entry = entry;
+    return candidate;
+  }
+
+  // Ends a list's walk.
+  static Candidate End() {
+    Candidate end = {};
+    end.box_distance = INT_MAX;
+    return end;
+  }
+
+  // Distance() to the entry, then the entry, as one number, so that the
+  // smallest is the nearest entry and ties go to the lower one.
+  static int Key(const Color& color, const Candidate& candidate) {
+    int distance = 0;
+    for (int c = 0; c < 4; ++c) {
+      const int diff = color.c[c] - candidate.color[c];
+      distance += diff * diff;
+    }
+    return distance << 8 | candidate.entry;
+  }
+
+#if defined(PNG_QUANTIZER_SSE2)
+  // As above, with the colour's channels as 16-bit lanes.
+  static int Key(__m128i color, const Candidate& candidate) {
+    const __m128i diff = _mm_sub_epi16(color, _mm_loadl_epi64(
+      reinterpret_cast<const __m128i*>(candidate.color)));
+    const __m128i squares = _mm_madd_epi16(diff, diff);
+    return (_mm_cvtsi128_si32(squares) +
+      _mm_cvtsi128_si32(_mm_srli_si128(squares, 4))) << 8 | candidate.entry;
+  }
+#endif
+
+  // The bin of |color| with |bits| bits of each colour channel.
+  static uint32_t Bin(const Color& color, int bits) {
+    const int shift = 8 - bits;
+    return (color.c[0] >> shift) << (2 * bits + 4) |
+      (color.c[1] >> shift) << (bits + 4) | (color.c[2] >> shift) << 4 |
+      (color.c[3] == 255 ? 8 : color.c[3] >> 5);
+  }
+
+  // Lists the entries among |from|, up to its end, that can be nearest to
+  // some colour in |bin|, and ends the list. Returns where it starts in
+  // |list|.
+  int32_t List(uint32_t bin, int bits, const Candidate* from,
+    std::vector<Candidate>* list) {
+    const int size = 256 >> bits;
+    const int alpha = bin & 15;
+    int low[4], high[4];
+    for (int c = 0; c < 3; ++c) {
+      low[c] = ((bin >> (4 + (2 - c) * bits)) & ((1 << bits) - 1)) * size;
+      high[c] = low[c] + size - 1;
+    }
+    low[3] = alpha == 8 ? 255 : alpha << 5;
+    high[3] = alpha == 8 ? 255 : alpha == 7 ? 254 : low[3] + 31;
+
+    // Some entry is within |bound| of everything in the box; entries
+    // farther than that from all of it are never nearest.
+    int bound = INT_MAX;
+    for (const Candidate* candidate = from; candidate->box_distance != INT_MAX;
+      ++candidate) {
+      const Color& color = colors_[candidate->entry];
+      int max_distance = 0;
+      for (int c = 0; c < 4; ++c) {
+        const int v = color.c[c];
+        const int outside = std::max(v - low[c], high[c] - v);
+        max_distance += outside * outside;
+      }
+      bound = std::min(bound, max_distance);
+    }
+    const size_t begin = list->size();
+    for (; from->box_distance != INT_MAX; ++from) {
+      const Color& color = colors_[from->entry];
+      int box_distance = 0;
+      for (int c = 0; c < 4; ++c) {
+        const int v = color.c[c];
+        const int inside = std::max(0, std::max(low[c] - v, v - high[c]));
+        box_distance += inside * inside;
+      }
+      if (box_distance <= bound)
+        list->push_back(MakeCandidate(box_distance, from->entry));
+    }
+    std::sort(list->begin() + begin, list->end(),
+      [](const Candidate& a, const Candidate& b) {
+        return a.box_distance < b.box_distance ||
+          (a.box_distance == b.box_distance && a.entry < b.entry);
+      });
+    // Single-entry lists get theirs twice, then the end of the walk.
+    if (list->size() - begin == 1)
+      list->push_back((*list)[begin]);
+    list->push_back(End());
+    return static_cast<int32_t>(begin);
+  }
+
+  const std::vector<Color>& colors_;
+  // Every entry, as a list to take the coarse bins' from.
+  std::vector<Candidate> palette_;
+  // Start of each bin's list in |candidates_|, or -1 before its first use;
+  // likewise for the coarse bins.
+  std::vector<int32_t> offsets_;
+  std::vector<Candidate> candidates_;
+  std::vector<int32_t> coarse_offsets_;
+  std::vector<Candidate> coarse_candidates_;
+};
+
+}  // namespace
+
+PngQuantizer::PngQuantizer() : width_(0), bit_depth_(8) {
+}
+
+PngQuantizer::~PngQuantizer() {
+}
+
+void PngQuantizer::Quantize(const unsigned char* pixels, size_t stride,
+  PngDecoder::ColorFormat format, bool discard_transparency, int w, int h,
+  int max_colors, bool dither, int threads) {
+  max_colors = std::min(std::max(max_colors, 2), 256);
+  width_ = w;
+  const RowReader reader(pixels, stride, format, discard_transparency, w);
+  const size_t tasks = (h + kRowsPerTask - 1) / kRowsPerTask;
+  threads = static_cast<int>(std::min<size_t>(std::max(threads, 1), tasks));
+
+  // Histogram, one per thread, summed afterwards. Fully transparent pixels
+  // are counted apart; they all get one entry.
+  std::vector<std::vector<uint32_t>> histograms(threads);
+  std::vector<uint64_t> transparent(threads);
+  PngParallelFor(threads, threads, [&](size_t t) {
+    std::vector<uint32_t>& histogram = histograms[t];
+    histogram.assign(kHistogramBins, 0);
+    std::unique_ptr<unsigned char[]> rgba(new unsigned char[w * 4]);
+    for (size_t task = t; task < tasks; task += threads) {
+      const int end = std::min<int>(h, static_cast<int>(task + 1) *
+        kRowsPerTask);
+      for (int y = static_cast<int>(task) * kRowsPerTask; y < end; ++y) {
+        reader.Read(y, rgba.get());
+        for (int x = 0; x < w; ++x) {
+          const unsigned char* pixel = rgba.get() + x * 4;
+          if (pixel[3] == 0)
+            ++transparent[t];
+          else
+            ++histogram[HistogramBin(pixel)];
+        }
+      }
+    }
+  });
+  uint64_t transparent_pixels = 0;
+  for (int t = 0; t < threads; ++t)
+    transparent_pixels += transparent[t];
+  std::vector<HistogramEntry> entries;
+  for (uint32_t bin = 0; bin < kHistogramBins; ++bin) {
+    uint32_t count = 0;
+    for (int t = 0; t < threads; ++t)
+      count += histograms[t][bin];
+    if (count)
+      entries.push_back({ BinColor(bin), count });
+  }
+  histograms.clear();
+
+  std::vector<Color> colors;
+  if (!entries.empty())
+    colors = MedianCut(&entries, max_colors - (transparent_pixels ? 1 : 0));
+
+  // Refine the boxes' means against the actual pixels of a sample of rows.
+  const int sample_step = static_cast<int>(std::max<size_t>(1,
+    static_cast<size_t>(w) * h / kKMeansSamplePixels));
+  std::unique_ptr<unsigned char[]> rgba(new unsigned char[w * 4]);
+  for (int pass = 0; pass < kKMeansPasses && !colors.empty(); ++pass) {
+    const KdTree tree(colors);
+    std::vector<double> sums(colors.size() * 4);
+    std::vector<double> counts(colors.size());
+    int entry = 0;
+    for (int y = sample_step / 2 % h; y < h; y += sample_step) {
+      reader.Read(y, rgba.get());
+      for (int x = 0; x < w; ++x) {
+        const unsigned char* pixel = rgba.get() + x * 4;
+        if (pixel[3] == 0)
+          continue;
+        entry = tree.Nearest(LoadColor(pixel), entry);
+        for (int c = 0; c < 4; ++c)
+          sums[entry * 4 + c] += pixel[c];
+        ++counts[entry];
+      }
+    }
+    for (size_t i = 0; i < colors.size(); ++i) {
+      if (!counts[i])
+        continue;
+      for (int c = 0; c < 4; ++c)
+        colors[i].c[c] = static_cast<int>(sums[i * 4 + c] / counts[i] + 0.5);
+    }
+  }
+
+  // Translucent entries first for a short tRNS, then by luma so that
+  // similar colours get nearby indices.
+  if (transparent_pixels) {
+    const Color clear = { { 0, 0, 0, 0 } };
+    colors.push_back(clear);
+  }
+  std::sort(colors.begin(), colors.end(), [](const Color& a, const Color& b) {
+    const bool a_opaque = a.c[3] == 255, b_opaque = b.c[3] == 255;
+    if (a_opaque != b_opaque)
+      return b_opaque;
+    const int a_luma = 2 * a.c[0] + 5 * a.c[1] + a.c[2];
+    const int b_luma = 2 * b.c[0] + 5 * b.c[1] + b.c[2];
+    if (a_luma != b_luma)
+      return a_luma < b_luma;
+    return memcmp(a.c, b.c, sizeof(a.c)) < 0;
+  });
+  colors.erase(std::unique(colors.begin(), colors.end(),
+    [](const Color& a, const Color& b) {
+      return memcmp(a.c, b.c, sizeof(a.c)) == 0;
+    }), colors.end());
+  int clear_entry = -1;
+  palette_.clear();
+  trns_.clear();
+  for (size_t i = 0; i < colors.size(); ++i) {
+    for (int c = 0; c < 3; ++c)
+      palette_.push_back(static_cast<unsigned char>(colors[i].c[c]));
+    if (colors[i].c[3] != 255)
+      trns_.push_back(static_cast<unsigned char>(colors[i].c[3]));
+    if (colors[i].c[3] == 0 && clear_entry < 0)
+      clear_entry = static_cast<int>(i);
+  }
+  bit_depth_ = PngPaletteBitDepth(colors.size());
+
+  const KdTree tree(colors);
+  indices_.resize(static_cast<size_t>(w) * h);
+  if (!dither) {
+    PngParallelFor(tasks, threads, [&](size_t task) {
+      NearestCache cache(tree);
+      std::unique_ptr<unsigned char[]> row(new unsigned char[w * 4]);
+      const int end = std::min<int>(h, static_cast<int>(task + 1) *
+        kRowsPerTask);
+      for (int y = static_cast<int>(task) * kRowsPerTask; y < end; ++y) {
+        reader.Read(y, row.get());
+        unsigned char* out = &indices_[static_cast<size_t>(y) * w];
+        for (int x = 0; x < w; ++x) {
+          const unsigned char* pixel = row.get() + x * 4;
+          out[x] = static_cast<unsigned char>(pixel[3] == 0 ? clear_entry :
+            cache.Nearest(pixel));
+        }
+      }
+    });
+    return;
+  }
+
+  // Floyd-Steinberg: 7/16 of each pixel's error goes right, 3/16, 5/16 and
+  // 1/16 to the row below. Errors are kept in sixteenths, with a pixel of
+  // padding on either side. Dithered colours rarely repeat, so rather than
+  // by colour they are looked up by bin, among the few entries that can be
+  // nearest to anything in it (see BinNearest). Each pixel waits on its left
+  // neighbour, so the error going right and the row below's unfinished sums
+  // travel along in |Dither| instead of being added into the rows, and rows
+  // go in pairs, the second two pixels behind the first, to overlap two such
+  // chains. By then every error it reads is complete, and the sums come out
+  // as they would row by row.
+  struct Dither {
+    int right[4];
+    // Sums for the row below at this pixel and the next.
+    int here[4];
+    int next[4];
+  };
+  BinNearest nearest(colors);
+  auto diffuse = [&](const unsigned char* pixel, const int* error,
+    int* below, Dither* dither, unsigned char* out) {
+#if defined(PNG_QUANTIZER_SSE2)
+    __m128i diff = _mm_setzero_si128();
+    if (pixel[3] == 0) {
+      *out = static_cast<unsigned char>(clear_entry);
+    } else {
+      const __m128i zero = _mm_setzero_si128();
+      __m128i sum = _mm_add_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(error)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(dither->right)));
+      // Divided by 16 rounding toward zero, as in C.
+      sum = _mm_srai_epi32(_mm_add_epi32(sum,
+        _mm_srli_epi32(_mm_srai_epi32(sum, 31), 28)), 4);
+      uint32_t rgba;
+      memcpy(&rgba, pixel, sizeof(rgba));
+      sum = _mm_add_epi32(sum, _mm_unpacklo_epi16(_mm_unpacklo_epi8(
+        _mm_cvtsi32_si128(static_cast<int>(rgba)), zero), zero));
+      // The packs clamp to 0 to 255.
+      const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(sum, sum),
+        zero);
+      const __m128i wanted_lanes = _mm_unpacklo_epi16(
+        _mm_unpacklo_epi8(packed, zero), zero);
+      Color wanted;
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(wanted.c), wanted_lanes);
+      const int entry = nearest.Nearest(wanted);
+      *out = static_cast<unsigned char>(entry);
+      diff = _mm_sub_epi32(wanted_lanes,
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(colors[entry].c)));
+    }
+    // |below| is the pixel to the left, which this one completes.
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(below), _mm_add_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(dither->here)),
+      _mm_add_epi32(_mm_add_epi32(diff, diff), diff)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dither->here), _mm_add_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(dither->next)),
+      _mm_add_epi32(_mm_slli_epi32(diff, 2), diff)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dither->next), diff);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dither->right),
+      _mm_sub_epi32(_mm_slli_epi32(diff, 3), diff));
+#else
+    int diff[4] = { 0, 0, 0, 0 };
+    if (pixel[3] == 0) {
+      *out = static_cast<unsigned char>(clear_entry);
+    } else {
+      Color wanted;
+      for (int c = 0; c < 4; ++c) {
+        wanted.c[c] = std::min(255, std::max(0,
+          pixel[c] + (error[c] + dither->right[c]) / 16));
+      }
+      const int entry = nearest.Nearest(wanted);
+      *out = static_cast<unsigned char>(entry);
+      for (int c = 0; c < 4; ++c)
+        diff[c] = wanted.c[c] - colors[entry].c[c];
+    }
+    // |below| is the pixel to the left, which this one completes.
+    for (int c = 0; c < 4; ++c) {
+      below[c] = dither->here[c] + diff[c] * 3;
+      dither->here[c] = dither->next[c] + diff[c] * 5;
+      dither->next[c] = diff[c];
+      dither->right[c] = diff[c] * 7;
+    }
+#endif
+  };
+  const size_t error_size = static_cast<size_t>(w + 2) * 4;
+  std::vector<int> errors[3] = {
+    std::vector<int>(error_size), std::vector<int>(error_size),
+    std::vector<int>(error_size) };
+  std::unique_ptr<unsigned char[]> second_rgba(new unsigned char[w * 4]);
+  for (int y = 0; y < h; y += 2) {
+    // |errors[0]| holds row y's; each pair writes all of the other two.
+    Dither first = {}, second = {};
+    reader.Read(y, rgba.get());
+    unsigned char* out = &indices_[static_cast<size_t>(y) * w];
+    if (y + 1 == h) {
+      for (int x = 0; x < w; ++x) {
+        diffuse(rgba.get() + x * 4, &errors[0][(x + 1) * 4],
+          &errors[1][x * 4], &first, out + x);
+      }
+      break;
+    }
+    reader.Read(y + 1, second_rgba.get());
+    unsigned char* second_out = out + w;
+    for (int x = 0; x < w + 2; ++x) {
+      if (x < w) {
+        diffuse(rgba.get() + x * 4, &errors[0][(x + 1) * 4],
+          &errors[1][x * 4], &first, out + x);
+      } else if (x == w) {
+        std::copy(first.here, first.here + 4, &errors[1][w * 4]);
+      }
+      if (x >= 2) {
+        diffuse(second_rgba.get() + (x - 2) * 4, &errors[1][(x - 1) * 4],
+          &errors[2][(x - 2) * 4], &second, second_out + x - 2);
+      }
+    }
+    std::copy(second.here, second.here + 4, &errors[2][w * 4]);
+    errors[0].swap(errors[2]);
+  }
+}
+
+size_t PngQuantizer::RowBytes() const {
+  return (static_cast<size_t>(width_) * bit_depth_ + 7) / 8;
+}
+
+void PngQuantizer::PackRow(uint32_t y, unsigned char* dst) const {
+  PackPngSamples(&indices_[static_cast<size_t>(y) * width_], width_,
+    bit_depth_, dst);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "png_decoder.h"
+
+// Lossy reduction of an image to a palette of at most 256 colours, for
+// thumbnails and previews. The palette comes from median cut over a colour
+// histogram, refined by a few k-means passes over the pixels; every pixel
+// then maps to its nearest entry, found with a k-d tree, optionally with
+// Floyd-Steinberg dithering. Fully transparent pixels share one entry, and
+// translucent entries go through tRNS.
+class PngQuantizer {
+public:
+  PngQuantizer();
+  ~PngQuantizer();
+
+  // Quantizes the |w| x |h| image whose rows start |stride| bytes apart at
+  // |pixels| to at most |max_colors| colours, 2 to 256. |discard_transparency|
+  // treats every pixel as opaque. The histogram and, without |dither|, the
+  // mapping run on up to |threads| threads; dithering carries error from row
+  // to row and runs on the calling thread.
+  void Quantize(const unsigned char* pixels, size_t stride,
+    PngDecoder::ColorFormat format, bool discard_transparency, int w, int h,
+    int max_colors, bool dither, int threads);
+
+  // Bits per index, 1 to 8.
+  int bit_depth() const { return bit_depth_; }
+
+  // PLTE entries as RGB triplets, and the tRNS alpha values of the
+  // translucent entries, which come first.
+  const std::vector<unsigned char>& palette() const { return palette_; }
+  const std::vector<unsigned char>& trns() const { return trns_; }
+
+  // Bytes per packed row.
+  size_t RowBytes() const;
+
+  // Writes row |y| as packed palette indices. May be called from several
+  // threads at once.
+  void PackRow(uint32_t y, unsigned char* dst) const;
+
+private:
+  int width_;
+  int bit_depth_;
+  std::vector<unsigned char> palette_;
+  std::vector<unsigned char> trns_;
+  // One palette index per pixel.
+  std::vector<unsigned char> indices_;
+};
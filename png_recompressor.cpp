@@ -0,0 +1,488 @@
+#include "stdafx.h"
+#include "png_recompressor.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "logging.h"
+#include "png_chunk_reader.h"
+#include "png_color_reduction.h"
+#include "png_decoder.h"
+#include "png_idat_decoder.h"
+#include "png_parallel.h"
+#include "png_restart_points.h"
+#include "png_row_filter.h"
+#include "third_party/zlib/zlib.h"
+
+namespace {
+
+const unsigned char kPngSignature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+const uint32_t kIHDR = 0x49484452;
+const uint32_t kPLTE = 0x504c5445;
+const uint32_t kIDAT = 0x49444154;
+const uint32_t kIEND = 0x49454e44;
+const uint32_t kTRNS = 0x74524e53;
+
+// Chunks whose meaning depends on the colour type, and which RecompressPng
+// would have to translate to reduce the colours; images with them keep
+// theirs.
+const uint32_t kColorTypeChunks[] = {
+  0x624b4744,  // bKGD
+  0x73424954,  // sBIT
+  0x68495354,  // hIST
+  0x69434350,  // iCCP
+};
+
+// Memory levels tried: libpng's 8, and 9, whose bigger hash table and
+// symbol buffer change both the matches found and where blocks end.
+const int kMemLevels[] = { 8, 9 };
+
+const int kStrategies[] = {
+  Z_DEFAULT_STRATEGY, Z_FILTERED, Z_RLE, Z_HUFFMAN_ONLY };
+
+// Bytes deflate keeps free at the end of its window (zlib's MIN_LOOKAHEAD).
+const size_t kMinLookahead = 262;
+
+const int kAllFilters = (1 << (PNG_ROW_FILTER_PAETH + 1)) - 1;
+
+// zlib's smallest window.
+const int kMinWindowBits = 9;
+
+// Image data to encode: the input's own samples, or the same pixels in the
+// narrowest format PngColorReducer finds.
+struct Image {
+  std::vector<unsigned char> rows;
+  size_t row_bytes;
+  int bpp;
+  // Empty for the input's samples; otherwise the IHDR payload, PLTE and tRNS
+  // written in place of the input's.
+  std::vector<unsigned char> ihdr;
+  std::vector<unsigned char> palette;
+  std::vector<unsigned char> trns;
+  // Bytes of the output besides the IDAT stream.
+  size_t overhead;
+};
+
+struct Candidate {
+  int image;
+  PngDeflateSettings settings;
+  int window_bits;
+  int mem_level;
+};
+
+bool operator==(const Candidate& a, const Candidate& b) {
+  return a.image == b.image &&
+    a.settings.filter_mask == b.settings.filter_mask &&
+    a.settings.zlib_level == b.settings.zlib_level &&
+    a.settings.zlib_strategy == b.settings.zlib_strategy &&
+    a.window_bits == b.window_bits && a.mem_level == b.mem_level;
+}
+
+// Inflates and unfilters the image data of |reader| into |rows|, row after
+// row without filter type bytes.
+bool ReadRows(const PngChunkReader& reader, std::vector<unsigned char>* rows) {
+  const uint32_t height = reader.header().height;
+  const size_t row_bytes = reader.RowBytes(reader.header().width);
+  const int bpp = reader.FilterBpp();
+  std::vector<unsigned char> filtered(row_bytes + 1);
+  rows->resize(row_bytes * height);
+  IdatInflater inflater(reader.idat());
+  if (!inflater.Init())
+    return false;
+  for (uint32_t y = 0; y < height; ++y) {
+    unsigned char* row = &(*rows)[y * row_bytes];
+    if (!inflater.Read(filtered.data(), filtered.size()))
+      return false;
+    memcpy(row, &filtered[1], row_bytes);
+    if (!UnfilterPngRow(filtered[0], bpp, row_bytes,
+      y ? row - row_bytes : nullptr, row))
+      return false;
+  }
+  return true;
+}
+
+// Sample |x| of |bit_depth| bits from |row|.
+unsigned GetSample(const unsigned char* row, size_t x, int bit_depth) {
+  if (bit_depth == 8)
+    return row[x];
+  const size_t bit = x * bit_depth;
+  return (row[bit / 8] >> (8 - bit_depth - bit % 8)) & ((1 << bit_depth) - 1);
+}
+
+// Converts |rows| of the image in |reader|, as ReadRows() writes them, to
+// 8-bit RGBA pixels, with tRNS applied. Returns false for 16-bit samples,
+// which do not fit, and for palette indices past the end of PLTE.
+bool ExpandRows(const PngChunkReader& reader,
+  const std::vector<unsigned char>& rows, std::vector<unsigned char>* pixels) {
+  const PngChunkReader::Header& header = reader.header();
+  if (header.bit_depth == 16)
+    return false;
+  const size_t row_bytes = reader.RowBytes(header.width);
+  const std::vector<unsigned char>& palette = reader.palette();
+  const std::vector<unsigned char>& trns = reader.trns();
+  const int channels = reader.channels();
+  const unsigned max_sample = (1u << header.bit_depth) - 1;
+  // Gray and RGB images mark one colour transparent with 16-bit samples.
+  const bool has_key = !trns.empty() &&
+    (header.color_type == 0 || header.color_type == 2);
+  unsigned key[3] = { 0, 0, 0 };
+  for (size_t i = 0; has_key && i < trns.size() / 2 && i < 3; ++i)
+    key[i] = (trns[i * 2] << 8) | trns[i * 2 + 1];
+
+  pixels->resize(static_cast<size_t>(header.width) * header.height * 4);
+  unsigned char* dst = pixels->data();
+  for (uint32_t y = 0; y < header.height; ++y) {
+    const unsigned char* row = &rows[y * row_bytes];
+    for (uint32_t x = 0; x < header.width; ++x, dst += 4) {
+      unsigned samples[4];
+      for (int c = 0; c < channels; ++c)
+        samples[c] = GetSample(row, static_cast<size_t>(x) * channels + c,
+          header.bit_depth);
+      switch (header.color_type) {
+      case 3:  // Palette.
+        if (samples[0] * 3 >= palette.size())
+          return false;
+        memcpy(dst, &palette[samples[0] * 3], 3);
+        dst[3] = samples[0] < trns.size() ? trns[samples[0]] : 255;
+        break;
+      case 0:  // Gray.
+        dst[0] = dst[1] = dst[2] =
+          static_cast<unsigned char>(samples[0] * 255 / max_sample);
+        dst[3] = has_key && samples[0] == key[0] ? 0 : 255;
+        break;
+      case 4:  // Gray and alpha.
+        dst[0] = dst[1] = dst[2] = static_cast<unsigned char>(samples[0]);
+        dst[3] = static_cast<unsigned char>(samples[1]);
+        break;
+      case 2:  // RGB.
+        for (int c = 0; c < 3; ++c)
+          dst[c] = static_cast<unsigned char>(samples[c]);
+        dst[3] = has_key && samples[0] == key[0] && samples[1] == key[1] &&
+          samples[2] == key[2] ? 0 : 255;
+        break;
+      default:  // RGBA.
+        for (int c = 0; c < 4; ++c)
+          dst[c] = static_cast<unsigned char>(samples[c]);
+        break;
+      }
+    }
+  }
+  return true;
+}
+
+// The image of |reader|, whose samples are |rows|, in the narrowest format
+// that holds its pixels, if that differs from the input's own. Images with
+// chunks tied to the colour type are left alone.
+bool ReduceColors(const PngChunkReader& reader,
+  const std::vector<unsigned char>& rows, Image* image) {
+  for (const PngChunkReader::Chunk& chunk : reader.chunks()) {
+    if (std::find(std::begin(kColorTypeChunks), std::end(kColorTypeChunks),
+      chunk.type) != std::end(kColorTypeChunks))
+      return false;
+  }
+  std::vector<unsigned char> pixels;
+  if (!ExpandRows(reader, rows, &pixels))
+    return false;
+
+  const PngChunkReader::Header& header = reader.header();
+  const int w = static_cast<int>(header.width);
+  const size_t stride = static_cast<size_t>(w) * 4;
+  PngColorReducer reducer(PngDecoder::FORMAT_RGBA, false);
+  reducer.Analyze(pixels.data(), stride, w, static_cast<int>(header.height));
+  if (reducer.color_type() == header.color_type &&
+    reducer.bit_depth() == header.bit_depth &&
+    (header.color_type != 3 || (reducer.palette() == reader.palette() &&
+      reducer.trns() == reader.trns())))
+    return false;
+
+  image->row_bytes = reducer.RowBytes(w);
+  image->bpp = reducer.FilterBpp();
+  image->rows.resize(image->row_bytes * header.height);
+  for (uint32_t y = 0; y < header.height; ++y) {
+    reducer.PackRow(&pixels[y * stride], w,
+      &image->rows[y * image->row_bytes]);
+  }
+  const unsigned char ihdr[13] = {
+    static_cast<unsigned char>(header.width >> 24),
+    static_cast<unsigned char>(header.width >> 16),
+    static_cast<unsigned char>(header.width >> 8),
+    static_cast<unsigned char>(header.width),
+    static_cast<unsigned char>(header.height >> 24),
+    static_cast<unsigned char>(header.height >> 16),
+    static_cast<unsigned char>(header.height >> 8),
+    static_cast<unsigned char>(header.height),
+    static_cast<unsigned char>(reducer.bit_depth()),
+    static_cast<unsigned char>(reducer.color_type()),
+    0, 0, 0,
+  };
+  image->ihdr.assign(ihdr, ihdr + sizeof(ihdr));
+  image->palette = reducer.palette();
+  image->trns = reducer.trns();
+  return true;
+}
+
+// The smallest deflate window holding |filtered_bytes| of data, as libpng
+// picks for small images.
+int WindowBitsFor(size_t filtered_bytes) {
+  int window_bits = MAX_WBITS;
+  while (window_bits > 9 &&
+    filtered_bytes + kMinLookahead <= (1u << (window_bits - 1)))
+    --window_bits;
+  return window_bits;
+}
+
+// Appends the grid of configurations for |image| to |candidates|, leaving
+// out |first|. |window_bits| is the smallest window holding the image.
+void ListCandidates(int image, int window_bits, const Candidate& first,
+  const PngRecompressOptions& options, std::vector<Candidate>* candidates) {
+  const int filter_masks[] = {
+    kAllFilters,
+    PngFilterBit(PNG_ROW_FILTER_NONE),
+    PngFilterBit(PNG_ROW_FILTER_SUB),
+    PngFilterBit(PNG_ROW_FILTER_UP),
+    PngFilterBit(PNG_ROW_FILTER_AVG),
+    PngFilterBit(PNG_ROW_FILTER_PAETH),
+  };
+  const int min_window_bits =
+    std::max(kMinWindowBits, window_bits - options.window_levels + 1);
+  for (int filter_mask : filter_masks) {
+    for (int strategy : kStrategies) {
+      // Run-length and Huffman-only coding ignore the level.
+      const bool levels = strategy == Z_DEFAULT_STRATEGY ||
+        strategy == Z_FILTERED;
+      for (int level = options.max_zlib_level;
+        level >= (levels ? options.min_zlib_level : options.max_zlib_level);
+        --level) {
+        for (int bits = window_bits; bits >= min_window_bits; --bits) {
+          for (int mem_level : kMemLevels) {
+            const Candidate candidate = {
+              image, { filter_mask, level, strategy }, bits, mem_level };
+            if (!(candidate == first))
+              candidates->push_back(candidate);
+          }
+        }
+      }
+    }
+  }
+}
+
+// The input with its IDAT chunks replaced by one holding |stream|, and its
+// IHDR, PLTE and tRNS by those of |image| if it has its own.
+void WritePng(const PngChunkReader& reader, const Image& image,
+  const std::vector<unsigned char>& stream,
+  std::vector<unsigned char>* output) {
+  const bool reduced = !image.ihdr.empty();
+  output->clear();
+  output->insert(output->end(), kPngSignature,
+    kPngSignature + sizeof(kPngSignature));
+  bool wrote_idat = false;
+  for (const PngChunkReader::Chunk& chunk : reader.chunks()) {
+    if (chunk.type == PngChunkReader::kRestartPointsType)
+      continue;
+    if (reduced && (chunk.type == kPLTE || chunk.type == kTRNS))
+      continue;
+    if (reduced && chunk.type == kIHDR) {
+      AppendPngChunk(kIHDR, image.ihdr.data(), image.ihdr.size(), output);
+      continue;
+    }
+    if (chunk.type == kIDAT) {
+      if (!wrote_idat) {
+        if (!image.palette.empty()) {
+          AppendPngChunk(kPLTE, image.palette.data(), image.palette.size(),
+            output);
+        }
+        if (!image.trns.empty())
+          AppendPngChunk(kTRNS, image.trns.data(), image.trns.size(), output);
+        AppendPngChunk(kIDAT, stream.data(), stream.size(), output);
+        wrote_idat = true;
+      }
+      continue;
+    }
+    // Copy length, type, payload and CRC verbatim.
+    const unsigned char* begin = chunk.data.data - 8;
+    output->insert(output->end(), begin, chunk.data.data + chunk.data.size + 4);
+    if (chunk.type == kIEND)
+      break;
+  }
+}
+
+// Decodes |output| both to samples and to pixels and compares them with
+// |rows| and the pixels of |input|.
+bool VerifyPng(const unsigned char* input, size_t input_size,
+  const std::vector<unsigned char>& output,
+  const std::vector<unsigned char>& rows) {
+  PngChunkReader reader;
+  std::vector<unsigned char> output_rows;
+  if (!reader.Parse(output.data(), output.size()) || !reader.complete() ||
+    !ReadRows(reader, &output_rows) || output_rows != rows)
+    return false;
+
+  // A batch job has nobody to click through libpng's error boxes.
+  PngDecoder::DecodeOptions options;
+  options.error_dialogs = false;
+  std::vector<unsigned char> input_pixels, output_pixels;
+  int input_w, input_h, output_w, output_h;
+  return PngDecoder::Decode(input, input_size, PngDecoder::FORMAT_RGBA,
+    options, &input_pixels, &input_w, &input_h) &&
+    PngDecoder::Decode(output.data(), output.size(), PngDecoder::FORMAT_RGBA,
+      options, &output_pixels, &output_w, &output_h) &&
+    input_w == output_w && input_h == output_h &&
+    input_pixels == output_pixels;
+}
+
+}  // namespace
+
+PngRecompressOptions::PngRecompressOptions()
+  : max_threads(0),
+  min_zlib_level(6),
+  max_zlib_level(9),
+  window_levels(2),
+  reduce_colors(true) {
+}
+
+PngRecompressResult::PngRecompressResult()
+  : candidates(0),
+  abandoned(0),
+  improved(false),
+  reduced_colors(false),
+  window_bits(MAX_WBITS),
+  mem_level(8) {
+  settings.filter_mask = kAllFilters;
+  settings.zlib_level = PngDecoder::DEFAULT_ZLIB_COMPRESSION;
+  settings.zlib_strategy = Z_DEFAULT_STRATEGY;
+}
+
+bool RecompressPng(const unsigned char* input, size_t input_size,
+  const PngRecompressOptions& options, std::vector<unsigned char>* output,
+  PngRecompressResult* result) {
+  if (options.min_zlib_level < 1 ||
+    options.max_zlib_level < options.min_zlib_level ||
+    options.max_zlib_level > 9 || options.window_levels < 1)
+    return false;
+  PngChunkReader reader;
+  if (!reader.Parse(input, input_size) || !reader.complete() ||
+    reader.header().interlace_type != 0)
+    return false;
+
+  const uint32_t height = reader.header().height;
+  std::vector<Image> images(1);
+  images[0].row_bytes = reader.RowBytes(reader.header().width);
+  images[0].bpp = reader.FilterBpp();
+  if (!ReadRows(reader, &images[0].rows))
+    return false;
+  Image reduced;
+  if (options.reduce_colors && ReduceColors(reader, images[0].rows, &reduced))
+    images.push_back(std::move(reduced));
+
+  // Every image's best guess first, so that a likely winner sets a tight
+  // bound early.
+  std::vector<Candidate> candidates;
+  std::vector<int> window_bits(images.size());
+  for (size_t i = 0; i < images.size(); ++i) {
+    Image& image = images[i];
+    const PngRowSource source = [&](uint32_t y, unsigned char* row) {
+      memcpy(row, &image.rows[y * image.row_bytes], image.row_bytes);
+    };
+    window_bits[i] = WindowBitsFor((image.row_bytes + 1) * height);
+    Candidate first = { static_cast<int>(i),
+      ChooseDeflateSettings(source, image.row_bytes, image.bpp, height,
+        options.max_zlib_level), window_bits[i], kMemLevels[0] };
+    // As listed in the grid.
+    if (first.settings.zlib_strategy == Z_RLE ||
+      first.settings.zlib_strategy == Z_HUFFMAN_ONLY)
+      first.settings.zlib_level = options.max_zlib_level;
+    candidates.push_back(first);
+
+    std::vector<unsigned char> empty_png;
+    WritePng(reader, image, std::vector<unsigned char>(), &empty_png);
+    image.overhead = empty_png.size();
+  }
+  for (size_t i = 0; i < images.size(); ++i) {
+    ListCandidates(static_cast<int>(i), window_bits[i], candidates[i],
+      options, &candidates);
+  }
+
+  int threads = options.max_threads;
+  if (threads <= 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+
+  // Anything worth writing must beat the input file, and then the smallest
+  // output so far; each image's streams are held to that less the rest of
+  // its file. Candidates finish in any order; ties go to the one listed
+  // first, so the result does not depend on the thread count.
+  std::vector<std::atomic<size_t>> size_limits(images.size());
+  for (size_t i = 0; i < images.size(); ++i) {
+    size_limits[i].store(input_size > images[i].overhead ?
+      input_size - images[i].overhead : 0);
+  }
+  std::atomic<int> abandoned(0);
+  std::mutex best_mutex;
+  size_t best_index = candidates.size();
+  size_t best_size = 0;
+  std::vector<unsigned char> best_stream;
+  PngParallelFor(candidates.size(), threads, [&](size_t i) {
+    const Candidate& candidate = candidates[i];
+    const Image& image = images[candidate.image];
+    const PngRowSource source = [&](uint32_t y, unsigned char* row) {
+      memcpy(row, &image.rows[y * image.row_bytes], image.row_bytes);
+    };
+    std::vector<unsigned char> stream;
+    if (!DeflateRowsWithLimit(source, image.row_bytes, image.bpp, height,
+      candidate.settings, candidate.window_bits, candidate.mem_level,
+      &size_limits[candidate.image], &stream)) {
+      ++abandoned;
+      return;
+    }
+    const size_t size = image.overhead + stream.size();
+    std::lock_guard<std::mutex> lock(best_mutex);
+    if (best_index == candidates.size() || size < best_size ||
+      (size == best_size && i < best_index)) {
+      best_index = i;
+      best_size = size;
+      best_stream.swap(stream);
+      for (size_t j = 0; j < images.size(); ++j) {
+        size_limits[j].store(size > images[j].overhead ?
+          size - images[j].overhead : 0);
+      }
+    }
+  });
+
+  if (result) {
+    *result = PngRecompressResult();
+    result->candidates = static_cast<int>(candidates.size());
+    result->abandoned = abandoned.load();
+  }
+
+  if (best_index < candidates.size()) {
+    const Candidate& best = candidates[best_index];
+    const Image& image = images[best.image];
+    WritePng(reader, image, best_stream, output);
+    if (output->size() < input_size) {
+      if (!VerifyPng(input, input_size, *output, image.rows)) {
+        PNG_LOG("RecompressPng: output does not match the input\n");
+        return false;
+      }
+      PNG_LOG("RecompressPng: %u -> %u bytes, candidate %u of %u\n",
+        static_cast<unsigned>(input_size),
+        static_cast<unsigned>(output->size()),
+        static_cast<unsigned>(best_index),
+        static_cast<unsigned>(candidates.size()));
+      if (result) {
+        result->improved = true;
+        result->reduced_colors = best.image != 0;
+        result->settings = best.settings;
+        result->window_bits = best.window_bits;
+        result->mem_level = best.mem_level;
+      }
+      return true;
+    }
+  }
+  output->assign(input, input + input_size);
+  return true;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "png_idat_encoder.h"
+
+// Offline lossless recompression, for assets that are encoded once and
+// served many times. The image data is inflated and unfiltered once, and
+// optionally reduced to the narrowest pixel format that holds it, then
+// filtered and deflated again with every configuration in a grid, on a pool
+// of threads, keeping the smallest result.
+
+struct PngRecompressOptions {
+  PngRecompressOptions();
+
+  // Threads encoding candidates; 0 means one per logical processor.
+  int max_threads;
+
+  // zlib levels tried with the default and filtered strategies, inclusive.
+  // Level 9 is not always the smallest; the lazy matching of lower levels
+  // sometimes wins by a little.
+  int min_zlib_level;
+  int max_zlib_level;
+
+  // Deflate windows tried, counting down from the smallest that holds the
+  // image and stopping at zlib's 512 bytes; 1 tries only that one.
+  int window_levels;
+
+  // Also tries the image as gray, gray with alpha, RGB, or a palette at the
+  // lowest bit depth that holds it exactly (see PngColorReducer), when that
+  // differs from the input's format. Skipped for 16-bit images and for
+  // images with bKGD, sBIT, hIST or iCCP, whose contents depend on the
+  // colour type.
+  bool reduce_colors;
+};
+
+struct PngRecompressResult {
+  PngRecompressResult();
+
+  // Configurations tried, and how many of them were abandoned partway
+  // because their stream had already grown past the smallest one so far.
+  int candidates;
+  int abandoned;
+
+  // False if no configuration beat the input, which was then copied as is.
+  bool improved;
+
+  // The configuration written, when |improved|; |reduced_colors| if the
+  // image was written in PngColorReducer's format.
+  bool reduced_colors;
+  PngDeflateSettings settings;
+  int window_bits;
+  int mem_level;
+};
+
+// Rewrites the non-interlaced PNG in |input| to |output| with the smallest
+// file found over the pixel formats, filter sets, zlib strategies, levels,
+// windows and memory levels of the grid, with the image data in a single
+// IDAT chunk. Candidates start with ChooseDeflateSettings()'s guess for each
+// pixel format and must beat the input file, so most of the rest are
+// abandoned early. Other chunks are copied unchanged, except rsPT, whose
+// restart points no longer apply, and IHDR, PLTE and tRNS when the colours
+// were reduced. The output is decoded again and its samples and pixels
+// compared with the input's before it is returned. Returns false if the
+// input is interlaced, does not decode, or the check fails.
+bool RecompressPng(const unsigned char* input, size_t input_size,
+  const PngRecompressOptions& options, std::vector<unsigned char>* output,
+  PngRecompressResult* result = nullptr);
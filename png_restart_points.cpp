@@ -0,0 +1,241 @@
+#include "stdafx.h"
+#include "png_restart_points.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "logging.h"
+#include "png_idat_decoder.h"
+#include "png_row_filter.h"
+#include "png_zlib_pool.h"
+#include "third_party/zlib/zlib.h"
+
+namespace {
+
+// Same bound as the decoder: w * h * 4 must fit a signed int.
+const uint64_t kMaxPixels = (1 << 29) - 1;
+
+const unsigned char kPngSignature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+const uint32_t kIDAT = 0x49444154;
+const uint32_t kIEND = 0x49454e44;
+
+// IDAT payload size used when writing. libpng uses 8 KB; bigger chunks cost
+// less per-chunk overhead on the read side.
+const size_t kIdatChunkSize = 256 * 1024;
+
+void AppendUint32(uint32_t value, std::vector<unsigned char>* output) {
+  output->push_back(static_cast<unsigned char>(value >> 24));
+  output->push_back(static_cast<unsigned char>(value >> 16));
+  output->push_back(static_cast<unsigned char>(value >> 8));
+  output->push_back(static_cast<unsigned char>(value));
+}
+
+// Feeds |size| bytes to |stream|, ending with |flush|, and appends whatever
+// comes out to |output|.
+bool DeflateInto(z_stream* stream, const unsigned char* input, size_t size,
+  int flush, std::vector<unsigned char>* output) {
+  const size_t kMaxPiece = 1u << 30;
+  unsigned char buffer[64 * 1024];
+  do {
+    const size_t piece = std::min(size, kMaxPiece);
+    const int piece_flush = piece == size ? flush : Z_NO_FLUSH;
+    stream->next_in = const_cast<unsigned char*>(input);
+    stream->avail_in = static_cast<uInt>(piece);
+    int ret;
+    do {
+      stream->next_out = buffer;
+      stream->avail_out = sizeof(buffer);
+      ret = deflate(stream, piece_flush);
+      if (ret == Z_STREAM_ERROR)
+        return false;
+      output->insert(output->end(), buffer,
+        buffer + sizeof(buffer) - stream->avail_out);
+    } while (stream->avail_out == 0 ||
+      (piece_flush == Z_FINISH && ret != Z_STREAM_END));
+    input += piece;
+    size -= piece;
+  } while (size > 0);
+  return true;
+}
+
+}  // namespace
+
+bool DeflateWithRestartPoints(const unsigned char* filtered, size_t stride,
+  uint32_t height, uint32_t rows_per_segment, int zlib_level,
+  int zlib_strategy, std::vector<unsigned char>* stream,
+  std::vector<PngChunkReader::RestartPoint>* points) {
+  if (rows_per_segment == 0)
+    return false;
+
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  UsePngZlibPool(&zs);
+  if (deflateInit2(&zs, zlib_level, Z_DEFLATED, MAX_WBITS, 8,
+    zlib_strategy) != Z_OK)
+    return false;
+
+  stream->clear();
+  points->clear();
+  bool ok = true;
+  for (uint32_t y = 0; y < height && ok; y += rows_per_segment) {
+    if (stream->size() > UINT32_MAX) {
+      ok = false;
+      break;
+    }
+    points->push_back({ y, static_cast<uint32_t>(y == 0 ? 0 : stream->size()) });
+    const uint32_t rows = std::min(rows_per_segment, height - y);
+    const bool last = y + rows == height;
+    ok = DeflateInto(&zs, filtered + y * stride, rows * stride,
+      last ? Z_FINISH : Z_FULL_FLUSH, stream);
+  }
+  deflateEnd(&zs);
+  return ok;
+}
+
+bool DeflateRowsWithRestartPoints(const PngRowSource& source,
+  size_t row_bytes, int bpp, uint32_t height, uint32_t rows_per_segment,
+  const PngDeflateSettings& settings, std::vector<unsigned char>* stream,
+  std::vector<PngChunkReader::RestartPoint>* points) {
+  if (rows_per_segment == 0)
+    return false;
+
+  // Segment starts keep None or Sub from the mask, or Sub if it has neither.
+  const int start_mask = settings.filter_mask &
+    (PngFilterBit(PNG_ROW_FILTER_NONE) | PngFilterBit(PNG_ROW_FILTER_SUB));
+  const size_t stride = row_bytes + 1;
+  std::vector<unsigned char> filtered(stride * height);
+  std::vector<unsigned char> prev(row_bytes);
+  std::vector<unsigned char> cur(row_bytes);
+  std::vector<unsigned char> scratch(stride);
+  for (uint32_t y = 0; y < height; ++y) {
+    source(y, cur.data());
+    const int mask = y % rows_per_segment ? settings.filter_mask :
+      start_mask ? start_mask : PngFilterBit(PNG_ROW_FILTER_SUB);
+    FilterPngRow(mask, bpp, row_bytes, prev.data(), cur.data(),
+      &filtered[y * stride], scratch.data());
+    prev.swap(cur);
+  }
+  return DeflateWithRestartPoints(filtered.data(), stride, height,
+    rows_per_segment, settings.zlib_level, settings.zlib_strategy, stream,
+    points);
+}
+
+void AppendPngChunk(uint32_t type, const unsigned char* data, size_t length,
+  std::vector<unsigned char>* output) {
+  AppendUint32(static_cast<uint32_t>(length), output);
+  const size_t type_pos = output->size();
+  AppendUint32(type, output);
+  output->insert(output->end(), data, data + length);
+  uLong crc = crc32(0L, Z_NULL, 0);
+  crc = crc32(crc, &(*output)[type_pos], static_cast<uInt>(length + 4));
+  AppendUint32(static_cast<uint32_t>(crc), output);
+}
+
+void AppendRestartPointsChunk(
+  const std::vector<PngChunkReader::RestartPoint>& points,
+  std::vector<unsigned char>* output) {
+  std::vector<unsigned char> payload;
+  AppendUint32(static_cast<uint32_t>(points.size()), &payload);
+  for (const PngChunkReader::RestartPoint& point : points) {
+    AppendUint32(point.first_row, &payload);
+    AppendUint32(point.stream_offset, &payload);
+  }
+  AppendPngChunk(PngChunkReader::kRestartPointsType, payload.data(),
+    payload.size(), output);
+}
+
+void AppendIdatChunks(const std::vector<unsigned char>& stream,
+  std::vector<unsigned char>* output) {
+  for (size_t pos = 0; pos < stream.size(); pos += kIdatChunkSize) {
+    AppendPngChunk(kIDAT, &stream[pos],
+      std::min(kIdatChunkSize, stream.size() - pos), output);
+  }
+}
+
+bool AddPngRestartPoints(const unsigned char* input, size_t input_size,
+  uint32_t rows_per_segment, int zlib_level,
+  std::vector<unsigned char>* output) {
+  // Checked up front: the refiltering below divides by it.
+  if (rows_per_segment == 0)
+    return false;
+
+  PngChunkReader reader;
+  if (!reader.Parse(input, input_size) || !reader.complete() ||
+    reader.header().interlace_type != 0)
+    return false;
+  if (static_cast<uint64_t>(reader.header().width) * reader.header().height >
+    kMaxPixels)
+    return false;
+
+  const uint32_t height = reader.header().height;
+  const size_t row_bytes = reader.RowBytes(reader.header().width);
+  const size_t stride = row_bytes + 1;
+  const int bpp = reader.FilterBpp();
+
+  std::vector<unsigned char> filtered(stride * height);
+  IdatInflater inflater(reader.idat());
+  if (!inflater.Init() || !inflater.Read(filtered.data(), filtered.size()))
+    return false;
+  // The rows must end the stream: Finish() only succeeds at Z_STREAM_END,
+  // with the Adler-32 checked.
+  uLong adler = adler32(0L, Z_NULL, 0);
+  size_t end_offset = 0;
+  if (!inflater.Finish(&adler, &end_offset) ||
+    adler != adler32(0L, Z_NULL, 0))
+    return false;
+
+  // Segments must not depend on the row above their first row. Unfilter the
+  // image as we go and refilter those rows with Sub where needed.
+  std::vector<unsigned char> prev(row_bytes);
+  std::vector<unsigned char> cur(row_bytes);
+  for (uint32_t y = 0; y < height; ++y) {
+    unsigned char* row = &filtered[y * stride];
+    memcpy(cur.data(), row + 1, row_bytes);
+    if (!UnfilterPngRow(row[0], bpp, row_bytes, y ? prev.data() : nullptr,
+      cur.data()))
+      return false;
+    if (y > 0 && y % rows_per_segment == 0 &&
+      row[0] != PNG_ROW_FILTER_NONE && row[0] != PNG_ROW_FILTER_SUB) {
+      row[0] = PNG_ROW_FILTER_SUB;
+      for (size_t i = 0; i < row_bytes; ++i) {
+        row[1 + i] = static_cast<unsigned char>(
+          i < static_cast<size_t>(bpp) ? cur[i] : cur[i] - cur[i - bpp]);
+      }
+    }
+    prev.swap(cur);
+  }
+
+  std::vector<unsigned char> stream;
+  std::vector<PngChunkReader::RestartPoint> points;
+  if (!DeflateWithRestartPoints(filtered.data(), stride, height,
+    rows_per_segment, zlib_level, Z_DEFAULT_STRATEGY, &stream, &points))
+    return false;
+
+  output->clear();
+  output->insert(output->end(), kPngSignature,
+    kPngSignature + sizeof(kPngSignature));
+  bool wrote_idat = false;
+  for (const PngChunkReader::Chunk& chunk : reader.chunks()) {
+    if (chunk.type == PngChunkReader::kRestartPointsType)
+      continue;
+    if (chunk.type == kIDAT) {
+      if (!wrote_idat) {
+        AppendRestartPointsChunk(points, output);
+        AppendIdatChunks(stream, output);
+        wrote_idat = true;
+      }
+      continue;
+    }
+    // Copy length, type, payload and CRC verbatim.
+    const unsigned char* begin = chunk.data.data - 8;
+    output->insert(output->end(), begin, chunk.data.data + chunk.data.size + 4);
+    if (chunk.type == kIEND)
+      break;
+  }
+  PNG_LOG("AddPngRestartPoints: %u segments, %u -> %u IDAT bytes\n",
+    static_cast<unsigned>(points.size()),
+    static_cast<unsigned>(reader.idat_size()),
+    static_cast<unsigned>(stream.size()));
+  return true;
+}
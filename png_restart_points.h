@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "png_chunk_reader.h"
+#include "png_idat_encoder.h"
+
+// Writing side of restart points (see PngChunkReader::RestartPoint). Files
+// written this way are ordinary PNGs to every other reader; our decoder
+// inflates their segments in parallel.
+
+// Deflates |height| filtered rows of |stride| bytes each, filter type byte
+// included, into one zlib stream in |stream|, with a full flush before every
+// |rows_per_segment| rows. The offsets of the flush points go to |points|.
+// The first row of each segment should use the None or Sub filter so that
+// segments can also be unfiltered independently. Returns false on zlib
+// failure or if the stream would not fit 32-bit offsets.
+bool DeflateWithRestartPoints(const unsigned char* filtered, size_t stride,
+  uint32_t height, uint32_t rows_per_segment, int zlib_level,
+  int zlib_strategy, std::vector<unsigned char>* stream,
+  std::vector<PngChunkReader::RestartPoint>* points);
+
+// Filters |height| rows of |row_bytes| bytes from |source| with
+// FilterPngRow() and |settings|, limiting the first row of every segment to
+// None and Sub, then deflates them with DeflateWithRestartPoints().
+bool DeflateRowsWithRestartPoints(const PngRowSource& source,
+  size_t row_bytes, int bpp, uint32_t height, uint32_t rows_per_segment,
+  const PngDeflateSettings& settings, std::vector<unsigned char>* stream,
+  std::vector<PngChunkReader::RestartPoint>* points);
+
+// Appends an rsPT chunk describing |points| to |output|.
+void AppendRestartPointsChunk(
+  const std::vector<PngChunkReader::RestartPoint>& points,
+  std::vector<unsigned char>* output);
+
+// Appends a complete chunk, with length and CRC, to |output|.
+void AppendPngChunk(uint32_t type, const unsigned char* data, size_t length,
+  std::vector<unsigned char>* output);
+
+// Appends |stream| to |output| as IDAT chunks.
+void AppendIdatChunks(const std::vector<unsigned char>& stream,
+  std::vector<unsigned char>* output);
+
+// Rewrites the non-interlaced PNG in |input| so that its IDAT stream restarts
+// every |rows_per_segment| rows, recompressing at |zlib_level| and adding an
+// rsPT chunk. Rows that start a segment are refiltered with Sub if they
+// referred to the row above. All other chunks are copied unchanged. Fails
+// if |rows_per_segment| is 0, if the image is bigger than the decoder
+// accepts, or if the IDAT stream does not end, Adler-32 included, right
+// after the last row.
+bool AddPngRestartPoints(const unsigned char* input, size_t input_size,
+  uint32_t rows_per_segment, int zlib_level,
+  std::vector<unsigned char>* output);
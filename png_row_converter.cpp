@@ -0,0 +1,247 @@
+#include "stdafx.h"
+#include "png_row_converter.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "png_chunk_reader.h"
+#include "third_party/libpng/png.h"
+
+namespace {
+
+// Must match the gamma handling in png_decoder.cpp's DecodeInfoCallback.
+const double kMaxGamma = 21474.83;
+const double kDefaultGamma = 2.2;
+const double kInverseGamma = 1.0 / kDefaultGamma;
+
+// libpng skips gamma correction when screen_gamma * file_gamma is within
+// PNG_GAMMA_THRESHOLD of 1.0 (see png_gamma_threshold in pngrtran.c).
+bool GammaIsSignificant(const PngChunkReader& reader) {
+  double gamma = kInverseGamma;
+  if (reader.has_gamma()) {
+    gamma = reader.gamma();
+    if (gamma <= 0.0 || gamma > kMaxGamma)
+      gamma = kInverseGamma;
+  }
+  const double screen = floor(kDefaultGamma * PNG_FP_1 + .5);
+  const double file = floor(gamma * PNG_FP_1 + .5);
+  const double product = floor(screen * file / PNG_FP_1 + .5);
+  return product < PNG_FP_1 - PNG_GAMMA_THRESHOLD_FIXED ||
+    product > PNG_FP_1 + PNG_GAMMA_THRESHOLD_FIXED;
+}
+
+inline unsigned MulDiv255Round(unsigned a, unsigned b) {
+  unsigned prod = a * b + 128;
+  return (prod + (prod >> 8)) >> 8;
+}
+
+template <int kFormat>
+inline uint32_t PackPixel(unsigned r, unsigned g, unsigned b, unsigned a) {
+  if (kFormat == PngDecoder::FORMAT_SkBitmap) {
+    // Premultiplied ARGB in a native 32-bit word, like ConvertRGBARowToSkia.
+    if (a != 255) {
+      r = MulDiv255Round(r, a);
+      g = MulDiv255Round(g, a);
+      b = MulDiv255Round(b, a);
+    }
+    return (a << 24) | (r << 16) | (g << 8) | b;
+  }
+  unsigned char bytes[4];
+  if (kFormat == PngDecoder::FORMAT_BGRA) {
+    bytes[0] = static_cast<unsigned char>(b);
+    bytes[2] = static_cast<unsigned char>(r);
+  }
+  else {
+    bytes[0] = static_cast<unsigned char>(r);
+    bytes[2] = static_cast<unsigned char>(b);
+  }
+  bytes[1] = static_cast<unsigned char>(g);
+  bytes[3] = static_cast<unsigned char>(a);
+  uint32_t pixel;
+  memcpy(&pixel, bytes, 4);
+  return pixel;
+}
+
+uint32_t PackPixel(PngDecoder::ColorFormat format, unsigned r, unsigned g,
+  unsigned b, unsigned a) {
+  switch (format) {
+  case PngDecoder::FORMAT_RGBA:
+    return PackPixel<PngDecoder::FORMAT_RGBA>(r, g, b, a);
+  case PngDecoder::FORMAT_BGRA:
+    return PackPixel<PngDecoder::FORMAT_BGRA>(r, g, b, a);
+  default:
+    return PackPixel<PngDecoder::FORMAT_SkBitmap>(r, g, b, a);
+  }
+}
+
+inline uint16_t Read16(const unsigned char* p) {
+  return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+}  // namespace
+
+PngRowConverter::PngRowConverter()
+  : format_(PngDecoder::FORMAT_RGBA),
+  layout_(LAYOUT_RGB_ALPHA),
+  bit_depth_(8),
+  has_key_(false) {
+  memset(lut_, 0, sizeof(lut_));
+  memset(key_, 0, sizeof(key_));
+}
+
+PngRowConverter::~PngRowConverter() {
+}
+
+bool PngRowConverter::Init(const PngChunkReader& reader,
+  PngDecoder::ColorFormat format) {
+  if (GammaIsSignificant(reader))
+    return false;
+
+  const PngChunkReader::Header& header = reader.header();
+  const std::vector<unsigned char>& trns = reader.trns();
+  format_ = format;
+  bit_depth_ = header.bit_depth;
+  has_key_ = false;
+
+  switch (header.color_type) {
+  case PNG_COLOR_TYPE_PALETTE: {
+    layout_ = LAYOUT_LOOKUP;
+    // libpng keeps a zeroed 256 entry palette, so out of range indices come
+    // out as opaque black.
+    const std::vector<unsigned char>& palette = reader.palette();
+    const size_t entries = palette.size() / 3;
+    for (size_t i = 0; i < 256; ++i) {
+      unsigned r = 0, g = 0, b = 0;
+      if (i < entries) {
+        r = palette[3 * i];
+        g = palette[3 * i + 1];
+        b = palette[3 * i + 2];
+      }
+      const unsigned a = i < trns.size() ? trns[i] : 255;
+      lut_[i] = PackPixel(format, r, g, b, a);
+    }
+    break;
+  }
+  case PNG_COLOR_TYPE_GRAY:
+    if (!trns.empty()) {
+      has_key_ = true;
+      key_[0] = Read16(&trns[0]);
+    }
+    if (header.bit_depth == 16) {
+      layout_ = LAYOUT_GRAY16;
+      break;
+    }
+    layout_ = LAYOUT_LOOKUP;
+    {
+      // png_set_expand scales 1, 2 and 4 bit gray up to 8 bits and compares
+      // the tRNS key at the original depth.
+      const unsigned max_value = (1u << header.bit_depth) - 1;
+      for (unsigned v = 0; v <= max_value; ++v) {
+        const unsigned gray = v * 255 / max_value;
+        const unsigned a = has_key_ && v == (key_[0] & max_value) ? 0 : 255;
+        lut_[v] = PackPixel(format, gray, gray, gray, a);
+      }
+    }
+    break;
+  case PNG_COLOR_TYPE_GRAY_ALPHA:
+    layout_ = LAYOUT_GRAY_ALPHA;
+    break;
+  case PNG_COLOR_TYPE_RGB:
+    layout_ = LAYOUT_RGB;
+    if (!trns.empty()) {
+      has_key_ = true;
+      for (int i = 0; i < 3; ++i)
+        key_[i] = Read16(&trns[2 * i]);
+    }
+    break;
+  case PNG_COLOR_TYPE_RGB_ALPHA:
+    layout_ = LAYOUT_RGB_ALPHA;
+    break;
+  default:
+    return false;
+  }
+  return true;
+}
+
+void PngRowConverter::ConvertRow(const unsigned char* src, uint32_t pixels,
+  unsigned char* dst) const {
+  switch (format_) {
+  case PngDecoder::FORMAT_RGBA:
+    ConvertRowImpl<PngDecoder::FORMAT_RGBA>(src, pixels, dst);
+    break;
+  case PngDecoder::FORMAT_BGRA:
+    ConvertRowImpl<PngDecoder::FORMAT_BGRA>(src, pixels, dst);
+    break;
+  case PngDecoder::FORMAT_SkBitmap:
+    ConvertRowImpl<PngDecoder::FORMAT_SkBitmap>(src, pixels, dst);
+    break;
+  }
+}
+
+template <int kFormat>
+void PngRowConverter::ConvertRowImpl(const unsigned char* src,
+  uint32_t pixels, unsigned char* dst) const {
+  uint32_t* out = reinterpret_cast<uint32_t*>(dst);
+  // libpng strips 16-bit samples to their high byte.
+  const int step = bit_depth_ == 16 ? 2 : 1;
+
+  switch (layout_) {
+  case LAYOUT_LOOKUP:
+    if (bit_depth_ == 8) {
+      for (uint32_t x = 0; x < pixels; ++x)
+        out[x] = lut_[src[x]];
+    }
+    else {
+      const int depth = bit_depth_;
+      const unsigned mask = (1u << depth) - 1;
+      const int per_byte = 8 / depth;
+      for (uint32_t x = 0; x < pixels; ++x) {
+        const int shift = 8 - depth * (1 + static_cast<int>(x % per_byte));
+        out[x] = lut_[(src[x / per_byte] >> shift) & mask];
+      }
+    }
+    break;
+  case LAYOUT_GRAY16:
+    for (uint32_t x = 0; x < pixels; ++x, src += 2) {
+      const unsigned a = has_key_ && Read16(src) == key_[0] ? 0 : 255;
+      out[x] = PackPixel<kFormat>(src[0], src[0], src[0], a);
+    }
+    break;
+  case LAYOUT_GRAY_ALPHA:
+    for (uint32_t x = 0; x < pixels; ++x, src += 2 * step) {
+      out[x] = PackPixel<kFormat>(src[0], src[0], src[0], src[step]);
+    }
+    break;
+  case LAYOUT_RGB:
+    if (bit_depth_ == 8) {
+      if (!has_key_) {
+        // The common case; keep the loop free of the key test.
+        for (uint32_t x = 0; x < pixels; ++x, src += 3)
+          out[x] = PackPixel<kFormat>(src[0], src[1], src[2], 255);
+        break;
+      }
+      const unsigned kr = key_[0] & 0xff;
+      const unsigned kg = key_[1] & 0xff;
+      const unsigned kb = key_[2] & 0xff;
+      for (uint32_t x = 0; x < pixels; ++x, src += 3) {
+        const unsigned a = src[0] == kr && src[1] == kg && src[2] == kb ?
+          0 : 255;
+        out[x] = PackPixel<kFormat>(src[0], src[1], src[2], a);
+      }
+    }
+    else {
+      for (uint32_t x = 0; x < pixels; ++x, src += 6) {
+        const unsigned a = has_key_ && Read16(src) == key_[0] &&
+          Read16(src + 2) == key_[1] && Read16(src + 4) == key_[2] ? 0 : 255;
+        out[x] = PackPixel<kFormat>(src[0], src[2], src[4], a);
+      }
+    }
+    break;
+  case LAYOUT_RGB_ALPHA:
+    for (uint32_t x = 0; x < pixels; ++x, src += 4 * step) {
+      out[x] = PackPixel<kFormat>(src[0], src[step], src[2 * step],
+        src[3 * step]);
+    }
+    break;
+  }
+}
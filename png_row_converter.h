@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "png_decoder.h"
+
+class PngChunkReader;
+
+// Turns unfiltered PNG rows into 4-byte output pixels, producing exactly what
+// the transforms set up in png_decoder.cpp's DecodeInfoCallback produce:
+// expansion of palette, low bit depth gray and tRNS, 16 to 8 bit stripping,
+// gray to RGB, alpha filling, BGR swapping and Skia premultiplication.
+// Rows are independent, so conversion can run on any number of threads.
+class PngRowConverter {
+public:
+  PngRowConverter();
+  ~PngRowConverter();
+
+  // Returns false if the image needs a transform only libpng implements
+  // (gamma correction); such images must go through libpng.
+  bool Init(const PngChunkReader& reader, PngDecoder::ColorFormat format);
+
+  // Converts |pixels| pixels from |src| into |dst|, which must have room for
+  // 4 * |pixels| bytes.
+  void ConvertRow(const unsigned char* src, uint32_t pixels,
+    unsigned char* dst) const;
+
+private:
+  enum Layout {
+    // Palette, and gray below 16 bits: each sample indexes |lut_|.
+    LAYOUT_LOOKUP,
+    LAYOUT_GRAY16,
+    LAYOUT_GRAY_ALPHA,
+    LAYOUT_RGB,
+    LAYOUT_RGB_ALPHA,
+  };
+
+  template <int kFormat>
+  void ConvertRowImpl(const unsigned char* src, uint32_t pixels,
+    unsigned char* dst) const;
+
+  PngDecoder::ColorFormat format_;
+  Layout layout_;
+  int bit_depth_;
+
+  // Output pixels for every 8-bit sample value, for LAYOUT_LOOKUP.
+  uint32_t lut_[256];
+
+  // tRNS colour key for gray and RGB images, at the file's bit depth.
+  bool has_key_;
+  uint16_t key_[3];
+};
@@ -0,0 +1,747 @@
+#include "stdafx.h"
+#include "png_row_filter.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define PNG_ROW_FILTER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// The AVX2 filters are built for every x86 target and only used when the CPU
+// has AVX2. MSVC accepts AVX2 intrinsics anywhere; GCC and clang want the
+// functions that use them marked.
+#if defined(_M_X64) || defined(__x86_64__)
+#define PNG_ROW_FILTER_AVX2 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define PNG_ROW_FILTER_TARGET_AVX2
+#else
+#define PNG_ROW_FILTER_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+
+inline unsigned char PaethPredictor(int a, int b, int c) {
+  const int pa = abs(b - c);
+  const int pb = abs(a - c);
+  const int pc = abs(a + b - 2 * c);
+  if (pa <= pb && pa <= pc)
+    return static_cast<unsigned char>(a);
+  return static_cast<unsigned char>(pb <= pc ? b : c);
+}
+
+void UnfilterSub(int bpp, size_t row_bytes, unsigned char* row) {
+  for (size_t i = bpp; i < row_bytes; ++i)
+    row[i] = static_cast<unsigned char>(row[i] + row[i - bpp]);
+}
+
+void UnfilterUp(size_t row_bytes, const unsigned char* prev,
+  unsigned char* row) {
+  // Simple enough for the compiler to vectorize.
+  for (size_t i = 0; i < row_bytes; ++i)
+    row[i] = static_cast<unsigned char>(row[i] + prev[i]);
+}
+
+void UnfilterAvg(int bpp, size_t row_bytes, const unsigned char* prev,
+  unsigned char* row) {
+  size_t i = 0;
+  for (; i < static_cast<size_t>(bpp) && i < row_bytes; ++i)
+    row[i] = static_cast<unsigned char>(row[i] + (prev[i] >> 1));
+  for (; i < row_bytes; ++i)
+    row[i] = static_cast<unsigned char>(
+      row[i] + ((row[i - bpp] + prev[i]) >> 1));
+}
+
+void UnfilterPaeth(int bpp, size_t row_bytes, const unsigned char* prev,
+  unsigned char* row) {
+  size_t i = 0;
+  for (; i < static_cast<size_t>(bpp) && i < row_bytes; ++i)
+    row[i] = static_cast<unsigned char>(row[i] + prev[i]);
+  for (; i < row_bytes; ++i) {
+    row[i] = static_cast<unsigned char>(
+      row[i] + PaethPredictor(row[i - bpp], prev[i], prev[i - bpp]));
+  }
+}
+
+// Forward filters. Each writes |row| filtered with its filter to |out| and
+// returns the sum of absolute values that FilterPngRow compares, giving up
+// early once that exceeds |limit|. They all take the same arguments so that
+// FilterPngRow can pick an implementation per filter type once, at run time.
+typedef size_t (*ForwardFilter)(int bpp, size_t row_bytes,
+  const unsigned char* prev, const unsigned char* row, unsigned char* out,
+  size_t limit);
+
+inline size_t SignedMagnitude(unsigned char v) {
+  return v < 128 ? v : 256 - v;
+}
+
+// Filtered byte |i| of |row|, for i >= bpp. The first |bpp| bytes of a row
+// have no left neighbour and are filtered with a and c taken as zero.
+inline unsigned char SubByte(int bpp, const unsigned char* prev,
+  const unsigned char* row, size_t i) {
+  return static_cast<unsigned char>(row[i] - row[i - bpp]);
+}
+
+inline unsigned char UpByte(int bpp, const unsigned char* prev,
+  const unsigned char* row, size_t i) {
+  return static_cast<unsigned char>(row[i] - prev[i]);
+}
+
+inline unsigned char AvgByte(int bpp, const unsigned char* prev,
+  const unsigned char* row, size_t i) {
+  return static_cast<unsigned char>(row[i] - ((row[i - bpp] + prev[i]) >> 1));
+}
+
+inline unsigned char PaethByte(int bpp, const unsigned char* prev,
+  const unsigned char* row, size_t i) {
+  return static_cast<unsigned char>(
+    row[i] - PaethPredictor(row[i - bpp], prev[i], prev[i - bpp]));
+}
+
+// Filters the first |bpp| bytes of |row|, which every filter but Up treats
+// specially, and returns their sum.
+size_t FilterRowStart(int filter_type, int bpp, size_t row_bytes,
+  const unsigned char* prev, const unsigned char* row, unsigned char* out) {
+  const size_t n = std::min(static_cast<size_t>(bpp), row_bytes);
+  size_t sum = 0;
+  for (size_t i = 0; i < n; ++i) {
+    switch (filter_type) {
+    case PNG_ROW_FILTER_UP:
+    case PNG_ROW_FILTER_PAETH:
+      out[i] = static_cast<unsigned char>(row[i] - prev[i]);
+      break;
+    case PNG_ROW_FILTER_AVG:
+      out[i] = static_cast<unsigned char>(row[i] - (prev[i] >> 1));
+      break;
+    default:
+      out[i] = row[i];
+      break;
+    }
+    sum += SignedMagnitude(out[i]);
+  }
+  return sum;
+}
+
+size_t FilterNone(int bpp, size_t row_bytes, const unsigned char* prev,
+  const unsigned char* row, unsigned char* out, size_t limit) {
+  memcpy(out, row, row_bytes);
+  size_t sum = 0;
+  for (size_t i = 0; i < row_bytes && sum <= limit; ++i)
+    sum += SignedMagnitude(row[i]);
+  return sum;
+}
+
+template <unsigned char (*kByte)(int, const unsigned char*,
+  const unsigned char*, size_t)>
+size_t FilterScalar(int filter_type, int bpp, size_t row_bytes,
+  const unsigned char* prev, const unsigned char* row, unsigned char* out,
+  size_t limit) {
+  size_t sum = FilterRowStart(filter_type, bpp, row_bytes, prev, row, out);
+  for (size_t i = bpp; i < row_bytes && sum <= limit; ++i) {
+    out[i] = kByte(bpp, prev, row, i);
+    sum += SignedMagnitude(out[i]);
+  }
+  return sum;
+}
+
+size_t FilterSub(int bpp, size_t row_bytes, const unsigned char* prev,
+  const unsigned char* row, unsigned char* out, size_t limit) {
+  return FilterScalar<SubByte>(PNG_ROW_FILTER_SUB, bpp, row_bytes, prev, row,
+    out, limit);
+}
+
+size_t FilterUp(int bpp, size_t row_bytes, const unsigned char* prev,
+  const unsigned char* row, unsigned char* out, size_t limit) {
+  return FilterScalar<UpByte>(PNG_ROW_FILTER_UP, bpp, row_bytes, prev, row,
+    out, limit);
+}
+
+size_t FilterAvg(int bpp, size_t row_bytes, const unsigned char* prev,
+  const unsigned char* row, unsigned char* out, size_t limit) {
+  return FilterScalar<AvgByte>(PNG_ROW_FILTER_AVG, bpp, row_bytes, prev, row,
+    out, limit);
+}
+
+size_t FilterPaeth(int bpp, size_t row_bytes, const unsigned char* prev,
+  const unsigned char* row, unsigned char* out, size_t limit) {
+  return FilterScalar<PaethByte>(PNG_ROW_FILTER_PAETH, bpp, row_bytes, prev,
+    row, out, limit);
+}
+
+#if defined(PNG_ROW_FILTER_SSE2)
+
+// The SSE2 filters work one pixel at a time, carrying the previous pixel in a
+// register, the same way libpng's intel/filter_sse2_intrinsics.c does. They
+// handle 3 and 4 byte pixels, which covers 8-bit RGB and RGBA.
+
+inline __m128i Load4(const unsigned char* p) {
+  int32_t v;
+  memcpy(&v, p, 4);
+  return _mm_cvtsi32_si128(v);
+}
+
+inline __m128i Load3(const unsigned char* p) {
+  int32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+  return _mm_cvtsi32_si128(v);
+}
+
+inline void Store4(unsigned char* p, __m128i v) {
+  int32_t x = _mm_cvtsi128_si32(v);
+  memcpy(p, &x, 4);
+}
+
+inline void Store3(unsigned char* p, __m128i v) {
+  int32_t x = _mm_cvtsi128_si32(v);
+  memcpy(p, &x, 3);
+}
+
+template <int kBpp>
+inline __m128i LoadPixel(const unsigned char* p) {
+  return kBpp == 4 ? Load4(p) : Load3(p);
+}
+
+template <int kBpp>
+inline void StorePixel(unsigned char* p, __m128i v) {
+  if (kBpp == 4)
+    Store4(p, v);
+  else
+    Store3(p, v);
+}
+
+// Up has no dependency between bytes, so it goes 16 at a time.
+void UnfilterUpSSE2(size_t row_bytes, const unsigned char* prev,
+  unsigned char* row) {
+  size_t i = 0;
+  for (; i + 16 <= row_bytes; i += 16) {
+    const __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i*>(row + i));
+    const __m128i b =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(row + i), _mm_add_epi8(x, b));
+  }
+  UnfilterUp(row_bytes - i, prev + i, row + i);
+}
+
+template <int kBpp>
+void UnfilterSubSSE2(size_t row_bytes, unsigned char* row) {
+  __m128i d = _mm_setzero_si128();
+  for (size_t i = 0; i + kBpp <= row_bytes; i += kBpp) {
+    d = _mm_add_epi8(LoadPixel<kBpp>(row + i), d);
+    StorePixel<kBpp>(row + i, d);
+  }
+}
+
+template <int kBpp>
+void UnfilterAvgSSE2(size_t row_bytes, const unsigned char* prev,
+  unsigned char* row) {
+  const __m128i ones = _mm_set1_epi8(1);
+  __m128i d = _mm_setzero_si128();
+  for (size_t i = 0; i + kBpp <= row_bytes; i += kBpp) {
+    const __m128i a = d;
+    const __m128i b = LoadPixel<kBpp>(prev + i);
+    // PNG wants a truncating average; _mm_avg_epu8 rounds up, so take the
+    // rounding back off where a + b was odd.
+    __m128i avg = _mm_avg_epu8(a, b);
+    avg = _mm_sub_epi8(avg, _mm_and_si128(_mm_xor_si128(a, b), ones));
+    d = _mm_add_epi8(LoadPixel<kBpp>(row + i), avg);
+    StorePixel<kBpp>(row + i, d);
+  }
+}
+
+inline __m128i Abs16(__m128i x) {
+  return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+inline __m128i Select(__m128i mask, __m128i if_true, __m128i if_false) {
+  return _mm_or_si128(_mm_and_si128(mask, if_true),
+    _mm_andnot_si128(mask, if_false));
+}
+
+template <int kBpp>
+void UnfilterPaethSSE2(size_t row_bytes, const unsigned char* prev,
+  unsigned char* row) {
+  const __m128i zero = _mm_setzero_si128();
+  // a: left, b: above, c: above left; all widened to 16 bits.
+  __m128i a = zero;
+  __m128i c = zero;
+  for (size_t i = 0; i + kBpp <= row_bytes; i += kBpp) {
+    const __m128i b = _mm_unpacklo_epi8(LoadPixel<kBpp>(prev + i), zero);
+    const __m128i x = _mm_unpacklo_epi8(LoadPixel<kBpp>(row + i), zero);
+
+    // |p - a| = |b - c|, |p - b| = |a - c|, |p - c| = |a + b - 2c|.
+    const __m128i pa_signed = _mm_sub_epi16(b, c);
+    const __m128i pb_signed = _mm_sub_epi16(a, c);
+    const __m128i pa = Abs16(pa_signed);
+    const __m128i pb = Abs16(pb_signed);
+    const __m128i pc = Abs16(_mm_add_epi16(pa_signed, pb_signed));
+    const __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+
+    const __m128i nearest = Select(_mm_cmpeq_epi16(smallest, pa), a,
+      Select(_mm_cmpeq_epi16(smallest, pb), b, c));
+    const __m128i d = _mm_and_si128(_mm_add_epi16(x, nearest),
+      _mm_set1_epi16(0xFF));
+    StorePixel<kBpp>(row + i, _mm_packus_epi16(d, d));
+
+    a = d;
+    c = b;
+  }
+}
+
+// The forward filters have no dependency between output bytes, since they
+// only read the unfiltered rows, so they work 16 bytes at a time for any
+// |bpp|. Each kernel returns the filtered bytes at |i|, for i >= bpp.
+
+struct NoneSSE2 {
+  static __m128i Filter(int bpp, const unsigned char* prev,
+    const unsigned char* row, size_t i) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+  }
+};
+
+struct SubSSE2 {
+  static __m128i Filter(int bpp, const unsigned char* prev,
+    const unsigned char* row, size_t i) {
+    return _mm_sub_epi8(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i)),
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i - bpp)));
+  }
+};
+
+struct UpSSE2 {
+  static __m128i Filter(int bpp, const unsigned char* prev,
+    const unsigned char* row, size_t i) {
+    return _mm_sub_epi8(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i)),
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + i)));
+  }
+};
+
+struct AvgSSE2 {
+  static __m128i Filter(int bpp, const unsigned char* prev,
+    const unsigned char* row, size_t i) {
+    const __m128i a =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i - bpp));
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + i));
+    // Truncating average, as in UnfilterAvgSSE2.
+    const __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b),
+      _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+    return _mm_sub_epi8(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i)), avg);
+  }
+};
+
+// Paeth predictor for eight bytes widened to 16 bits.
+inline __m128i PaethPredictor16(__m128i a, __m128i b, __m128i c) {
+  const __m128i pa_signed = _mm_sub_epi16(b, c);
+  const __m128i pb_signed = _mm_sub_epi16(a, c);
+  const __m128i pa = Abs16(pa_signed);
+  const __m128i pb = Abs16(pb_signed);
+  const __m128i pc = Abs16(_mm_add_epi16(pa_signed, pb_signed));
+  const __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+  return Select(_mm_cmpeq_epi16(smallest, pa), a,
+    Select(_mm_cmpeq_epi16(smallest, pb), b, c));
+}
+
+struct PaethSSE2 {
+  static __m128i Filter(int bpp, const unsigned char* prev,
+    const unsigned char* row, size_t i) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i a =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i - bpp));
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + i));
+    const __m128i c =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + i - bpp));
+    const __m128i lo = PaethPredictor16(_mm_unpacklo_epi8(a, zero),
+      _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero));
+    const __m128i hi = PaethPredictor16(_mm_unpackhi_epi8(a, zero),
+      _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero));
+    return _mm_sub_epi8(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i)),
+      _mm_packus_epi16(lo, hi));
+  }
+};
+
+// Sums of the bytes of |v| read as signed magnitudes, in the two 64-bit
+// halves. As unsigned bytes, min(v, -v) is exactly SignedMagnitude(v).
+inline __m128i SumMagnitudesSSE2(__m128i v) {
+  const __m128i zero = _mm_setzero_si128();
+  return _mm_sad_epu8(_mm_min_epu8(v, _mm_sub_epi8(zero, v)), zero);
+}
+
+// Runs |Kernel| over bytes [begin, row_bytes) of the row, adding to |sum|.
+// The limit is checked every 64 bytes; stopping late only costs time, since
+// a row over the limit cannot win.
+template <typename Kernel, unsigned char (*kByte)(int, const unsigned char*,
+  const unsigned char*, size_t)>
+size_t FilterSSE2(int bpp, size_t begin, size_t row_bytes,
+  const unsigned char* prev, const unsigned char* row, unsigned char* out,
+  size_t sum, size_t limit) {
+  size_t i = begin;
+  while (i + 16 <= row_bytes && sum <= limit) {
+    __m128i sums = _mm_setzero_si128();
+    for (int n = 0; n < 4 && i + 16 <= row_bytes; ++n, i += 16) {
+      const __m128i v = Kernel::Filter(bpp, prev, row, i);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+      sums = _mm_add_epi64(sums, SumMagnitudesSSE2(v));
+    }
+    sum += _mm_cvtsi128_si32(sums) +
+      _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+  }
+  for (; i < row_bytes && sum <= limit; ++i) {
+    out[i] = kByte(bpp, prev, row, i);
+    sum += SignedMagnitude(out[i]);
+  }
+  return sum;
+}
+
+inline unsigned char NoneByte(int bpp, const unsigned char* prev,
+  const unsigned char* row, size_t i) {
+  return row[i];
+}
+
+size_t FilterNoneSSE2(int bpp, size_t row_bytes, const unsigned char* prev,
+  const unsigned char* row, unsigned char* out, size_t limit) {
+  return FilterSSE2<NoneSSE2, NoneByte>(bpp, 0, row_bytes, prev, row, out, 0,
+    limit);
+}
+
+size_t FilterSubSSE2(int bpp, size_t row_bytes, const unsigned char* prev,
+  const unsigned char* row, unsigned char* out, size_t limit) {
+  return FilterSSE2<SubSSE2, SubByte>(bpp, bpp, row_bytes, prev, row, out,
+    FilterRowStart(PNG_ROW_FILTER_SUB, bpp, row_bytes, prev, row, out), limit);
+}
+
+size_t FilterUpSSE2(int bpp, size_t row_bytes, const unsigned char* prev,
+  const unsigned char* row, unsigned char* out, size_t limit) {
+  return FilterSSE2<UpSSE2, UpByte>(bpp, 0, row_bytes, prev, row, out, 0,
+    limit);
+}
+
+size_t FilterAvgSSE2(int bpp, size_t row_bytes, const unsigned char* prev,
+  const unsigned char* row, unsigned char* out, size_t limit) {
+  return FilterSSE2<AvgSSE2, AvgByte>(bpp, bpp, row_bytes, prev, row, out,
+    FilterRowStart(PNG_ROW_FILTER_AVG, bpp, row_bytes, prev, row, out), limit);
+}
+
+size_t FilterPaethSSE2(int bpp, size_t row_bytes, const unsigned char* prev,
+  const unsigned char* row, unsigned char* out, size_t limit) {
+  return FilterSSE2<PaethSSE2, PaethByte>(bpp, bpp, row_bytes, prev, row, out,
+    FilterRowStart(PNG_ROW_FILTER_PAETH, bpp, row_bytes, prev, row, out),
+    limit);
+}
+
+#endif  // defined(PNG_ROW_FILTER_SSE2)
+
+#if defined(PNG_ROW_FILTER_AVX2)
+
+// The same kernels, 32 bytes at a time. _mm256_unpack*_epi8 and
+// _mm256_packus_epi16 both work within 128-bit lanes, so widening and
+// narrowing again keeps the bytes in order.
+
+struct NoneAVX2 {
+  PNG_ROW_FILTER_TARGET_AVX2 static __m256i Filter(int bpp,
+    const unsigned char* prev, const unsigned char* row, size_t i) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i));
+  }
+};
+
+struct SubAVX2 {
+  PNG_ROW_FILTER_TARGET_AVX2 static __m256i Filter(int bpp,
+    const unsigned char* prev, const unsigned char* row, size_t i) {
+    return _mm256_sub_epi8(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i)),
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i - bpp)));
+  }
+};
+
+struct UpAVX2 {
+  PNG_ROW_FILTER_TARGET_AVX2 static __m256i Filter(int bpp,
+    const unsigned char* prev, const unsigned char* row, size_t i) {
+    return _mm256_sub_epi8(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i)),
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev + i)));
+  }
+};
+
+struct AvgAVX2 {
+  PNG_ROW_FILTER_TARGET_AVX2 static __m256i Filter(int bpp,
+    const unsigned char* prev, const unsigned char* row, size_t i) {
+    const __m256i a =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i - bpp));
+    const __m256i b =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev + i));
+    const __m256i avg = _mm256_sub_epi8(_mm256_avg_epu8(a, b),
+      _mm256_and_si256(_mm256_xor_si256(a, b), _mm256_set1_epi8(1)));
+    return _mm256_sub_epi8(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i)), avg);
+  }
+};
+
+PNG_ROW_FILTER_TARGET_AVX2 inline __m256i PaethPredictor16AVX2(__m256i a,
+  __m256i b, __m256i c) {
+  const __m256i pa_signed = _mm256_sub_epi16(b, c);
+  const __m256i pb_signed = _mm256_sub_epi16(a, c);
+  const __m256i pa = _mm256_abs_epi16(pa_signed);
+  const __m256i pb = _mm256_abs_epi16(pb_signed);
+  const __m256i pc = _mm256_abs_epi16(_mm256_add_epi16(pa_signed, pb_signed));
+  const __m256i smallest = _mm256_min_epi16(pc, _mm256_min_epi16(pa, pb));
+  return _mm256_blendv_epi8(
+    _mm256_blendv_epi8(c, b, _mm256_cmpeq_epi16(smallest, pb)), a,
+    _mm256_cmpeq_epi16(smallest, pa));
+}
+
+struct PaethAVX2 {
+  PNG_ROW_FILTER_TARGET_AVX2 static __m256i Filter(int bpp,
+    const unsigned char* prev, const unsigned char* row, size_t i) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i a =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i - bpp));
+    const __m256i b =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev + i));
+    const __m256i c =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev + i - bpp));
+    const __m256i lo = PaethPredictor16AVX2(_mm256_unpacklo_epi8(a, zero),
+      _mm256_unpacklo_epi8(b, zero), _mm256_unpacklo_epi8(c, zero));
+    const __m256i hi = PaethPredictor16AVX2(_mm256_unpackhi_epi8(a, zero),
+      _mm256_unpackhi_epi8(b, zero), _mm256_unpackhi_epi8(c, zero));
+    return _mm256_sub_epi8(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i)),
+      _mm256_packus_epi16(lo, hi));
+  }
+};
+
+template <typename Kernel, unsigned char (*kByte)(int, const unsigned char*,
+  const unsigned char*, size_t)>
+PNG_ROW_FILTER_TARGET_AVX2 size_t FilterAVX2(int bpp, size_t begin,
+  size_t row_bytes, const unsigned char* prev, const unsigned char* row,
+  unsigned char* out, size_t sum, size_t limit) {
+  const __m256i zero = _mm256_setzero_si256();
+  size_t i = begin;
+  while (i + 32 <= row_bytes && sum <= limit) {
+    __m256i sums = zero;
+    for (int n = 0; n < 2 && i + 32 <= row_bytes; ++n, i += 32) {
+      const __m256i v = Kernel::Filter(bpp, prev, row, i);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), v);
+      sums = _mm256_add_epi64(sums, _mm256_sad_epu8(
+        _mm256_min_epu8(v, _mm256_sub_epi8(zero, v)), zero));
+    }
+    const __m128i halves = _mm_add_epi64(_mm256_castsi256_si128(sums),
+      _mm256_extracti128_si256(sums, 1));
+    sum += _mm_cvtsi128_si32(halves) +
+      _mm_cvtsi128_si32(_mm_srli_si128(halves, 8));
+  }
+  for (; i < row_bytes && sum <= limit; ++i) {
+    out[i] = kByte(bpp, prev, row, i);
+    sum += SignedMagnitude(out[i]);
+  }
+  return sum;
+}
+
+size_t FilterNoneAVX2(int bpp, size_t row_bytes, const unsigned char* prev,
+  const unsigned char* row, unsigned char* out, size_t limit) {
+  return FilterAVX2<NoneAVX2, NoneByte>(bpp, 0, row_bytes, prev, row, out, 0,
+    limit);
+}
+
+size_t FilterSubAVX2(int bpp, size_t row_bytes, const unsigned char* prev,
+  const unsigned char* row, unsigned char* out, size_t limit) {
+  return FilterAVX2<SubAVX2, SubByte>(bpp, bpp, row_bytes, prev, row, out,
+    FilterRowStart(PNG_ROW_FILTER_SUB, bpp, row_bytes, prev, row, out), limit);
+}
+
+size_t FilterUpAVX2(int bpp, size_t row_bytes, const unsigned char* prev,
+  const unsigned char* row, unsigned char* out, size_t limit) {
+  return FilterAVX2<UpAVX2, UpByte>(bpp, 0, row_bytes, prev, row, out, 0,
+    limit);
+}
+
+size_t FilterAvgAVX2(int bpp, size_t row_bytes, const unsigned char* prev,
+  const unsigned char* row, unsigned char* out, size_t limit) {
+  return FilterAVX2<AvgAVX2, AvgByte>(bpp, bpp, row_bytes, prev, row, out,
+    FilterRowStart(PNG_ROW_FILTER_AVG, bpp, row_bytes, prev, row, out), limit);
+}
+
+size_t FilterPaethAVX2(int bpp, size_t row_bytes, const unsigned char* prev,
+  const unsigned char* row, unsigned char* out, size_t limit) {
+  return FilterAVX2<PaethAVX2, PaethByte>(bpp, bpp, row_bytes, prev, row, out,
+    FilterRowStart(PNG_ROW_FILTER_PAETH, bpp, row_bytes, prev, row, out),
+    limit);
+}
+
+// AVX2 needs both the instructions and the OS saving the YMM registers.
+bool CpuHasAVX2() {
+#if defined(_MSC_VER)
+  int regs[4];
+  __cpuid(regs, 0);
+  if (regs[0] < 7)
+    return false;
+  __cpuid(regs, 1);
+  const int kOSXSAVE = 1 << 27;
+  const int kAVX = 1 << 28;
+  if ((regs[2] & (kOSXSAVE | kAVX)) != (kOSXSAVE | kAVX))
+    return false;
+  if ((_xgetbv(0) & 6) != 6)
+    return false;
+  __cpuidex(regs, 7, 0);
+  return (regs[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+#endif  // defined(PNG_ROW_FILTER_AVX2)
+
+const ForwardFilter kScalarFilters[] = {
+  FilterNone, FilterSub, FilterUp, FilterAvg, FilterPaeth,
+};
+
+// Rows shorter than this gain nothing from the vector filters.
+const size_t kMinVectorRowBytes = 32;
+
+// The forward filters for each filter type, picked once per process, the
+// way libpng's intel_init.c picks its unfilter functions.
+const ForwardFilter* SelectForwardFilters() {
+#if defined(PNG_ROW_FILTER_AVX2)
+  static const ForwardFilter kAVX2[] = {
+    FilterNoneAVX2, FilterSubAVX2, FilterUpAVX2, FilterAvgAVX2,
+    FilterPaethAVX2,
+  };
+  if (CpuHasAVX2())
+    return kAVX2;
+#endif
+#if defined(PNG_ROW_FILTER_SSE2)
+  static const ForwardFilter kSSE2[] = {
+    FilterNoneSSE2, FilterSubSSE2, FilterUpSSE2, FilterAvgSSE2,
+    FilterPaethSSE2,
+  };
+  return kSSE2;
+#else
+  return kScalarFilters;
+#endif
+}
+
+size_t FilterRowAs(int filter_type, int bpp, size_t row_bytes,
+  const unsigned char* prev, const unsigned char* row, unsigned char* out,
+  size_t limit) {
+  static const ForwardFilter* const filters = SelectForwardFilters();
+  if (row_bytes < kMinVectorRowBytes)
+    return kScalarFilters[filter_type](bpp, row_bytes, prev, row, out, limit);
+  return filters[filter_type](bpp, row_bytes, prev, row, out, limit);
+}
+
+}  // namespace
+
+bool UnfilterPngRow(int filter_type, int bpp, size_t row_bytes,
+  const unsigned char* prev_row, unsigned char* row) {
+  switch (filter_type) {
+  case PNG_ROW_FILTER_NONE:
+    return true;
+  case PNG_ROW_FILTER_SUB:
+#if defined(PNG_ROW_FILTER_SSE2)
+    if (bpp == 4) {
+      UnfilterSubSSE2<4>(row_bytes, row);
+      return true;
+    }
+    if (bpp == 3) {
+      UnfilterSubSSE2<3>(row_bytes, row);
+      return true;
+    }
+#endif
+    UnfilterSub(bpp, row_bytes, row);
+    return true;
+  case PNG_ROW_FILTER_UP:
+    if (!prev_row)
+      return true;
+#if defined(PNG_ROW_FILTER_SSE2)
+    UnfilterUpSSE2(row_bytes, prev_row, row);
+#else
+    UnfilterUp(row_bytes, prev_row, row);
+#endif
+    return true;
+  case PNG_ROW_FILTER_AVG:
+    if (!prev_row) {
+      // With no row above, Avg degenerates to half of the left neighbour.
+      for (size_t i = bpp; i < row_bytes; ++i)
+        row[i] = static_cast<unsigned char>(row[i] + (row[i - bpp] >> 1));
+      return true;
+    }
+#if defined(PNG_ROW_FILTER_SSE2)
+    if (bpp == 4) {
+      UnfilterAvgSSE2<4>(row_bytes, prev_row, row);
+      return true;
+    }
+    if (bpp == 3) {
+      UnfilterAvgSSE2<3>(row_bytes, prev_row, row);
+      return true;
+    }
+#endif
+    UnfilterAvg(bpp, row_bytes, prev_row, row);
+    return true;
+  case PNG_ROW_FILTER_PAETH:
+    if (!prev_row) {
+      // With no row above, Paeth always predicts the left neighbour.
+      UnfilterSub(bpp, row_bytes, row);
+      return true;
+    }
+#if defined(PNG_ROW_FILTER_SSE2)
+    if (bpp == 4) {
+      UnfilterPaethSSE2<4>(row_bytes, prev_row, row);
+      return true;
+    }
+    if (bpp == 3) {
+      UnfilterPaethSSE2<3>(row_bytes, prev_row, row);
+      return true;
+    }
+#endif
+    UnfilterPaeth(bpp, row_bytes, prev_row, row);
+    return true;
+  default:
+    return false;
+  }
+}
+
+int FilterPngRow(int filter_mask, int bpp, size_t row_bytes,
+  const unsigned char* prev_row, const unsigned char* row, unsigned char* out,
+  unsigned char* scratch) {
+  filter_mask &= PngFilterBit(PNG_ROW_FILTER_PAETH + 1) - 1;
+  if (filter_mask == 0)
+    filter_mask = PngFilterBit(PNG_ROW_FILTER_NONE);
+
+  // A single filter needs no scoring.
+  if ((filter_mask & (filter_mask - 1)) == 0) {
+    int only = PNG_ROW_FILTER_NONE;
+    while (!(filter_mask & PngFilterBit(only)))
+      ++only;
+    out[0] = static_cast<unsigned char>(only);
+    FilterRowAs(only, bpp, row_bytes, prev_row, row, out + 1, SIZE_MAX);
+    return only;
+  }
+
+  // Candidates go to whichever buffer is not holding the best row so far.
+  unsigned char* best = nullptr;
+  unsigned char* candidate = out;
+  size_t best_sum = SIZE_MAX;
+  for (int type = PNG_ROW_FILTER_NONE; type <= PNG_ROW_FILTER_PAETH; ++type) {
+    if (!(filter_mask & PngFilterBit(type)))
+      continue;
+    candidate[0] = static_cast<unsigned char>(type);
+    const size_t sum = FilterRowAs(type, bpp, row_bytes, prev_row, row,
+      candidate + 1, best_sum);
+    if (sum < best_sum) {
+      best_sum = sum;
+      unsigned char* const previous_best = best;
+      best = candidate;
+      candidate = previous_best ? previous_best : scratch;
+    }
+  }
+  if (best != out)
+    memcpy(out, best, row_bytes + 1);
+  return out[0];
+}
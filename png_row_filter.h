@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+
+// PNG filter types, as stored in the first byte of every filtered row.
+enum PngFilterType {
+  PNG_ROW_FILTER_NONE = 0,
+  PNG_ROW_FILTER_SUB = 1,
+  PNG_ROW_FILTER_UP = 2,
+  PNG_ROW_FILTER_AVG = 3,
+  PNG_ROW_FILTER_PAETH = 4,
+};
+
+// Reverses |filter_type| on |row| in place. |prev_row| is the previous row
+// after unfiltering, or nullptr for the first row of an image or pass. |bpp|
+// is the filter distance in bytes (see PngChunkReader::FilterBpp()). Returns
+// false for an unknown filter type. Uses SSE2 where the CPU has it, with the
+// same results as libpng's png_read_filter_row.
+bool UnfilterPngRow(int filter_type, int bpp, size_t row_bytes,
+  const unsigned char* prev_row, unsigned char* row);
+
+// Bit for |filter_type| in a FilterPngRow() mask.
+inline int PngFilterBit(int filter_type) {
+  return 1 << filter_type;
+}
+
+// Filters |row| for writing and stores the filter type byte followed by the
+// |row_bytes| filtered bytes in |out|. Tries every filter in |filter_mask|
+// and keeps the one whose bytes, read as signed, have the smallest sum of
+// absolute values, the heuristic and tie-breaking of libpng's
+// png_write_find_filter, so the result matches libpng's writer byte for
+// byte. |prev_row| is the unfiltered row above, all zeros for the first row.
+// |scratch| must hold row_bytes + 1 bytes. Returns the filter chosen. The
+// candidates and their sums are computed with AVX2 or SSE2 where the CPU has
+// them, picked at run time, with the same results as the scalar code.
+int FilterPngRow(int filter_mask, int bpp, size_t row_bytes,
+  const unsigned char* prev_row, const unsigned char* row, unsigned char* out,
+  unsigned char* scratch);
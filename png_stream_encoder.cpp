@@ -0,0 +1,245 @@
+#include "stdafx.h"
+#include "png_stream_encoder.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <vector>
+
+#include "logging.h"
+#include "png_color_reduction.h"
+#include "png_zlib_pool.h"
+
+#include "third_party/libpng/png.h"
+#include "third_party/zlib/zlib.h"
+
+namespace {
+
+// Largest width and height libpng accepts once its defaults, meant for
+// decoding untrusted files, are lifted.
+const png_uint_32 kMaxDimension = PNG_UINT_31_MAX;
+
+void LogLibPNGStreamError(png_structp png_ptr, png_const_charp error_msg) {
+  PNG_LOG("libpng stream encode error: %s\n", error_msg);
+  longjmp(png_jmpbuf(png_ptr), 1);
+}
+
+void LogLibPNGStreamWarning(png_structp png_ptr,
+  png_const_charp warning_msg) {
+  PNG_LOG("libpng stream encode warning: %s\n", warning_msg);
+}
+
+void WriteToSink(png_structp png_ptr, png_bytep data, png_size_t size) {
+  PngSink* sink = static_cast<PngSink*>(png_get_io_ptr(png_ptr));
+  if (!sink->Write(data, size))
+    png_error(png_ptr, "sink write failed");
+}
+
+void FlushSink(png_structp png_ptr) {
+}
+
+}  // namespace
+
+PngBufferSink::PngBufferSink(unsigned char* buffer, size_t capacity)
+  : buffer_(buffer),
+  capacity_(capacity),
+  size_(0) {
+}
+
+bool PngBufferSink::Write(const unsigned char* data, size_t size) {
+  if (size > capacity_ - size_)
+    return false;
+  memcpy(buffer_ + size_, data, size);
+  size_ += size;
+  return true;
+}
+
+PngFileDescriptorSink::PngFileDescriptorSink(int fd) : fd_(fd) {
+}
+
+bool PngFileDescriptorSink::Write(const unsigned char* data, size_t size) {
+  while (size) {
+#if defined(_WIN32)
+    const int written = _write(fd_, data,
+      static_cast<unsigned>(std::min<size_t>(size, INT_MAX)));
+#else
+    const ssize_t written = write(fd_, data, size);
+#endif
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return false;
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+PngIoVecSink::PngIoVecSink(const PngIoVec* buffers, size_t count)
+  : buffers_(buffers),
+  count_(count),
+  buffer_(0),
+  offset_(0),
+  size_(0) {
+}
+
+bool PngIoVecSink::Write(const unsigned char* data, size_t size) {
+  while (size) {
+    if (buffer_ == count_)
+      return false;
+    const PngIoVec& buffer = buffers_[buffer_];
+    const size_t copy = std::min(size, buffer.size - offset_);
+    memcpy(static_cast<unsigned char*>(buffer.base) + offset_, data, copy);
+    data += copy;
+    size -= copy;
+    size_ += copy;
+    offset_ += copy;
+    if (offset_ == buffer.size) {
+      ++buffer_;
+      offset_ = 0;
+    }
+  }
+  return true;
+}
+
+// libpng's write state and the row being packed.
+class PngStreamEncoder::Writer {
+public:
+  Writer(int w, int h, PngEncoder::ColorFormat format,
+    bool discard_transparency)
+    : png_ptr_(nullptr),
+    info_ptr_(nullptr),
+    width_(w),
+    height_(h),
+    reducer_(format, discard_transparency),
+    row_(reducer_.RowBytes(w)) {
+  }
+
+  ~Writer() {
+    png_destroy_write_struct(&png_ptr_, &info_ptr_);
+  }
+
+  bool Build() {
+    png_ptr_ = png_create_write_struct_2(PNG_LIBPNG_VER_STRING, NULL, NULL,
+      NULL, NULL, PngPoolMalloc, PngPoolFree);
+    if (!png_ptr_)
+      return false;
+    info_ptr_ = png_create_info_struct(png_ptr_);
+    return info_ptr_ != nullptr;
+  }
+
+  png_struct* png_ptr_;
+  png_info* info_ptr_;
+  const int width_;
+  const int height_;
+  const PngColorReducer reducer_;
+  std::vector<unsigned char> row_;
+};
+
+PngStreamEncoder::PngStreamEncoder() : rows_written_(0) {
+}
+
+PngStreamEncoder::~PngStreamEncoder() {
+}
+
+bool PngStreamEncoder::Begin(int w, int h, PngEncoder::ColorFormat format,
+  const PngEncoder::EncodeOptions& options, PngSink* sink) {
+  writer_.reset();
+  rows_written_ = 0;
+  if (w <= 0 || h <= 0 || !sink)
+    return false;
+  if (options.zlib_level < 0 || options.zlib_level > 9 ||
+    ToLibPNGFilters(options.filters) == 0)
+    return false;
+
+  std::unique_ptr<Writer> writer(
+    new Writer(w, h, format, options.discard_transparency));
+  if (!writer->Build())
+    return false;
+  png_structp png_ptr = writer->png_ptr_;
+  png_infop info_ptr = writer->info_ptr_;
+
+  std::vector<png_text> text(options.comments.size());
+  for (size_t i = 0; i < text.size(); ++i) {
+    memset(&text[i], 0, sizeof(png_text));
+    text[i].compression = PNG_TEXT_COMPRESSION_NONE;
+    text[i].key = const_cast<png_charp>(options.comments[i].key.c_str());
+    text[i].text = const_cast<png_charp>(options.comments[i].text.c_str());
+    text[i].text_length = options.comments[i].text.size();
+  }
+
+  if (setjmp(png_jmpbuf(png_ptr)))
+    return false;
+
+  png_set_error_fn(png_ptr, NULL,
+    LogLibPNGStreamError, LogLibPNGStreamWarning);
+  png_set_write_fn(png_ptr, sink, WriteToSink, FlushSink);
+  png_set_user_limits(png_ptr, kMaxDimension, kMaxDimension);
+
+  if (options.fast_deflate) {
+    png_set_compression_level(png_ptr, Z_BEST_SPEED);
+    png_set_compression_strategy(png_ptr, Z_QUICK);
+  }
+  else {
+    png_set_compression_level(png_ptr, options.zlib_level);
+    png_set_compression_strategy(png_ptr, options.zlib_strategy);
+  }
+  png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE,
+    ToLibPNGFilters(options.filters));
+  if (options.idat_chunk_size)
+    png_set_compression_buffer_size(png_ptr, options.idat_chunk_size);
+
+  png_set_IHDR(png_ptr, info_ptr, w, h, writer->reducer_.bit_depth(),
+    writer->reducer_.color_type(), PNG_INTERLACE_NONE,
+    PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+  if (options.write_srgb)
+    png_set_sRGB_gAMA_and_cHRM(png_ptr, info_ptr, PNG_sRGB_INTENT_PERCEPTUAL);
+  if (!text.empty())
+    png_set_text(png_ptr, info_ptr, text.data(),
+      static_cast<int>(text.size()));
+
+  png_write_info(png_ptr, info_ptr);
+  writer_.swap(writer);
+  return true;
+}
+
+bool PngStreamEncoder::WriteRows(const unsigned char* pixels, size_t stride,
+  int rows) {
+  if (!writer_ || rows < 0 || rows > writer_->height_ - rows_written_)
+    return false;
+  if (stride < static_cast<size_t>(writer_->width_) * 4)
+    return false;
+
+  if (setjmp(png_jmpbuf(writer_->png_ptr_))) {
+    writer_.reset();
+    return false;
+  }
+  for (int y = 0; y < rows; ++y) {
+    writer_->reducer_.PackRow(pixels + y * stride, writer_->width_,
+      writer_->row_.data());
+    png_write_row(writer_->png_ptr_, writer_->row_.data());
+    ++rows_written_;
+  }
+  return true;
+}
+
+bool PngStreamEncoder::Finish() {
+  if (!writer_ || rows_written_ != writer_->height_)
+    return false;
+  if (setjmp(png_jmpbuf(writer_->png_ptr_))) {
+    writer_.reset();
+    return false;
+  }
+  png_write_end(writer_->png_ptr_, writer_->info_ptr_);
+  writer_.reset();
+  return true;
+}
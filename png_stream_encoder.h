@@ -0,0 +1,121 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <memory>
+
+#include "png_encoder.h"
+
+// Destination of a streamed PNG.
+class PngSink {
+public:
+  virtual ~PngSink() {}
+
+  // Writes all |size| bytes at |data|. Returning false ends the encode.
+  virtual bool Write(const unsigned char* data, size_t size) = 0;
+};
+
+// Writes into one caller-owned buffer, failing once it is full.
+class PngBufferSink : public PngSink {
+public:
+  PngBufferSink(unsigned char* buffer, size_t capacity);
+
+  bool Write(const unsigned char* data, size_t size) override;
+
+  // Bytes written so far.
+  size_t size() const { return size_; }
+
+private:
+  unsigned char* const buffer_;
+  const size_t capacity_;
+  size_t size_;
+};
+
+// Writes to an open file descriptor: a file, pipe or socket. Short writes
+// are retried; the descriptor stays open.
+class PngFileDescriptorSink : public PngSink {
+public:
+  explicit PngFileDescriptorSink(int fd);
+
+  bool Write(const unsigned char* data, size_t size) override;
+
+private:
+  const int fd_;
+};
+
+// One caller buffer of a PngIoVecSink, as in struct iovec.
+struct PngIoVec {
+  void* base;
+  size_t size;
+};
+
+// Fills a list of caller buffers in order, each before the next, failing
+// once they are all full. |buffers| must outlive the sink.
+class PngIoVecSink : public PngSink {
+public:
+  PngIoVecSink(const PngIoVec* buffers, size_t count);
+
+  bool Write(const unsigned char* data, size_t size) override;
+
+  // Bytes written so far, over all buffers.
+  size_t size() const { return size_; }
+
+private:
+  const PngIoVec* const buffers_;
+  const size_t count_;
+  size_t buffer_;
+  size_t offset_;
+  size_t size_;
+};
+
+// Encodes an image handed over a few rows at a time, for images produced in
+// strips and too big to hold whole, such as mosaics. Rows go through libpng's
+// png_write_row, which keeps only the current and previous rows and the
+// deflate state; compressed data reaches the sink an IDAT chunk at a time.
+// Memory use is bounded by the row size, the deflate window and
+// EncodeOptions::idat_chunk_size, whatever the height.
+//
+//   PngFileDescriptorSink sink(fd);
+//   PngStreamEncoder encoder;
+//   if (!encoder.Begin(w, h, PngDecoder::FORMAT_RGBA, options, &sink))
+//     ...
+//   while (encoder.rows_written() < h) {
+//     RenderStrip(strip.data(), strip_rows);
+//     if (!encoder.WriteRows(strip.data(), w * 4, strip_rows))
+//       ...
+//   }
+//   if (!encoder.Finish())
+//     ...
+class PngStreamEncoder {
+public:
+  PngStreamEncoder();
+  ~PngStreamEncoder();
+
+  // Writes the signature and the chunks ahead of the image data for a |w| x
+  // |h| image to |sink|, which must outlive the encoder. |options| apply as
+  // to PngEncoder::Encode(), except for those that need the whole image up
+  // front: max_threads, restart_rows, auto_tune, reduce_colors and
+  // max_colors are ignored, so rows are written as RGBA, or RGB when
+  // discarding transparency. Unlike Encode() there is no bound on the pixel
+  // count, only libpng's 2^31 - 1 on each dimension.
+  bool Begin(int w, int h, PngEncoder::ColorFormat format,
+    const PngEncoder::EncodeOptions& options, PngSink* sink);
+
+  // Encodes the next |rows| rows, which start |stride| bytes apart at
+  // |pixels|. Fails if that goes past the image's height.
+  bool WriteRows(const unsigned char* pixels, size_t stride, int rows);
+
+  // Rows encoded so far.
+  int rows_written() const { return rows_written_; }
+
+  // Once every row is written, flushes the image data and writes IEND.
+  bool Finish();
+
+private:
+  class Writer;
+
+  // Null before Begin(), after Finish() and after any error, which leaves
+  // the sink holding a truncated PNG.
+  std::unique_ptr<Writer> writer_;
+  int rows_written_;
+};
@@ -0,0 +1,138 @@
+#include "stdafx.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "png_decoder.h"
+#include "png_stream_encoder.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace {
+
+const int kWidth = 97;
+const int kHeight = 61;
+
+// An RGBA image with a little of everything: gradients, noise and alpha.
+std::vector<unsigned char> MakePixels() {
+  std::vector<unsigned char> pixels(kWidth * kHeight * 4);
+  for (int y = 0; y < kHeight; ++y) {
+    for (int x = 0; x < kWidth; ++x) {
+      unsigned char* p = &pixels[(y * kWidth + x) * 4];
+      p[0] = static_cast<unsigned char>(x * 3);
+      p[1] = static_cast<unsigned char>(y * 5 + x * x);
+      p[2] = static_cast<unsigned char>(x ^ y);
+      p[3] = static_cast<unsigned char>(255 - y);
+    }
+  }
+  return pixels;
+}
+
+// Streams |pixels| to |sink| in strips of 8 rows.
+bool StreamEncode(const std::vector<unsigned char>& pixels, PngSink* sink) {
+  PngEncoder::EncodeOptions options;
+  PngStreamEncoder encoder;
+  if (!encoder.Begin(kWidth, kHeight, PngDecoder::FORMAT_RGBA, options, sink))
+    return false;
+  while (encoder.rows_written() < kHeight) {
+    const int rows = std::min(8, kHeight - encoder.rows_written());
+    if (!encoder.WriteRows(&pixels[encoder.rows_written() * kWidth * 4],
+      kWidth * 4, rows))
+      return false;
+  }
+  return encoder.Finish();
+}
+
+// What PngEncoder writes for the same image; the stream encoder goes through
+// libpng the same way, so the files match.
+std::vector<unsigned char> Encode(const std::vector<unsigned char>& pixels) {
+  std::vector<unsigned char> png;
+  EXPECT_TRUE(PngEncoder::Encode(pixels.data(), kWidth * 4,
+    PngDecoder::FORMAT_RGBA, kWidth, kHeight, PngEncoder::EncodeOptions(),
+    &png));
+  return png;
+}
+
+void ExpectDecodes(const std::vector<unsigned char>& png,
+  const std::vector<unsigned char>& pixels) {
+  std::vector<unsigned char> decoded;
+  int w = 0;
+  int h = 0;
+  ASSERT_TRUE(PngDecoder::Decode(png.data(), png.size(),
+    PngDecoder::FORMAT_RGBA, &decoded, &w, &h));
+  EXPECT_EQ(kWidth, w);
+  EXPECT_EQ(kHeight, h);
+  EXPECT_EQ(pixels, decoded);
+}
+
+}  // namespace
+
+TEST(PngStreamEncoderTest, BufferSink) {
+  const std::vector<unsigned char> pixels = MakePixels();
+  const std::vector<unsigned char> expected = Encode(pixels);
+
+  std::vector<unsigned char> buffer(expected.size() + 100);
+  PngBufferSink sink(buffer.data(), buffer.size());
+  ASSERT_TRUE(StreamEncode(pixels, &sink));
+  buffer.resize(sink.size());
+  EXPECT_EQ(expected, buffer);
+  ExpectDecodes(buffer, pixels);
+
+  // One byte short.
+  std::vector<unsigned char> small(expected.size() - 1);
+  PngBufferSink small_sink(small.data(), small.size());
+  EXPECT_FALSE(StreamEncode(pixels, &small_sink));
+}
+
+TEST(PngStreamEncoderTest, FileDescriptorSink) {
+  const std::vector<unsigned char> pixels = MakePixels();
+  FILE* file = tmpfile();
+  ASSERT_TRUE(file);
+  PngFileDescriptorSink sink(fileno(file));
+  EXPECT_TRUE(StreamEncode(pixels, &sink));
+
+  std::vector<unsigned char> png;
+  rewind(file);
+  unsigned char buffer[4096];
+  size_t read;
+  while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    png.insert(png.end(), buffer, buffer + read);
+  fclose(file);
+  EXPECT_EQ(Encode(pixels), png);
+  ExpectDecodes(png, pixels);
+}
+
+TEST(PngStreamEncoderTest, FileDescriptorSinkBadDescriptor) {
+  PngFileDescriptorSink sink(-1);
+  EXPECT_FALSE(StreamEncode(MakePixels(), &sink));
+}
+
+// Buffers of odd sizes, so that chunks straddle them.
+TEST(PngStreamEncoderTest, IoVecSink) {
+  const std::vector<unsigned char> pixels = MakePixels();
+  const std::vector<unsigned char> expected = Encode(pixels);
+
+  std::vector<unsigned char> first(13);
+  std::vector<unsigned char> second(expected.size() / 2 + 1);
+  std::vector<unsigned char> third(expected.size());
+  const PngIoVec buffers[] = {
+    { first.data(), first.size() },
+    { second.data(), second.size() },
+    { third.data(), third.size() },
+  };
+  PngIoVecSink sink(buffers, 3);
+  ASSERT_TRUE(StreamEncode(pixels, &sink));
+  ASSERT_EQ(expected.size(), sink.size());
+
+  std::vector<unsigned char> png(first);
+  png.insert(png.end(), second.begin(), second.end());
+  png.insert(png.end(), third.begin(),
+    third.begin() + (sink.size() - first.size() - second.size()));
+  EXPECT_EQ(expected, png);
+
+  // Without the last buffer the data does not fit.
+  PngIoVecSink short_sink(buffers, 2);
+  EXPECT_FALSE(StreamEncode(pixels, &short_sink));
+  EXPECT_EQ(first.size() + second.size(), short_sink.size());
+}
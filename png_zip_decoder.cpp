@@ -0,0 +1,114 @@
+#include "stdafx.h"
+#include "png_zip_decoder.h"
+
+#include <stdint.h>
+
+#include <limits>
+
+#include "base/files/file_path.h"
+#include "base/strings/string_piece.h"
+#include "base/time/time.h"
+#include "third_party/zlib/google/zip_reader.h"
+
+namespace {
+
+// Feeds an entry to a PngStreamDecoder as ZipReader inflates it, and cuts
+// the extraction short once the decoder has failed or reached IEND.
+class PngStreamWriterDelegate : public zip::WriterDelegate {
+public:
+  explicit PngStreamWriterDelegate(PngStreamDecoder* decoder)
+    : decoder_(decoder),
+    refused_(false) {
+  }
+
+  bool PrepareOutput() override {
+    return true;
+  }
+
+  bool WriteBytes(const char* data, int num_bytes) override {
+    refused_ = decoder_->done() ||
+      !decoder_->Feed(reinterpret_cast<const unsigned char*>(data),
+        static_cast<size_t>(num_bytes));
+    return !refused_;
+  }
+
+  void SetTimeModified(const base::Time& time) override {
+  }
+
+  // Whether extraction was cut short here rather than by ZipReader.
+  bool refused() const { return refused_; }
+
+private:
+  PngStreamDecoder* const decoder_;
+  bool refused_;
+};
+
+}  // namespace
+
+bool DecodePngZipEntry(zip::ZipReader* reader,
+  PngDecoder::ColorFormat format, const PngDecoder::DecodeOptions& options,
+  std::vector<unsigned char>* output, int* w, int* h,
+  PngDecoder::DecodeResult* result) {
+  PngDecoder::DecodeResult local_result;
+  if (!result)
+    result = &local_result;
+
+  if (reader->HasCurrentEntryStoredData()) {
+    base::StringPiece stored;
+    if (!reader->GetCurrentEntryStoredData(&stored)) {
+      // The entry does not match its CRC-32.
+      output->clear();
+      result->error = PngDecoder::DECODE_ERROR_CORRUPT;
+      return false;
+    }
+    return PngDecoder::Decode(
+      reinterpret_cast<const unsigned char*>(stored.data()), stored.size(),
+      format, options, output, w, h, result);
+  }
+
+  // Extraction also stops early, and fails, when the decoder is done or has
+  // failed, which Finish() tells apart from data that ran out.
+  PngStreamDecoder decoder(format, options, output);
+  PngStreamWriterDelegate delegate(&decoder);
+  const bool extracted = reader->ExtractCurrentEntry(&delegate,
+    std::numeric_limits<uint64_t>::max());
+  const bool decoded = decoder.Finish(w, h, result);
+  if (extracted || delegate.refused())
+    return decoded;
+  // Otherwise ZipReader could not inflate the entry to its end, or it did
+  // not match its CRC-32, so whatever the decoder got is corrupt rather than
+  // cut short or not a PNG.
+  result->error = PngDecoder::DECODE_ERROR_CORRUPT;
+  if (decoder.done()) {
+    // The whole PNG arrived, but not as the archive recorded it.
+    output->clear();
+    result->rows_decoded = 0;
+    return false;
+  }
+  return decoded;
+}
+
+bool DecodePngZipEntries(zip::ZipReader* reader,
+  PngDecoder::ColorFormat format, const PngDecoder::DecodeOptions& options,
+  const PngZipEntryCallback& callback) {
+  std::vector<unsigned char> pixels;
+  while (reader->HasMore()) {
+    if (!reader->OpenCurrentEntryInZip())
+      return false;
+    const zip::ZipReader::EntryInfo* entry = reader->current_entry_info();
+    if (!entry->is_directory() &&
+      entry->file_path().MatchesExtension(FILE_PATH_LITERAL(".png"))) {
+      int w = 0;
+      int h = 0;
+      PngDecoder::DecodeResult result;
+      const bool decoded = DecodePngZipEntry(reader, format, options, &pixels,
+        &w, &h, &result);
+      if (!callback(entry->file_path().AsUTF8Unsafe(), decoded, pixels, w, h,
+        result))
+        return false;
+    }
+    if (!reader->AdvanceToNextEntry())
+      return false;
+  }
+  return true;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "png_decoder.h"
+
+namespace zip {
+class ZipReader;
+}
+
+// Decodes the PNG in the current entry of |reader|, on which
+// OpenCurrentEntryInZip() must have been called. A stored entry of an
+// archive opened with ZipReader::OpenFromMemory(), e.g. over the bytes of a
+// base::MemoryMappedFile, is decoded in place by PngDecoder::Decode(), with
+// no copy of the file. Any other entry is inflated a buffer at a time
+// straight into a PngStreamDecoder, so the PNG file is never held whole;
+// |options.mode| and |options.max_threads| then do not apply. Results are as
+// for PngDecoder::Decode(); an entry that does not match its CRC-32, or
+// one that cannot be inflated to its end, is DECODE_ERROR_CORRUPT.
+bool DecodePngZipEntry(zip::ZipReader* reader,
+  PngDecoder::ColorFormat format, const PngDecoder::DecodeOptions& options,
+  std::vector<unsigned char>* output, int* w, int* h,
+  PngDecoder::DecodeResult* result = nullptr);
+
+// Called for each PNG entry with its path in the archive as UTF-8 and what
+// DecodePngZipEntry() returned for it. |pixels| is only valid during the
+// call. Returning false stops the walk.
+typedef std::function<bool(const std::string& path, bool decoded,
+  const std::vector<unsigned char>& pixels, int w, int h,
+  const PngDecoder::DecodeResult& result)> PngZipEntryCallback;
+
+// Decodes, in archive order, every entry of the freshly opened |reader|
+// whose name ends in ".png" in any case, reusing one pixel buffer. Returns
+// false if the archive could not be read to the end or |callback| stopped
+// the walk.
+bool DecodePngZipEntries(zip::ZipReader* reader,
+  PngDecoder::ColorFormat format, const PngDecoder::DecodeOptions& options,
+  const PngZipEntryCallback& callback);
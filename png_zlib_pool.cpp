@@ -0,0 +1,165 @@
+#include "stdafx.h"
+#include "png_zlib_pool.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+namespace {
+
+// Each block starts with its size class, padded to keep malloc's alignment
+// for what follows.
+const size_t kHeaderBytes = 16;
+
+// Size classes: 16 of 64 bytes apart up to 1 KB, then 8 per power of two up
+// to kMaxPooledBytes, so a block wastes at most an eighth of its size.
+const size_t kSmallClasses = 16;
+const size_t kSmallClassBytes = 64;
+const size_t kMaxPooledBytes = 4 << 20;
+const size_t kClassCount = kSmallClasses + (22 - 10) * 8;
+
+// Class of blocks that are not pooled.
+const size_t kUnpooled = kClassCount;
+
+// Bytes a thread keeps on its free lists at most.
+const size_t kMaxCachedBytes = 16 << 20;
+
+int FloorLog2(size_t value) {
+  int log = 0;
+  while (value >>= 1)
+    ++log;
+  return log;
+}
+
+size_t ClassOf(size_t size) {
+  if (size <= kSmallClasses * kSmallClassBytes)
+    return size ? (size - 1) / kSmallClassBytes : 0;
+  // Eight classes above 2^e, each 2^(e - 3) bytes apart.
+  const int e = FloorLog2(size - 1);
+  const size_t step = static_cast<size_t>(1) << (e - 3);
+  const size_t k = (size + step - 1) / step;
+  return kSmallClasses + (e - 10) * 8 + (k - 9);
+}
+
+size_t ClassBytes(size_t klass) {
+  if (klass < kSmallClasses)
+    return (klass + 1) * kSmallClassBytes;
+  const size_t j = klass - kSmallClasses;
+  return (9 + j % 8) << (10 + j / 8 - 3);
+}
+
+struct FreeBlock {
+  FreeBlock* next;
+};
+
+class ThreadFreeLists {
+public:
+  ThreadFreeLists() : bytes_(0) {
+    for (size_t i = 0; i < kClassCount; ++i)
+      lists_[i] = nullptr;
+  }
+
+  ~ThreadFreeLists() {
+    Trim();
+  }
+
+  // A free block of |klass|, header included, or null.
+  void* Take(size_t klass) {
+    FreeBlock* block = lists_[klass];
+    if (!block)
+      return nullptr;
+    lists_[klass] = block->next;
+    bytes_ -= ClassBytes(klass);
+    return block;
+  }
+
+  // Keeps |block|, unless that would go over kMaxCachedBytes.
+  bool Give(size_t klass, void* block) {
+    const size_t bytes = ClassBytes(klass);
+    if (bytes_ + bytes > kMaxCachedBytes)
+      return false;
+    FreeBlock* free_block = static_cast<FreeBlock*>(block);
+    free_block->next = lists_[klass];
+    lists_[klass] = free_block;
+    bytes_ += bytes;
+    return true;
+  }
+
+  void Trim() {
+    for (size_t i = 0; i < kClassCount; ++i) {
+      while (FreeBlock* block = lists_[i]) {
+        lists_[i] = block->next;
+        free(block);
+      }
+    }
+    bytes_ = 0;
+  }
+
+private:
+  FreeBlock* lists_[kClassCount];
+  size_t bytes_;
+};
+
+thread_local ThreadFreeLists free_lists;
+
+void* PoolAllocate(size_t size) {
+  if (size > kMaxPooledBytes) {
+    if (size > SIZE_MAX - kHeaderBytes)
+      return nullptr;
+    unsigned char* block =
+      static_cast<unsigned char*>(malloc(kHeaderBytes + size));
+    if (!block)
+      return nullptr;
+    *reinterpret_cast<size_t*>(block) = kUnpooled;
+    return block + kHeaderBytes;
+  }
+
+  const size_t klass = ClassOf(size);
+  unsigned char* block = static_cast<unsigned char*>(free_lists.Take(klass));
+  if (!block) {
+    block = static_cast<unsigned char*>(
+      malloc(kHeaderBytes + ClassBytes(klass)));
+    if (!block)
+      return nullptr;
+  }
+  *reinterpret_cast<size_t*>(block) = klass;
+  return block + kHeaderBytes;
+}
+
+void PoolFree(void* address) {
+  if (!address)
+    return;
+  unsigned char* block = static_cast<unsigned char*>(address) - kHeaderBytes;
+  const size_t klass = *reinterpret_cast<size_t*>(block);
+  if (klass == kUnpooled || !free_lists.Give(klass, block))
+    free(block);
+}
+
+}  // namespace
+
+voidpf PngZlibAlloc(voidpf opaque, uInt items, uInt size) {
+  if (size && items > SIZE_MAX / size)
+    return Z_NULL;
+  return PoolAllocate(static_cast<size_t>(items) * size);
+}
+
+void PngZlibFree(voidpf opaque, voidpf address) {
+  PoolFree(address);
+}
+
+void UsePngZlibPool(z_stream* stream) {
+  stream->zalloc = PngZlibAlloc;
+  stream->zfree = PngZlibFree;
+  stream->opaque = Z_NULL;
+}
+
+png_voidp PngPoolMalloc(png_structp png_ptr, png_alloc_size_t size) {
+  return PoolAllocate(size);
+}
+
+void PngPoolFree(png_structp png_ptr, png_voidp ptr) {
+  PoolFree(ptr);
+}
+
+void TrimPngZlibPool() {
+  free_lists.Trim();
+}
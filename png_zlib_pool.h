@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "third_party/libpng/png.h"
+#include "third_party/zlib/zlib.h"
+
+// Recycles the blocks zlib streams allocate over and over: inflate's state
+// and 32 KB window, and deflate's state, window, hash chains and pending
+// buffer, along with libpng's own structs and row buffers. A freed block goes
+// on a free list of the freeing thread, one list per size class, and the next
+// allocation of that class on that thread takes it back, so a thread decoding
+// or encoding a batch of images stops calling malloc after the first one.
+// Classes are 64 bytes apart up to 1 KB, then eight per power of two; blocks
+// over 4 MB, and blocks freed once a thread holds 16 MB, go back to free().
+// A block may be freed on another thread than the one that allocated it.
+// Free lists are released when their thread exits.
+
+// zalloc and zfree for a z_stream. |opaque| is unused.
+voidpf PngZlibAlloc(voidpf opaque, uInt items, uInt size);
+void PngZlibFree(voidpf opaque, voidpf address);
+
+// Points |stream| at the pool. Call before inflateInit() or deflateInit().
+void UsePngZlibPool(z_stream* stream);
+
+// malloc_fn and free_fn for png_create_read_struct_2() and
+// png_create_write_struct_2(). libpng allocates its zlib stream's memory
+// through them too.
+png_voidp PngPoolMalloc(png_structp png_ptr, png_alloc_size_t size);
+void PngPoolFree(png_structp png_ptr, png_voidp ptr);
+
+// Frees the blocks on the calling thread's free lists.
+void TrimPngZlibPool();
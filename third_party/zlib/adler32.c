@@ -76,6 +76,12 @@ uLong ZEXPORT adler32_z(adler, buf, len)
     unsigned n;
 
 #if defined(ADLER32_SIMD_SSSE3)
+#if defined(ADLER32_SIMD_AVX2)
+    if (x86_cpu_enable_avx512 && buf && len >= 256)
+        return adler32_simd_avx512_(adler, buf, len);
+    if (x86_cpu_enable_avx2 && buf && len >= 64)
+        return adler32_simd_avx2_(adler, buf, len);
+#endif
     if (x86_cpu_enable_ssse3 && buf && len >= 64)
         return adler32_simd_(adler, buf, len);
 #elif defined(ADLER32_SIMD_NEON)
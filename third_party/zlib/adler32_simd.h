@@ -14,3 +14,17 @@ uint32_t ZLIB_INTERNAL adler32_simd_(
     uint32_t adler,
     const unsigned char *buf,
     z_size_t len);
+
+#if defined(ADLER32_SIMD_AVX2)
+/* 32 bytes a step; needs x86_cpu_enable_avx2. */
+uint32_t ZLIB_INTERNAL adler32_simd_avx2_(
+    uint32_t adler,
+    const unsigned char *buf,
+    z_size_t len);
+
+/* 64 bytes a step; needs x86_cpu_enable_avx512. */
+uint32_t ZLIB_INTERNAL adler32_simd_avx512_(
+    uint32_t adler,
+    const unsigned char *buf,
+    z_size_t len);
+#endif
@@ -0,0 +1,146 @@
+/* adler32_simd_avx2.c
+ *
+ * Copyright 2026 The Chromium Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the Chromium source repository LICENSE file.
+ *
+ * The SSSE3 code of adler32_simd.c on 256-bit registers: each step takes 64
+ * input bytes D1 ... D64 in two loads and adds
+ *
+ *   B = B0 + 64.A0 + [D1 D2 D3 ... D64] x [64 63 62 ... 1]
+ *
+ * with _mm256_sad_epu8() summing the bytes for A, and _mm256_maddubs_epi16()
+ * then _mm256_madd_epi16() weighting them for B; the byte products fit the
+ * 16-bit sums, 255 x 64 + 255 x 63 < 32768. Two loads a step keep the loop
+ * from waiting on the A sum. Built with -mavx2, apart from the rest of zlib,
+ * and only called when x86_cpu_enable_avx2 is set.
+ */
+
+#include "adler32_simd.h"
+
+/* Definitions from adler32.c: largest prime smaller than 65536 */
+#define BASE 65521U
+/* NMAX is the largest n such that 255n(n+1)/2 + (n+1)(BASE-1) <= 2^32-1 */
+#define NMAX 5552
+
+#if defined(ADLER32_SIMD_AVX2)
+
+#include <immintrin.h>
+
+/* Sum of the eight epi32 lanes of |v|. */
+static uint32_t hsum_epi32_avx2(__m256i v)
+{
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v),
+                                _mm256_extracti128_si256(v, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2,3,0,1)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1,0,3,2)));
+    return (uint32_t) _mm_cvtsi128_si32(sum);
+}
+
+uint32_t ZLIB_INTERNAL adler32_simd_avx2_(  /* AVX2 */
+    uint32_t adler,
+    const unsigned char *buf,
+    z_size_t len)
+{
+    /*
+     * Split Adler-32 into component sums.
+     */
+    uint32_t s1 = adler & 0xffff;
+    uint32_t s2 = adler >> 16;
+
+    /*
+     * Process the data in blocks.
+     */
+    const unsigned BLOCK_SIZE = 1 << 6;
+
+    z_size_t blocks = len / BLOCK_SIZE;
+    len -= blocks * BLOCK_SIZE;
+
+    const __m256i tap1 = _mm256_setr_epi8(
+        64,63,62,61,60,59,58,57,56,55,54,53,52,51,50,49,
+        48,47,46,45,44,43,42,41,40,39,38,37,36,35,34,33);
+    const __m256i tap2 = _mm256_setr_epi8(
+        32,31,30,29,28,27,26,25,24,23,22,21,20,19,18,17,
+        16,15,14,13,12,11,10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+
+    while (blocks)
+    {
+        unsigned n = NMAX / BLOCK_SIZE;  /* The NMAX constraint. */
+        if (n > blocks)
+            n = (unsigned) blocks;
+        blocks -= n;
+
+        /*
+         * Process n blocks of data. At most NMAX data bytes can be
+         * processed before s2 must be reduced modulo BASE.
+         */
+        __m256i v_ps = _mm256_setr_epi32(s1 * n, 0, 0, 0, 0, 0, 0, 0);
+        __m256i v_s2 = _mm256_setr_epi32(s2, 0, 0, 0, 0, 0, 0, 0);
+        __m256i v_s1 = _mm256_setzero_si256();
+
+        do {
+            /*
+             * Load 64 input bytes.
+             */
+            const __m256i bytes1 = _mm256_loadu_si256((const __m256i*)buf);
+            const __m256i bytes2 =
+                _mm256_loadu_si256((const __m256i*)(buf + 32));
+
+            /*
+             * Add previous block byte sum to v_ps.
+             */
+            v_ps = _mm256_add_epi32(v_ps, v_s1);
+
+            /*
+             * Horizontally add the bytes for s1, multiply-adds the
+             * bytes by [ 64, 63, 62, ... ] for s2.
+             */
+            const __m256i sad = _mm256_add_epi32(
+                _mm256_sad_epu8(bytes1, zero), _mm256_sad_epu8(bytes2, zero));
+            v_s1 = _mm256_add_epi32(v_s1, sad);
+            const __m256i mad1 = _mm256_maddubs_epi16(bytes1, tap1);
+            const __m256i mad2 = _mm256_maddubs_epi16(bytes2, tap2);
+            v_s2 = _mm256_add_epi32(v_s2, _mm256_add_epi32(
+                _mm256_madd_epi16(mad1, ones), _mm256_madd_epi16(mad2, ones)));
+
+            buf += BLOCK_SIZE;
+
+        } while (--n);
+
+        v_s2 = _mm256_add_epi32(v_s2, _mm256_slli_epi32(v_ps, 6));
+
+        /*
+         * Sum epi32 ints v_s1(s2) and accumulate in s1(s2).
+         */
+        s1 += hsum_epi32_avx2(v_s1);
+        s2 = hsum_epi32_avx2(v_s2);
+
+        /*
+         * Reduce.
+         */
+        s1 %= BASE;
+        s2 %= BASE;
+    }
+
+    /*
+     * Handle leftover data.
+     */
+    if (len) {
+        while (len--) {
+            s2 += (s1 += *buf++);
+        }
+
+        if (s1 >= BASE)
+            s1 -= BASE;
+        s2 %= BASE;
+    }
+
+    /*
+     * Return the recombined sums.
+     */
+    return s1 | (s2 << 16);
+}
+
+#endif  /* ADLER32_SIMD_AVX2 */
@@ -0,0 +1,125 @@
+/* adler32_simd_avx512.c
+ *
+ * Copyright 2026 The Chromium Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the Chromium source repository LICENSE file.
+ *
+ * adler32_simd_avx2.c on 512-bit registers, 64 input bytes a step:
+ *
+ *   B = B0 + 64.A0 + [D1 D2 D3 ... D64] x [64 63 62 ... 1].
+ *
+ * _mm512_maddubs_epi16() needs AVX-512BW. The byte products fit its 16-bit
+ * sums: 255 x 64 + 255 x 63 < 32768. Built with -mavx512f -mavx512bw, apart
+ * from the rest of zlib, and only called when x86_cpu_enable_avx512 is set.
+ */
+
+#include "adler32_simd.h"
+
+/* Definitions from adler32.c: largest prime smaller than 65536 */
+#define BASE 65521U
+/* NMAX is the largest n such that 255n(n+1)/2 + (n+1)(BASE-1) <= 2^32-1 */
+#define NMAX 5552
+
+#if defined(ADLER32_SIMD_AVX2)
+
+#include <immintrin.h>
+
+uint32_t ZLIB_INTERNAL adler32_simd_avx512_(  /* AVX-512 */
+    uint32_t adler,
+    const unsigned char *buf,
+    z_size_t len)
+{
+    /*
+     * Split Adler-32 into component sums.
+     */
+    uint32_t s1 = adler & 0xffff;
+    uint32_t s2 = adler >> 16;
+
+    /*
+     * Process the data in blocks.
+     */
+    const unsigned BLOCK_SIZE = 1 << 6;
+
+    z_size_t blocks = len / BLOCK_SIZE;
+    len -= blocks * BLOCK_SIZE;
+
+    const __m512i tap = _mm512_set_epi8(
+         1, 2, 3, 4, 5, 6, 7, 8, 9,10,11,12,13,14,15,16,
+        17,18,19,20,21,22,23,24,25,26,27,28,29,30,31,32,
+        33,34,35,36,37,38,39,40,41,42,43,44,45,46,47,48,
+        49,50,51,52,53,54,55,56,57,58,59,60,61,62,63,64);
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i ones = _mm512_set1_epi16(1);
+
+    while (blocks)
+    {
+        unsigned n = NMAX / BLOCK_SIZE;  /* The NMAX constraint. */
+        if (n > blocks)
+            n = (unsigned) blocks;
+        blocks -= n;
+
+        /*
+         * Process n blocks of data. At most NMAX data bytes can be
+         * processed before s2 must be reduced modulo BASE.
+         */
+        __m512i v_ps = _mm512_zextsi128_si512(_mm_cvtsi32_si128(s1 * n));
+        __m512i v_s2 = _mm512_zextsi128_si512(_mm_cvtsi32_si128(s2));
+        __m512i v_s1 = _mm512_setzero_si512();
+
+        do {
+            /*
+             * Load 64 input bytes.
+             */
+            const __m512i bytes = _mm512_loadu_si512((const void*)buf);
+
+            /*
+             * Add previous block byte sum to v_ps.
+             */
+            v_ps = _mm512_add_epi32(v_ps, v_s1);
+
+            /*
+             * Horizontally add the bytes for s1, multiply-adds the
+             * bytes by [ 64, 63, 62, ... ] for s2.
+             */
+            v_s1 = _mm512_add_epi32(v_s1, _mm512_sad_epu8(bytes, zero));
+            const __m512i mad = _mm512_maddubs_epi16(bytes, tap);
+            v_s2 = _mm512_add_epi32(v_s2, _mm512_madd_epi16(mad, ones));
+
+            buf += BLOCK_SIZE;
+
+        } while (--n);
+
+        v_s2 = _mm512_add_epi32(v_s2, _mm512_slli_epi32(v_ps, 6));
+
+        /*
+         * Sum epi32 ints v_s1(s2) and accumulate in s1(s2).
+         */
+        s1 += (uint32_t) _mm512_reduce_add_epi32(v_s1);
+        s2 = (uint32_t) _mm512_reduce_add_epi32(v_s2);
+
+        /*
+         * Reduce.
+         */
+        s1 %= BASE;
+        s2 %= BASE;
+    }
+
+    /*
+     * Handle leftover data, less than a block.
+     */
+    if (len) {
+        while (len--) {
+            s2 += (s1 += *buf++);
+        }
+
+        s1 %= BASE;
+        s2 %= BASE;
+    }
+
+    /*
+     * Return the recombined sums.
+     */
+    return s1 | (s2 << 16);
+}
+
+#endif  /* ADLER32_SIMD_AVX2 */
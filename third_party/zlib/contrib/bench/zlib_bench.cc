@@ -12,10 +12,29 @@
  * it with the [raw] argument. Use the [gzip] [zlib] arguments to select those
  * stream wrappers.
  *
+ * The compression level and strategy default to zlib's; change them with
+ * --compression <level> and one of --filtered, --huffman, --rle, --fixed or
+ * --quick (Z_QUICK, fast fixed-code deflate for images) after the wrapper.
+ *
+ * Sweeps: --compression, --window (deflate window bits, 9-15) and --threads
+ * take a list of values and ranges such as 1,6,9 or 1-9, and --strategy a
+ * list of default, filtered, huffman, rle, fixed and quick. Every file is
+ * benchmarked with every combination.
+ *
+ * --threads N runs the loop on N threads at once, each on its own buffers,
+ * and reports their combined rates, to show how throughput scales.
+ *
+ * --idat reads PNG files, and benchmarks on the filtered rows their IDAT
+ * chunks hold, which is the data a PNG encoder deflates, in place of the
+ * file's bytes. It also reports the rate at which the file's own IDAT stream
+ * uncompresses, as a PNG decoder would.
+ *
+ * --json prints one JSON object per result line in place of the text.
+ *
  * Note this code can be compiled outside of the Chromium build system against
  * the system zlib (-lz) with g++ or clang++ as follows:
  *
- *   g++|clang++ -O3 -Wall -std=c++11 -lstdc++ -lz zlib_bench.cc
+ *   g++|clang++ -O3 -Wall -std=c++11 -pthread -lstdc++ -lz zlib_bench.cc
  */
 
 #include <algorithm>
@@ -23,12 +42,14 @@
 #include <fstream>
 #include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <memory.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "zlib.h"
 
@@ -74,6 +95,73 @@ Data read_file_data_or_exit(const char* name) {
   return data;
 }
 
+uint32_t read_uint32_be(const unsigned char* p) {
+  return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+         (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+/*
+ * The concatenated IDAT chunk data of a PNG file: one zlib stream.
+ */
+std::string png_idat_stream_or_exit(const char* name, const Data& file) {
+  static const unsigned char signature[8] = {
+    0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  const unsigned char* data =
+      reinterpret_cast<const unsigned char*>(file.data.get());
+
+  if (file.size < 8 || memcmp(data, signature, 8)) {
+    fprintf(stderr, "%s is not a PNG file\n", name);
+    exit(1);
+  }
+
+  std::string idat;
+  size_t offset = 8;
+  while (file.size - offset >= 12) {
+    const size_t length = read_uint32_be(data + offset);
+    const unsigned char* type = data + offset + 4;
+    if (length > file.size - offset - 12)
+      break;
+    if (!memcmp(type, "IDAT", 4))
+      idat.append(reinterpret_cast<const char*>(data + offset + 8), length);
+    else if (!memcmp(type, "IEND", 4))
+      break;
+    offset += length + 12;
+  }
+
+  if (idat.empty()) {
+    fprintf(stderr, "%s has no IDAT data\n", name);
+    exit(1);
+  }
+
+  return idat;
+}
+
+/*
+ * Uncompresses a PNG's IDAT stream into |rows|, growing it to fit.
+ */
+void png_idat_rows_or_exit(
+    const char* name,
+    const std::string& idat,
+    std::string* rows)
+{
+  rows->resize(idat.size() * 4);
+  for (;;) {
+    uLongf rows_size = rows->size();
+    int result = uncompress((Bytef*)string_data(rows), &rows_size,
+        (const Bytef*)idat.data(), idat.size());
+    if (result == Z_OK && rows_size) {
+      rows->resize(rows_size);
+      return;
+    }
+    if (result != Z_BUF_ERROR || rows->size() > (size_t(1) << 30)) {
+      fprintf(stderr, "%s: IDAT stream does not uncompress (%d)\n",
+          name, result);
+      exit(1);
+    }
+    rows->resize(rows->size() * 2);
+  }
+}
+
 size_t zlib_estimate_compressed_size(size_t input_size) {
   return compressBound(input_size);
 }
@@ -85,13 +173,19 @@ enum zlib_wrapper {
   kWrapperZRAW,
 };
 
+int zlib_level = Z_DEFAULT_COMPRESSION;
+int zlib_strategy = Z_DEFAULT_STRATEGY;
+int zlib_window_bits = MAX_WBITS;
+int zlib_threads = 1;
+bool json_output = false;
+
 inline int zlib_stream_wrapper_type(zlib_wrapper type) {
   if (type == kWrapperZLIB) // zlib DEFLATE stream wrapper
-    return MAX_WBITS;
+    return zlib_window_bits;
   if (type == kWrapperGZIP) // gzip DEFLATE stream wrapper
-    return MAX_WBITS + 16;
+    return zlib_window_bits + 16;
   if (type == kWrapperZRAW) // no wrapper, use raw DEFLATE
-    return -MAX_WBITS;
+    return -zlib_window_bits;
   error_exit("bad wrapper type", int(type));
   return 0;
 }
@@ -107,6 +201,19 @@ const char* zlib_wrapper_name(zlib_wrapper type) {
   return 0;
 }
 
+const char* zlib_strategy_name(int strategy) {
+  switch (strategy) {
+    case Z_FILTERED: return "filtered ";
+    case Z_HUFFMAN_ONLY: return "huffman ";
+    case Z_RLE: return "rle ";
+    case Z_FIXED: return "fixed ";
+#ifdef Z_QUICK
+    case Z_QUICK: return "quick ";
+#endif
+  }
+  return "";
+}
+
 void zlib_compress(
     const zlib_wrapper type,
     const char* input,
@@ -121,8 +228,8 @@ void zlib_compress(
   z_stream stream;
   memset(&stream, 0, sizeof(stream));
 
-  int result = deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
-      zlib_stream_wrapper_type(type), MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+  int result = deflateInit2(&stream, zlib_level, Z_DEFLATED,
+      zlib_stream_wrapper_type(type), MAX_MEM_LEVEL, zlib_strategy);
   if (result != Z_OK)
     error_exit("deflateInit2 failed", result);
 
@@ -181,25 +288,65 @@ void verify_equal(const char* input, size_t size, std::string* output) {
   exit(3);
 }
 
-void zlib_file(const char* name, const zlib_wrapper type) {
-  /*
-   * Read the file data.
-   */
-  const auto file = read_file_data_or_exit(name);
-  const int length = static_cast<int>(file.size);
-  const char* data = file.data.get();
-  printf("%-40s :\n", name);
+const char* zlib_strategy_json_name(int strategy) {
+  switch (strategy) {
+    case Z_FILTERED: return "filtered";
+    case Z_HUFFMAN_ONLY: return "huffman";
+    case Z_RLE: return "rle";
+    case Z_FIXED: return "fixed";
+#ifdef Z_QUICK
+    case Z_QUICK: return "quick";
+#endif
+  }
+  return "default";
+}
 
+std::string json_string(const char* s) {
+  std::string json("\"");
+  for (; *s; ++s) {
+    const unsigned char c = *s;
+    if (c == '"' || c == '\\') {
+      json += '\\';
+      json += c;
+    } else if (c < 0x20) {
+      char escape[8];
+      snprintf(escape, sizeof(escape), "\\u%04x", c);
+      json += escape;
+    } else {
+      json += c;
+    }
+  }
+  return json + "\"";
+}
+
+/*
+ * Calls f(thread) for each of |threads| threads, all at once, and waits for
+ * them to finish. One thread runs on the caller's.
+ */
+template <typename F>
+void run_threads(int threads, F f) {
+  if (threads == 1) {
+    f(0);
+    return;
+  }
+  std::vector<std::thread> pool;
+  for (int t = 0; t < threads; ++t)
+    pool.emplace_back(f, t);
+  for (auto& thread : pool)
+    thread.join();
+}
+
+void zlib_bench(const char* name, const char* data, int length,
+                const zlib_wrapper type, const char* input_kind) {
   /*
    * Chop the data into blocks.
    */
   const int block_size = 1 << 20;
   const int blocks = (length + block_size - 1) / block_size;
+  const int threads = zlib_threads;
 
   std::vector<const char*> input(blocks);
   std::vector<size_t> input_length(blocks);
-  std::vector<std::string> compressed(blocks);
-  std::vector<std::string> output(blocks);
 
   for (int b = 0; b < blocks; ++b) {
     int input_start = b * block_size;
@@ -208,6 +355,14 @@ void zlib_file(const char* name, const zlib_wrapper type) {
     input_length[b] = input_limit - input_start;
   }
 
+  /*
+   * Each thread compresses and uncompresses into its own buffers.
+   */
+  std::vector<std::vector<std::string>> compressed(
+      threads, std::vector<std::string>(blocks));
+  std::vector<std::vector<std::string>> output(
+      threads, std::vector<std::string>(blocks));
+
   /*
    * Run the zlib compress/uncompress loop a few times with |repeats| to
    * process about 10MB of data if the length is small relative to 10MB.
@@ -223,51 +378,82 @@ void zlib_file(const char* name, const zlib_wrapper type) {
     const auto now = [] { return std::chrono::steady_clock::now(); };
 
     // Pre-grow the output buffer so we don't measure string resize time.
-    for (int b = 0; b < blocks; ++b)
-      compressed[b].resize(zlib_estimate_compressed_size(block_size));
+    for (int t = 0; t < threads; ++t)
+      for (int b = 0; b < blocks; ++b)
+        compressed[t][b].resize(zlib_estimate_compressed_size(block_size));
 
     auto start = now();
-    for (int b = 0; b < blocks; ++b)
-      for (int r = 0; r < repeats; ++r)
-        zlib_compress(type, input[b], input_length[b], &compressed[b]);
+    run_threads(threads, [&](int t) {
+      for (int b = 0; b < blocks; ++b)
+        for (int r = 0; r < repeats; ++r)
+          zlib_compress(type, input[b], input_length[b], &compressed[t][b]);
+    });
     ctime[run] = std::chrono::duration<double>(now() - start).count();
 
     // Compress again, resizing compressed, so we don't leave junk at the
     // end of the compressed string that could confuse zlib_uncompress().
-    for (int b = 0; b < blocks; ++b)
-      zlib_compress(type, input[b], input_length[b], &compressed[b], true);
-
-    for (int b = 0; b < blocks; ++b)
-      output[b].resize(input_length[b]);
+    for (int t = 0; t < threads; ++t) {
+      for (int b = 0; b < blocks; ++b) {
+        zlib_compress(type, input[b], input_length[b], &compressed[t][b],
+                      true);
+        output[t][b].resize(input_length[b]);
+      }
+    }
 
     start = now();
-    for (int r = 0; r < repeats; ++r)
-      for (int b = 0; b < blocks; ++b)
-        zlib_uncompress(type, compressed[b], input_length[b], &output[b]);
+    run_threads(threads, [&](int t) {
+      for (int r = 0; r < repeats; ++r)
+        for (int b = 0; b < blocks; ++b)
+          zlib_uncompress(type, compressed[t][b], input_length[b],
+                          &output[t][b]);
+    });
     utime[run] = std::chrono::duration<double>(now() - start).count();
 
-    for (int b = 0; b < blocks; ++b)
-      verify_equal(input[b], input_length[b], &output[b]);
+    for (int t = 0; t < threads; ++t)
+      for (int b = 0; b < blocks; ++b)
+        verify_equal(input[b], input_length[b], &output[t][b]);
   }
 
   /*
-   * Output the median/maximum compress/uncompress rates in MB/s.
+   * Output the median/maximum compress/uncompress rates in MB/s, of all
+   * threads together.
    */
   size_t output_length = 0;
-  for (size_t i = 0; i < compressed.size(); ++i)
-    output_length += compressed[i].size();
+  for (size_t i = 0; i < compressed[0].size(); ++i)
+    output_length += compressed[0][i].size();
 
   std::sort(ctime, ctime + runs);
   std::sort(utime, utime + runs);
 
-  double deflate_rate_med = length * repeats / mega_byte / ctime[runs / 2];
-  double inflate_rate_med = length * repeats / mega_byte / utime[runs / 2];
-  double deflate_rate_max = length * repeats / mega_byte / ctime[0];
-  double inflate_rate_max = length * repeats / mega_byte / utime[0];
+  const double megabytes = double(length) * repeats * threads / mega_byte;
+  double deflate_rate_med = megabytes / ctime[runs / 2];
+  double inflate_rate_med = megabytes / utime[runs / 2];
+  double deflate_rate_max = megabytes / ctime[0];
+  double inflate_rate_max = megabytes / utime[0];
+
+  if (json_output) {
+    printf("{\"file\": %s, \"input\": \"%s\", \"wrapper\": \"%s\", "
+           "\"level\": %d, \"strategy\": \"%s\", \"window_bits\": %d, "
+           "\"threads\": %d, \"block_size\": %d, \"input_bytes\": %d, "
+           "\"output_bytes\": %u, \"compress_mbps_median\": %.1f, "
+           "\"compress_mbps_max\": %.1f, \"uncompress_mbps_median\": %.1f, "
+           "\"uncompress_mbps_max\": %.1f}\n",
+      json_string(name).c_str(), input_kind, zlib_wrapper_name(type),
+      zlib_level, zlib_strategy_json_name(zlib_strategy), zlib_window_bits,
+      threads, block_size, length, static_cast<unsigned>(output_length),
+      deflate_rate_med, deflate_rate_max, inflate_rate_med, inflate_rate_max);
+    return;
+  }
 
-  // type, block size, compression ratio, etc
-  printf("%s: [b %dM] bytes %6d -> %6u %4.1f%%",
-    zlib_wrapper_name(type), block_size / (1 << 20), length,
+  // type, level, strategy, window, threads, block size, compression ratio
+  printf("%s: [l %d] %s", zlib_wrapper_name(type), zlib_level,
+    zlib_strategy_name(zlib_strategy));
+  if (zlib_window_bits != MAX_WBITS)
+    printf("[w %d] ", zlib_window_bits);
+  if (threads != 1)
+    printf("[t %d] ", threads);
+  printf("[b %dM] bytes %6d -> %6u %4.1f%%",
+    block_size / (1 << 20), length,
     static_cast<unsigned>(output_length), output_length * 100.0 / length);
 
   // compress / uncompress median (max) rates
@@ -275,8 +461,158 @@ void zlib_file(const char* name, const zlib_wrapper type) {
     deflate_rate_med, deflate_rate_max, inflate_rate_med, inflate_rate_max);
 }
 
+/*
+ * Uncompresses a PNG's own IDAT stream |runs| times, and outputs the median
+ * and maximum rates in MB/s of filtered row bytes.
+ */
+void png_idat_bench(const char* name, const std::string& idat,
+                    const std::string& rows) {
+  const int mega_byte = 1024 * 1024;
+  const size_t length = rows.size();
+  const int repeats = int((10 * mega_byte + length) / (length + 1));
+  const int runs = 5;
+  double utime[runs];
+  std::string output(length, 0);
+
+  for (int run = 0; run < runs; ++run) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeats; ++r) {
+      uLongf output_size = length;
+      int result = uncompress((Bytef*)string_data(&output), &output_size,
+          (const Bytef*)idat.data(), idat.size());
+      if (result != Z_OK || output_size != length)
+        error_exit("IDAT uncompress failed", result);
+    }
+    utime[run] = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    verify_equal(rows.data(), length, &output);
+  }
+
+  std::sort(utime, utime + runs);
+  const double megabytes = double(length) * repeats / mega_byte;
+  double inflate_rate_med = megabytes / utime[runs / 2];
+  double inflate_rate_max = megabytes / utime[0];
+
+  if (json_output) {
+    printf("{\"file\": %s, \"input\": \"idat\", \"idat_bytes\": %u, "
+           "\"rows_bytes\": %u, \"uncompress_mbps_median\": %.1f, "
+           "\"uncompress_mbps_max\": %.1f}\n",
+      json_string(name).c_str(), static_cast<unsigned>(idat.size()),
+      static_cast<unsigned>(length), inflate_rate_med, inflate_rate_max);
+    return;
+  }
+
+  printf("IDAT: bytes %6u -> %6u rows uncomp %5.1f (%5.1f) MB/s\n",
+    static_cast<unsigned>(idat.size()), static_cast<unsigned>(length),
+    inflate_rate_med, inflate_rate_max);
+}
+
+std::vector<int> zlib_levels;
+std::vector<int> zlib_strategies;
+std::vector<int> zlib_window_bits_list;
+std::vector<int> zlib_thread_counts;
+
+void zlib_file(const char* name, const zlib_wrapper type, bool idat) {
+  /*
+   * Read the file data, or the filtered rows of a PNG file.
+   */
+  const auto file = read_file_data_or_exit(name);
+  const char* data = file.data.get();
+  int length = static_cast<int>(file.size);
+
+  std::string rows;
+  if (idat) {
+    const std::string stream = png_idat_stream_or_exit(name, file);
+    png_idat_rows_or_exit(name, stream, &rows);
+    data = rows.data();
+    length = static_cast<int>(rows.size());
+    if (!json_output)
+      printf("%-40s :\n", name);
+    png_idat_bench(name, stream, rows);
+  } else if (!json_output) {
+    printf("%-40s :\n", name);
+  }
+
+  for (int level : zlib_levels) {
+    for (int strategy : zlib_strategies) {
+      for (int window_bits : zlib_window_bits_list) {
+        for (int threads : zlib_thread_counts) {
+          zlib_level = level;
+          zlib_strategy = strategy;
+          zlib_window_bits = window_bits;
+          zlib_threads = threads;
+          zlib_bench(name, data, length, type, idat ? "idat_rows" : "file");
+        }
+      }
+    }
+  }
+}
+
+/*
+ * Parses a list of values and ranges, like "1,6,9" or "1-9", within
+ * [min, max].
+ */
+bool parse_int_list(const char* arg, int min, int max,
+                    std::vector<int>* values) {
+  values->clear();
+  while (*arg) {
+    char* end;
+    long first = strtol(arg, &end, 10);
+    long last = first;
+    if (end == arg)
+      return false;
+    if (*end == '-') {
+      arg = end + 1;
+      last = strtol(arg, &end, 10);
+      if (end == arg)
+        return false;
+    }
+    if (first < min || last > max || first > last)
+      return false;
+    for (long value = first; value <= last; ++value)
+      values->push_back(int(value));
+    if (*end == ',')
+      ++end;
+    else if (*end)
+      return false;
+    arg = end;
+  }
+  return !values->empty();
+}
+
+bool parse_strategy_list(const char* arg, std::vector<int>* strategies) {
+  strategies->clear();
+  std::string list(arg);
+  size_t start = 0;
+  while (start <= list.size()) {
+    size_t end = list.find(',', start);
+    if (end == std::string::npos)
+      end = list.size();
+    const std::string name = list.substr(start, end - start);
+    if (name == "default")
+      strategies->push_back(Z_DEFAULT_STRATEGY);
+    else if (name == "filtered")
+      strategies->push_back(Z_FILTERED);
+    else if (name == "huffman")
+      strategies->push_back(Z_HUFFMAN_ONLY);
+    else if (name == "rle")
+      strategies->push_back(Z_RLE);
+    else if (name == "fixed")
+      strategies->push_back(Z_FIXED);
+#ifdef Z_QUICK  // This tree's zlib only
+    else if (name == "quick")
+      strategies->push_back(Z_QUICK);
+#endif
+    else
+      return false;
+    start = end + 1;
+  }
+  return true;
+}
+
 int main(int argc, char* argv[]) {
   zlib_wrapper type = kWrapperNONE;
+  bool idat = false;
 
   if (argc > 1) {
     if (!strcmp(argv[1], "zlib"))
@@ -287,12 +623,54 @@ int main(int argc, char* argv[]) {
       type = kWrapperZRAW;
   }
 
-  if ((type != kWrapperNONE) && (argc > 2)) {
-    for (int file = 2; file < argc; ++file)
-      zlib_file(argv[file], type);
+  zlib_levels.assign(1, Z_DEFAULT_COMPRESSION);
+  zlib_strategies.assign(1, Z_DEFAULT_STRATEGY);
+  zlib_window_bits_list.assign(1, MAX_WBITS);
+  zlib_thread_counts.assign(1, 1);
+
+  int file = 2;
+  for (; file < argc && !strncmp(argv[file], "--", 2); ++file) {
+    bool valid = true;
+    if (!strcmp(argv[file], "--compression") && file + 1 < argc)
+      valid = parse_int_list(argv[++file], 0, 9, &zlib_levels);
+    else if (!strcmp(argv[file], "--strategy") && file + 1 < argc)
+      valid = parse_strategy_list(argv[++file], &zlib_strategies);
+    else if (!strcmp(argv[file], "--window") && file + 1 < argc)
+      valid = parse_int_list(argv[++file], 9, MAX_WBITS,
+                             &zlib_window_bits_list);
+    else if (!strcmp(argv[file], "--threads") && file + 1 < argc)
+      valid = parse_int_list(argv[++file], 1, 256, &zlib_thread_counts);
+    else if (!strcmp(argv[file], "--filtered"))
+      zlib_strategies.assign(1, Z_FILTERED);
+    else if (!strcmp(argv[file], "--huffman"))
+      zlib_strategies.assign(1, Z_HUFFMAN_ONLY);
+    else if (!strcmp(argv[file], "--rle"))
+      zlib_strategies.assign(1, Z_RLE);
+    else if (!strcmp(argv[file], "--fixed"))
+      zlib_strategies.assign(1, Z_FIXED);
+#ifdef Z_QUICK  // This tree's zlib only
+    else if (!strcmp(argv[file], "--quick"))
+      zlib_strategies.assign(1, Z_QUICK);
+#endif
+    else if (!strcmp(argv[file], "--idat"))
+      idat = true;
+    else if (!strcmp(argv[file], "--json"))
+      json_output = true;
+    else
+      valid = false;
+    if (!valid)
+      type = kWrapperNONE;
+  }
+
+  if ((type != kWrapperNONE) && (file < argc)) {
+    for (; file < argc; ++file)
+      zlib_file(argv[file], type, idat);
     return 0;
   }
 
-  printf("usage: %s gzip|zlib|raw files...\n", argv[0]);
+  printf("usage: %s gzip|zlib|raw [--compression 0-9] [--window 9-15] "
+         "[--strategy default,filtered,huffman,rle,fixed,quick] "
+         "[--filtered|--huffman|--rle|--fixed|--quick] [--threads N] "
+         "[--idat] [--json] files...\n", argv[0]);
   return 1;
 }
@@ -36,32 +36,56 @@ typedef __m128i z_vec128i_t;
 #endif
 
 /*
- * chunk copy type: the z_vec128i_t type size should be exactly 128-bits
- * and equal to CHUNKCOPY_CHUNK_SIZE.
+ * INFLATE_CHUNK_SIMD_AVX2 builds on INFLATE_CHUNK_SIMD_SSE2 to copy in 256-bit
+ * chunks, for inffast_chunk_avx2.c, whose translation unit alone is built with
+ * AVX2 enabled.
  */
-#define CHUNKCOPY_CHUNK_SIZE sizeof(z_vec128i_t)
+#if defined(INFLATE_CHUNK_SIMD_AVX2)
+#if !defined(INFLATE_CHUNK_SIMD_SSE2)
+#error INFLATE_CHUNK_SIMD_AVX2 requires INFLATE_CHUNK_SIMD_SSE2
+#endif
+#include <immintrin.h>
+typedef __m256i z_vec256i_t;
+typedef z_vec256i_t z_chunk_t;
+#else
+typedef z_vec128i_t z_chunk_t;
+#endif
+
+/*
+ * chunk copy type: the z_chunk_t type size should be exactly 128-bits, or
+ * 256-bits with AVX2, and equal to CHUNKCOPY_CHUNK_SIZE.
+ */
+#define CHUNKCOPY_CHUNK_SIZE sizeof(z_chunk_t)
+
+Z_STATIC_ASSERT(vector_128_or_256_bits_wide,
+                CHUNKCOPY_CHUNK_SIZE == sizeof(int8_t) * 16 ||
+                CHUNKCOPY_CHUNK_SIZE == sizeof(int8_t) * 32);
 
-Z_STATIC_ASSERT(vector_128_bits_wide,
-                CHUNKCOPY_CHUNK_SIZE == sizeof(int8_t) * 16);
+/*
+ * The largest CHUNKCOPY_CHUNK_SIZE of any build of inffast_chunk.c. The
+ * window is padded by this much, since chunk copies out of it may read past
+ * its end whichever build of inflate_fast_chunk_() runs.
+ */
+#define CHUNKCOPY_MAX_CHUNK_SIZE 32
 
 /*
  * Ask the compiler to perform a wide, unaligned load with a machine
- * instruction appropriate for the z_vec128i_t type.
+ * instruction appropriate for the z_chunk_t type.
  */
-static inline z_vec128i_t loadchunk(
+static inline z_chunk_t loadchunk(
     const unsigned char FAR* s) {
-  z_vec128i_t v;
+  z_chunk_t v;
   Z_BUILTIN_MEMCPY(&v, s, sizeof(v));
   return v;
 }
 
 /*
  * Ask the compiler to perform a wide, unaligned store with a machine
- * instruction appropriate for the z_vec128i_t type.
+ * instruction appropriate for the z_chunk_t type.
  */
 static inline void storechunk(
     unsigned char FAR* d,
-    const z_vec128i_t v) {
+    const z_chunk_t v) {
   Z_BUILTIN_MEMCPY(d, &v, sizeof(v));
 }
 
@@ -112,6 +136,11 @@ static inline unsigned char FAR* chunkcopy_core_safe(
   Assert(out + len <= limit, "chunk copy exceeds safety limit");
   if ((limit - out) < (ptrdiff_t)CHUNKCOPY_CHUNK_SIZE) {
     const unsigned char FAR* Z_RESTRICT rfrom = from;
+    if (len & 16) {
+      Z_BUILTIN_MEMCPY(out, rfrom, 16);
+      out += 16;
+      rfrom += 16;
+    }
     if (len & 8) {
       Z_BUILTIN_MEMCPY(out, rfrom, 8);
       out += 8;
@@ -197,13 +226,68 @@ static inline z_vec128i_t v_load8_dup(const void* src) {
 }
 
 /*
- * v_store_128(): store the 128-bit vec in a memory destination (that might
+ * v_store_chunk(): store the 128-bit vec in a memory destination (that might
  * not be 16-byte aligned) void* out.
  */
-static inline void v_store_128(void* out, const z_vec128i_t vec) {
+static inline void v_store_chunk(void* out, const z_chunk_t vec) {
   vst1q_u8(out, vec);
 }
 
+#elif defined(INFLATE_CHUNK_SIMD_AVX2)
+/*
+ * v_load128_dup(): load *src as an unaligned 128-bit vec and duplicate it in
+ * both 128-bit lanes of the 256-bit result.
+ */
+static inline z_chunk_t v_load128_dup(const void* src) {
+  return _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)src));
+}
+
+/*
+ * v_load64_dup(): load *src as an unaligned 64-bit int and duplicate it in
+ * every 64-bit component of the 256-bit result (64-bit int splat).
+ */
+static inline z_chunk_t v_load64_dup(const void* src) {
+  int64_t i64;
+  Z_BUILTIN_MEMCPY(&i64, src, sizeof(i64));
+  return _mm256_set1_epi64x(i64);
+}
+
+/*
+ * v_load32_dup(): load *src as an unaligned 32-bit int and duplicate it in
+ * every 32-bit component of the 256-bit result (32-bit int splat).
+ */
+static inline z_chunk_t v_load32_dup(const void* src) {
+  int32_t i32;
+  Z_BUILTIN_MEMCPY(&i32, src, sizeof(i32));
+  return _mm256_set1_epi32(i32);
+}
+
+/*
+ * v_load16_dup(): load *src as an unaligned 16-bit int and duplicate it in
+ * every 16-bit component of the 256-bit result (16-bit int splat).
+ */
+static inline z_chunk_t v_load16_dup(const void* src) {
+  int16_t i16;
+  Z_BUILTIN_MEMCPY(&i16, src, sizeof(i16));
+  return _mm256_set1_epi16(i16);
+}
+
+/*
+ * v_load8_dup(): load the 8-bit int *src and duplicate it in every 8-bit
+ * component of the 256-bit result (8-bit int splat).
+ */
+static inline z_chunk_t v_load8_dup(const void* src) {
+  return _mm256_set1_epi8(*(const char*)src);
+}
+
+/*
+ * v_store_chunk(): store the 256-bit vec in a memory destination (that might
+ * not be 32-byte aligned) void* out.
+ */
+static inline void v_store_chunk(void* out, const z_chunk_t vec) {
+  _mm256_storeu_si256((__m256i*)out, vec);
+}
+
 #elif defined(INFLATE_CHUNK_SIMD_SSE2)
 /*
  * v_load64_dup(): load *src as an unaligned 64-bit int and duplicate it in
@@ -244,10 +328,10 @@ static inline z_vec128i_t v_load8_dup(const void* src) {
 }
 
 /*
- * v_store_128(): store the 128-bit vec in a memory destination (that might
+ * v_store_chunk(): store the 128-bit vec in a memory destination (that might
  * not be 16-byte aligned) void* out.
  */
-static inline void v_store_128(void* out, const z_vec128i_t vec) {
+static inline void v_store_chunk(void* out, const z_chunk_t vec) {
   _mm_storeu_si128((__m128i*)out, vec);
 }
 #endif
@@ -262,30 +346,30 @@ static inline unsigned char FAR* chunkset_core(
     unsigned char FAR* out,
     unsigned period,
     unsigned len) {
-  z_vec128i_t v;
+  z_chunk_t v;
   const int bump = ((len - 1) % sizeof(v)) + 1;
 
   switch (period) {
     case 1:
       v = v_load8_dup(out - 1);
-      v_store_128(out, v);
+      v_store_chunk(out, v);
       out += bump;
       len -= bump;
       while (len > 0) {
-        v_store_128(out, v);
+        v_store_chunk(out, v);
         out += sizeof(v);
         len -= sizeof(v);
       }
       return out;
     case 2:
       v = v_load16_dup(out - 2);
-      v_store_128(out, v);
+      v_store_chunk(out, v);
       out += bump;
       len -= bump;
       if (len > 0) {
         v = v_load16_dup(out - 2);
         do {
-          v_store_128(out, v);
+          v_store_chunk(out, v);
           out += sizeof(v);
           len -= sizeof(v);
         } while (len > 0);
@@ -293,13 +377,13 @@ static inline unsigned char FAR* chunkset_core(
       return out;
     case 4:
       v = v_load32_dup(out - 4);
-      v_store_128(out, v);
+      v_store_chunk(out, v);
       out += bump;
       len -= bump;
       if (len > 0) {
         v = v_load32_dup(out - 4);
         do {
-          v_store_128(out, v);
+          v_store_chunk(out, v);
           out += sizeof(v);
           len -= sizeof(v);
         } while (len > 0);
@@ -307,18 +391,34 @@ static inline unsigned char FAR* chunkset_core(
       return out;
     case 8:
       v = v_load64_dup(out - 8);
-      v_store_128(out, v);
+      v_store_chunk(out, v);
       out += bump;
       len -= bump;
       if (len > 0) {
         v = v_load64_dup(out - 8);
         do {
-          v_store_128(out, v);
+          v_store_chunk(out, v);
           out += sizeof(v);
           len -= sizeof(v);
         } while (len > 0);
       }
       return out;
+#if defined(INFLATE_CHUNK_SIMD_AVX2)
+    case 16:
+      v = v_load128_dup(out - 16);
+      v_store_chunk(out, v);
+      out += bump;
+      len -= bump;
+      if (len > 0) {
+        v = v_load128_dup(out - 16);
+        do {
+          v_store_chunk(out, v);
+          out += sizeof(v);
+          len -= sizeof(v);
+        } while (len > 0);
+      }
+      return out;
+#endif
   }
   out = chunkunroll_relaxed(out, &period, &len);
   return chunkcopy_core(out, out - period, len);
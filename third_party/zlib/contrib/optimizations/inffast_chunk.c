@@ -32,7 +32,8 @@
         strm->next_out[0..strm->avail_out] does not overlap with
               strm->next_in[0..strm->avail_in]
         strm->state->window is allocated with an additional
-              CHUNKCOPY_CHUNK_SIZE-1 bytes of padding beyond strm->state->wsize
+              CHUNKCOPY_MAX_CHUNK_SIZE bytes of padding beyond
+              strm->state->wsize
 
    On return, state->mode is one of:
 
@@ -71,7 +72,11 @@
       requires strm->avail_out >= 258 for each loop to avoid checking for
       available output space while decoding.
  */
+#if defined(INFLATE_CHUNK_SIMD_AVX2)
+void ZLIB_INTERNAL inflate_fast_chunk_avx2_(strm, start)
+#else
 void ZLIB_INTERNAL inflate_fast_chunk_(strm, start)
+#endif
 z_streamp strm;
 unsigned start;         /* inflate()'s starting value for strm->avail_out */
 {
@@ -16,11 +16,24 @@
    length/distance code pair (15 bits for the length code, 5 bits for length
    extra, 15 bits for the distance code, 13 bits for distance extra) requires
    reading up to 48 input bits (6 bytes). The wide input data reading option
-   requires a little endian machine, and reads 64 input bits (8 bytes).
+   requires a little endian machine, and reads 64 input bits (8 bytes). It is
+   the default on x86_64.
 */
+#if !defined(INFLATE_CHUNK_READ_64LE) && \
+    (defined(__x86_64__) || defined(_M_X64))
+#define INFLATE_CHUNK_READ_64LE
+#endif
+
 #ifdef INFLATE_CHUNK_READ_64LE
 #undef INFLATE_FAST_MIN_INPUT
 #define INFLATE_FAST_MIN_INPUT 8
 #endif
 
 void ZLIB_INTERNAL inflate_fast_chunk_ OF((z_streamp strm, unsigned start));
+
+#if defined(INFLATE_CHUNK_SIMD_SSE2)
+/* inffast_chunk.c built with 32-byte AVX2 chunk copies, for when
+   x86_cpu_enable_avx2 is set. */
+void ZLIB_INTERNAL inflate_fast_chunk_avx2_ OF((z_streamp strm,
+                                                unsigned start));
+#endif
@@ -0,0 +1,13 @@
+/* inffast_chunk_avx2.c -- fast decoding with AVX2 chunk copies
+ * Copyright 2026 The Chromium Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the Chromium source repository LICENSE file.
+ */
+
+/*
+   Builds inffast_chunk.c as inflate_fast_chunk_avx2_(), which copies matches
+   in 32-byte chunks. This file alone is compiled with AVX2 enabled, and
+   inflate() only calls it when x86_cpu_enable_avx2 is set.
+ */
+#define INFLATE_CHUNK_SIMD_AVX2
+#include "contrib/optimizations/inffast_chunk.c"
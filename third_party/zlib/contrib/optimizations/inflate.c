@@ -85,6 +85,9 @@
 #include "inflate.h"
 #include "contrib/optimizations/inffast_chunk.h"
 #include "contrib/optimizations/chunkcopy.h"
+#if defined(INFLATE_CHUNK_SIMD_SSE2)
+#include "x86.h"
+#endif
 
 #ifdef MAKEFIXED
 #  ifndef BUILDFIXED
@@ -202,6 +205,10 @@ int stream_size;
     int ret;
     struct inflate_state FAR *state;
 
+#if defined(INFLATE_CHUNK_SIMD_SSE2)
+    x86_check_features();
+#endif
+
     if (version == Z_NULL || version[0] != ZLIB_VERSION[0] ||
         stream_size != (int)(sizeof(z_stream)))
         return Z_VERSION_ERROR;
@@ -409,7 +416,7 @@ unsigned copy;
     if (state->window == Z_NULL) {
         unsigned wsize = 1U << state->wbits;
         state->window = (unsigned char FAR *)
-                        ZALLOC(strm, wsize + CHUNKCOPY_CHUNK_SIZE,
+                        ZALLOC(strm, wsize + CHUNKCOPY_MAX_CHUNK_SIZE,
                                sizeof(unsigned char));
         if (state->window == Z_NULL) return 1;
 #ifdef INFLATE_CLEAR_UNUSED_UNDEFINED
@@ -419,7 +426,7 @@ unsigned copy;
            and is subsequently either overwritten or left deliberately
            undefined at the end of decode; so there's really no point.
          */
-        zmemzero(state->window + wsize, CHUNKCOPY_CHUNK_SIZE);
+        zmemzero(state->window + wsize, CHUNKCOPY_MAX_CHUNK_SIZE);
 #endif
     }
 
@@ -1027,11 +1034,14 @@ int flush;
             }
 
             /* build code tables -- note: do not change the lenbits or distbits
-               values here (9 and 6) without reading the comments in inftrees.h
-               concerning the ENOUGH constants, which depend on those values */
+               values here (10 and 8) without reading the comments in inftrees.h
+               concerning the ENOUGH constants, which depend on those values.
+               Root tables wider than inflate.c's 9 and 6 bits resolve more
+               codes in a single lookup: every literal/length code of up to 10
+               bits, and every distance code of up to 8 bits */
             state->next = state->codes;
             state->lencode = (const code FAR *)(state->next);
-            state->lenbits = 9;
+            state->lenbits = 10;
             ret = inflate_table(LENS, state->lens, state->nlen, &(state->next),
                                 &(state->lenbits), state->work);
             if (ret) {
@@ -1040,7 +1050,7 @@ int flush;
                 break;
             }
             state->distcode = (const code FAR *)(state->next);
-            state->distbits = 6;
+            state->distbits = 8;
             ret = inflate_table(DISTS, state->lens + state->nlen, state->ndist,
                             &(state->next), &(state->distbits), state->work);
             if (ret) {
@@ -1057,6 +1067,11 @@ int flush;
             if (have >= INFLATE_FAST_MIN_INPUT &&
                 left >= INFLATE_FAST_MIN_OUTPUT) {
                 RESTORE();
+#if defined(INFLATE_CHUNK_SIMD_SSE2)
+                if (x86_cpu_enable_avx2)
+                    inflate_fast_chunk_avx2_(strm, out);
+                else
+#endif
                 inflate_fast_chunk_(strm, out);
                 LOAD();
                 if (state->mode == TYPE)
@@ -1268,8 +1283,8 @@ int flush;
     * mislead clients relying on undefined behavior (i.e. assuming
     * that the data is over when the buffer has a zero/null value).
     */
-   if (left >= CHUNKCOPY_CHUNK_SIZE)
-      memset(put, 0x55, CHUNKCOPY_CHUNK_SIZE);
+   if (left >= CHUNKCOPY_MAX_CHUNK_SIZE)
+      memset(put, 0x55, CHUNKCOPY_MAX_CHUNK_SIZE);
    else
       memset(put, 0x55, left);
 
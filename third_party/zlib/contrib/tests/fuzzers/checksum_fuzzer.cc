@@ -0,0 +1,74 @@
+// Copyright 2026 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <cassert>
+
+#include "third_party/zlib/zlib.h"
+
+// Adler-32 a byte at a time, straight from RFC 1950.
+static uLong ReferenceAdler32(uLong adler, const uint8_t* data, size_t size) {
+  uLong s1 = adler & 0xffff;
+  uLong s2 = adler >> 16;
+  for (size_t i = 0; i < size; ++i) {
+    s1 = (s1 + data[i]) % 65521;
+    s2 = (s2 + s1) % 65521;
+  }
+  return s1 | (s2 << 16);
+}
+
+// CRC-32 a bit at a time, in the reflected form of RFC 1952.
+static uLong ReferenceCrc32(uLong crc, const uint8_t* data, size_t size) {
+  crc = ~crc & 0xffffffff;
+  for (size_t i = 0; i < size; ++i) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; ++bit)
+      crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+  }
+  return ~crc & 0xffffffff;
+}
+
+// Entry point for LibFuzzer. Checks adler32() and crc32(), whichever SIMD
+// variants the CPU selects, against the references over the whole input,
+// over the input split in two at a point taken from its first bytes, and
+// from a misaligned start.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  // Selects the SIMD variants, as zlib users are expected to.
+  adler32(0, Z_NULL, 0);
+  crc32(0, Z_NULL, 0);
+
+  const uLong expected = ReferenceAdler32(1, data, size);
+  assert(adler32_z(1, data, size) == expected);
+
+  size_t split = 0;
+  if (size >= 2)
+    split = ((data[0] << 8) | data[1]) % (size + 1);
+  const uLong first = adler32_z(1, data, split);
+  assert(first == ReferenceAdler32(1, data, split));
+  assert(adler32_z(first, data + split, size - split) == expected);
+  assert(adler32_combine(first, ReferenceAdler32(1, data + split,
+                                                 size - split),
+                         static_cast<z_off_t>(size - split)) == expected);
+
+  // The largest valid sums as a starting value push s1 and s2 past the
+  // modulus at once.
+  const uLong largest = (65520UL << 16) | 65520;
+  if (size > 1) {
+    assert(adler32_z(largest, data + 1, size - 1) ==
+           ReferenceAdler32(largest, data + 1, size - 1));
+  }
+
+  const uLong expected_crc = ReferenceCrc32(0, data, size);
+  assert(crc32_z(0, data, size) == expected_crc);
+  const uLong first_crc = crc32_z(0, data, split);
+  assert(first_crc == ReferenceCrc32(0, data, split));
+  assert(crc32_z(first_crc, data + split, size - split) == expected_crc);
+  if (size > 1) {
+    assert(crc32_z(0xffffffff, data + 1, size - 1) ==
+           ReferenceCrc32(0xffffffff, data + 1, size - 1));
+  }
+  return 0;
+}
@@ -230,6 +230,20 @@ unsigned long ZEXPORT crc32_z(crc, buf, len)
         return 0UL;
     }
 
+#if defined(CRC32_SIMD_VPCLMUL)
+    if (x86_cpu_enable_vpclmul && len >= Z_CRC32_VPCLMUL_THRESHOLD) {
+        /* crc32 64-byte chunks, leaving the sse4.2 code at least 64 bytes */
+        z_size_t chunk_size = (len - Z_CRC32_SSE42_MINIMUM_LENGTH) &
+                              ~Z_CRC32_VPCLMUL_CHUNKSIZE_MASK;
+        if (x86_cpu_enable_avx512)
+            crc = ~crc32_avx512_simd_(buf, chunk_size, ~(uint32_t)crc);
+        else
+            crc = ~crc32_avx2_simd_(buf, chunk_size, ~(uint32_t)crc);
+        len -= chunk_size;
+        buf += chunk_size;
+    }
+#endif /* CRC32_SIMD_VPCLMUL */
+
     if (x86_cpu_enable_simd && len >= Z_CRC32_SSE42_MINIMUM_LENGTH) {
         /* crc32 16-byte chunks */
         z_size_t chunk_size = len & ~Z_CRC32_SSE42_CHUNKSIZE_MASK;
@@ -26,6 +26,27 @@ uint32_t ZLIB_INTERNAL crc32_sse42_simd_(
 #define Z_CRC32_SSE42_MINIMUM_LENGTH 64
 #define Z_CRC32_SSE42_CHUNKSIZE_MASK 15
 
+/*
+ * crc32_avx2_simd_() and crc32_avx512_simd_(): compute the crc32 of the
+ * buffer with VPCLMULQDQ on 256 or 512-bit registers, where the buffer
+ * length must be at least 256, and a multiple of 64. They need
+ * x86_cpu_enable_vpclmul, and the AVX-512 one x86_cpu_enable_avx512 too.
+ */
+uint32_t ZLIB_INTERNAL crc32_avx2_simd_(
+    const unsigned char *buf,
+    z_size_t len,
+    uint32_t crc);
+
+uint32_t ZLIB_INTERNAL crc32_avx512_simd_(
+    const unsigned char *buf,
+    z_size_t len,
+    uint32_t crc);
+
+#define Z_CRC32_VPCLMUL_MINIMUM_LENGTH 256
+#define Z_CRC32_VPCLMUL_CHUNKSIZE_MASK 63
+/* Below this, the SSE4.2 code is faster, given the wider fold's setup. */
+#define Z_CRC32_VPCLMUL_THRESHOLD 768
+
 /*
  * CRC32 checksums using ARMv8-a crypto instructions.
  */
@@ -0,0 +1,87 @@
+/* crc32_simd_avx2.c
+ *
+ * Copyright 2026 The Chromium Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the Chromium source repository LICENSE file.
+ */
+
+#include "crc32_simd.h"
+
+#if defined(CRC32_SIMD_VPCLMUL)
+
+/*
+ * crc32_avx2_simd_(): crc32_avx512_simd_() on four 256-bit registers, 128
+ * bytes a step, for CPUs with VPCLMULQDQ but not AVX-512. The two registers
+ * left at the end, 64 bytes, go to crc32_sse42_simd_(). See
+ * crc32_simd_avx512.c for the constants.
+ */
+
+#include <immintrin.h>
+
+uint32_t ZLIB_INTERNAL crc32_avx2_simd_(  /* AVX2+VPCLMULQDQ */
+    const unsigned char *buf,
+    z_size_t len,
+    uint32_t crc)
+{
+    /* D = 1024, four registers ahead, and D = 512, two registers ahead. */
+    static const uint64_t zalign(16) k1024[] = { 0x01e88ef372, 0x014a7fe880 };
+    static const uint64_t zalign(16) k512[] = { 0x0154442bd4, 0x01c6e41596 };
+
+    unsigned char zalign(32) folded[64];
+    __m256i x0, x1, x2, x3, k;
+
+    x0 = _mm256_loadu_si256((const __m256i *)(buf + 0x00));
+    x1 = _mm256_loadu_si256((const __m256i *)(buf + 0x20));
+    x2 = _mm256_loadu_si256((const __m256i *)(buf + 0x40));
+    x3 = _mm256_loadu_si256((const __m256i *)(buf + 0x60));
+
+    x0 = _mm256_xor_si256(x0, _mm256_zextsi128_si256(_mm_cvtsi32_si128(crc)));
+
+    buf += 128;
+    len -= 128;
+
+#define FOLD(x, k, y) \
+    _mm256_xor_si256(_mm256_xor_si256(_mm256_clmulepi64_epi128(x, k, 0x00), \
+                                      _mm256_clmulepi64_epi128(x, k, 0x11)), \
+                     y)
+
+    /*
+     * Parallel fold blocks of 128, if any.
+     */
+    k = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)k1024));
+    while (len >= 128)
+    {
+        x0 = FOLD(x0, k, _mm256_loadu_si256((const __m256i *)(buf + 0x00)));
+        x1 = FOLD(x1, k, _mm256_loadu_si256((const __m256i *)(buf + 0x20)));
+        x2 = FOLD(x2, k, _mm256_loadu_si256((const __m256i *)(buf + 0x40)));
+        x3 = FOLD(x3, k, _mm256_loadu_si256((const __m256i *)(buf + 0x60)));
+
+        buf += 128;
+        len -= 128;
+    }
+
+    /*
+     * Fold into 512 bits, two registers, then single fold blocks of 64, if
+     * any.
+     */
+    k = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)k512));
+    x2 = FOLD(x0, k, x2);
+    x3 = FOLD(x1, k, x3);
+
+    while (len >= 64)
+    {
+        x2 = FOLD(x2, k, _mm256_loadu_si256((const __m256i *)(buf + 0x00)));
+        x3 = FOLD(x3, k, _mm256_loadu_si256((const __m256i *)(buf + 0x20)));
+
+        buf += 64;
+        len -= 64;
+    }
+
+#undef FOLD
+
+    _mm256_store_si256((__m256i *)(folded + 0x00), x2);
+    _mm256_store_si256((__m256i *)(folded + 0x20), x3);
+    return crc32_sse42_simd_(folded, sizeof(folded), 0);
+}
+
+#endif  /* CRC32_SIMD_VPCLMUL */
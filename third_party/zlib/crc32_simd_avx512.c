@@ -0,0 +1,89 @@
+/* crc32_simd_avx512.c
+ *
+ * Copyright 2026 The Chromium Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the Chromium source repository LICENSE file.
+ */
+
+#include "crc32_simd.h"
+
+#if defined(CRC32_SIMD_VPCLMUL)
+
+/*
+ * crc32_avx512_simd_(): the folding of crc32_sse42_simd_() on four 512-bit
+ * registers, 256 bytes a step, with VPCLMULQDQ multiplying all four 128-bit
+ * lanes of each at once. The 64 bytes left folded at the end hold the same
+ * remainder, modulo the CRC polynomial, as everything before them, so
+ * crc32_sse42_simd_() of those bytes alone finishes the job.
+ *
+ * Fold constants for a distance of D bits, in the bit-reflected domain of
+ * the paper cited in crc32_simd.c, are x^(D+32) and x^(D-32) mod P(x).
+ */
+
+#include <immintrin.h>
+
+uint32_t ZLIB_INTERNAL crc32_avx512_simd_(  /* AVX512+VPCLMULQDQ */
+    const unsigned char *buf,
+    z_size_t len,
+    uint32_t crc)
+{
+    /* D = 2048, four registers ahead, and D = 512, one register ahead. */
+    static const uint64_t zalign(16) k2048[] = { 0x011542778a, 0x01322d1430 };
+    static const uint64_t zalign(16) k512[] = { 0x0154442bd4, 0x01c6e41596 };
+
+    unsigned char zalign(64) folded[64];
+    __m512i x0, x1, x2, x3, k;
+
+    x0 = _mm512_loadu_si512((const void *)(buf + 0x00));
+    x1 = _mm512_loadu_si512((const void *)(buf + 0x40));
+    x2 = _mm512_loadu_si512((const void *)(buf + 0x80));
+    x3 = _mm512_loadu_si512((const void *)(buf + 0xc0));
+
+    x0 = _mm512_xor_si512(x0, _mm512_zextsi128_si512(_mm_cvtsi32_si128(crc)));
+
+    buf += 256;
+    len -= 256;
+
+#define FOLD(x, k, y) \
+    _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x, k, 0x00), \
+                              _mm512_clmulepi64_epi128(x, k, 0x11), \
+                              y, 0x96)
+
+    /*
+     * Parallel fold blocks of 256, if any.
+     */
+    k = _mm512_broadcast_i32x4(_mm_load_si128((const __m128i *)k2048));
+    while (len >= 256)
+    {
+        x0 = FOLD(x0, k, _mm512_loadu_si512((const void *)(buf + 0x00)));
+        x1 = FOLD(x1, k, _mm512_loadu_si512((const void *)(buf + 0x40)));
+        x2 = FOLD(x2, k, _mm512_loadu_si512((const void *)(buf + 0x80)));
+        x3 = FOLD(x3, k, _mm512_loadu_si512((const void *)(buf + 0xc0)));
+
+        buf += 256;
+        len -= 256;
+    }
+
+    /*
+     * Fold into 512 bits, then single fold blocks of 64, if any.
+     */
+    k = _mm512_broadcast_i32x4(_mm_load_si128((const __m128i *)k512));
+    x1 = FOLD(x0, k, x1);
+    x2 = FOLD(x1, k, x2);
+    x3 = FOLD(x2, k, x3);
+
+    while (len >= 64)
+    {
+        x3 = FOLD(x3, k, _mm512_loadu_si512((const void *)buf));
+
+        buf += 64;
+        len -= 64;
+    }
+
+#undef FOLD
+
+    _mm512_store_si512((void *)folded, x3);
+    return crc32_sse42_simd_(folded, sizeof(folded), 0);
+}
+
+#endif  /* CRC32_SIMD_VPCLMUL */
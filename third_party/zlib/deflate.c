@@ -84,6 +84,7 @@ local block_state deflate_slow   OF((deflate_state *s, int flush));
 #endif
 local block_state deflate_rle    OF((deflate_state *s, int flush));
 local block_state deflate_huff   OF((deflate_state *s, int flush));
+local block_state deflate_quick  OF((deflate_state *s, int flush));
 local void lm_init        OF((deflate_state *s));
 local void putShortMSB    OF((deflate_state *s, uInt b));
 local void flush_pending  OF((z_streamp strm));
@@ -325,7 +326,7 @@ int ZEXPORT deflateInit2_(strm, level, method, windowBits, memLevel, strategy,
 #endif
     if (memLevel < 1 || memLevel > MAX_MEM_LEVEL || method != Z_DEFLATED ||
         windowBits < 8 || windowBits > 15 || level < 0 || level > 9 ||
-        strategy < 0 || strategy > Z_FIXED || (windowBits == 8 && wrap != 1)) {
+        strategy < 0 || strategy > Z_QUICK || (windowBits == 8 && wrap != 1)) {
         return Z_STREAM_ERROR;
     }
     if (windowBits == 8) windowBits = 9;  /* until 256-byte window bug fixed */
@@ -612,7 +613,7 @@ int ZEXPORT deflateParams(strm, level, strategy)
 #else
     if (level == Z_DEFAULT_COMPRESSION) level = 6;
 #endif
-    if (level < 0 || level > 9 || strategy < 0 || strategy > Z_FIXED) {
+    if (level < 0 || level > 9 || strategy < 0 || strategy > Z_QUICK) {
         return Z_STREAM_ERROR;
     }
     func = configuration_table[s->level].func;
@@ -1031,6 +1032,7 @@ int ZEXPORT deflate (strm, flush)
         bstate = s->level == 0 ? deflate_stored(s, flush) :
                  s->strategy == Z_HUFFMAN_ONLY ? deflate_huff(s, flush) :
                  s->strategy == Z_RLE ? deflate_rle(s, flush) :
+                 s->strategy == Z_QUICK ? deflate_quick(s, flush) :
                  (*(configuration_table[s->level].func))(s, flush);
 
         if (bstate == finish_started || bstate == finish_done) {
@@ -1284,6 +1286,11 @@ local uInt longest_match(s, cur_match)
     Posf *prev = s->prev;
     uInt wmask = s->w_mask;
 
+    if (x86_cpu_enable_avx2)
+        return longest_match_avx2(s, cur_match);
+    if (x86_cpu_enable_simd)
+        return longest_match_sse(s, cur_match);
+
 #ifdef UNALIGNED_OK
     /* Compare two bytes at a time. Note: this is not always beneficial.
      * Try with and without -DUNALIGNED_OK to check.
@@ -2207,6 +2214,100 @@ local block_state deflate_huff(s, flush)
     return block_done;
 }
 
+/* ===========================================================================
+ * For Z_QUICK, look up each position once in the hash table, with no hash
+ * chains and no lazy evaluation, and only insert the strings that start a
+ * literal or a match.  With SSE4.2 the hash is the CRC-32 of the next four
+ * bytes (three from level 6 up), computed by insert_string_sse().  Blocks
+ * are coded as usual: on filtered image data the fixed codes cost far more in
+ * size than building the trees costs in time.
+ */
+local INLINE Pos quick_insert_string(deflate_state *const s, const Pos str)
+{
+    if (x86_cpu_enable_simd)
+        return insert_string_sse(s, str);
+    /* insert_string_c() rolls ins_h along; positions are skipped here */
+    s->ins_h = s->window[str];
+    UPDATE_HASH(s, s->ins_h, s->window[str + 1]);
+    return insert_string_c(s, str);
+}
+
+/* Length of the match between scan and match, up to max, comparing eight
+ * bytes at a time.  Both may be read up to max bytes ahead.
+ */
+local INLINE uInt quick_match_length(const Bytef *scan, const Bytef *match,
+                                     uInt max)
+{
+    uInt len = 0;
+    while (len + 8 <= max && zmemcmp(scan + len, match + len, 8) == 0)
+        len += 8;
+    while (len < max && scan[len] == match[len])
+        len++;
+    return len;
+}
+
+local block_state deflate_quick(s, flush)
+    deflate_state *s;
+    int flush;
+{
+    IPos hash_head;         /* position at the same hash, or NIL */
+    uInt max_len;           /* longest match allowed here */
+    int bflush;             /* set if current block must be flushed */
+
+    for (;;) {
+        /* Make sure that we always have enough lookahead, except
+         * at the end of the input file. We need MAX_MATCH bytes
+         * for the next match, plus MIN_MATCH bytes to insert the
+         * string following the next match.
+         */
+        if (s->lookahead < MIN_LOOKAHEAD) {
+            fill_window(s);
+            if (s->lookahead < MIN_LOOKAHEAD && flush == Z_NO_FLUSH) {
+                return need_more;
+            }
+            if (s->lookahead == 0) break; /* flush the current block */
+        }
+
+        s->match_length = 0;
+        if (s->lookahead >= MIN_MATCH) {
+            hash_head = quick_insert_string(s, s->strstart);
+            if (hash_head != NIL && hash_head < s->strstart &&
+                s->strstart - hash_head <= MAX_DIST(s)) {
+                max_len = s->lookahead < MAX_MATCH ? s->lookahead : MAX_MATCH;
+                s->match_length = quick_match_length(
+                    s->window + s->strstart, s->window + hash_head, max_len);
+                s->match_start = hash_head;
+            }
+        }
+
+        if (s->match_length >= MIN_MATCH) {
+            check_match(s, s->strstart, s->match_start, s->match_length);
+
+            _tr_tally_dist(s, s->strstart - s->match_start,
+                           s->match_length - MIN_MATCH, bflush);
+
+            s->lookahead -= s->match_length;
+            s->strstart += s->match_length;
+            s->match_length = 0;
+        } else {
+            /* No match, output a literal byte */
+            Tracevv((stderr,"%c", s->window[s->strstart]));
+            _tr_tally_lit (s, s->window[s->strstart], bflush);
+            s->lookahead--;
+            s->strstart++;
+        }
+        if (bflush) FLUSH_BLOCK(s, 0);
+    }
+    s->insert = s->strstart < MIN_MATCH-1 ? s->strstart : MIN_MATCH-1;
+    if (flush == Z_FINISH) {
+        FLUSH_BLOCK(s, 1);
+        return finish_done;
+    }
+    if (s->last_lit)
+        FLUSH_BLOCK(s, 0);
+    return block_done;
+}
+
 /* Safe to inline this as GCC/clang will use inline asm and Visual Studio will
  * use intrinsic without extra params
  */
@@ -356,4 +356,7 @@ unsigned ZLIB_INTERNAL crc_fold_512to32(deflate_state* const s);
 
 void ZLIB_INTERNAL fill_window_sse(deflate_state* s);
 
+uInt ZLIB_INTERNAL longest_match_sse(deflate_state* s, IPos cur_match);
+uInt ZLIB_INTERNAL longest_match_avx2(deflate_state* s, IPos cur_match);
+
 #endif /* DEFLATE_H */
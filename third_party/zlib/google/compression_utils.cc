@@ -8,11 +8,16 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <algorithm>
+#include <atomic>
 #include <vector>
 
 #include "base/bit_cast.h"
 #include "base/logging.h"
+#include "base/macros.h"
 #include "base/sys_byteorder.h"
+#include "base/sys_info.h"
+#include "base/threading/simple_thread.h"
 
 #if defined(USE_SYSTEM_ZLIB)
 #include <zlib.h>
@@ -22,6 +27,9 @@
 
 namespace {
 
+// The size of GzipStreamUncompressor's output buffer.
+const size_t kStreamOutputBufferSize = 64 * 1024;
+
 // The difference in bytes between a zlib header and a gzip header.
 const size_t kGzipZlibHeaderDifferenceBytes = 16;
 
@@ -80,6 +88,168 @@ int GzipCompressHelper(Bytef* dest,
   return err;
 }
 
+// GzipCompressParallel() compresses inputs of at least this many bytes in
+// blocks of kParallelBlockSize bytes, on up to kMaxParallelThreads threads.
+const size_t kParallelMinimumSize = 1024 * 1024;
+const size_t kParallelBlockSize = 256 * 1024;
+const int kMaxParallelThreads = 8;
+
+// Each block is primed with this much of the input before it, deflate's
+// whole window, so that its matches reach back as in a single stream.
+const size_t kParallelDictionarySize = 32 * 1024;
+
+// A block ends with a sync flush, which adds an empty stored block: 3 bits
+// of header, up to 7 bits of padding and 4 bytes of lengths.
+const size_t kSyncFlushBytes = 6;
+
+// The gzip header deflate() writes for an all-zero gz_header at the default
+// level: no name or time, and 0 for the OS.
+const Bytef kGzipHeader[] = {0x1f, 0x8b, 0x08, 0, 0, 0, 0, 0, 0, 0};
+
+// CRC-32 and uncompressed size, each 4 bytes.
+const size_t kGzipTrailerSize = 8;
+
+uLong ParallelBlockCount(uLong input_size) {
+  return (input_size + kParallelBlockSize - 1) / kParallelBlockSize;
+}
+
+uLong ParallelBlockBound(uLong block_size) {
+  return compressBound(block_size) + kSyncFlushBytes;
+}
+
+// One block of a parallel compression, and its result.
+struct ParallelBlock {
+  const Bytef* input;
+  uLong input_size;
+  std::vector<Bytef> output;
+  uLong crc;
+  int error;
+};
+
+// Compresses blocks, claiming them in order, until none are left. Several
+// threads run the same ParallelBlockCompressor.
+class ParallelBlockCompressor : public base::DelegateSimpleThread::Delegate {
+ public:
+  ParallelBlockCompressor(const Bytef* input,
+                          std::vector<ParallelBlock>* blocks)
+      : input_(input), blocks_(blocks), next_block_(0) {}
+
+  // base::DelegateSimpleThread::Delegate:
+  void Run() override {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    int err = deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                           -MAX_WBITS, kZlibMemoryLevel, Z_DEFAULT_STRATEGY);
+
+    for (size_t i = next_block_++; i < blocks_->size(); i = next_block_++) {
+      ParallelBlock& block = (*blocks_)[i];
+      block.error = err == Z_OK ? Compress(&stream, &block, i) : err;
+    }
+
+    if (err == Z_OK)
+      deflateEnd(&stream);
+  }
+
+ private:
+  int Compress(z_stream* stream, ParallelBlock* block, size_t index) {
+    const bool last = index + 1 == blocks_->size();
+    block->crc = crc32(crc32(0L, Z_NULL, 0), block->input,
+                       static_cast<uInt>(block->input_size));
+    block->output.resize(ParallelBlockBound(block->input_size));
+
+    int err = deflateReset(stream);
+    if (err != Z_OK)
+      return err;
+
+    const size_t offset = block->input - input_;
+    if (offset) {
+      const size_t dictionary_size = std::min(offset, kParallelDictionarySize);
+      err = deflateSetDictionary(stream, block->input - dictionary_size,
+                                 static_cast<uInt>(dictionary_size));
+      if (err != Z_OK)
+        return err;
+    }
+
+    stream->next_in = const_cast<Bytef*>(block->input);
+    stream->avail_in = static_cast<uInt>(block->input_size);
+    stream->next_out = block->output.data();
+    stream->avail_out = static_cast<uInt>(block->output.size());
+
+    // Every block but the last ends byte-aligned and not final, so the next
+    // one's deflate data can follow it. A flush that fills the output may
+    // not be complete.
+    err = deflate(stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    if (err == Z_OK && (last || !stream->avail_out))
+      err = Z_BUF_ERROR;
+    if (err != Z_OK && err != Z_STREAM_END)
+      return err;
+
+    block->output.resize(block->output.size() - stream->avail_out);
+    return Z_OK;
+  }
+
+  const Bytef* const input_;
+  std::vector<ParallelBlock>* const blocks_;
+  std::atomic<size_t> next_block_;
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelBlockCompressor);
+};
+
+// Like GzipCompressHelper(), for inputs of kParallelMinimumSize or more.
+int GzipCompressParallelHelper(Bytef* dest,
+                               uLongf* dest_length,
+                               const Bytef* source,
+                               uLong source_length) {
+  std::vector<ParallelBlock> blocks(ParallelBlockCount(source_length));
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    const uLong offset = i * kParallelBlockSize;
+    blocks[i].input = source + offset;
+    blocks[i].input_size =
+        std::min<uLong>(kParallelBlockSize, source_length - offset);
+  }
+
+  // The calling thread compresses blocks too.
+  ParallelBlockCompressor compressor(source, &blocks);
+  const int threads = std::min<int>(
+      {base::SysInfo::NumberOfProcessors(), kMaxParallelThreads,
+       static_cast<int>(blocks.size())});
+  if (threads > 1) {
+    base::DelegateSimpleThreadPool pool("GzipCompress", threads - 1);
+    pool.Start();
+    pool.AddWork(&compressor, threads - 1);
+    compressor.Run();
+    pool.JoinAll();
+  } else {
+    compressor.Run();
+  }
+
+  uLong size = sizeof(kGzipHeader) + kGzipTrailerSize;
+  uLong crc = crc32(0L, Z_NULL, 0);
+  for (const ParallelBlock& block : blocks) {
+    if (block.error != Z_OK)
+      return block.error;
+    size += block.output.size();
+    crc = crc32_combine(crc, block.crc, block.input_size);
+  }
+  if (size > *dest_length)
+    return Z_BUF_ERROR;
+
+  Bytef* out = dest;
+  memcpy(out, kGzipHeader, sizeof(kGzipHeader));
+  out += sizeof(kGzipHeader);
+  for (const ParallelBlock& block : blocks) {
+    memcpy(out, block.output.data(), block.output.size());
+    out += block.output.size();
+  }
+  const uint32_t trailer[2] = {
+      base::ByteSwapToLE32(static_cast<uint32_t>(crc)),
+      base::ByteSwapToLE32(static_cast<uint32_t>(source_length))};
+  memcpy(out, trailer, sizeof(trailer));
+
+  *dest_length = size;
+  return Z_OK;
+}
+
 // This code is taken almost verbatim from third_party/zlib/uncompr.c. The only
 // difference is inflateInit2() is called which sets the window bits to be > 16.
 // That causes a gzip header to be parsed rather than a zlib header.
@@ -123,25 +293,100 @@ int GzipUncompressHelper(Bytef* dest,
 
 namespace compression {
 
-bool GzipCompress(const std::string& input, std::string* output) {
+namespace {
+
+// GzipCompress() and GzipCompressParallel() into a buffer.
+bool GzipCompressToBuffer(base::StringPiece input,
+                          char* output_buffer,
+                          size_t output_buffer_size,
+                          size_t* compressed_size,
+                          bool parallel) {
   const uLongf input_size = static_cast<uLongf>(input.size());
-  std::vector<Bytef> compressed_data(kGzipZlibHeaderDifferenceBytes +
-                                     compressBound(input_size));
-
-  uLongf compressed_size = static_cast<uLongf>(compressed_data.size());
-  if (GzipCompressHelper(&compressed_data.front(),
-                         &compressed_size,
-                         bit_cast<const Bytef*>(input.data()),
-                         input_size) != Z_OK) {
+  uLongf output_size = static_cast<uLongf>(output_buffer_size);
+  if (input_size != input.size() || output_size != output_buffer_size)
+    return false;
+
+  const int err =
+      parallel && input_size >= kParallelMinimumSize
+          ? GzipCompressParallelHelper(bit_cast<Bytef*>(output_buffer),
+                                       &output_size,
+                                       bit_cast<const Bytef*>(input.data()),
+                                       input_size)
+          : GzipCompressHelper(bit_cast<Bytef*>(output_buffer),
+                               &output_size,
+                               bit_cast<const Bytef*>(input.data()),
+                               input_size);
+  if (err != Z_OK)
+    return false;
+
+  *compressed_size = output_size;
+  DCHECK_EQ(static_cast<uint32_t>(input_size),
+            GetUncompressedSize(base::StringPiece(output_buffer, output_size)));
+  return true;
+}
+
+// GzipCompress() and GzipCompressParallel() into a string.
+bool GzipCompressToString(const std::string& input,
+                          std::string* output,
+                          bool parallel) {
+  std::vector<char> compressed_data(
+      parallel ? GzipCompressParallelBound(input.size())
+               : GzipCompressBound(input.size()));
+
+  size_t compressed_size;
+  if (!GzipCompressToBuffer(input, compressed_data.data(),
+                            compressed_data.size(), &compressed_size,
+                            parallel)) {
     return false;
   }
 
-  compressed_data.resize(compressed_size);
-  output->assign(compressed_data.begin(), compressed_data.end());
-  DCHECK_EQ(input_size, GetUncompressedSize(*output));
+  output->assign(compressed_data.data(), compressed_size);
   return true;
 }
 
+}  // namespace
+
+bool GzipCompress(const std::string& input, std::string* output) {
+  return GzipCompressToString(input, output, false);
+}
+
+bool GzipCompress(base::StringPiece input,
+                  char* output_buffer,
+                  size_t output_buffer_size,
+                  size_t* compressed_size) {
+  return GzipCompressToBuffer(input, output_buffer, output_buffer_size,
+                              compressed_size, false);
+}
+
+size_t GzipCompressBound(size_t input_size) {
+  return kGzipZlibHeaderDifferenceBytes +
+         compressBound(static_cast<uLong>(input_size));
+}
+
+bool GzipCompressParallel(const std::string& input, std::string* output) {
+  return GzipCompressToString(input, output, true);
+}
+
+bool GzipCompressParallel(base::StringPiece input,
+                          char* output_buffer,
+                          size_t output_buffer_size,
+                          size_t* compressed_size) {
+  return GzipCompressToBuffer(input, output_buffer, output_buffer_size,
+                              compressed_size, true);
+}
+
+size_t GzipCompressParallelBound(size_t input_size) {
+  const uLong size = static_cast<uLong>(input_size);
+  if (size < kParallelMinimumSize)
+    return GzipCompressBound(input_size);
+
+  // Whole blocks, then the last, which may be shorter.
+  const uLong blocks = ParallelBlockCount(size);
+  return sizeof(kGzipHeader) + kGzipTrailerSize +
+         (blocks - 1) * ParallelBlockBound(kParallelBlockSize) +
+         ParallelBlockBound(size - (blocks - 1) * kParallelBlockSize);
+}
+
 bool GzipUncompress(const std::string& input, std::string* output) {
   std::string uncompressed_output;
   uLongf uncompressed_size = static_cast<uLongf>(GetUncompressedSize(input));
@@ -177,4 +422,83 @@ uint32_t GetUncompressedSize(base::StringPiece compressed_data) {
   return base::ByteSwapToLE32(size);
 }
 
+GzipStreamUncompressor::GzipStreamUncompressor(const Sink& sink)
+    : sink_(sink),
+      stream_(new z_stream),
+      output_(kStreamOutputBufferSize),
+      total_out_(0),
+      failed_(false),
+      member_ended_(false) {
+  memset(stream_.get(), 0, sizeof(z_stream));
+  initialized_ = inflateInit2(stream_.get(), MAX_WBITS +
+                              kWindowBitsToGetGzipHeader) == Z_OK;
+}
+
+GzipStreamUncompressor::~GzipStreamUncompressor() {
+  if (initialized_)
+    inflateEnd(stream_.get());
+}
+
+bool GzipStreamUncompressor::Feed(base::StringPiece input) {
+  if (!initialized_ || failed_)
+    return false;
+
+  z_stream* stream = stream_.get();
+  stream->next_in = bit_cast<Bytef*>(input.data());
+  stream->avail_in = static_cast<uInt>(input.size());
+  if (stream->avail_in != input.size()) {
+    failed_ = true;
+    return false;
+  }
+
+  // Inflate until the input is used up and the output buffer is not full,
+  // which means inflate has no more output pending.
+  do {
+    if (member_ended_) {
+      if (!stream->avail_in)
+        break;
+      // Another member follows. Reuse the state rather than free it.
+      inflateReset(stream);
+      member_ended_ = false;
+    }
+
+    stream->next_out = bit_cast<Bytef*>(output_.data());
+    stream->avail_out = static_cast<uInt>(output_.size());
+    const int err = inflate(stream, Z_NO_FLUSH);
+    const size_t produced = output_.size() - stream->avail_out;
+    total_out_ += produced;
+
+    if (produced &&
+        !sink_.Run(base::StringPiece(output_.data(), produced))) {
+      failed_ = true;
+      return false;
+    }
+
+    if (err == Z_STREAM_END) {
+      member_ended_ = true;
+    } else if (err == Z_BUF_ERROR) {
+      // No progress possible: all input used and all output handed over.
+      break;
+    } else if (err != Z_OK) {
+      failed_ = true;
+      return false;
+    }
+  } while (stream->avail_in || !stream->avail_out);
+
+  stream->next_in = nullptr;
+  return true;
+}
+
+bool GzipStreamUncompressor::IsComplete() const {
+  return initialized_ && !failed_ && member_ended_;
+}
+
+void GzipStreamUncompressor::Reset() {
+  if (initialized_)
+    inflateReset(stream_.get());
+  total_out_ = 0;
+  failed_ = false;
+  member_ended_ = false;
+}
+
 }  // namespace compression
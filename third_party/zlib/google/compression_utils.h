@@ -5,16 +5,60 @@
 #ifndef THIRD_PARTY_ZLIB_GOOGLE_COMPRESSION_UTILS_H_
 #define THIRD_PARTY_ZLIB_GOOGLE_COMPRESSION_UTILS_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
 #include <string>
+#include <vector>
 
+#include "base/callback.h"
+#include "base/macros.h"
 #include "base/strings/string_piece.h"
 
+struct z_stream_s;
+
 namespace compression {
 
 // Compresses the data in |input| using gzip, storing the result in |output|.
 // |input| and |output| are allowed to be the same string (in-place operation).
 bool GzipCompress(const std::string& input, std::string* output);
 
+// Like the above method, but compresses into the |output_buffer_size| bytes at
+// |output_buffer|, and stores the compressed size in |compressed_size|.
+// Returns false if the compressed data does not fit; GzipCompressBound(
+// input.size()) bytes are always enough. |input| and |output_buffer| must not
+// overlap.
+bool GzipCompress(base::StringPiece input,
+                  char* output_buffer,
+                  size_t output_buffer_size,
+                  size_t* compressed_size);
+
+// Returns the most bytes GzipCompress() can produce from |input_size| bytes.
+size_t GzipCompressBound(size_t input_size);
+
+// Like GzipCompress(), but inputs of 1 MB or more are compressed pigz-style:
+// cut in 256 KB blocks, each primed with the 32 KB of input before it and
+// compressed on its own, on up to 8 threads, then joined into one standard
+// gzip member, with the blocks' CRC-32s combined. The output only depends on
+// |input|, not on the number of threads, but is not the same as
+// GzipCompress()'s and is a little larger. Compressing such inputs waits for
+// worker threads, so it must be called where blocking is allowed. Smaller
+// inputs are compressed as by GzipCompress().
+bool GzipCompressParallel(const std::string& input, std::string* output);
+
+// Like the above method, but compresses into a buffer, as the second
+// GzipCompress(); GzipCompressParallelBound(input.size()) bytes are always
+// enough.
+bool GzipCompressParallel(base::StringPiece input,
+                          char* output_buffer,
+                          size_t output_buffer_size,
+                          size_t* compressed_size);
+
+// Returns the most bytes GzipCompressParallel() can produce from
+// |input_size| bytes.
+size_t GzipCompressParallelBound(size_t input_size);
+
 // Uncompresses the data in |input| using gzip, storing the result in |output|.
 // |input| and |output| are allowed to be the same string (in-place operation).
 bool GzipUncompress(const std::string& input, std::string* output);
@@ -27,6 +71,50 @@ bool GzipUncompress(base::StringPiece input, base::StringPiece output);
 // Returns the uncompressed size from GZIP-compressed |compressed_data|.
 uint32_t GetUncompressedSize(base::StringPiece compressed_data);
 
+// Uncompresses gzip data fed to it in pieces of any size, and hands the
+// uncompressed data to a sink as it comes out. Unlike GzipUncompress(), it
+// needs neither all of the input nor the uncompressed size up front, so it
+// works on data over 4 GB, and it uncompresses each member of a multi-member
+// stream in turn, as gzip -d does; any bytes after a member must start
+// another. It holds one inflate state, reused across Feed() calls, members
+// and Reset(), and a 64 KB output buffer, however long the data.
+class GzipStreamUncompressor {
+ public:
+  // Receives each piece of uncompressed data, at most 64 KB at a time.
+  // Returning false stops the uncompression as a failure.
+  typedef base::Callback<bool(base::StringPiece)> Sink;
+
+  explicit GzipStreamUncompressor(const Sink& sink);
+  ~GzipStreamUncompressor();
+
+  // Uncompresses |input|, the next piece of the gzip data. Returns false if
+  // the data is not valid gzip, or the sink returned false; once it has,
+  // later calls fail too, until Reset().
+  bool Feed(base::StringPiece input);
+
+  // Returns true if the data fed so far is one or more whole members, so
+  // that it could end here. After the last Feed(), tells complete data from
+  // truncated data.
+  bool IsComplete() const;
+
+  // Starts over on new data, keeping the inflate state's memory.
+  void Reset();
+
+  // Returns the number of uncompressed bytes handed to the sink so far.
+  uint64_t total_out() const { return total_out_; }
+
+ private:
+  Sink sink_;
+  std::unique_ptr<z_stream_s> stream_;
+  std::vector<char> output_;
+  uint64_t total_out_;
+  bool initialized_;
+  bool failed_;
+  bool member_ended_;
+
+  DISALLOW_COPY_AND_ASSIGN(GzipStreamUncompressor);
+};
+
 }  // namespace compression
 
 #endif  // THIRD_PARTY_ZLIB_GOOGLE_COMPRESSION_UTILS_H_
@@ -9,6 +9,7 @@
 
 #include <string>
 
+#include "base/bind.h"
 #include "base/logging.h"
 #include "base/macros.h"
 #include "testing/gtest/include/gtest/gtest.h"
@@ -31,6 +32,16 @@ const uint8_t kCompressedData[] = {
     0x48, 0xcd, 0xc9, 0xc9, 0x57, 0x28, 0xcf, 0x2f, 0xca, 0x49, 0x01,
     0x00, 0x85, 0x11, 0x4a, 0x0d, 0x0b, 0x00, 0x00, 0x00};
 
+bool AppendToString(std::string* output, base::StringPiece data) {
+  output->append(data.data(), data.size());
+  return true;
+}
+
+bool StopAtFirstPiece(int* pieces, base::StringPiece data) {
+  ++*pieces;
+  return false;
+}
+
 }  // namespace
 
 TEST(CompressionUtilsTest, GzipCompression) {
@@ -74,6 +85,91 @@ TEST(CompressionUtilsTest, LargeInput) {
   EXPECT_EQ(data, uncompressed_data);
 }
 
+// Checks that inputs large enough to be compressed in parallel blocks give a
+// single gzip member that uncompresses to the input, and that only
+// GzipCompressParallel() compresses them so.
+TEST(CompressionUtilsTest, ParallelInput) {
+  const size_t kSize = 3 * 1024 * 1024 + 123;
+
+  // Runs of repeated text, some reaching across blocks, between bytes that
+  // do not compress.
+  std::string data;
+  data.reserve(kSize);
+  uint32_t seed = 1;
+  while (data.size() < kSize) {
+    seed = seed * 1103515245 + 12345;
+    if (seed & 0x10000) {
+      data.append((seed >> 8) % 50000, static_cast<char>(seed >> 24));
+    } else {
+      for (size_t i = (seed >> 8) % 1000; i; --i) {
+        seed = seed * 1103515245 + 12345;
+        data.push_back(static_cast<char>(seed >> 24));
+      }
+    }
+  }
+  data.resize(kSize);
+
+  std::string compressed_data;
+  EXPECT_TRUE(GzipCompressParallel(data, &compressed_data));
+  EXPECT_LE(compressed_data.size(), GzipCompressParallelBound(kSize));
+  EXPECT_EQ(kSize, GetUncompressedSize(compressed_data));
+
+  const std::string gzip_header(reinterpret_cast<const char*>(kCompressedData),
+                                10);
+  EXPECT_EQ(gzip_header, compressed_data.substr(0, 10));
+
+  std::string uncompressed_data;
+  EXPECT_TRUE(GzipUncompress(compressed_data, &uncompressed_data));
+  EXPECT_EQ(data, uncompressed_data);
+
+  // Too small a buffer fails.
+  std::string buffer(compressed_data.size() - 1, '\0');
+  size_t compressed_size = 0;
+  EXPECT_FALSE(GzipCompressParallel(data, &buffer[0], buffer.size(),
+                                    &compressed_size));
+
+  // GzipCompress() keeps to a single deflate stream.
+  std::string single_stream_data;
+  EXPECT_TRUE(GzipCompress(data, &single_stream_data));
+  EXPECT_LE(single_stream_data.size(), GzipCompressBound(kSize));
+  EXPECT_NE(compressed_data, single_stream_data);
+  EXPECT_TRUE(GzipUncompress(single_stream_data, &uncompressed_data));
+  EXPECT_EQ(data, uncompressed_data);
+}
+
+// Below the size for parallel blocks, GzipCompressParallel() compresses as
+// GzipCompress() does.
+TEST(CompressionUtilsTest, ParallelSmallInput) {
+  const std::string data(reinterpret_cast<const char*>(kData),
+                         arraysize(kData));
+  const std::string golden_compressed_data(
+      reinterpret_cast<const char*>(kCompressedData),
+      arraysize(kCompressedData));
+
+  std::string compressed_data;
+  EXPECT_TRUE(GzipCompressParallel(data, &compressed_data));
+  EXPECT_EQ(golden_compressed_data, compressed_data);
+  EXPECT_EQ(GzipCompressBound(data.size()),
+            GzipCompressParallelBound(data.size()));
+}
+
+TEST(CompressionUtilsTest, CompressIntoBuffer) {
+  const base::StringPiece data(reinterpret_cast<const char*>(kData),
+                               arraysize(kData));
+  const std::string golden_compressed_data(
+      reinterpret_cast<const char*>(kCompressedData),
+      arraysize(kCompressedData));
+
+  std::string buffer(GzipCompressBound(data.size()), '\0');
+  size_t compressed_size = 0;
+  EXPECT_TRUE(GzipCompress(data, &buffer[0], buffer.size(),
+                           &compressed_size));
+  EXPECT_EQ(golden_compressed_data, buffer.substr(0, compressed_size));
+
+  EXPECT_FALSE(GzipCompress(data, &buffer[0], arraysize(kCompressedData) - 1,
+                            &compressed_size));
+}
+
 TEST(CompressionUtilsTest, InPlace) {
   const std::string original_data(reinterpret_cast<const char*>(kData),
                                   arraysize(kData));
@@ -88,4 +184,77 @@ TEST(CompressionUtilsTest, InPlace) {
   EXPECT_EQ(original_data, data);
 }
 
+// Checks that data fed a byte at a time comes out whole, through more than
+// one output buffer.
+TEST(CompressionUtilsTest, StreamUncompression) {
+  const size_t kSize = 200 * 1024;
+  std::string data;
+  data.resize(kSize);
+  for (size_t i = 0; i < kSize; ++i)
+    data[i] = static_cast<char>((i * i) >> 7);
+
+  std::string compressed_data;
+  EXPECT_TRUE(GzipCompress(data, &compressed_data));
+
+  std::string uncompressed_data;
+  GzipStreamUncompressor uncompressor(
+      base::Bind(&AppendToString, &uncompressed_data));
+  for (size_t i = 0; i < compressed_data.size(); ++i) {
+    EXPECT_FALSE(uncompressor.IsComplete());
+    ASSERT_TRUE(uncompressor.Feed(base::StringPiece(&compressed_data[i], 1)));
+  }
+  EXPECT_TRUE(uncompressor.IsComplete());
+  EXPECT_EQ(kSize, uncompressor.total_out());
+  EXPECT_EQ(data, uncompressed_data);
+}
+
+TEST(CompressionUtilsTest, StreamUncompressionMultipleMembers) {
+  const std::string member(reinterpret_cast<const char*>(kCompressedData),
+                           arraysize(kCompressedData));
+  const std::string golden_data(reinterpret_cast<const char*>(kData),
+                                arraysize(kData));
+
+  std::string uncompressed_data;
+  GzipStreamUncompressor uncompressor(
+      base::Bind(&AppendToString, &uncompressed_data));
+  EXPECT_TRUE(uncompressor.Feed(member + member.substr(0, 5)));
+  EXPECT_FALSE(uncompressor.IsComplete());
+  EXPECT_TRUE(uncompressor.Feed(member.substr(5) + member));
+  EXPECT_TRUE(uncompressor.IsComplete());
+  EXPECT_EQ(golden_data + golden_data + golden_data, uncompressed_data);
+
+  // Reset() starts over on new data.
+  uncompressor.Reset();
+  uncompressed_data.clear();
+  EXPECT_TRUE(uncompressor.Feed(member));
+  EXPECT_TRUE(uncompressor.IsComplete());
+  EXPECT_EQ(golden_data, uncompressed_data);
+}
+
+TEST(CompressionUtilsTest, StreamUncompressionErrors) {
+  const std::string member(reinterpret_cast<const char*>(kCompressedData),
+                           arraysize(kCompressedData));
+  std::string uncompressed_data;
+
+  // Truncated data is not finished.
+  GzipStreamUncompressor truncated(
+      base::Bind(&AppendToString, &uncompressed_data));
+  EXPECT_TRUE(truncated.Feed(member.substr(0, member.size() - 1)));
+  EXPECT_FALSE(truncated.IsComplete());
+
+  // Bytes after a member that do not start another fail.
+  GzipStreamUncompressor trailing(
+      base::Bind(&AppendToString, &uncompressed_data));
+  EXPECT_FALSE(trailing.Feed(member + "trailing"));
+  EXPECT_FALSE(trailing.IsComplete());
+  EXPECT_FALSE(trailing.Feed(member));
+
+  // A sink returning false stops the uncompression.
+  int pieces = 0;
+  GzipStreamUncompressor stopped(base::Bind(&StopAtFirstPiece, &pieces));
+  EXPECT_FALSE(stopped.Feed(member));
+  EXPECT_EQ(1, pieces);
+  EXPECT_FALSE(stopped.IsComplete());
+}
+
 }  // namespace compression
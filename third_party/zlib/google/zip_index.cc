@@ -0,0 +1,291 @@
+// Copyright 2026 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "third_party/zlib/google/zip_index.h"
+
+#include <limits.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "base/logging.h"
+#include "base/synchronization/lock.h"
+#include "base/sys_info.h"
+#include "base/threading/simple_thread.h"
+#include "third_party/zlib/google/zip_internal.h"
+
+namespace zip {
+
+namespace {
+
+// How much work an entry is expected to be: the bytes it inflates to, plus
+// one so that empty entries count too.
+uint64_t EntryCost(const ZipIndex::Entry& entry) {
+  return static_cast<uint64_t>(std::max<int64_t>(entry.original_size, 0)) + 1;
+}
+
+// Hands out the entries of one ProcessZipEntries() call. Every worker
+// thread, the calling one included, runs the same ZipEntryProcessor.
+class ZipEntryProcessor : public base::DelegateSimpleThread::Delegate {
+ public:
+  ZipEntryProcessor(const ZipIndex& index,
+                    const std::vector<size_t>& entry_indices,
+                    const ZipProcessOptions& options,
+                    int num_workers,
+                    const ZipEntryProcessCallback& process,
+                    const ZipEntryCompletionCallback& completion)
+      : index_(index),
+        entry_indices_(entry_indices),
+        process_(process),
+        completion_(completion),
+        assignment_(options.assignment),
+        ordered_completion_(options.ordered_completion),
+        next_worker_(0),
+        next_slot_(0),
+        status_(entry_indices.size(), kPending),
+        next_completion_(0),
+        succeeded_(true) {
+    // Slots are positions in |entry_indices_|, largest entry first.
+    std::vector<size_t> slots(entry_indices_.size());
+    for (size_t i = 0; i < slots.size(); ++i)
+      slots[i] = i;
+    std::stable_sort(slots.begin(), slots.end(), [this](size_t a, size_t b) {
+      return Cost(a) > Cost(b);
+    });
+
+    if (assignment_ == ZIP_ENTRY_ASSIGNMENT_DYNAMIC) {
+      slots_ = slots;
+      return;
+    }
+
+    // Greedy balancing: each entry, largest first, to the least loaded
+    // worker. Within a share, archive order keeps reads sequential.
+    shares_.resize(num_workers);
+    std::vector<uint64_t> loads(num_workers, 0);
+    for (size_t slot : slots) {
+      const size_t worker =
+          std::min_element(loads.begin(), loads.end()) - loads.begin();
+      shares_[worker].push_back(slot);
+      loads[worker] += Cost(slot);
+    }
+    for (std::vector<size_t>& share : shares_) {
+      std::sort(share.begin(), share.end(), [this](size_t a, size_t b) {
+        return entry_indices_[a] < entry_indices_[b];
+      });
+    }
+  }
+
+  // base::DelegateSimpleThread::Delegate:
+  void Run() override {
+    ZipReader reader;
+    ZipReader* opened_reader = reader.OpenFromIndex(index_) ? &reader : NULL;
+
+    if (assignment_ == ZIP_ENTRY_ASSIGNMENT_DYNAMIC) {
+      for (size_t i = next_slot_++; i < slots_.size(); i = next_slot_++)
+        Process(opened_reader, slots_[i]);
+      return;
+    }
+
+    const size_t worker = next_worker_++;
+    DCHECK_LT(worker, shares_.size());
+    for (size_t slot : shares_[worker])
+      Process(opened_reader, slot);
+  }
+
+  // Valid once every worker has returned from Run().
+  bool succeeded() const { return succeeded_; }
+
+ private:
+  enum Status { kPending, kSucceeded, kFailed };
+
+  uint64_t Cost(size_t slot) const {
+    return EntryCost(index_.entries()[entry_indices_[slot]]);
+  }
+
+  // Processes the entry in |slot|. A worker whose reader could not be opened
+  // fails its entries without calling |process_|.
+  void Process(ZipReader* reader, size_t slot) {
+    const size_t entry_index = entry_indices_[slot];
+    const bool success = reader &&
+                         reader->OpenIndexedEntry(index_, entry_index) &&
+                         process_.Run(reader, entry_index);
+    Complete(slot, success);
+  }
+
+  // Reports |slot| to |completion_|, or, with ordered completion, every
+  // entry from the first one not yet reported up to the next one still being
+  // processed. Whichever worker finishes that one reports the rest.
+  void Complete(size_t slot, bool success) {
+    base::AutoLock auto_lock(lock_);
+    if (!success)
+      succeeded_ = false;
+
+    if (!ordered_completion_) {
+      if (!completion_.is_null())
+        completion_.Run(entry_indices_[slot], success);
+      return;
+    }
+
+    status_[slot] = success ? kSucceeded : kFailed;
+    for (; next_completion_ < status_.size() &&
+           status_[next_completion_] != kPending;
+         ++next_completion_) {
+      if (!completion_.is_null()) {
+        completion_.Run(entry_indices_[next_completion_],
+                        status_[next_completion_] == kSucceeded);
+      }
+    }
+  }
+
+  const ZipIndex& index_;
+  const std::vector<size_t>& entry_indices_;
+  const ZipEntryProcessCallback& process_;
+  const ZipEntryCompletionCallback& completion_;
+  const ZipEntryAssignment assignment_;
+  const bool ordered_completion_;
+
+  // ZIP_ENTRY_ASSIGNMENT_DYNAMIC: the slots in the order they are taken.
+  std::vector<size_t> slots_;
+  // ZIP_ENTRY_ASSIGNMENT_SIZE_BALANCED: the slots of each worker.
+  std::vector<std::vector<size_t>> shares_;
+
+  std::atomic<size_t> next_worker_;
+  std::atomic<size_t> next_slot_;
+
+  // Guards the members below, and serializes |completion_|.
+  base::Lock lock_;
+  std::vector<Status> status_;
+  size_t next_completion_;
+  bool succeeded_;
+
+  DISALLOW_COPY_AND_ASSIGN(ZipEntryProcessor);
+};
+
+}  // namespace
+
+ZipIndex::Entry::Entry()
+    : original_size(0),
+      compressed_size(0),
+      is_directory(false),
+      is_unsafe(false),
+      position() {}
+
+ZipIndex::ZipIndex()
+#if defined(OS_POSIX)
+    : zip_fd_(-1)
+#endif
+{
+}
+
+ZipIndex::~ZipIndex() {}
+
+bool ZipIndex::Open(const base::FilePath& zip_file_path) {
+  DCHECK(entries_.empty());
+
+  zip_file_path_ = zip_file_path;
+  return Build();
+}
+
+bool ZipIndex::OpenFromMemory(base::StringPiece data) {
+  DCHECK(entries_.empty());
+
+  zip_data_ = data;
+  return Build();
+}
+
+#if defined(OS_POSIX)
+bool ZipIndex::OpenFromFd(int zip_fd) {
+  DCHECK(entries_.empty());
+
+  zip_fd_ = zip_fd;
+  return Build();
+}
+#endif
+
+bool ZipIndex::Build() {
+  ZipReader reader;
+  if (!reader.OpenFromIndex(*this))
+    return false;
+
+  entries_.reserve(reader.num_entries());
+  while (reader.HasMore()) {
+    unz_file_info64 raw_file_info = {};
+    Entry entry;
+    if (!reader.OpenCurrentEntryInZip() ||
+        unzGetCurrentFileInfo64(reader.zip_file_, &raw_file_info, NULL, 0,
+                                NULL, 0, NULL, 0) != UNZ_OK ||
+        unzGetFilePos64(reader.zip_file_, &entry.position) != UNZ_OK) {
+      entries_.clear();
+      return false;
+    }
+
+    const ZipReader::EntryInfo* entry_info = reader.current_entry_info();
+    entry.file_path = entry_info->file_path();
+    entry.original_size = raw_file_info.uncompressed_size;
+    entry.compressed_size = raw_file_info.compressed_size;
+    entry.last_modified = entry_info->last_modified();
+    entry.is_directory = entry_info->is_directory();
+    entry.is_unsafe = entry_info->is_unsafe();
+    entries_.push_back(entry);
+
+    if (!reader.AdvanceToNextEntry()) {
+      entries_.clear();
+      return false;
+    }
+  }
+  return true;
+}
+
+unzFile ZipIndex::OpenHandle() const {
+  if (zip_data_.data())
+    return internal::PrepareMemoryForUnzipping(zip_data_);
+#if defined(OS_POSIX)
+  if (zip_fd_ >= 0)
+    return internal::OpenFdForPositionalUnzipping(zip_fd_);
+#endif
+  if (!zip_file_path_.empty())
+    return internal::OpenForUnzipping(zip_file_path_.AsUTF8Unsafe());
+  return NULL;
+}
+
+ZipProcessOptions::ZipProcessOptions()
+    : num_workers(0),
+      assignment(ZIP_ENTRY_ASSIGNMENT_DYNAMIC),
+      ordered_completion(false) {}
+
+bool ProcessZipEntries(const ZipIndex& index,
+                       const std::vector<size_t>& entry_indices,
+                       const ZipProcessOptions& options,
+                       const ZipEntryProcessCallback& process,
+                       const ZipEntryCompletionCallback& completion) {
+  if (entry_indices.empty())
+    return true;
+  for (size_t entry_index : entry_indices) {
+    if (entry_index >= index.entries().size())
+      return false;
+  }
+
+  const int num_workers = std::max(
+      1, std::min<int>(options.num_workers > 0
+                           ? options.num_workers
+                           : base::SysInfo::NumberOfProcessors(),
+                       static_cast<int>(std::min<size_t>(
+                           entry_indices.size(), INT_MAX))));
+
+  // The calling thread processes entries too.
+  ZipEntryProcessor processor(index, entry_indices, options, num_workers,
+                              process, completion);
+  if (num_workers > 1) {
+    base::DelegateSimpleThreadPool pool("ZipEntries", num_workers - 1);
+    pool.Start();
+    pool.AddWork(&processor, num_workers - 1);
+    processor.Run();
+    pool.JoinAll();
+  } else {
+    processor.Run();
+  }
+  return processor.succeeded();
+}
+
+}  // namespace zip
@@ -0,0 +1,147 @@
+// Copyright 2026 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef THIRD_PARTY_ZLIB_GOOGLE_ZIP_INDEX_H_
+#define THIRD_PARTY_ZLIB_GOOGLE_ZIP_INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "base/callback.h"
+#include "base/files/file_path.h"
+#include "base/macros.h"
+#include "base/strings/string_piece.h"
+#include "base/time/time.h"
+#include "build/build_config.h"
+#include "third_party/zlib/google/zip_reader.h"
+
+namespace zip {
+
+// A read-only index of the entries in a zip archive's central directory.
+// A ZipReader is a single cursor over one minizip handle. A ZipIndex is built
+// once and can then be shared by any number of threads. Each thread opens its
+// own ZipReader over the same archive with ZipReader::OpenFromIndex() and
+// goes straight to any entry with ZipReader::OpenIndexedEntry().
+// ProcessZipEntries() below does this with a pool of worker threads.
+//
+//   ZipIndex index;
+//   if (!index.Open(zip_file_path))
+//     ...
+//   // On any thread:
+//   ZipReader reader;
+//   if (reader.OpenFromIndex(index) && reader.OpenIndexedEntry(index, i))
+//     reader.ExtractCurrentEntryToString(max_bytes, &contents);
+class ZipIndex {
+ public:
+  // One entry of the archive, with what ZipReader::EntryInfo tells about it.
+  struct Entry {
+    Entry();
+
+    base::FilePath file_path;
+    int64_t original_size;
+    int64_t compressed_size;
+    base::Time last_modified;
+    bool is_directory;
+    bool is_unsafe;
+
+    // Where minizip finds the entry in the central directory.
+    unz64_file_pos position;
+  };
+
+  ZipIndex();
+  ~ZipIndex();
+
+  // Indexes the archive at |zip_file_path|. Each reader opens the file
+  // again. Returns true on success.
+  bool Open(const base::FilePath& zip_file_path);
+
+  // Indexes the archive in |data|, such as the bytes of a
+  // base::MemoryMappedFile. Each reader keeps its own offset into |data|,
+  // which must outlive the index and its readers. Returns true on success.
+  bool OpenFromMemory(base::StringPiece data);
+
+#if defined(OS_POSIX)
+  // Indexes the archive open as |zip_fd|. Each reader reads it with pread(),
+  // so readers do not share its file offset. |zip_fd| must stay open as long
+  // as the index and its readers, and is not closed. Returns true on
+  // success.
+  bool OpenFromFd(int zip_fd);
+#endif
+
+  // The entries, in archive order.
+  const std::vector<Entry>& entries() const { return entries_; }
+
+ private:
+  friend class ZipReader;
+
+  // Reads the central directory of the archive given to one of the Open
+  // functions.
+  bool Build();
+
+  // Opens a new minizip handle over the archive.
+  unzFile OpenHandle() const;
+
+  base::FilePath zip_file_path_;
+  base::StringPiece zip_data_;
+#if defined(OS_POSIX)
+  int zip_fd_;
+#endif
+  std::vector<Entry> entries_;
+
+  DISALLOW_COPY_AND_ASSIGN(ZipIndex);
+};
+
+// How ProcessZipEntries() shares the entries among its workers.
+enum ZipEntryAssignment {
+  // Workers take the next entry, largest first, whenever they finish one.
+  ZIP_ENTRY_ASSIGNMENT_DYNAMIC,
+
+  // Before starting, each entry goes to the worker with the fewest bytes so
+  // far, largest entries first, so that workers get about the same number
+  // of bytes. Each worker then processes its share in archive order, which
+  // keeps its reads moving forward through the file.
+  ZIP_ENTRY_ASSIGNMENT_SIZE_BALANCED,
+};
+
+struct ZipProcessOptions {
+  ZipProcessOptions();
+
+  // Threads to process entries on, the calling thread included. 0 means one
+  // per processor. Never more than there are entries.
+  int num_workers;
+
+  ZipEntryAssignment assignment;
+
+  // Whether the completion callback sees the entries in the order they were
+  // given, or as soon as each one is processed.
+  bool ordered_completion;
+};
+
+// Processes entry |entry_index| of the index with |reader|, a reader of the
+// worker's own on which OpenIndexedEntry() has succeeded. Runs on one of the
+// worker threads, alongside calls for other entries. Returns true on success.
+typedef base::Callback<bool(ZipReader* reader, size_t entry_index)>
+    ZipEntryProcessCallback;
+
+// Tells that entry |entry_index| has been processed, and whether that
+// succeeded. Calls never overlap, but come from any of the worker threads,
+// while other entries are processed.
+typedef base::Callback<void(size_t entry_index, bool success)>
+    ZipEntryCompletionCallback;
+
+// Runs |process| for each entry of |index| listed in |entry_indices|, on
+// several threads, and |completion|, which may be null, after each one.
+// Returns once every entry is done: true if all of them were processed
+// successfully. Returns false right away, without processing any entry, if
+// one of |entry_indices| is not an entry of |index|.
+bool ProcessZipEntries(const ZipIndex& index,
+                       const std::vector<size_t>& entry_indices,
+                       const ZipProcessOptions& options,
+                       const ZipEntryProcessCallback& process,
+                       const ZipEntryCompletionCallback& completion);
+
+}  // namespace zip
+
+#endif  // THIRD_PARTY_ZLIB_GOOGLE_ZIP_INDEX_H_
@@ -0,0 +1,250 @@
+// Copyright 2026 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "third_party/zlib/google/zip_index.h"
+
+#include <stddef.h>
+
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/bind.h"
+#include "base/files/file.h"
+#include "base/files/file_path.h"
+#include "base/files/file_util.h"
+#include "base/path_service.h"
+#include "build/build_config.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/zlib/google/zip_reader.h"
+
+namespace zip {
+
+namespace {
+
+// Extracts the current entry of |reader| into (*contents)[entry_index].
+bool ExtractEntry(std::vector<std::string>* contents,
+                  ZipReader* reader,
+                  size_t entry_index) {
+  return reader->ExtractCurrentEntryToString(1 << 20,
+                                             &(*contents)[entry_index]);
+}
+
+// Fails for |failing_entry|, and extracts the rest as ExtractEntry() does.
+bool ExtractEntryOrFail(size_t failing_entry,
+                        std::vector<std::string>* contents,
+                        ZipReader* reader,
+                        size_t entry_index) {
+  if (entry_index == failing_entry)
+    return false;
+  return ExtractEntry(contents, reader, entry_index);
+}
+
+void RecordCompletion(std::vector<std::pair<size_t, bool>>* completions,
+                      size_t entry_index,
+                      bool success) {
+  completions->push_back(std::make_pair(entry_index, success));
+}
+
+}  // namespace
+
+class ZipIndexTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    base::FilePath source_root;
+    ASSERT_TRUE(base::PathService::Get(base::DIR_SOURCE_ROOT, &source_root));
+    test_data_dir_ = source_root.AppendASCII("third_party")
+                         .AppendASCII("zlib")
+                         .AppendASCII("google")
+                         .AppendASCII("test")
+                         .AppendASCII("data");
+    test_zip_file_ = test_data_dir_.AppendASCII("test.zip");
+  }
+
+  // Checks |contents|, indexed like |index|, against the files test.zip was
+  // made from.
+  void ExpectEntryContents(const ZipIndex& index,
+                           const std::vector<size_t>& entry_indices,
+                           const std::vector<std::string>& contents) {
+    for (size_t entry_index : entry_indices) {
+      const base::FilePath& path = index.entries()[entry_index].file_path;
+      std::string expected;
+      ASSERT_TRUE(base::ReadFileToString(
+          test_data_dir_.AppendASCII("test").Append(path), &expected));
+      EXPECT_EQ(expected, contents[entry_index]) << path.value();
+    }
+  }
+
+  // The files of test.zip, in reverse archive order.
+  std::vector<size_t> FileEntries(const ZipIndex& index) {
+    std::vector<size_t> entry_indices;
+    for (size_t i = index.entries().size(); i-- > 0;) {
+      if (!index.entries()[i].is_directory)
+        entry_indices.push_back(i);
+    }
+    return entry_indices;
+  }
+
+  base::FilePath test_data_dir_;
+  base::FilePath test_zip_file_;
+};
+
+TEST_F(ZipIndexTest, Entries) {
+  ZipIndex index;
+  ASSERT_TRUE(index.Open(test_zip_file_));
+
+  // Same entries, in the same order, as ZipReader walks.
+  ZipReader reader;
+  ASSERT_TRUE(reader.Open(test_zip_file_));
+  ASSERT_EQ(static_cast<size_t>(reader.num_entries()), index.entries().size());
+  for (const ZipIndex::Entry& entry : index.entries()) {
+    ASSERT_TRUE(reader.OpenCurrentEntryInZip());
+    const ZipReader::EntryInfo* info = reader.current_entry_info();
+    EXPECT_EQ(info->file_path(), entry.file_path);
+    EXPECT_EQ(info->original_size(), entry.original_size);
+    EXPECT_EQ(info->last_modified(), entry.last_modified);
+    EXPECT_EQ(info->is_directory(), entry.is_directory);
+    EXPECT_FALSE(entry.is_unsafe);
+    ASSERT_TRUE(reader.AdvanceToNextEntry());
+  }
+  EXPECT_FALSE(reader.HasMore());
+
+  // quux.txt is the only deflated entry.
+  const base::FilePath quux_path(FILE_PATH_LITERAL("foo/bar/quux.txt"));
+  for (const ZipIndex::Entry& entry : index.entries()) {
+    if (entry.file_path == quux_path)
+      EXPECT_LT(entry.compressed_size, entry.original_size);
+    else
+      EXPECT_EQ(entry.compressed_size, entry.original_size);
+  }
+}
+
+TEST_F(ZipIndexTest, OpenNonZipFile) {
+  ZipIndex index;
+  EXPECT_FALSE(index.Open(test_data_dir_.AppendASCII("create_test_zip.sh")));
+  EXPECT_TRUE(index.entries().empty());
+}
+
+// Readers opened over one index keep positions of their own, whichever way
+// the archive was given.
+TEST_F(ZipIndexTest, IndependentReaders) {
+  std::string data;
+  ASSERT_TRUE(base::ReadFileToString(test_zip_file_, &data));
+  ZipIndex indexes[3];
+  ASSERT_TRUE(indexes[0].Open(test_zip_file_));
+  ASSERT_TRUE(indexes[1].OpenFromMemory(data));
+#if defined(OS_POSIX)
+  base::File file(test_zip_file_,
+                  base::File::FLAG_OPEN | base::File::FLAG_READ);
+  ASSERT_TRUE(file.IsValid());
+  ASSERT_TRUE(indexes[2].OpenFromFd(file.GetPlatformFile()));
+  const size_t num_indexes = 3;
+#else
+  const size_t num_indexes = 2;
+#endif
+
+  for (size_t i = 0; i < num_indexes; ++i) {
+    const ZipIndex& index = indexes[i];
+    const std::vector<size_t> entry_indices = FileEntries(index);
+    ASSERT_EQ(entry_indices.size(), index.entries().size() - 2);
+
+    // One reader per entry, each opened before any of them reads.
+    std::vector<std::unique_ptr<ZipReader>> readers;
+    for (size_t entry_index : entry_indices) {
+      readers.push_back(std::make_unique<ZipReader>());
+      ASSERT_TRUE(readers.back()->OpenFromIndex(index));
+      ASSERT_TRUE(readers.back()->OpenIndexedEntry(index, entry_index));
+      EXPECT_EQ(index.entries()[entry_index].file_path,
+                readers.back()->current_entry_info()->file_path());
+    }
+    std::vector<std::string> contents(index.entries().size());
+    for (size_t j = 0; j < readers.size(); ++j)
+      ASSERT_TRUE(ExtractEntry(&contents, readers[j].get(), entry_indices[j]));
+    ExpectEntryContents(index, entry_indices, contents);
+  }
+}
+
+TEST_F(ZipIndexTest, ProcessEntries) {
+  ZipIndex index;
+  ASSERT_TRUE(index.Open(test_zip_file_));
+  const std::vector<size_t> entry_indices = FileEntries(index);
+
+  for (int assignment = ZIP_ENTRY_ASSIGNMENT_DYNAMIC;
+       assignment <= ZIP_ENTRY_ASSIGNMENT_SIZE_BALANCED; ++assignment) {
+    for (int ordered = 0; ordered < 2; ++ordered) {
+      for (int num_workers = 1; num_workers <= 4; ++num_workers) {
+        SCOPED_TRACE(testing::Message() << "assignment " << assignment
+                                        << ", ordered " << ordered
+                                        << ", workers " << num_workers);
+        ZipProcessOptions options;
+        options.num_workers = num_workers;
+        options.assignment = static_cast<ZipEntryAssignment>(assignment);
+        options.ordered_completion = ordered != 0;
+
+        std::vector<std::string> contents(index.entries().size());
+        std::vector<std::pair<size_t, bool>> completions;
+        EXPECT_TRUE(ProcessZipEntries(
+            index, entry_indices, options, base::Bind(&ExtractEntry, &contents),
+            base::Bind(&RecordCompletion, &completions)));
+        ExpectEntryContents(index, entry_indices, contents);
+
+        ASSERT_EQ(entry_indices.size(), completions.size());
+        std::set<size_t> completed;
+        for (size_t i = 0; i < completions.size(); ++i) {
+          EXPECT_TRUE(completions[i].second);
+          completed.insert(completions[i].first);
+          if (ordered)
+            EXPECT_EQ(entry_indices[i], completions[i].first);
+        }
+        EXPECT_EQ(std::set<size_t>(entry_indices.begin(), entry_indices.end()),
+                  completed);
+      }
+    }
+  }
+}
+
+TEST_F(ZipIndexTest, ProcessEntriesFailure) {
+  ZipIndex index;
+  ASSERT_TRUE(index.Open(test_zip_file_));
+  const std::vector<size_t> entry_indices = FileEntries(index);
+  const size_t failing_entry = entry_indices[1];
+
+  ZipProcessOptions options;
+  options.num_workers = 3;
+  options.ordered_completion = true;
+  std::vector<std::string> contents(index.entries().size());
+  std::vector<std::pair<size_t, bool>> completions;
+  EXPECT_FALSE(ProcessZipEntries(
+      index, entry_indices, options,
+      base::Bind(&ExtractEntryOrFail, failing_entry, &contents),
+      base::Bind(&RecordCompletion, &completions)));
+
+  ASSERT_EQ(entry_indices.size(), completions.size());
+  for (size_t i = 0; i < completions.size(); ++i) {
+    EXPECT_EQ(entry_indices[i], completions[i].first);
+    EXPECT_EQ(entry_indices[i] != failing_entry, completions[i].second);
+  }
+
+  // Without a completion callback, and without entries.
+  EXPECT_FALSE(ProcessZipEntries(
+      index, entry_indices, options,
+      base::Bind(&ExtractEntryOrFail, failing_entry, &contents),
+      ZipEntryCompletionCallback()));
+  EXPECT_TRUE(ProcessZipEntries(index, std::vector<size_t>(), options,
+                                base::Bind(&ExtractEntry, &contents),
+                                ZipEntryCompletionCallback()));
+
+  // An index past the last entry fails the call before anything is run.
+  std::vector<size_t> bad_indices = entry_indices;
+  bad_indices.push_back(index.entries().size());
+  completions.clear();
+  EXPECT_FALSE(ProcessZipEntries(index, bad_indices, options,
+                                 base::Bind(&ExtractEntry, &contents),
+                                 base::Bind(&RecordCompletion, &completions)));
+  EXPECT_TRUE(completions.empty());
+}
+
+}  // namespace zip
@@ -8,6 +8,12 @@
 
 #include <algorithm>
 
+#if defined(OS_POSIX)
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "base/logging.h"
 #include "base/strings/utf_string_conversions.h"
 
@@ -117,6 +123,96 @@ void FillFdOpenFileFunc(zlib_filefunc_def* pzlib_filefunc_def, int fd) {
   *ptr_fd = fd;
   pzlib_filefunc_def->opaque = ptr_fd;
 }
+
+// A file descriptor read with pread() at an offset of its own, so that any
+// number of unzFile objects can read the same descriptor at once without
+// sharing its file offset. The following I/O API functions expect their
+// opaque parameters to refer to this struct.
+struct PositionalFile {
+  int fd;  // weak
+  ZPOS64_T offset;
+  int error;
+};
+
+void* OpenPositionalFile(void* opaque, const void* /*filename*/, int mode) {
+  if ((mode & ZLIB_FILEFUNC_MODE_READWRITEFILTER) != ZLIB_FILEFUNC_MODE_READ) {
+    NOTREACHED();
+    return NULL;
+  }
+  PositionalFile* file = static_cast<PositionalFile*>(opaque);
+  file->offset = 0;
+  file->error = 0;
+  return opaque;
+}
+
+uLong ReadPositionalFile(void* opaque, void* /*stream*/, void* buf,
+                         uLong size) {
+  PositionalFile* file = static_cast<PositionalFile*>(opaque);
+  uLong total = 0;
+  while (total < size) {
+    const ssize_t bytes_read =
+        pread(file->fd, static_cast<char*>(buf) + total, size - total,
+              static_cast<off_t>(file->offset));
+    if (bytes_read < 0 && errno == EINTR)
+      continue;
+    if (bytes_read < 0) {
+      file->error = errno;
+      break;
+    }
+    if (bytes_read == 0)
+      break;
+    total += static_cast<uLong>(bytes_read);
+    file->offset += static_cast<ZPOS64_T>(bytes_read);
+  }
+  return total;
+}
+
+uLong WritePositionalFile(void* /*opaque*/,
+                          void* /*stream*/,
+                          const void* /*buf*/,
+                          uLong /*size*/) {
+  NOTREACHED();
+  return 0;
+}
+
+ZPOS64_T TellPositionalFile(void* opaque, void* /*stream*/) {
+  return static_cast<PositionalFile*>(opaque)->offset;
+}
+
+long SeekPositionalFile(void* opaque,
+                        void* /*stream*/,
+                        ZPOS64_T offset,
+                        int origin) {
+  PositionalFile* file = static_cast<PositionalFile*>(opaque);
+  if (origin == ZLIB_FILEFUNC_SEEK_CUR) {
+    file->offset += offset;
+    return 0;
+  }
+  if (origin == ZLIB_FILEFUNC_SEEK_END) {
+    struct stat file_stat;
+    if (fstat(file->fd, &file_stat) != 0)
+      return -1;
+    const ZPOS64_T length = static_cast<ZPOS64_T>(file_stat.st_size);
+    file->offset = length > offset ? length - offset : 0;
+    return 0;
+  }
+  if (origin == ZLIB_FILEFUNC_SEEK_SET) {
+    file->offset = offset;
+    return 0;
+  }
+  NOTREACHED();
+  return -1;
+}
+
+// Frees the PositionalFile; the descriptor is not ours to close.
+int ClosePositionalFile(void* opaque, void* /*stream*/) {
+  free(opaque);
+  return 0;
+}
+
+int GetErrorOfPositionalFile(void* opaque, void* /*stream*/) {
+  return static_cast<PositionalFile*>(opaque)->error;
+}
 #endif  // defined(OS_POSIX)
 
 #if defined(OS_WIN)
@@ -156,7 +252,7 @@ struct ZipBuffer {
 // given opaque parameter and returns it because this parameter stores all
 // information needed for uncompressing data. (This function does not support
 // writing compressed data and it returns NULL for this case.)
-void* OpenZipBuffer(void* opaque, const char* /*filename*/, int mode) {
+void* OpenZipBuffer(void* opaque, const void* /*filename*/, int mode) {
   if ((mode & ZLIB_FILEFUNC_MODE_READWRITEFILTER) != ZLIB_FILEFUNC_MODE_READ) {
     NOTREACHED();
     return NULL;
@@ -193,15 +289,18 @@ uLong WriteZipBuffer(void* /*opaque*/,
 }
 
 // Returns the offset from the beginning of the data.
-long GetOffsetOfZipBuffer(void* opaque, void* /*stream*/) {
+ZPOS64_T GetOffsetOfZipBuffer(void* opaque, void* /*stream*/) {
   ZipBuffer* buffer = static_cast<ZipBuffer*>(opaque);
   if (!buffer)
-    return -1;
-  return static_cast<long>(buffer->offset);
+    return static_cast<ZPOS64_T>(-1);
+  return buffer->offset;
 }
 
 // Moves the current offset to the specified position.
-long SeekZipBuffer(void* opaque, void* /*stream*/, uLong offset, int origin) {
+long SeekZipBuffer(void* opaque,
+                   void* /*stream*/,
+                   ZPOS64_T offset,
+                   int origin) {
   ZipBuffer* buffer = static_cast<ZipBuffer*>(opaque);
   if (!buffer)
     return -1;
@@ -211,11 +310,14 @@ long SeekZipBuffer(void* opaque, void* /*stream*/, uLong offset, int origin) {
     return 0;
   }
   if (origin == ZLIB_FILEFUNC_SEEK_END) {
-    buffer->offset = (buffer->length > offset) ? buffer->length - offset : 0;
+    buffer->offset = (buffer->length > offset)
+                         ? buffer->length - static_cast<size_t>(offset)
+                         : 0;
     return 0;
   }
   if (origin == ZLIB_FILEFUNC_SEEK_SET) {
-    buffer->offset = std::min(buffer->length, static_cast<size_t>(offset));
+    buffer->offset = static_cast<size_t>(
+        std::min<ZPOS64_T>(buffer->length, offset));
     return 0;
   }
   NOTREACHED();
@@ -297,7 +399,7 @@ unzFile OpenHandleForUnzipping(HANDLE zip_handle) {
 #endif
 
 // static
-unzFile PrepareMemoryForUnzipping(const std::string& data) {
+unzFile PrepareMemoryForUnzipping(base::StringPiece data) {
   if (data.empty())
     return NULL;
 
@@ -308,18 +410,44 @@ unzFile PrepareMemoryForUnzipping(const std::string& data) {
   buffer->length = data.length();
   buffer->offset = 0;
 
-  zlib_filefunc_def zip_functions;
-  zip_functions.zopen_file = OpenZipBuffer;
+  // The 64-bit functions, so that archives over 4 GB, such as large
+  // memory-mapped files, work where long is 32 bits.
+  zlib_filefunc64_def zip_functions;
+  zip_functions.zopen64_file = OpenZipBuffer;
   zip_functions.zread_file = ReadZipBuffer;
   zip_functions.zwrite_file = WriteZipBuffer;
-  zip_functions.ztell_file = GetOffsetOfZipBuffer;
-  zip_functions.zseek_file = SeekZipBuffer;
+  zip_functions.ztell64_file = GetOffsetOfZipBuffer;
+  zip_functions.zseek64_file = SeekZipBuffer;
   zip_functions.zclose_file = CloseZipBuffer;
   zip_functions.zerror_file = GetErrorOfZipBuffer;
   zip_functions.opaque = static_cast<void*>(buffer);
-  return unzOpen2(NULL, &zip_functions);
+  return unzOpen2_64(NULL, &zip_functions);
 }
 
+#if defined(OS_POSIX)
+unzFile OpenFdForPositionalUnzipping(int zip_fd) {
+  PositionalFile* file =
+      static_cast<PositionalFile*>(malloc(sizeof(PositionalFile)));
+  if (!file)
+    return NULL;
+  file->fd = zip_fd;
+  file->offset = 0;
+  file->error = 0;
+
+  zlib_filefunc64_def zip_functions;
+  zip_functions.zopen64_file = OpenPositionalFile;
+  zip_functions.zread_file = ReadPositionalFile;
+  zip_functions.zwrite_file = WritePositionalFile;
+  zip_functions.ztell64_file = TellPositionalFile;
+  zip_functions.zseek64_file = SeekPositionalFile;
+  zip_functions.zclose_file = ClosePositionalFile;
+  zip_functions.zerror_file = GetErrorOfPositionalFile;
+  zip_functions.opaque = file;
+  // Passing dummy "fd" filename to zlib.
+  return unzOpen2_64("fd", &zip_functions);
+}
+#endif
+
 zipFile OpenForZipping(const std::string& file_name_utf8, int append_flag) {
   zlib_filefunc_def* zip_func_ptrs = NULL;
 #if defined(OS_WIN)
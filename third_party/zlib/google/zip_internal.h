@@ -7,6 +7,7 @@
 
 #include <string>
 
+#include "base/strings/string_piece.h"
 #include "base/time/time.h"
 #include "build/build_config.h"
 
@@ -40,15 +41,22 @@ unzFile OpenForUnzipping(const std::string& file_name_utf8);
 unzFile OpenFdForUnzipping(int zip_fd);
 #endif
 
+#if defined(OS_POSIX)
+// Like OpenFdForUnzipping(), but reads |zip_fd| with pread() at an offset of
+// the returned object's own, so that several objects can read the same
+// descriptor concurrently. |zip_fd| is not closed.
+unzFile OpenFdForPositionalUnzipping(int zip_fd);
+#endif
+
 #if defined(OS_WIN)
 // Opens the file referred to by |zip_handle| for unzipping.
 unzFile OpenHandleForUnzipping(HANDLE zip_handle);
 #endif
 
-// Creates a custom unzFile object which reads data from the specified string.
+// Creates a custom unzFile object which reads data from the specified memory.
 // This custom unzFile object overrides the I/O API functions of zlib so it can
-// read data from the specified string.
-unzFile PrepareMemoryForUnzipping(const std::string& data);
+// read data from the specified memory, with 64-bit offsets.
+unzFile PrepareMemoryForUnzipping(base::StringPiece data);
 
 // Opens the given file name in UTF-8 for zipping, with some setup for
 // Windows. |append_flag| will be passed to zipOpen2().
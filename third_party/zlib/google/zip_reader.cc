@@ -4,6 +4,7 @@
 
 #include "third_party/zlib/google/zip_reader.h"
 
+#include <algorithm>
 #include <utility>
 
 #include "base/bind.h"
@@ -15,12 +16,15 @@
 #include "base/strings/utf_string_conversions.h"
 #include "base/threading/thread_task_runner_handle.h"
 #include "build/build_config.h"
+#include "third_party/zlib/google/zip_index.h"
 #include "third_party/zlib/google/zip_internal.h"
 
 #if defined(USE_SYSTEM_MINIZIP)
 #include <minizip/unzip.h>
+#include <zlib.h>
 #else
 #include "third_party/zlib/contrib/minizip/unzip.h"
+#include "third_party/zlib/zlib.h"
 #if defined(OS_WIN)
 #include "third_party/zlib/contrib/minizip/iowin32.h"
 #endif  // defined(OS_WIN)
@@ -167,9 +171,16 @@ bool ZipReader::OpenFromPlatformFile(base::PlatformFile zip_fd) {
 }
 
 bool ZipReader::OpenFromString(const std::string& data) {
+  return OpenFromMemory(data);
+}
+
+bool ZipReader::OpenFromMemory(base::StringPiece data) {
+  DCHECK(!zip_file_);
+
   zip_file_ = internal::PrepareMemoryForUnzipping(data);
   if (!zip_file_)
     return false;
+  zip_data_ = data;
   return OpenInternal();
 }
 
@@ -231,6 +242,17 @@ bool ZipReader::OpenCurrentEntryInZip() {
   return true;
 }
 
+bool ZipReader::OpenIndexedEntry(const ZipIndex& index, size_t entry_index) {
+  DCHECK(zip_file_);
+  DCHECK_LT(entry_index, index.entries().size());
+
+  unz64_file_pos position = index.entries()[entry_index].position;
+  if (unzGoToFilePos64(zip_file_, &position) != UNZ_OK)
+    return false;
+  reached_end_ = false;
+  return OpenCurrentEntryInZip();
+}
+
 bool ZipReader::ExtractCurrentEntry(WriterDelegate* delegate,
                                     uint64_t num_bytes_to_extract) const {
   DCHECK(zip_file_);
@@ -271,7 +293,12 @@ bool ZipReader::ExtractCurrentEntry(WriterDelegate* delegate,
     }
   }
 
-  unzCloseCurrentFile(zip_file_);
+  // Once the whole entry has been read, closing it checks the CRC-32.
+  const int close_result = unzCloseCurrentFile(zip_file_);
+  if (entire_file_extracted && close_result != UNZ_OK) {
+    DVLOG(1) << "Unzip failed: bad CRC-32 or data (" << close_result << ")";
+    entire_file_extracted = false;
+  }
 
   if (entire_file_extracted &&
       current_entry_info()->last_modified() != base::Time::UnixEpoch()) {
@@ -372,6 +399,74 @@ bool ZipReader::ExtractCurrentEntryToString(uint64_t max_read_bytes,
   return true;
 }
 
+bool ZipReader::OpenFromIndex(const ZipIndex& index) {
+  DCHECK(!zip_file_);
+
+  zip_file_ = index.OpenHandle();
+  if (!zip_file_)
+    return false;
+  zip_data_ = index.zip_data_;
+  return OpenInternal();
+}
+
+bool ZipReader::HasCurrentEntryStoredData() const {
+  DCHECK(zip_file_);
+
+  if (!zip_data_.data())
+    return false;
+
+  unz_file_info64 raw_file_info = {};
+  if (unzGetCurrentFileInfo64(zip_file_, &raw_file_info, NULL, 0, NULL, 0,
+                              NULL, 0) != UNZ_OK) {
+    return false;
+  }
+  // Method 0 is "stored"; bit 0 of the flags marks encryption.
+  return raw_file_info.compression_method == 0 && !(raw_file_info.flag & 1);
+}
+
+bool ZipReader::GetCurrentEntryStoredData(base::StringPiece* data) const {
+  DCHECK(data);
+
+  if (!HasCurrentEntryStoredData())
+    return false;
+
+  unz_file_info64 raw_file_info = {};
+  if (unzGetCurrentFileInfo64(zip_file_, &raw_file_info, NULL, 0, NULL, 0,
+                              NULL, 0) != UNZ_OK) {
+    return false;
+  }
+
+  // Opening the entry reads its local header, which tells where the data
+  // starts.
+  if (unzOpenCurrentFile(zip_file_) != UNZ_OK)
+    return false;
+  const ZPOS64_T offset = unzGetCurrentFileZStreamPos64(zip_file_);
+  unzCloseCurrentFile(zip_file_);
+
+  if (offset > zip_data_.size() ||
+      raw_file_info.compressed_size > zip_data_.size() - offset) {
+    return false;
+  }
+  const base::StringPiece contents =
+      zip_data_.substr(static_cast<size_t>(offset),
+                       static_cast<size_t>(raw_file_info.compressed_size));
+
+  // Check the CRC-32, as extraction does.
+  uLong crc = crc32(0L, Z_NULL, 0);
+  for (size_t done = 0; done < contents.size();) {
+    const uInt chunk = static_cast<uInt>(
+        std::min<size_t>(contents.size() - done, 1u << 30));
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(contents.data() + done),
+                chunk);
+    done += chunk;
+  }
+  if (crc != raw_file_info.crc)
+    return false;
+
+  *data = contents;
+  return true;
+}
+
 bool ZipReader::OpenInternal() {
   DCHECK(zip_file_);
 
@@ -390,6 +485,7 @@ bool ZipReader::OpenInternal() {
 
 void ZipReader::Reset() {
   zip_file_ = NULL;
+  zip_data_ = base::StringPiece();
   num_entries_ = 0;
   reached_end_ = false;
   current_entry_info_.reset();
@@ -407,7 +503,13 @@ void ZipReader::ExtractChunk(base::File output_file,
                                                 internal::kZipBufSize);
 
   if (num_bytes_read == 0) {
-    unzCloseCurrentFile(zip_file_);
+    // Closing the fully read entry checks its CRC-32.
+    const int close_result = unzCloseCurrentFile(zip_file_);
+    if (close_result != UNZ_OK) {
+      DVLOG(1) << "Unzip failed: bad CRC-32 or data (" << close_result << ")";
+      failure_callback.Run();
+      return;
+    }
     success_callback.Run();
   } else if (num_bytes_read < 0) {
     DVLOG(1) << "Unzip failed: error while reading zipfile "
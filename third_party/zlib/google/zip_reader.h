@@ -16,6 +16,7 @@
 #include "base/files/file_util.h"
 #include "base/macros.h"
 #include "base/memory/weak_ptr.h"
+#include "base/strings/string_piece.h"
 #include "base/time/time.h"
 
 #if defined(USE_SYSTEM_MINIZIP)
@@ -26,6 +27,8 @@
 
 namespace zip {
 
+class ZipIndex;
+
 // A delegate interface used to stream out an entry; see
 // ZipReader::ExtractCurrentEntry.
 class WriterDelegate {
@@ -132,6 +135,16 @@ class ZipReader {
   // string until it finishes extracting files.
   bool OpenFromString(const std::string& data);
 
+  // Opens the zip data in |data|, such as the bytes of a
+  // base::MemoryMappedFile, without copying them. As with OpenFromString(),
+  // the caller must keep |data| valid until it finishes extracting files.
+  bool OpenFromMemory(base::StringPiece data);
+
+  // Opens a new handle of its own over the archive indexed by |index|, which
+  // must outlive this reader; see zip_index.h. Any number of readers may be
+  // opened over the same index and used on different threads.
+  bool OpenFromIndex(const ZipIndex& index);
+
   // Closes the currently opened zip file. This function is called in the
   // destructor of the class, so you usually don't need to call this.
   void Close();
@@ -157,9 +170,14 @@ class ZipReader {
   // state is reset automatically as needed.
   bool OpenCurrentEntryInZip();
 
+  // Makes entry |entry_index| of |index| the current entry and opens it, as
+  // OpenCurrentEntryInZip() does, without walking the entries before it.
+  // The reader must have been opened with OpenFromIndex(index).
+  bool OpenIndexedEntry(const ZipIndex& index, size_t entry_index);
+
   // Extracts |num_bytes_to_extract| bytes of the current entry to |delegate|,
   // starting from the beginning of the entry. Return value specifies whether
-  // the entire file was extracted.
+  // the entire file was extracted and matched its CRC-32.
   bool ExtractCurrentEntry(WriterDelegate* delegate,
                            uint64_t num_bytes_to_extract) const;
 
@@ -190,6 +208,20 @@ class ZipReader {
   bool ExtractCurrentEntryToString(uint64_t max_read_bytes,
                                    std::string* output) const;
 
+  // Returns true if the archive was opened with OpenFromMemory() or
+  // OpenFromString() and its current entry is stored uncompressed and not
+  // encrypted, so that GetCurrentEntryStoredData() applies. Other entries
+  // need ExtractCurrentEntry(). OpenCurrentEntryInZip() must be called
+  // beforehand.
+  bool HasCurrentEntryStoredData() const;
+
+  // Points |data| at the contents of the current entry inside the archive's
+  // own bytes, for an entry HasCurrentEntryStoredData() accepts. Nothing is
+  // copied; |data| stays valid as long as the archive data does. Returns
+  // false for other entries, or if the entry is damaged, e.g. its CRC-32
+  // does not match. OpenCurrentEntryInZip() must be called beforehand.
+  bool GetCurrentEntryStoredData(base::StringPiece* data) const;
+
   // Returns the current entry info. Returns NULL if the current entry is
   // not yet opened. OpenCurrentEntryInZip() must be called beforehand.
   EntryInfo* current_entry_info() const {
@@ -201,6 +233,8 @@ class ZipReader {
   int num_entries() const { return num_entries_; }
 
  private:
+  friend class ZipIndex;
+
   // Common code used both in Open and OpenFromFd.
   bool OpenInternal();
 
@@ -216,6 +250,8 @@ class ZipReader {
                     const int64_t offset);
 
   unzFile zip_file_;
+  // The archive's bytes, when it was opened from memory.
+  base::StringPiece zip_data_;
   int num_entries_;
   bool reached_end_;
   std::unique_ptr<EntryInfo> current_entry_info_;
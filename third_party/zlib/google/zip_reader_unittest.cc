@@ -400,6 +400,84 @@ TEST_F(ZipReaderTest, OpenFromString) {
   EXPECT_EQ(std::string("This is a test.\n"), actual);
 }
 
+// Verifies that stored entries of an archive in memory can be read in place,
+// and that deflated entries and archives opened from a file are refused.
+TEST_F(ZipReaderTest, GetCurrentEntryStoredData) {
+  std::string data;
+  ASSERT_TRUE(base::ReadFileToString(test_zip_file_, &data));
+  ZipReader reader;
+  ASSERT_TRUE(reader.OpenFromMemory(data));
+
+  base::FilePath stored_path(FILE_PATH_LITERAL("foo/bar/baz.txt"));
+  ASSERT_TRUE(LocateAndOpenEntry(&reader, stored_path));
+  EXPECT_TRUE(reader.HasCurrentEntryStoredData());
+  base::StringPiece stored;
+  ASSERT_TRUE(reader.GetCurrentEntryStoredData(&stored));
+  std::string extracted;
+  ASSERT_TRUE(reader.ExtractCurrentEntryToString(1024, &extracted));
+  EXPECT_EQ(extracted, stored.as_string());
+  EXPECT_GE(stored.data(), data.data());
+  EXPECT_LE(stored.data() + stored.size(), data.data() + data.size());
+
+  base::FilePath deflated_path(FILE_PATH_LITERAL("foo/bar/quux.txt"));
+  ASSERT_TRUE(LocateAndOpenEntry(&reader, deflated_path));
+  EXPECT_FALSE(reader.HasCurrentEntryStoredData());
+  EXPECT_FALSE(reader.GetCurrentEntryStoredData(&stored));
+  reader.Close();
+
+  ASSERT_TRUE(reader.Open(test_zip_file_));
+  ASSERT_TRUE(LocateAndOpenEntry(&reader, stored_path));
+  EXPECT_FALSE(reader.HasCurrentEntryStoredData());
+  EXPECT_FALSE(reader.GetCurrentEntryStoredData(&stored));
+}
+
+// Verifies that a stored entry whose bytes do not match its CRC-32 is refused,
+// though it is still recognized as stored.
+TEST_F(ZipReaderTest, GetCurrentEntryStoredDataBadCrc) {
+  std::string data;
+  ASSERT_TRUE(base::ReadFileToString(test_zip_file_, &data));
+  const char kName[] = "foo/bar/baz.txt";
+  const std::string::size_type pos = data.find(kName);
+  ASSERT_NE(std::string::npos, pos);
+  // The local header's name is followed by its extra field, then the data.
+  const size_t header = pos - 30;
+  const size_t extra_length = static_cast<unsigned char>(data[header + 28]) |
+                              static_cast<unsigned char>(data[header + 29])
+                                  << 8;
+  data[pos + strlen(kName) + extra_length] ^= 1;
+
+  ZipReader reader;
+  ASSERT_TRUE(reader.OpenFromMemory(data));
+  ASSERT_TRUE(LocateAndOpenEntry(
+      &reader, base::FilePath(FILE_PATH_LITERAL("foo/bar/baz.txt"))));
+  EXPECT_TRUE(reader.HasCurrentEntryStoredData());
+  base::StringPiece stored;
+  EXPECT_FALSE(reader.GetCurrentEntryStoredData(&stored));
+}
+
+// Verifies that a deflated entry whose data does not match its CRC-32 is not
+// reported as extracted.
+TEST_F(ZipReaderTest, ExtractCurrentEntryBadCrc) {
+  std::string data;
+  ASSERT_TRUE(base::ReadFileToString(test_zip_file_, &data));
+  const char kName[] = "foo/bar/quux.txt";
+  const std::string::size_type local = data.find(kName);
+  ASSERT_NE(std::string::npos, local);
+  const std::string::size_type central = data.find(kName, local + 1);
+  ASSERT_NE(std::string::npos, central);
+  // The CRC-32 is 14 bytes into the 30-byte local header, and 16 bytes into
+  // the 46-byte central directory header. Both must agree.
+  data[local - 30 + 14] ^= 1;
+  data[central - 46 + 16] ^= 1;
+
+  ZipReader reader;
+  ASSERT_TRUE(reader.OpenFromMemory(data));
+  ASSERT_TRUE(LocateAndOpenEntry(
+      &reader, base::FilePath(FILE_PATH_LITERAL("foo/bar/quux.txt"))));
+  std::string contents;
+  EXPECT_FALSE(reader.ExtractCurrentEntryToString(1024, &contents));
+}
+
 // Verifies that the asynchronous extraction to a file works.
 TEST_F(ZipReaderTest, ExtractToFileAsync_RegularFile) {
   MockUnzipListener listener;
@@ -0,0 +1,144 @@
+/* longest_match_simd.c -- longest_match() comparing a vector at a time
+ * Copyright 2026 The Chromium Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the Chromium source repository LICENSE file.
+ */
+
+/*
+ * deflate.c's longest_match(), walking the hash chain the same way and
+ * rejecting candidates on the same two bytes at each end, but comparing each
+ * remaining candidate to the current string 16 bytes at a time with SSE2, or
+ * 32 with AVX2 when built from longest_match_simd_avx2.c. Filtered image rows
+ * repeat for long stretches, so most candidates that pass the first check
+ * run on for tens to hundreds of bytes, where the byte-at-a-time loop spends
+ * most of deflate's time.
+ *
+ * All of the string is compared, byte 2 included, as the CRC-32 hash of
+ * insert_string_sse() does not guarantee it matches.
+ */
+
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+#include "deflate.h"
+
+#if defined(LONGEST_MATCH_SIMD_AVX2)
+#define LONGEST_MATCH_SIMD longest_match_avx2
+#define LONGEST_MATCH_VECTOR 32
+#else
+#define LONGEST_MATCH_SIMD longest_match_sse
+#define LONGEST_MATCH_VECTOR 16
+#endif
+
+#define NIL 0
+/* Tail of hash chains, as in deflate.c */
+
+#ifdef _MSC_VER
+#define INLINE __inline
+#else
+#define INLINE inline
+#endif
+
+/* Index of the lowest set bit of mask, which is not zero. */
+local INLINE unsigned lowest_bit(unsigned mask)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned)index;
+#else
+    return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+/* Number of leading bytes scan and match have in common, up to 256. */
+local INLINE unsigned compare256(const Bytef *scan, const Bytef *match)
+{
+    unsigned len = 0;
+    do {
+#if defined(LONGEST_MATCH_SIMD_AVX2)
+        __m256i a = _mm256_loadu_si256((const __m256i *)(scan + len));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(match + len));
+        unsigned equal = (unsigned)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(a, b));
+        if (equal != 0xffffffff)
+            return len + lowest_bit(~equal);
+#else
+        __m128i a = _mm_loadu_si128((const __m128i *)(scan + len));
+        __m128i b = _mm_loadu_si128((const __m128i *)(match + len));
+        unsigned equal = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+        if (equal != 0xffff)
+            return len + lowest_bit(~equal & 0xffff);
+#endif
+        len += LONGEST_MATCH_VECTOR;
+    } while (len < 256);
+    return 256;
+}
+
+/* Unaligned 16-bit load. */
+local INLINE ush load16(const Bytef *p)
+{
+    ush v;
+    zmemcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/*
+ * Same contract as longest_match() in deflate.c. The current string is read
+ * up to MAX_MATCH bytes ahead, which the MIN_LOOKAHEAD bytes kept at the end
+ * of the window allow, and never past the end of the window.
+ */
+uInt ZLIB_INTERNAL LONGEST_MATCH_SIMD(deflate_state *s, IPos cur_match)
+{
+    unsigned chain_length = s->max_chain_length;
+    Bytef *scan = s->window + s->strstart;
+    Bytef *match;
+    unsigned len;
+    unsigned best_len = s->prev_length;
+    unsigned nice_match = (unsigned)s->nice_match;
+    IPos limit = s->strstart > (IPos)MAX_DIST(s) ?
+        s->strstart - (IPos)MAX_DIST(s) : NIL;
+    Posf *prev = s->prev;
+    uInt wmask = s->w_mask;
+    ush scan_start = load16(scan);
+    ush scan_end = load16(scan + best_len - 1);
+
+    Assert(s->hash_bits >= 8 && MAX_MATCH == 258, "Code too clever");
+    Assert((ulg)s->strstart <= s->window_size-MIN_LOOKAHEAD, "need lookahead");
+
+    if (s->prev_length >= s->good_match)
+        chain_length >>= 2;
+    if (nice_match > s->lookahead)
+        nice_match = s->lookahead;
+
+    do {
+        Assert(cur_match < s->strstart, "no future");
+        match = s->window + cur_match;
+
+        if (load16(match + best_len - 1) != scan_end ||
+            load16(match) != scan_start)
+            continue;
+
+        len = compare256(scan, match);
+        if (len == 256 && scan[256] == match[256]) {
+            len++;
+            if (scan[257] == match[257])
+                len++;
+        }
+
+        if (len > best_len) {
+            s->match_start = cur_match;
+            best_len = len;
+            if (len >= nice_match)
+                break;
+            scan_end = load16(scan + best_len - 1);
+        }
+    } while ((cur_match = prev[cur_match & wmask]) > limit &&
+             --chain_length != 0);
+
+    if (best_len <= s->lookahead)
+        return best_len;
+    return s->lookahead;
+}
@@ -0,0 +1,13 @@
+/* longest_match_simd_avx2.c -- longest_match() comparing 32 bytes a step
+ * Copyright 2026 The Chromium Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the Chromium source repository LICENSE file.
+ */
+
+/*
+ * Builds longest_match_simd.c as longest_match_avx2(). This file alone is
+ * compiled with AVX2 enabled, and deflate only calls it when
+ * x86_cpu_enable_avx2 is set.
+ */
+#define LONGEST_MATCH_SIMD_AVX2
+#include "longest_match_simd.c"
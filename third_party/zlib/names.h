@@ -160,6 +160,8 @@
 #define crc_fold_init Cr_z_crc_fold_init
 #define crc_reset Cr_z_crc_reset
 #define fill_window_sse Cr_z_fill_window_sse
+#define longest_match_sse Cr_z_longest_match_sse
+#define longest_match_avx2 Cr_z_longest_match_avx2
 #define deflate_read_buf Cr_z_deflate_read_buf
 #define x86_check_features Cr_z_x86_check_features
 #define x86_cpu_enable_simd Cr_z_x86_cpu_enable_simd
@@ -167,12 +169,20 @@
 /* Symbols added by adler_simd.c */
 #define adler32_simd_ Cr_z_adler32_simd_
 #define x86_cpu_enable_ssse3 Cr_z_x86_cpu_enable_ssse3
+#define adler32_simd_avx2_ Cr_z_adler32_simd_avx2_
+#define adler32_simd_avx512_ Cr_z_adler32_simd_avx512_
+#define x86_cpu_enable_avx2 Cr_z_x86_cpu_enable_avx2
+#define x86_cpu_enable_avx512 Cr_z_x86_cpu_enable_avx512
 
 /* Symbols added by contrib/optimizations/inffast_chunk */
 #define inflate_fast_chunk_ Cr_z_inflate_fast_chunk_
+#define inflate_fast_chunk_avx2_ Cr_z_inflate_fast_chunk_avx2_
 
 /* Symbols added by crc32_simd.c */
 #define crc32_sse42_simd_ Cr_z_crc32_sse42_simd_
+#define crc32_avx2_simd_ Cr_z_crc32_avx2_simd_
+#define crc32_avx512_simd_ Cr_z_crc32_avx512_simd_
+#define x86_cpu_enable_vpclmul Cr_z_x86_cpu_enable_vpclmul
 
 /* Symbols added by armv8_crc32 */
 #define arm_cpu_enable_crc32 Cr_z_arm_cpu_enable_crc32
@@ -30,6 +30,20 @@ void ZLIB_INTERNAL fill_window_sse(deflate_state *s)
     assert(0);
 }
 
+int ZLIB_INTERNAL x86_cpu_enable_avx2 = 0;
+
+uInt ZLIB_INTERNAL longest_match_sse(deflate_state *s, IPos cur_match)
+{
+    assert(0);
+    return 0;
+}
+
+uInt ZLIB_INTERNAL longest_match_avx2(deflate_state *s, IPos cur_match)
+{
+    assert(0);
+    return 0;
+}
+
 void x86_check_features(void)
 {
 }
@@ -13,6 +13,14 @@
 
 int ZLIB_INTERNAL x86_cpu_enable_ssse3 = 0;
 int ZLIB_INTERNAL x86_cpu_enable_simd = 0;
+int ZLIB_INTERNAL x86_cpu_enable_avx2 = 0;
+int ZLIB_INTERNAL x86_cpu_enable_avx512 = 0;
+int ZLIB_INTERNAL x86_cpu_enable_vpclmul = 0;
+
+/* XCR0 state the OS must save for AVX (SSE, AVX) and for AVX-512 (also the
+ * opmask and the upper halves and registers of ZMM). */
+#define XCR0_AVX_STATE 0x06
+#define XCR0_AVX512_STATE 0xe6
 
 #ifndef _MSC_VER
 #include <pthread.h>
@@ -20,6 +28,27 @@ int ZLIB_INTERNAL x86_cpu_enable_simd = 0;
 pthread_once_t cpu_check_inited_once = PTHREAD_ONCE_INIT;
 static void _x86_check_features(void);
 
+/* cpuid for |leaf|, subleaf 0. */
+static void x86_cpuid(unsigned leaf, unsigned *eax, unsigned *ebx,
+                      unsigned *ecx, unsigned *edx)
+{
+    *eax = leaf;
+    *ecx = 0;
+#ifdef __i386__
+    __asm__ __volatile__ (
+        "xchg %%ebx, %1\n\t"
+        "cpuid\n\t"
+        "xchg %1, %%ebx\n\t"
+    : "+a" (*eax), "=S" (*ebx), "+c" (*ecx), "=d" (*edx)
+    );
+#else
+    __asm__ __volatile__ (
+        "cpuid\n\t"
+    : "+a" (*eax), "=b" (*ebx), "+c" (*ecx), "=d" (*edx)
+    );
+#endif  /* (__i386__) */
+}
+
 void x86_check_features(void)
 {
   pthread_once(&cpu_check_inited_once, _x86_check_features);
@@ -31,35 +60,50 @@ static void _x86_check_features(void)
     int x86_cpu_has_ssse3;
     int x86_cpu_has_sse42;
     int x86_cpu_has_pclmulqdq;
+    int x86_cpu_has_osxsave;
+    unsigned max_leaf;
+    unsigned leaf7_ebx = 0;
+    unsigned leaf7_ecx = 0;
+    unsigned xcr0 = 0;
     unsigned eax, ebx, ecx, edx;
 
-    eax = 1;
-#ifdef __i386__
-    __asm__ __volatile__ (
-        "xchg %%ebx, %1\n\t"
-        "cpuid\n\t"
-        "xchg %1, %%ebx\n\t"
-    : "+a" (eax), "=S" (ebx), "=c" (ecx), "=d" (edx)
-    );
-#else
-    __asm__ __volatile__ (
-        "cpuid\n\t"
-    : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
-    );
-#endif  /* (__i386__) */
+    x86_cpuid(0, &max_leaf, &ebx, &ecx, &edx);
+    x86_cpuid(1, &eax, &ebx, &ecx, &edx);
 
     x86_cpu_has_sse2 = edx & 0x4000000;
     x86_cpu_has_ssse3 = ecx & 0x000200;
     x86_cpu_has_sse42 = ecx & 0x100000;
     x86_cpu_has_pclmulqdq = ecx & 0x2;
+    x86_cpu_has_osxsave = ecx & 0x8000000;
 
     x86_cpu_enable_ssse3 = x86_cpu_has_ssse3;
 
     x86_cpu_enable_simd = x86_cpu_has_sse2 &&
                           x86_cpu_has_sse42 &&
                           x86_cpu_has_pclmulqdq;
+
+    if (max_leaf >= 7)
+        x86_cpuid(7, &eax, &leaf7_ebx, &leaf7_ecx, &edx);
+    if (x86_cpu_has_osxsave)
+        __asm__ __volatile__ ("xgetbv" : "=a" (xcr0), "=d" (edx) : "c" (0));
+
+    /* AVX2 in leaf 7 EBX bit 5; AVX-512 Foundation and Byte/Word in bits
+     * 16 and 30. */
+    x86_cpu_enable_avx2 = x86_cpu_enable_ssse3 &&
+                          (leaf7_ebx & 0x20) &&
+                          (xcr0 & XCR0_AVX_STATE) == XCR0_AVX_STATE;
+    x86_cpu_enable_avx512 = x86_cpu_enable_avx2 &&
+                            (leaf7_ebx & 0x10000) &&
+                            (leaf7_ebx & 0x40000000) &&
+                            (xcr0 & XCR0_AVX512_STATE) == XCR0_AVX512_STATE;
+    /* VPCLMULQDQ in leaf 7 ECX bit 10; its CRC-32 code finishes with the
+     * PCLMULQDQ code. */
+    x86_cpu_enable_vpclmul = x86_cpu_enable_simd &&
+                             x86_cpu_enable_avx2 &&
+                             (leaf7_ecx & 0x400);
 }
 #else
+#include <immintrin.h>
 #include <intrin.h>
 #include <windows.h>
 
@@ -82,20 +126,52 @@ static BOOL CALLBACK _x86_check_features(PINIT_ONCE once,
     int x86_cpu_has_ssse3;
     int x86_cpu_has_sse42;
     int x86_cpu_has_pclmulqdq;
+    int x86_cpu_has_osxsave;
+    int max_leaf;
+    unsigned leaf7_ebx = 0;
+    unsigned leaf7_ecx = 0;
+    unsigned xcr0 = 0;
     int regs[4];
 
+    __cpuid(regs, 0);
+    max_leaf = regs[0];
+
     __cpuid(regs, 1);
 
     x86_cpu_has_sse2 = regs[3] & 0x4000000;
     x86_cpu_has_ssse3 = regs[2] & 0x000200;
     x86_cpu_has_sse42 = regs[2] & 0x100000;
     x86_cpu_has_pclmulqdq = regs[2] & 0x2;
+    x86_cpu_has_osxsave = regs[2] & 0x8000000;
 
     x86_cpu_enable_ssse3 = x86_cpu_has_ssse3;
 
     x86_cpu_enable_simd = x86_cpu_has_sse2 &&
                           x86_cpu_has_sse42 &&
                           x86_cpu_has_pclmulqdq;
+
+    if (max_leaf >= 7) {
+        __cpuidex(regs, 7, 0);
+        leaf7_ebx = regs[1];
+        leaf7_ecx = regs[2];
+    }
+    if (x86_cpu_has_osxsave)
+        xcr0 = (unsigned) _xgetbv(0);
+
+    /* AVX2 in leaf 7 EBX bit 5; AVX-512 Foundation and Byte/Word in bits
+     * 16 and 30. */
+    x86_cpu_enable_avx2 = x86_cpu_enable_ssse3 &&
+                          (leaf7_ebx & 0x20) &&
+                          (xcr0 & XCR0_AVX_STATE) == XCR0_AVX_STATE;
+    x86_cpu_enable_avx512 = x86_cpu_enable_avx2 &&
+                            (leaf7_ebx & 0x10000) &&
+                            (leaf7_ebx & 0x40000000) &&
+                            (xcr0 & XCR0_AVX512_STATE) == XCR0_AVX512_STATE;
+    /* VPCLMULQDQ in leaf 7 ECX bit 10; its CRC-32 code finishes with the
+     * PCLMULQDQ code. */
+    x86_cpu_enable_vpclmul = x86_cpu_enable_simd &&
+                             x86_cpu_enable_avx2 &&
+                             (leaf7_ecx & 0x400);
     return TRUE;
 }
 #endif  /* _MSC_VER */
@@ -10,6 +10,9 @@
 
 extern int x86_cpu_enable_ssse3;
 extern int x86_cpu_enable_simd;
+extern int x86_cpu_enable_avx2;
+extern int x86_cpu_enable_avx512;
+extern int x86_cpu_enable_vpclmul;
 
 void x86_check_features(void);
 